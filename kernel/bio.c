@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,11 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The root device is striped across the NDISK virtio disks
+// (RAID-0): each run of STRIPE blocks is on the disk after
+// the last one's, so sequential I/O keeps every disk's queue
+// busy at once. bstartv() splits requests at stripe edges.
 
 
 #include "types.h"
@@ -22,35 +27,167 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "trace.h"
+#include "memstat.h"
 
-struct {
+#define NBUCKET 127  // prime, so (dev, blockno) spreads evenly
+
+// The buffer cache takes one in BCACHEFRAC of the pages
+// free at boot, but at least NBUF buffers.
+#define BCACHEFRAC 64
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // buffers hashed here, through next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  // Serializes eviction, the only path that holds
+  // more than one bucket lock at once.
+  struct spinlock lock;
+  int nbuf;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// The disk holding block b of the root device.
+static inline int
+sdisk(uint b)
+{
+  return b / STRIPE % NDISK;
+}
+
+// Block b of the root device's block number on its disk.
+static inline uint
+sblock(uint b)
+{
+  return b / (STRIPE * NDISK) * STRIPE + b % STRIPE;
+}
+
+static inline uint
+bhash(uint dev, uint blockno)
+{
+  return ((dev << 27) ^ blockno) % NBUCKET;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *bend;
+  struct bucket *bk;
+  char *data, *dend;
+  int n;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+  }
+
+  n = knpages() / BCACHEFRAC * (PGSIZE / BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+
+  // Carve the buffers and their data out of whole pages.
+  // Start every buffer out in bucket 0; eviction will
+  // move them to the bucket of the block they end up holding.
+  b = 0;
+  bend = 0;
+  data = dend = 0;
+  for(bcache.nbuf = 0; bcache.nbuf < n; bcache.nbuf++){
+    if(b == bend){
+      if((b = (struct buf*)kalloc(MT_BUF)) == 0)
+        panic("binit");
+      bend = b + PGSIZE / sizeof(struct buf);
+    }
+    if(data == dend){
+      if((data = kalloc(MT_BUF)) == 0)
+        panic("binit");
+      dend = data + PGSIZE;
+    }
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->data = (uchar*)data;
+    data += BSIZE;
+    b->valid = 0;
+    b->disk = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
+    b++;
   }
 }
 
+// Look for block (dev, blockno) in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Recycle a free buffer to hold blockno of dev and move it
+// onto bucket bk. Called with bcache.lock and bk->lock held,
+// which are still held on return.
+// Returns the buffer with refcnt 1, or 0 if every buffer is busy.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b, **pp, **bestpp;
+  struct bucket *victim, *best;
+
+  // Recycle the unused buffer with the oldest lastuse stamp.
+  // The lock of the bucket holding the best candidate so far is
+  // kept until a better one turns up. Only eviction holds more
+  // than one bucket lock, and bcache.lock serializes eviction,
+  // so this cannot deadlock.
+  best = 0;
+  bestpp = 0;
+  for(victim = bcache.bucket; victim < bcache.bucket+NBUCKET; victim++){
+    if(victim != bk)
+      acquire(&victim->lock);
+    int found = 0;
+    for(pp = &victim->head; *pp != 0; pp = &(*pp)->next){
+      // a buffer with I/O in flight may have no references
+      // (see bstart()), but must not be reused until it lands.
+      if((*pp)->refcnt == 0 && !(*pp)->disk &&
+         (bestpp == 0 || (*pp)->lastuse < (*bestpp)->lastuse)){
+        bestpp = pp;
+        found = 1;
+      }
+    }
+    if(found){
+      if(best != 0 && best != bk)
+        release(&best->lock);
+      best = victim;
+    } else if(victim != bk){
+      release(&victim->lock);
+    }
+  }
+  if(best == 0)
+    return 0;
+
+  b = *bestpp;
+  if(best != bk){
+    *bestpp = b->next;
+    release(&best->lock);
+    b->next = bk->head;
+    bk->head = b;
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  return b;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -58,32 +195,39 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[bhash(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Take the eviction lock, then look again, since
+  // another process may have cached the block while bk->lock was
+  // dropped.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+
+  if((b = brecycle(bk, dev, blockno)) == 0)
+    panic("bget: no buffers");
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -92,10 +236,12 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
+  TRACE(TR_BREAD, dev, blockno);
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b->dev, b, 0);
-    b->valid = 1;
+    if(!b->disk)
+      bstart(b, 0);
+    bwait(b);
   }
   return b;
 }
@@ -106,46 +252,168 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b->dev, b, 1);
+  TRACE(TR_BWRITE, b->dev, b->blockno);
+  bstart(b, 1);
+  bwait(b);
+}
+
+// Start reading or writing b, which must be locked, and
+// return without waiting. The disk marks b valid when a
+// read finishes. b may be released before then: bget()
+// won't recycle it while the disk owns it, and bread()
+// waits for the read rather than issuing another.
+void
+bstart(struct buf *b, int write)
+{
+  bstartv(&b, 1, write);
+}
+
+// Like bstart(), for the nb locked buffers bs[], which must
+// hold consecutive blocks; each disk moves its share of them
+// in one request.
+void
+bstartv(struct buf **bs, int nb, int write)
+{
+  struct proc *p;
+  int i, n;
+
+  if(nb < 1 || nb > MAXSGBLOCKS)
+    panic("bstartv");
+  for(i = 0; i < nb; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bstartv: lock");
+    if(bs[i]->dev != bs[0]->dev || bs[i]->blockno != bs[0]->blockno + i)
+      panic("bstartv: not contiguous");
+  }
+  if((p = myproc()) != 0){
+    if(write)
+      p->ru.nbwrite += nb;
+    else
+      p->ru.nbread += nb;
+  }
+  if(bs[0]->dev == TMPDEV){
+    for(i = 0; i < nb; i++)
+      ramdiskrw(bs[i], write);
+    return;
+  }
+  for(i = 0; i < nb; i += n){
+    n = STRIPE - bs[i]->blockno % STRIPE;
+    if(n > nb - i)
+      n = nb - i;
+    virtio_disk_submit(sdisk(bs[i]->blockno), bs + i, n, sblock(bs[i]->blockno), write);
+  }
+}
+
+// Return a locked buffer for blockno of dev if the block
+// needs reading in, or 0 if it is cached, already being read,
+// or every buffer is busy.
+static struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = &bcache.bucket[bhash(dev, blockno)];
+  acquire(&bk->lock);
+  if(bfind(bk, dev, blockno) != 0){
+    release(&bk->lock);
+    return 0;
+  }
+  release(&bk->lock);
+
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if(bfind(bk, dev, blockno) != 0 || (b = brecycle(bk, dev, blockno)) == 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
+  }
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  // a bread() may have found the buffer and read it
+  // first, maybe even dirtied it, since the locks were dropped.
+  acquiresleep(&b->lock);
+  if(b->valid || b->disk){
+    brelse(b);
+    return 0;
+  }
+  return b;
+}
+
+// Start reading blocks blocknos[0..n-1] of dev into the
+// cache, those not there already, without waiting for
+// them. Runs of consecutive blocks go to the disk as one
+// request. Gives up quietly on blocks if every buffer is busy.
+void
+bprefetch(uint dev, uint *blocknos, int n)
+{
+  struct buf *b, *run[MAXSGBLOCKS];
+  int i, j, nrun;
+
+  nrun = 0;
+  for(i = 0; i <= n; i++){
+    b = i < n ? bclaim(dev, blocknos[i]) : 0;
+    if(nrun > 0 && (b == 0 || nrun == MAXSGBLOCKS ||
+                    b->blockno != run[nrun-1]->blockno + 1)){
+      bstartv(run, nrun, 0);
+      for(j = 0; j < nrun; j++)
+        brelse(run[j]);
+      nrun = 0;
+    }
+    if(b)
+      run[nrun++] = b;
+  }
+}
+
+// Wait for the I/O started on b by bstart() to finish.
+void
+bwait(struct buf *b)
+{
+  if(b->dev == TMPDEV)
+    return;  // the RAM disk is done already
+  virtio_disk_wait(sdisk(b->blockno), b);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Stamp it with the current tick so eviction can
+// find the least recently used free buffer.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[bhash(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+    b->lastuse = ticks;
+  }
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[bhash(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[bhash(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
@@ -34,6 +34,7 @@ typedef struct sz_info Sz_info;
 static Sz_info *bd_sizes; 
 static void *bd_base;   // start address of memory managed by the buddy allocator
 static struct spinlock lock;
+static uint64 bd_nused; // bytes allocated by bd_malloc
 
 // Return 1 if bit at position index in array is set to 1
 int bit_isset(char *array, int index) {
@@ -148,6 +149,7 @@ bd_malloc(uint64 nbytes)
     bit_set(bd_sizes[k-1].alloc, blk_index(k-1, p));
     lst_push(&bd_sizes[k-1].free, q);
   }
+  bd_nused += BLK_SIZE(fk);
   release(&lock);
 
   return p;
@@ -172,6 +174,7 @@ bd_free(void *p) {
   int k;
 
   acquire(&lock);
+  bd_nused -= BLK_SIZE(size(p));
   for (k = size(p); k < MAXSIZE; k++) {
     int bi = blk_index(k, p);
     int buddy = (bi % 2 == 0) ? bi+1 : bi-1;
@@ -193,6 +196,12 @@ bd_free(void *p) {
   release(&lock);
 }
 
+// The number of bytes allocated and not yet freed.
+uint64
+bd_used(void) {
+  return bd_nused;
+}
+
 // Compute the first block at size k that doesn't contain p
 int
 blk_index_next(int k, char *p) {
@@ -5,8 +5,13 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  uint lastuse; // ticks at last release, for LRU eviction
+  struct buf *next; // hash bucket list
+  struct buf *qnext; // disk's queue, see virtio_disk.c
+  uint qblock;  // block on that disk
+  uint qtime;   // ticks when queued
+  uint qseq;    // order submitted, for requests for one block
+  char qwait;   // a process sleeps in virtio_disk_wait() for it
+  uchar *data;  // BSIZE bytes
 };
 
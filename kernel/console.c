@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -48,6 +49,10 @@ consputc(int c)
 
 struct {
   struct spinlock lock;
+
+  // one write() at a time, so that writes don't interleave
+  // while uartwrite() sleeps.
+  struct sleeplock wlock;
   
   // input
 #define INPUT_BUF 128
@@ -55,6 +60,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  int polled;  // poll() has looked; call pollwakeup() when a line comes
 } cons;
 
 //
@@ -63,18 +69,21 @@ struct {
 int
 consolewrite(struct file *f, int user_src, uint64 src, int n)
 {
-  int i;
-
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[64];
+  int i, m;
+
+  acquiresleep(&cons.wlock);
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    consputc(c);
+    uartwrite(buf, m);
   }
-  release(&cons.lock);
+  releasesleep(&cons.wlock);
 
-  return n;
+  return i;
 }
 
 //
@@ -177,6 +186,10 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        if(cons.polled){
+          cons.polled = 0;
+          pollwakeup();
+        }
       }
     }
     break;
@@ -185,10 +198,26 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// poll(): input is ready once a whole line has arrived;
+// output never waits long.
+int
+consolepoll(struct file *f)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  cons.polled = 1;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  initsleeplock(&cons.wlock, "conswrite");
 
   uartinit();
 
@@ -196,4 +225,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -2,18 +2,26 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct memstat;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timepage;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstart(struct buf*, int);
+void            bwait(struct buf*);
+void            bstartv(struct buf**, int, int);
+void            bprefetch(uint, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -24,57 +32,148 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+void            execput(struct inode*);
+int             execpage(struct proc*, uint64);
+int             execfault(struct proc*, uint64);
+void            execdup(struct proc*, struct proc*);
+void            execshrink(struct proc*, uint64);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
+int             ofilegrow(struct file***, int*, int);
 struct file*    filedup(struct file*);
-void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filegetdents(struct file*, uint64, int);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 void            fsinit(int);
+void            tmpinit(void);
+void            mount(struct inode*, struct inode*);
+int             mounted(struct inode*);
+void            dcenter(struct inode*, char*, uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
+int             isdirempty(struct inode*);
 struct inode*   ialloc(uint, short);
+struct inode*   iget(uint, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readiblocks(struct inode*, char*, uint, uint);
+uint            writeiblocks(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 
+// futex.c
+void            futexinit(void);
+
+// trace.c
+extern uint     tracemask;
+void            traceinit(void);
+void            tracerec(int, uint64, uint64);
+// a tracepoint; see trace.h for the types.
+#define TRACE(type, a0, a1) \
+  do { if(tracemask & (1 << (type))) tracerec((type), (uint64)(a0), (uint64)(a1)); } while(0)
+
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskrw(struct buf*, int);
 
 // kalloc.c
-void*           kalloc(void);
+void*           kalloc(int);
+void*           kzalloc(int);
+void            kzerod(void);
 void            kfree(void *);
 void            kinit();
+void            kdup(void *);
+int             krefcnt(void *);
+uint64          kfreepages(void);
+uint64          knpages(void);
+int             kfreechunk(void);
+void            kinithart(void);
+void*           kmalloc(uint64);
+void            kmfree(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(int);
+void            begin_opn(int, int);
 void            end_op(int);
+void            log_force(int);
+void            logflush(void);
+void            loginstall(void);
 void            crash_op(int,int);
 
+// mmap.c
+int             mmap_inrange(struct proc*, uint64, uint64);
+int             mmap_fault(struct proc*, uint64, int);
+int             mmap_fork(struct proc*, struct proc*);
+void            mmap_exit(struct proc*);
+
+// pcache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint, int*);
+int             pcread(struct inode*, int, uint64, uint, uint);
+uint            pcwrite(struct inode*, int, uint64, uint, uint);
+void            pcflush(struct inode*);
+void            pcthrottle(struct inode*);
+void            pcflushd(void);
+void            pcdrop(struct inode*, uint, uint);
+void            pcinval(struct inode*);
+int             pcreclaim(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipepoll(struct pipe*, int);
+
+// poll.c
+void            pollinit(void);
+void            pollwakeup(void);
+void            polltick(void);
+
+// shm.c
+void            shminit(void);
+struct shm*     shmopen(char*, uint64);
+void            shmclose(struct shm*);
+uint64          shmsize(struct shm*);
+char*           shmpage(struct shm*, uint64);
+int             shmunlink(char*);
+
+// swap.c
+void            swapinit(void);
+void            swapd(void);
+void            swapkick(void);
+int             swapwait(void);
+int             swapin(struct proc*, uint64);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+void            swapstat(struct memstat*);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,10 +184,20 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, struct file**, int);
+int             clone(uint64, uint64, uint64);
+void            killthreads(struct proc*);
+void            tlbshootdown(struct proc*);
+void            kproc(char*, void (*)(void));
+int             growproc(int, uint64*);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             setprio(int, int);
+int             setaffinity(int, uint64);
+uint64          getaffinity(int);
+int             getsysacct(int, uint*, uint64*);
+int             getrusage(int, uint64);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -99,6 +208,7 @@ void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             waitpid(int, uint64, int);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
@@ -116,11 +226,14 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 uint64          sys_ntas(void);
+uint64          sys_lockstat(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquireshared(struct sleeplock*);
+void            releaseshared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -132,6 +245,12 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// start.c
+void            timerstop(void);
+void            timerstart(void);
+void            ipi(int);
+int             clockticked(void);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -142,6 +261,7 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+extern struct timepage *timepage;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -151,27 +271,43 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
 int             uartgetc(void);
 
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmswitch(pagetable_t);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+void            kvmstackinit(uint64);
+void            kvmmapstack(uint64, uint64);
+uint64          kvmunmapstack(uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64, char**);
+uint64          vmfault(pagetable_t, uint64, int);
+void            vmtouch(uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmunmapmm(struct proc*, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// ucopy.S
+int             ucopy(char*, char*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -180,7 +316,9 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(int);
-void            virtio_disk_rw(int, struct buf *, int);
+void            virtio_disk_rw(int, struct buf *, uint, int);
+void            virtio_disk_submit(int, struct buf **, int, uint, int);
+void            virtio_disk_wait(int, struct buf *);
 void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
@@ -193,6 +331,7 @@ void            virtio_disk_intr(int);
 void           bd_init(void*,void*);
 void           bd_free(void*);
 void           *bd_malloc(uint64);
+uint64         bd_used(void);
 
 struct list {
   struct list *next;
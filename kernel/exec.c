@@ -3,23 +3,41 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
 
 int
 exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+
+  // only the leader may replace the threads' shared image.
+  if(p->mm != p)
+    return -1;
+  return execproc(p, path, argv);
+}
+
+// Replace p's user image with the program path.
+// p is the current process, or a new one being
+// set up by spawn().
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
-  uint64 argc, sz, sp, ustack[MAXARG+1], stackbase;
+  uint64 argc, sz, oldsz, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  pagetable_t pagetable = 0, oldpagetable, kpagetable = 0, oldkpagetable;
+  struct execseg seg[NEXECSEG], *sg;
+  int nseg;
+  struct inode *oldexe;
 
   begin_op(ROOTDEV);
 
@@ -38,8 +56,10 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Note where the program's segments go; execfault()
+  // reads their pages in as the program touches them.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,19 +69,28 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < PGROUNDUP(sz))
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr + ph.memsz >= USERTOP - 2*PGSIZE || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NEXECSEG)
       goto bad;
+    sg = &seg[nseg++];
+    sg->va = ph.vaddr;
+    sg->filesz = ph.filesz;
+    sg->memsz = ph.memsz;
+    sg->off = ph.off;
+    // text and read-only data are the same in every process
+    // running the program, so they can share pages.
+    sg->share = (ph.flags & ELF_PROG_FLAG_WRITE) == 0 && ph.off % PGSIZE == 0;
+    sg->perm = PTE_R | PTE_U;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      sg->perm |= PTE_X;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference, for execfault().
+  iunlock(ip);
   end_op(ROOTDEV);
-  ip = 0;
-
-  p = myproc();
-  uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -94,6 +123,9 @@ exec(char *path, char **argv)
   if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
     goto bad;
 
+  if((kpagetable = kvmcreate(pagetable)) == 0)
+    goto bad;
+
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
   // value, which goes in a0.
@@ -104,51 +136,165 @@ exec(char *path, char **argv)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
+  p->alarmticks = 0;  // the handler was in the old program
+  p->inalarm = 0;
     
-  // Commit to the user image.
+  // Commit to the user image. The old one may still be
+  // shared with threads, and spawn()'s child has none.
+  killthreads(p);
+  mmap_exit(p);
   oldpagetable = p->pagetable;
+  oldkpagetable = p->kpagetable;
+  oldsz = p->sz;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  p->kpagetable = kpagetable;
+  if(p == myproc())
+    kvmswitch(kpagetable);
   p->sz = sz;
+  p->guard = sz - 2*PGSIZE;
+  p->exe = ip;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->tf->epc = elf.entry;  // initial program counter = main
   p->tf->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  p->tf->tp = 0;  // no thread data yet; see tls() in user/ulib.c
+  if(oldpagetable)
+    proc_freepagetable(oldpagetable, oldsz);
+  if(oldkpagetable)
+    kfree((void*)oldkpagetable);
+  if(oldexe)
+    execput(oldexe);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  if(kpagetable)
+    kfree((void*)kpagetable);
   if(ip){
-    iunlockput(ip);
-    end_op(ROOTDEV);
+    if(holdingsleep(&ip->lock)){
+      iunlockput(ip);
+      end_op(ROOTDEV);
+    } else {
+      execput(ip);
+    }
   }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Drop a reference to a program inode, which may be the
+// last one to a file unlinked while it ran.
+void
+execput(struct inode *ip)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
+  uint dev = ip->dev;
+
+  begin_opn(dev, FREEOPBLOCKS);
+  iput(ip);
+  end_op(dev);
+}
+
+// The segment of mm's program with file contents at va, or 0.
+// Caller must hold mm->vmlock.
+static struct execseg*
+execseg(struct proc *mm, uint64 va)
+{
+  struct execseg *s;
+
+  for(s = mm->seg; s < &mm->seg[mm->nseg]; s++)
+    if(va >= s->va && va < s->va + s->filesz)
+      return s;
+  return 0;
+}
+
+// Is va in a page that execfault() reads from the program?
+// Caller must hold mm->vmlock.
+int
+execpage(struct proc *mm, uint64 va)
+{
+  return execseg(mm, PGROUNDDOWN(va)) != 0;
+}
+
+// Page in the program page containing va for mm, the owner
+// of the current process's address space. mm->exe stays put
+// meanwhile: exec() kills the other threads first.
+// Returns 0 on success, -1 if memory ran out or the read
+// failed.
+int
+execfault(struct proc *mm, uint64 va)
+{
+  struct execseg s, *sp;
+  struct inode *ip = mm->exe;
+  pte_t *pte;
+  char *mem;
+  int perm = 0, n, r;
+
+  va = PGROUNDDOWN(va);
+  acquire(&mm->vmlock);
+  if((sp = execseg(mm, va)) == 0){
+    release(&mm->vmlock);
+    return -1;
+  }
+  s = *sp;
+  release(&mm->vmlock);
+
+  // a shared page may run on past the segment's end into
+  // the file's next bytes, harmlessly unless that part of the
+  // page must read as zeros.
+  ilock(ip);
+  n = s.filesz - (va - s.va);
+  if(s.share && (n >= PGSIZE || s.memsz == s.filesz)){
+    mem = pcget(ip, (s.off + va - s.va) / PGSIZE, 0);
+    perm = s.perm;
+  } else if((mem = kzalloc(MT_USER)) != 0){
+    if(n > PGSIZE)
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+    if(readi(ip, 0, (uint64)mem, s.off + (va - s.va), n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+    perm = PTE_W|PTE_X|PTE_R|PTE_U;
   }
-  
-  return 0;
+  iunlock(ip);
+  if(mem == 0)
+    return -1;
+
+  // another thread may have paged va in meanwhile.
+  r = 0;
+  acquire(&mm->vmlock);
+  if((pte = walk(mm->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0){
+    if(va >= mm->sz || mappages(mm->pagetable, va, PGSIZE, (uint64)mem, perm) != 0)
+      r = -1;
+    else
+      mem = 0;
+  }
+  release(&mm->vmlock);
+  if(mem)
+    kfree(mem);
+  return r;
+}
+
+// Give child np its own reference to p's program.
+// Caller must hold p->vmlock.
+void
+execdup(struct proc *p, struct proc *np)
+{
+  np->exe = p->exe ? idup(p->exe) : 0;
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+}
+
+// The heap has shrunk to sz: pages above it no longer come
+// from the program if it grows back. Caller must hold
+// mm->vmlock.
+void
+execshrink(struct proc *mm, uint64 sz)
+{
+  struct execseg *s;
+
+  for(s = mm->seg; s < &mm->seg[mm->nseg]; s++)
+    if(s->va + s->filesz > sz)
+      s->filesz = sz > s->va ? sz - s->va : 0;
 }
@@ -2,3 +2,27 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+
+#define WNOHANG       0x1  // waitpid(): don't block
+
+// spawn() file actions, applied in order to the child's
+// copy of the caller's open files.
+#define SPAWN_END     0   // end of the action list
+#define SPAWN_DUP2    1   // make fd refer to srcfd's file
+#define SPAWN_CLOSE   2   // close fd
+#define SPAWN_OPEN    3   // open path with omode as fd
+
+struct spawnact {
+  int type;
+  int fd;
+  int srcfd;
+  int omode;
+  char *path;
+};
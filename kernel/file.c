@@ -12,18 +12,25 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "memstat.h"
 
 struct devsw devsw[NDEV];
-struct {
-  struct spinlock lock;
-  struct file file[NFILE];
-} ftable;
 
-void
-fileinit(void)
-{
-  initlock(&ftable.lock, "ftable");
-}
+// File structures are kmalloc()ed on open and freed on
+// last close, so the number of open files is limited
+// only by memory. f->ref is updated with atomics, not a
+// lock. Freed file structures are kept on per-CPU lists,
+// up to NFCACHE each, so that most opens and closes take
+// no shared lock; only the CPU that owns a list touches
+// it, with interrupts off.
+#define NFCACHE 16
+
+struct {
+  struct file *head;  // through f->fnext
+  int n;
+} fcache[NCPU];
 
 // Allocate a file structure.
 struct file*
@@ -31,15 +38,60 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  push_off();
+  if((f = fcache[cpuid()].head) != 0){
+    fcache[cpuid()].head = f->fnext;
+    fcache[cpuid()].n--;
+  }
+  pop_off();
+  if(f == 0 && (f = kmalloc(sizeof(*f))) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
+}
+
+// Free file structure f, or keep it for filealloc().
+static void
+filefree(struct file *f)
+{
+  push_off();
+  if(fcache[cpuid()].n < NFCACHE){
+    f->fnext = fcache[cpuid()].head;
+    fcache[cpuid()].head = f;
+    fcache[cpuid()].n++;
+    f = 0;
+  }
+  pop_off();
+  if(f)
+    kmfree(f);
+}
+
+// Make the file table *pofile, which has *pn entries, big
+// enough to hold descriptor fd, doubling its size as
+// often as needed. Returns 0, or -1 if fd is out of range
+// or memory is short.
+int
+ofilegrow(struct file ***pofile, int *pn, int fd)
+{
+  struct file **o;
+  int n;
+
+  if(fd < 0 || fd >= MAXOFILE)
+    return -1;
+  if(fd < *pn)
+    return 0;
+  for(n = *pn ? *pn : NOFILE; n <= fd; n *= 2)
+    ;
+  if((o = kmalloc(n * sizeof(*o))) == 0)
+    return -1;
+  memset(o, 0, n * sizeof(*o));
+  if(*pofile){
+    memmove(o, *pofile, *pn * sizeof(*o));
+    kmfree(*pofile);
   }
-  release(&ftable.lock);
+  *pofile = o;
+  *pn = n;
   return 0;
 }
 
@@ -47,11 +99,8 @@ filealloc(void)
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if(__sync_fetch_and_add(&f->ref, 1) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
@@ -60,23 +109,22 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  int n;
 
-  acquire(&ftable.lock);
-  if(f->ref < 1)
-    panic("fileclose");
-  if(--f->ref > 0){
-    release(&ftable.lock);
+  if((n = __sync_sub_and_fetch(&f->ref, 1)) > 0)
     return;
-  }
+  if(n < 0)
+    panic("fileclose");
   ff = *f;
-  f->ref = 0;
   f->type = FD_NONE;
-  release(&ftable.lock);
+  filefree(f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_SHM){
+    shmclose(ff.shm);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op(ff.ip->dev);
+    begin_opn(ff.ip->dev, FREEOPBLOCKS);
     iput(ff.ip);
     end_op(ff.ip->dev);
   }
@@ -101,10 +149,74 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read directory f's next entries, as struct dirstats,
+// into up to n bytes at user address addr. The entries are
+// collected with the directory locked and then stat'ed one
+// at a time without it, since locking a directory and then
+// an entry in it is the order create() uses the other way.
 int
-fileread(struct file *f, uint64 addr, int n)
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct inode *dp, *ip;
+  struct dirstat *ds;
+  struct dirent de;
+  int i, nds, max;
+
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  dp = f->ip;
+  max = n / sizeof(*ds);
+  if(max > PGSIZE / sizeof(*ds))
+    max = PGSIZE / sizeof(*ds);
+  if(max < 1)
+    return -1;
+  if((ds = kalloc(MT_KERNEL)) == 0)
+    return -1;
+
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    kfree(ds);
+    return -1;
+  }
+  for(nds = 0; nds < max && f->off + sizeof(de) <= dp->size; f->off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, f->off, sizeof(de)) != sizeof(de))
+      break;
+    if(de.inum == 0)
+      continue;
+    memset(&ds[nds], 0, sizeof(ds[nds]));
+    ds[nds].inum = de.inum;
+    memmove(ds[nds].name, de.name, DIRSIZ);
+    nds++;
+  }
+  iunlock(dp);
+
+  // iput() may free an inode unlinked meanwhile.
+  begin_opn(dp->dev, FREEOPBLOCKS);
+  for(i = 0; i < nds; i++){
+    ip = iget(dp->dev, ds[i].inum);
+    ilockshared(ip);
+    ds[i].type = ip->type;
+    ds[i].nlink = ip->nlink;
+    ds[i].size = ip->size;
+    iunlockshared(ip);
+    iput(ip);
+  }
+  end_op(dp->dev);
+
+  n = nds * sizeof(*ds);
+  if(copyout(p->pagetable, addr, (char*)ds, n) < 0)
+    n = -1;
+  kfree(ds);
+  return n;
+}
+
+// Read from file f.
+// addr is a user virtual address if user_dst is 1,
+// a kernel address if 0.
+static int
+fileread1(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,16 +224,27 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    if(user_dst)
+      vmtouch(addr, n, 1);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(f, 1, addr, n);
+    if(user_dst)
+      vmtouch(addr, n, 1);
+    r = devsw[f->major].read(f, user_dst, addr, n);
   } else if(f->type == FD_INODE){
+    // paging in a mapping of this file, or program data,
+    // takes that file's inode lock, which may be this one;
+    // fault the buffer in first.
+    if(user_dst)
+      vmtouch(addr, n, 1);
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+  } else if(f->type == FD_SHM){
+    return -1;  // only mmap()ed
   } else {
     panic("fileread");
   }
@@ -129,10 +252,17 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
+{
+  return fileread1(f, 1, addr, n);
+}
+
+// Write to file f.
+// addr is a user virtual address if user_src is 1,
+// a kernel address if 0.
+static int
+filewrite1(struct file *f, int user_src, uint64 addr, int n)
 {
   int r, ret = 0;
 
@@ -140,28 +270,47 @@ filewrite(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    if(user_src)
+      vmtouch(addr, n, 0);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(f, 1, addr, n);
+    if(user_src)
+      vmtouch(addr, n, 0);
+    ret = devsw[f->major].write(f, user_src, addr, n);
+  } else if(f->type == FD_INODE && f->ip->type == T_FILE){
+    // into the page cache, which logs the data later:
+    // no transaction, and no need to split the write.
+    if(user_src)
+      vmtouch(addr, n, 0);
+    ilock(f->ip);
+    if((r = writei(f->ip, user_src, addr, f->off, n)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    pcthrottle(f->ip);
+    ret = r;
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, two levels of indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      // as in fileread1(), fault in mappings and program
+      // text first.
+      if(user_src)
+        vmtouch(addr + i, n1, 0);
       begin_op(f->ip->dev);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op(f->ip->dev);
@@ -173,6 +322,8 @@ filewrite(struct file *f, uint64 addr, int n)
       i += r;
     }
     ret = (i == n ? n : -1);
+  } else if(f->type == FD_SHM){
+    return -1;  // only mmap()ed
   } else {
     panic("filewrite");
   }
@@ -180,3 +331,159 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return filewrite1(f, 1, addr, n);
+}
+
+// Read into the n user buffers in iov, in order, from
+// offset off of f, or from f->off, advancing it, if off is
+// negative. An inode is locked once for all of them. Stops
+// at the first short read, or, on a pipe, once it is empty.
+// Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type != FD_INODE){
+    if(off >= 0)
+      return -1;  // pipes and devices have no offsets
+    for(i = tot = 0; i < n; i++){
+      if(i > 0 && (f->type != FD_PIPE || !(pipepoll(f->pipe, 0) & POLLIN)))
+        break;  // don't wait once some data has been read
+      if((r = fileread1(f, 1, (uint64)iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
+
+  for(i = 0; i < n; i++)
+    vmtouch((uint64)iov[i].base, iov[i].len, 1);  // see fileread1()
+  ilock(f->ip);
+  o = off >= 0 ? off : f->off;
+  for(i = tot = 0; i < n; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].base, o, iov[i].len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    o += r;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  if(off < 0)
+    f->off = o;
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the n user buffers in iov, in order, at offset off
+// of f, or at f->off, advancing it, if off is negative. A
+// file is locked once for all of them, and, as its data
+// goes to the page cache, needs no log transaction.
+// Returns the number of bytes written, or -1.
+int
+filewritev(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type != FD_INODE || f->ip->type != T_FILE){
+    if(off >= 0)
+      return -1;  // pipes and devices have no offsets
+    for(i = tot = 0; i < n; i++){
+      if((r = filewrite1(f, 1, (uint64)iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+    }
+    return tot;
+  }
+
+  for(i = 0; i < n; i++)
+    vmtouch((uint64)iov[i].base, iov[i].len, 0);  // see fileread1()
+  ilock(f->ip);
+  o = off >= 0 ? off : f->off;
+  for(i = tot = 0; i < n; i++){
+    if((r = writei(f->ip, 1, (uint64)iov[i].base, o, iov[i].len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    o += r;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  if(off < 0)
+    f->off = o;
+  iunlock(f->ip);
+  pcthrottle(f->ip);
+  return tot;
+}
+
+// Move up to n bytes from in to out without passing them
+// through user space, a page at a time. The data is staged
+// in a kernel page rather than copied from the buffer cache
+// into a pipe directly, so that no inode or buffer lock is
+// held while sleeping on a full pipe.
+// A pipe or device input is read only once, like read().
+// A short write ends the splice; an inode input is left just
+// past the bytes written, while those read from a pipe or
+// device and not written are lost, as with read() and write().
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int r, w, m, tot;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  // fail before reading anything that couldn't be written,
+  // so the caller can fall back to read() and write().
+  if(out->type == FD_SHM)
+    return -1;
+  if((buf = kalloc(MT_KERNEL)) == 0)
+    return -1;
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread1(in, 0, (uint64)buf, m)) <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    if((w = filewrite1(out, 0, (uint64)buf, r)) != r){
+      if(w < 0)
+        w = 0;
+      if(in->type == FD_INODE){
+        ilock(in->ip);
+        in->off -= r - w;
+        iunlock(in->ip);
+      }
+      tot += w;
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    if(in->type != FD_INODE){
+      tot += r;
+      break;
+    }
+  }
+  kfree(buf);
+  return tot;
+}
+
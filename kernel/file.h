@@ -1,5 +1,5 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SHM } type;
   int ref; // reference count
   char readable;
   char writable;
@@ -8,12 +8,16 @@ struct file {
   uint off;          // FD_INODE and FD_DEVICE
   short major;       // FD_DEVICE
   short minor;       // FD_DEVICE
+  struct shm *shm;   // FD_SHM
+  struct file *fnext;  // on a per-CPU free list, once freed
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NMAPCACHE 16  // indirect block entries cached per inode
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
@@ -27,13 +31,34 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint mapstart;      // bmap: first file block map[] describes
+  uint mapn;          // bmap: valid entries in map[]
+  uint map[NMAPCACHE];  // bmap: copy of part of an indirect block
+  uint goal;          // block the next block allocated should be
+
+  uint ranext;        // readahead: block a sequential read would start at
+  uint rahead;        // readahead: first block not yet prefetched
+  uint rawin;         // readahead: window in blocks, 0 if not sequential
+
+  struct cpage *pages;  // page cache: pages of the contents, see pcache.c
+  int ndirty;         // page cache: dirty pages, under pcache.lock
+  int ondirty;        // page cache: on the dirty list, under pcache.lock
+  struct inode *dnext;  // page cache: dirty list
+  uint dsize;         // page cache: size on disk; size counts dirty pages too
+
+  struct dindex *dindex;  // directory: index of the entries, see fs.c
+
+  uint lastuse;       // ticks when ref last fell to 0, under bucket lock
+  struct inode *next; // icache hash chain, under bucket lock
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(struct file *, int, uint64, int);
   int (*write)(struct file *, int, uint64, int);
+  int (*poll)(struct file *);  // POLL* ready; 0 if never blocks
 };
 
 extern struct devsw devsw[];
@@ -15,17 +15,20 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "memstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+static void dcinit(void);
+static void dcpurge(uint, uint);
+static void dxfree(struct inode*);
+// one superblock per file system device, the disks and /tmp.
+struct superblock sb[TMPDEV+1];
 
 // Read the super block.
 static void
@@ -41,10 +44,62 @@ readsb(int dev, struct superblock *sb)
 // Init fs
 void
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC)
     panic("invalid file system");
-  initlog(dev, &sb);
+  initlog(dev, &sb[dev]);
+}
+
+// Make an empty file system for /tmp on the RAM disk, and
+// mount it. It has no log, and no superblock on the disk.
+void
+tmpinit(void)
+{
+  struct superblock *s = &sb[TMPDEV];
+  struct inode *dp, *rp;
+  struct dinode *dip;
+  struct buf *bp;
+  uint b, nmeta;
+
+  s->magic = FSMAGIC;
+  s->size = TMPSIZE;
+  s->ninodes = TMPINODES;
+  s->nlog = 0;
+  s->logstart = 0;
+  s->inodestart = 2;
+  s->bmapstart = 2 + (TMPINODES + IPB - 1) / IPB;
+  nmeta = s->bmapstart + (TMPSIZE + BPB - 1) / BPB;
+  s->nblocks = TMPSIZE - nmeta;
+  if(nmeta > BPB)
+    panic("tmpinit");
+
+  // the blocks up to the first data block are in use.
+  bp = bread(TMPDEV, s->bmapstart);
+  for(b = 0; b < nmeta; b++)
+    bp->data[b/8] |= 1 << (b%8);
+  bwrite(bp);
+  brelse(bp);
+
+  bp = bread(TMPDEV, IBLOCK(ROOTINO, sb[TMPDEV]));
+  dip = (struct dinode*)bp->data + ROOTINO%IPB;
+  dip->type = T_DIR;
+  dip->nlink = 1;
+  bwrite(bp);
+  brelse(bp);
+
+  rp = iget(TMPDEV, ROOTINO);
+  ilock(rp);
+  if(dirlink(rp, ".", ROOTINO) < 0 || dirlink(rp, "..", ROOTINO) < 0)
+    panic("tmpinit: dirlink");
+  iunlock(rp);
+
+  begin_op(ROOTDEV);
+  if((dp = namei("/tmp")) == 0)
+    printf("tmpinit: no /tmp to mount on\n");
+  else
+    mount(dp, rp);
+  end_op(ROOTDEV);
+  iput(rp);
 }
 
 // Zero a block.
@@ -61,29 +116,84 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Where balloc() looks for a free run when it has no goal.
+// Only a hint, so unlocked updates are harmless.
+static uint bhint;
+
+// Find a run of run free blocks whose first block is one of
+// the n blocks from start on, wrapping around the end of the
+// disk. Mark the first block of the run in use and return it,
+// or 0 if there is no such run. Runs do not span bitmap blocks.
 static uint
-balloc(uint dev)
+bfind(uint dev, uint start, int run, uint n)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi, i, j;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  b = start;
+  for(i = 0; i < n; i++, b++){
+    if(b >= sb[dev].size)
+      b = 0;
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb[dev])){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(b, sb[dev]));
+    }
+    bi = b % BPB;
+    if(bi % 8 == 0 && bp->data[bi/8] == 0xff && i + 8 <= n){
+      // skip a byte of in-use blocks.
+      i += 7;
+      b += 7;
+      continue;
+    }
+    for(j = 0; j < run; j++){
+      if(bi + j >= BPB || b + j >= sb[dev].size ||
+         (bp->data[(bi+j)/8] & (1 << ((bi+j) % 8))))
+        break;
+    }
+    if(j == run){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      return b;
     }
+  }
+  if(bp)
     brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block, at goal if that is free.
+// Otherwise start a new run of blocks where BALLOCRUN are
+// free, so that the file can keep growing contiguously, and
+// steer later files past it.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  if(goal == 0 || goal >= sb[dev].size || (b = bfind(dev, goal, 1, 1)) == 0){
+    if(goal == 0 || goal >= sb[dev].size)
+      goal = bhint;
+    if((b = bfind(dev, goal, BALLOCRUN, sb[dev].size)) == 0 &&
+       (b = bfind(dev, goal, 1, sb[dev].size)) == 0)
+      panic("balloc: out of blocks");
+    bhint = b + BALLOCRUN;
   }
-  panic("balloc: out of blocks");
+  bzero(dev, b);
+  return b;
+}
+
+// Allocate a block for ip, just after the last one.
+static uint
+iballoc(struct inode *ip)
+{
+  uint b;
+
+  b = balloc(ip->dev, ip->goal);
+  ip->goal = b + 1;
+  return b;
 }
 
 // Free a disk block.
@@ -93,7 +203,7 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(dev, BBLOCK(b, sb[dev]));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -129,11 +239,13 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is unused if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. An unused entry keeps its inode, so a
+//   later iget() of the same inode can skip the disk read,
+//   until iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
@@ -163,32 +275,61 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cache is a hash table on (dev, inum). Entries are
+// kmalloc()ed until there are NINODE of them; after that the
+// least recently used unused entry is recycled, and the cache
+// only grows when every entry is in use. Entries are never
+// freed, so the cache grows to the peak number of active inodes.
+//
+// The lock of the bucket an entry is hashed to protects its
+// ip->ref, ip->dev, ip->inum and ip->lastuse; one must hold it
+// while using any of those fields. An entry only moves between
+// buckets when it is recycled, which requires ip->ref == 0, so
+// a holder of a reference can find the bucket from ip->dev and
+// ip->inum without a lock. icache.lock serializes recycling, the
+// only path that holds more than one bucket lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;  // entries hashed here, through next
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  int ninode;
+  struct ibucket bucket[NIBUCKET];
 } icache;
 
+static inline struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &icache.bucket[((dev << 27) ^ inum) % NIBUCKET];
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct ibucket *bk;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  for(bk = icache.bucket; bk < icache.bucket+NIBUCKET; bk++){
+    initlock(&bk->lock, "icache.bucket");
+    bk->head = 0;
   }
+  dcinit();
 }
 
-static struct inode* iget(uint dev, uint inum);
+// Where ialloc() starts looking: the lowest inode number
+// that might be free. ialloc() moves it past the inode it
+// takes and iput() back to one it frees. Only a hint, so
+// unlocked updates are harmless.
+static uint ihint = 1;
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -196,21 +337,29 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, i;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  bp = 0;
+  inum = ihint;
+  for(i = 1; i < sb[dev].ninodes; i++, inum++){
+    if(inum < 1 || inum >= sb[dev].ninodes)
+      inum = 1;
+    if(bp == 0 || bp->blockno != IBLOCK(inum, sb[dev])){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum, sb[dev]));
+    }
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      ihint = inum + 1;
       return iget(dev, inum);
     }
-    brelse(bp);
   }
   panic("ialloc: no inodes");
 }
@@ -225,49 +374,131 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  dip->size = ip->dsize;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
+// Look for inode (dev, inum) in bucket bk.
+// Caller must hold bk->lock.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head; ip != 0; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
+// Take the least recently used unused entry out of its
+// bucket, or return 0 if every entry is in use.
+// Called with icache.lock and bk->lock held, which are
+// still held on return.
+static struct inode*
+irecycle(struct ibucket *bk)
+{
+  struct inode *ip, **pp, **bestpp;
+  struct ibucket *victim, *best;
+  int found;
+
+  // as in brecycle(), keep the lock of the bucket holding
+  // the best candidate so far until a better one turns up.
+  best = 0;
+  bestpp = 0;
+  for(victim = icache.bucket; victim < icache.bucket+NIBUCKET; victim++){
+    if(victim != bk)
+      acquire(&victim->lock);
+    found = 0;
+    for(pp = &victim->head; *pp != 0; pp = &(*pp)->next){
+      if((*pp)->ref == 0 &&
+         (bestpp == 0 || (*pp)->lastuse < (*bestpp)->lastuse)){
+        bestpp = pp;
+        found = 1;
+      }
+    }
+    if(found){
+      if(best != 0 && best != bk)
+        release(&best->lock);
+      best = victim;
+    } else if(victim != bk){
+      release(&victim->lock);
+    }
+  }
+  if(best == 0)
+    return 0;
+
+  ip = *bestpp;
+  *bestpp = ip->next;
+  if(best != bk)
+    release(&best->lock);
+  return ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk;
 
-  acquire(&icache.lock);
+  bk = ibucket(dev, inum);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    return ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not cached. Take the recycling lock and look again, since
+  // another process may have cached the inode meanwhile.
+  acquire(&icache.lock);
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    release(&icache.lock);
+    return ip;
+  }
+
+  // Recycle an unused entry, or grow the cache.
+  ip = 0;
+  if(icache.ninode >= NINODE && (ip = irecycle(bk)) != 0){
+    pcinval(ip);
+    dxfree(ip);
+  }
+  if(ip == 0){
+    if((ip = kmalloc(sizeof(*ip))) == 0)
+      panic("iget: no inodes");
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    icache.ninode++;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->rahead = ip->rawin = 0;
+  ip->mapn = 0;
+  ip->goal = 0;
+  ip->next = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&icache.lock);
 
   return ip;
@@ -278,9 +509,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -298,13 +531,13 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
-    ip->size = dip->size;
+    ip->size = ip->dsize = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -313,6 +546,26 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode shared with other readers, who may
+// look at its fields but not change them, nor read its
+// content, which updates the block-map and read-ahead state.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquireshared(&ip->lock);
+  if(ip->valid == 0){
+    // reading it in needs the lock exclusively. Once valid,
+    // it stays so while we hold a reference.
+    releaseshared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquireshared(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -323,6 +576,15 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releaseshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -333,7 +595,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -342,20 +606,27 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR){
+      dcpurge(ip->dev, ip->inum);
+      dxfree(ip);
+    }
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    if(ip->inum < ihint)
+      ihint = ip->inum;
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&icache.lock);
+  if(--ip->ref == 0)
+    ip->lastuse = ticks;
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -371,40 +642,106 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NINDIRECT*NINDIRECT
+// blocks after that are listed in the NINDIRECT blocks that
+// block ip->addrs[NDIRECT+1] lists.
+//
+// bmap() keeps a copy of the last run of indirect block
+// entries it used in ip->map[], so that most lookups during
+// a sequential scan of a big file need not read the
+// indirect blocks at all.
+
+// Return entry bn of indirect block addr, allocating a block
+// for it if there is none. If fbn is not ~0, it is the file
+// block entry bn maps, and the entries from bn on are copied
+// into ip's map cache.
+static uint
+bmapind(struct inode *ip, uint addr, uint bn, uint fbn)
+{
+  uint *a, n;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0){
+    a[bn] = addr = iballoc(ip);
+    log_write(bp);
+  }
+  if(fbn != ~0U){
+    n = NINDIRECT - bn;
+    if(n > NMAPCACHE)
+      n = NMAPCACHE;
+    memmove(ip->map, a + bn, n * sizeof(uint));
+    ip->mapstart = fbn;
+    ip->mapn = n;
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip);
     return addr;
   }
+
+  // unallocated blocks are 0 in the cache too; they miss.
+  if(bn - ip->mapstart < ip->mapn && (addr = ip->map[bn - ip->mapstart]) != 0)
+    return addr;
+
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = iballoc(ip);
+    return bmapind(ip, addr, bn, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NINDIRECT*NINDIRECT){
+    // Load the doubly-indirect block, then the indirect
+    // block it lists, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = iballoc(ip);
+    addr = bmapind(ip, addr, bn / NINDIRECT, ~0U);
+    return bmapind(ip, addr, bn % NINDIRECT, fbn);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists.
+// If depth > 1, those are themselves indirect blocks.
+static void
+itruncind(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      itruncind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -413,9 +750,9 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  pcinval(ip);
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -425,18 +762,17 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    itruncind(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
+  if(ip->addrs[NDIRECT+1]){
+    itruncind(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  ip->mapn = 0;
+  ip->size = ip->dsize = 0;
   iupdate(ip);
 }
 
@@ -450,68 +786,160 @@ stati(struct inode *ip, struct stat *st)
   st->type = ip->type;
   st->nlink = ip->nlink;
   st->size = ip->size;
+  st->rawin = ip->rawin;
+}
+
+// Start reading the blocks of ip's window from ranext into
+// the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip)
+{
+  uint bn, end, addrs[MAXRAHEAD];
+  int n;
+
+  end = ip->ranext + ip->rawin;
+  if(end > (ip->dsize + BSIZE - 1) / BSIZE)
+    end = (ip->dsize + BSIZE - 1) / BSIZE;  // blocks past dsize may not exist yet
+  bn = ip->ranext;
+  if(bn < ip->rahead)
+    bn = ip->rahead;
+  for(n = 0; bn < end; bn++)
+    addrs[n++] = bmap(ip, bn);
+  bprefetch(ip->dev, addrs, n);
+  if(end > ip->rahead)
+    ip->rahead = end;
+}
+
+// Copy n bytes of ip's contents at off, all inside the file,
+// to dst through the buffer cache. Returns 0, or -1 if the
+// copy failed. Caller must hold ip->lock.
+static int
+readblocks(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+      brelse(bp);
+      return -1;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// readblocks() into kernel memory, for the page cache.
+int
+readiblocks(struct inode *ip, char *dst, uint off, uint n)
+{
+  return readblocks(ip, 0, (uint64)dst, off, n);
 }
 
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Regular files are read through the page cache, and
+// everything else straight from the buffer cache.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  int miss;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+  // a read that starts where the last one ended is
+  // sequential, and doubles the readahead window.
+  if(off/BSIZE == ip->ranext){
+    ip->rawin = ip->rawin ? min(2*ip->rawin, MAXRAHEAD) : 2;
+  } else {
+    ip->rawin = 0;
+    ip->rahead = 0;
+  }
+
+  // only a read that missed in the page cache needs
+  // the next blocks brought into the buffer cache.
+  if(ip->type == T_FILE)
+    miss = pcread(ip, user_dst, dst, off, n);
+  else
+    miss = readblocks(ip, user_dst, dst, off, n) == 0;
+  ip->ranext = (off + n)/BSIZE;
+  if(ip->rawin && miss > 0)
+    readahead(ip);
+  return n;
+}
+
+// Copy n bytes from src to ip's contents at off through
+// the buffer cache, allocating blocks as needed. Returns
+// the number of bytes copied. Caller must hold ip->lock
+// and be in a transaction.
+static uint
+writeblocks(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    log_write(bp);
     brelse(bp);
   }
-  return n;
+  return tot;
+}
+
+// writeblocks() from kernel memory, for the page cache.
+uint
+writeiblocks(struct inode *ip, char *src, uint off, uint n)
+{
+  return writeblocks(ip, 0, (uint64)src, off, n);
 }
 
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
+// Regular files are written to the page cache, which
+// allocates their blocks and logs them later; only
+// everything else needs the caller to be in a transaction.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
-      break;
-    }
-    log_write(bp);
-    brelse(bp);
+  if(ip->type == T_FILE){
+    tot = pcwrite(ip, user_src, src, off, n);
+    if(off + tot > ip->size)
+      ip->size = off + tot;
+    return tot == n ? n : -1;
   }
 
+  tot = writeblocks(ip, user_src, src, off, n);
   if(n > 0){
-    if(off > ip->size)
-      ip->size = off;
+    if(off + tot > ip->size)
+      ip->size = off + tot;
+    ip->dsize = ip->size;
     // write the i-node back to disk even if the size didn't change
     // because the loop above might have called bmap() and added a new
     // block to ip->addrs[].
     iupdate(ip);
+    pcdrop(ip, off, tot);
   }
 
   return n;
@@ -525,17 +953,356 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// dcache remembers recent dirlookup() results, keyed by
+// directory and name, including names that are not there,
+// so that namex() seldom has to read directory contents.
+// dirlink() and unlink() keep it up to date, and a
+// directory's entries are dropped when it is freed.
+// Each (directory, name) hashes to one set of DCWAYS
+// entries; the least recently used one is replaced.
+
+#define DCSETS 64
+#define DCWAYS 4
+
+struct dcent {
+  uint dev;
+  uint dinum;         // directory's inode number, 0 if entry is free
+  char name[DIRSIZ];
+  uint inum;          // 0 if name is not in the directory
+  uint off;           // offset of name's dirent, if inum != 0
+  uint lastuse;
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dcent ent[DCSETS][DCWAYS];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dcent*
+dcset(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + name[i];
+  return dcache.ent[h % DCSETS];
+}
+
+// Find the entry for name in directory (dev, dinum).
+// Caller must hold dcache.lock.
+static struct dcent*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dcent *e, *set;
+
+  set = dcset(dev, dinum, name);
+  for(e = set; e < set + DCWAYS; e++){
+    if(e->dinum == dinum && e->dev == dev && namecmp(e->name, name) == 0){
+      e->lastuse = ++dcache.clock;
+      return e;
+    }
+  }
+  return 0;
+}
+
+// Record that name in directory dp is inode inum, whose
+// dirent is at off, or that there is no name if inum is 0.
+// Caller must hold dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcent *e, *e1, *set;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    set = dcset(dp->dev, dp->inum, name);
+    for(e = set; e < set + DCWAYS; e++)
+      if(e->dinum == 0)
+        break;
+    if(e == set + DCWAYS){
+      e = set;
+      for(e1 = set + 1; e1 < set + DCWAYS; e1++)
+        if(e1->lastuse < e->lastuse)
+          e = e1;
+    }
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    e->lastuse = ++dcache.clock;
+  }
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Forget every name in directory (dev, dinum),
+// because the directory is being freed.
+static void
+dcpurge(uint dev, uint dinum)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  for(e = &dcache.ent[0][0]; e < &dcache.ent[DCSETS][0]; e++)
+    if(e->dinum == dinum && e->dev == dev)
+      e->dinum = 0;
+  release(&dcache.lock);
+}
+
+// Look name up in dcache. If it knows, set *ipp to
+// the inode (0 if name isn't in dp), and *poff as
+// dirlookup() would, and return 1.
+// Caller must hold dp->lock, shared or exclusive.
+static int
+dclookup(struct inode *dp, char *name, uint *poff, struct inode **ipp)
+{
+  struct dcent *e;
+  uint off, inum;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  inum = e->inum;
+  off = e->off;
+  release(&dcache.lock);
+  *ipp = 0;
+  if(inum != 0){
+    if(poff)
+      *poff = off;
+    *ipp = iget(dp->dev, inum);
+  }
+  return 1;
+}
+
+// Directory index.
+//
+// A directory of DXMIN bytes or more gets a hash table of
+// its entries' names the first time dirlookup() or dirlink()
+// has to search it, so that neither reads the directory
+// through: lookups read one dirent per name with the same
+// hash, and dirlink() starts looking for a free dirent at
+// dx->free. The table lives in whole pages, up to DXPAGES
+// of them; a directory that would need more, or when memory
+// is short, is searched linearly, as small ones are.
+// dirlink() and dirunlink() keep the index up to date, and
+// it is dropped when the inode leaves the icache or is
+// freed. Callers hold dp->lock exclusively.
+
+#define DXMIN (4*BSIZE)
+#define DXPAGES 64
+#define DXDEAD 0xffffffff   // dxslot.ent of a removed entry
+
+struct dxslot {
+  uint hash;
+  uint ent;           // dirent number + 1, 0 if the slot is empty
+};
+
+#define DXPERPAGE (PGSIZE / sizeof(struct dxslot))
+
+struct dindex {
+  uint nslot;         // a power of 2
+  uint nused;         // slots not empty, DXDEAD ones included
+  uint nlive;         // dirents in use, "." and ".." included
+  uint free;          // offset: no free dirent comes before it
+  char *pg[DXPAGES];
+};
+
+static uint
+dxhash(char *name)
+{
+  uint h = 2166136261U;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static struct dxslot*
+dxslot(struct dindex *dx, uint i)
+{
+  i &= dx->nslot - 1;
+  return (struct dxslot*)dx->pg[i / DXPERPAGE] + i % DXPERPAGE;
+}
+
+static void
+dxfree(struct inode *dp)
+{
+  struct dindex *dx;
+  int i;
+
+  if((dx = dp->dindex) == 0)
+    return;
+  for(i = 0; i < DXPAGES; i++)
+    if(dx->pg[i])
+      kfree(dx->pg[i]);
+  kmfree(dx);
+  dp->dindex = 0;
+}
+
+static void
+dxinsert(struct dindex *dx, uint hash, uint ent)
+{
+  struct dxslot *sl;
+  uint i;
+
+  for(i = hash; ; i++){
+    sl = dxslot(dx, i);
+    if(sl->ent == 0 || sl->ent == DXDEAD)
+      break;
+  }
+  if(sl->ent == 0)
+    dx->nused++;
+  sl->hash = hash;
+  sl->ent = ent;
+}
+
+// Index dp, if it is big enough, with room for as many
+// entries again; leaves dp->dindex 0 if not.
+static void
+dxbuild(struct inode *dp)
+{
+  struct dindex *dx;
+  struct dirent de;
+  uint nent, nslot, off;
+  int i;
+
+  dxfree(dp);
+  if(dp->size < DXMIN)
+    return;
+  nent = dp->size / sizeof(de);
+  for(nslot = DXPERPAGE; nslot < 4 * nent; nslot *= 2)
+    ;
+  if(nslot > DXPAGES * DXPERPAGE || (dx = kmalloc(sizeof(*dx))) == 0)
+    return;
+  memset(dx, 0, sizeof(*dx));
+  dx->nslot = nslot;
+  dx->free = dp->size;
+  for(i = 0; i < nslot / DXPERPAGE; i++){
+    if((dx->pg[i] = kzalloc(MT_KERNEL)) == 0){
+      dp->dindex = dx;
+      dxfree(dp);
+      return;
+    }
+  }
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dxbuild read");
+    if(de.inum == 0){
+      if(off < dx->free)
+        dx->free = off;
+      continue;
+    }
+    dxinsert(dx, dxhash(de.name), off / sizeof(de) + 1);
+    dx->nlive++;
+  }
+  dp->dindex = dx;
+}
+
+// Find name in dp's index. Returns its inode number and
+// sets *poff, or returns 0.
+static uint
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct dindex *dx = dp->dindex;
+  struct dxslot *sl;
+  struct dirent de;
+  uint hash, i, off;
+
+  hash = dxhash(name);
+  for(i = hash; (sl = dxslot(dx, i))->ent != 0; i++){
+    if(sl->ent == DXDEAD || sl->hash != hash)
+      continue;
+    off = (sl->ent - 1) * sizeof(de);
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dxlookup read");
+    if(de.inum != 0 && namecmp(name, de.name) == 0){
+      *poff = off;
+      return de.inum;
+    }
+  }
+  return 0;
+}
+
+// The dirent at off now holds name.
+static void
+dxadd(struct inode *dp, char *name, uint off)
+{
+  struct dindex *dx = dp->dindex;
+
+  if(dx->nused + 1 > dx->nslot / 2){
+    dxbuild(dp);  // bigger, and without the DXDEAD slots
+    return;
+  }
+  dxinsert(dx, dxhash(name), off / sizeof(struct dirent) + 1);
+  dx->nlive++;
+  if(off == dx->free)
+    dx->free = off + sizeof(struct dirent);
+}
+
+// The dirent at off, which held name, is now free.
+static void
+dxremove(struct inode *dp, char *name, uint off)
+{
+  struct dindex *dx = dp->dindex;
+  struct dxslot *sl;
+  uint hash, i, ent;
+
+  hash = dxhash(name);
+  ent = off / sizeof(struct dirent) + 1;
+  for(i = hash; (sl = dxslot(dx, i))->ent != 0; i++){
+    if(sl->ent == ent){
+      sl->ent = DXDEAD;
+      dx->nlive--;
+      break;
+    }
+  }
+  if(off < dx->free)
+    dx->free = off;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct inode *ip;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, poff, &ip))
+    return ip;
+
+  if(dp->dindex == 0 && dp->size >= DXMIN)
+    dxbuild(dp);
+  if(dp->dindex){
+    if((inum = dxlookup(dp, name, &off)) == 0){
+      dcenter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcenter(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -546,10 +1313,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -568,7 +1337,9 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  if(dp->dindex == 0 && dp->size >= DXMIN)
+    dxbuild(dp);
+  for(off = dp->dindex ? dp->dindex->free : 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
@@ -579,10 +1350,123 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum, off);
+  if(dp->dindex){
+    dp->dindex->free = off;
+    dxadd(dp, name, off);
+  }
 
   return 0;
 }
 
+// Remove the entry for name, at off, from directory dp.
+// Caller must hold dp->lock.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink");
+  dcenter(dp, name, 0, 0);
+  if(dp->dindex)
+    dxremove(dp, name, off);
+}
+
+// Is the directory dp empty except for "." and ".." ?
+// Caller must hold dp->lock.
+int
+isdirempty(struct inode *dp)
+{
+  int off;
+  struct dirent de;
+
+  if(dp->dindex)
+    return dp->dindex->nlive <= 2;
+  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("isdirempty: readi");
+    if(de.inum != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Mounts
+
+// A file system is entered, by name, through the directory
+// it is mounted on, which namex() replaces with the root of
+// the file system, and left through ".." of its root. The
+// table is filled in at boot, and read without a lock.
+struct mount {
+  struct inode *on;    // mounted-on directory
+  struct inode *root;  // root of the file system mounted there
+} mtab[NMOUNT];
+
+// Mount the file system whose root is rp on directory dp.
+// Takes over the caller's reference to dp.
+void
+mount(struct inode *dp, struct inode *rp)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++){
+    if(m->on == 0){
+      m->root = idup(rp);
+      __sync_synchronize();
+      m->on = dp;
+      return;
+    }
+  }
+  panic("mount: table full");
+}
+
+// Is ip a mounted-on directory, or the root of a mounted
+// file system?
+int
+mounted(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++)
+    if(m->on && (m->on == ip || m->root == ip))
+      return 1;
+  return 0;
+}
+
+// The root of the file system mounted on ip, if any,
+// in place of ip.
+static struct inode*
+mountdown(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++){
+    if(m->on && m->on == ip){
+      iput(ip);
+      return idup(m->root);
+    }
+  }
+  return ip;
+}
+
+// The directory ip is mounted on, if ip is the root of a
+// mounted file system, in place of ip.
+static struct inode*
+mountup(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++){
+    if(m->on && m->root == ip){
+      iput(ip);
+      return idup(m->on);
+    }
+  }
+  return ip;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -625,6 +1509,7 @@ skipelem(char *path, char *name)
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
+// Crosses into and out of mounted file systems.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
@@ -637,22 +1522,35 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    if(namecmp(name, "..") == 0)
+      ip = mountup(ip);
+    // Most names are in dcache, and looking them up needs
+    // only a shared lock, so lookups in a busy directory
+    // such as / run in parallel. Reading the directory's
+    // content on a miss needs it exclusively.
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
-      return 0;
+    if(dclookup(ip, name, 0, &next)){
+      iunlockshared(ip);
+    } else {
+      iunlockshared(ip);
+      ilock(ip);
+      next = dirlookup(ip, name, 0);
+      iunlock(ip);
     }
-    iunlockput(ip);
-    ip = next;
+    iput(ip);
+    if(next == 0)
+      return 0;
+    ip = mountdown(next);
   }
   if(nameiparent){
     iput(ip);
@@ -24,9 +24,18 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NINDIRECT*NINDIRECT)
+
+// Upper bounds on the distinct blocks some FS operations
+// write, for begin_opn(). Freeing an inode's blocks may
+// write every bitmap block (a big file's blocks can be
+// anywhere on the disk) and the inode; link and unlink
+// also write a directory block and up to two more inodes.
+// Both must fit in MAXOPBLOCKS.
+#define FREEOPBLOCKS (FSSIZE/BPB + 2)
+#define LINKOPBLOCKS (FREEOPBLOCKS + 2)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +44,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -51,10 +60,20 @@ struct dinode {
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+#define DIRSIZ 30
 
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
 
+// getdents() returns a directory's entries as these,
+// with part of what stat() would say about each.
+struct dirstat {
+  uint inum;
+  short type;         // 0 if the entry went away meanwhile
+  short nlink;
+  uint64 size;
+  char name[DIRSIZ+1]; // null-terminated
+};
+
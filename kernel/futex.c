@@ -0,0 +1,172 @@
+//
+// Futexes: futex_wait() and futex_wake().
+//
+// A futex is an int in user memory, named by the physical
+// address of that int, so that threads sharing an address
+// space and processes sharing a MAP_SHARED page agree on the
+// name. Waiters queue on a hash bucket and sleep on their own
+// entry; the bucket lock makes checking the int and going to
+// sleep atomic with respect to futex_wake().
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+
+#define NFUTEX 31
+
+struct futexw {
+  uint64 pa;                // the int waited on
+  int woken;
+  struct futexw *next;
+};
+
+// Lock order: a bucket's lock, then vmlock or p->lock.
+struct futexq {
+  struct spinlock lock;
+  struct futexw *head;
+} futexq[NFUTEX];
+
+static inline struct futexq*
+fqhash(uint64 pa)
+{
+  return &futexq[(pa >> 2) % NFUTEX];
+}
+
+void
+futexinit(void)
+{
+  struct futexq *fq;
+
+  for(fq = futexq; fq < &futexq[NFUTEX]; fq++)
+    initlock(&fq->lock, "futex");
+}
+
+// The physical address of the int at user address addr in
+// the current process, or 0 if its page is not mapped
+// privately writable or shared.
+// Caller must hold p->mm->vmlock.
+static uint64
+futexpa(uint64 addr)
+{
+  pte_t *pte;
+
+  if(addr >= MAXVA || (pte = walk(myproc()->pagetable, addr, 0)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW))
+    return 0;
+  return PTE2PA(*pte) + (addr % PGSIZE);
+}
+
+// Sleep until a futex_wake() on addr, if the int there
+// still holds val.
+// Returns 0 when woken, -1 if the int differed, addr is
+// bad, or the process was killed.
+static int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexq *fq;
+  struct futexw w, **pp;
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+
+  // fault the page in, and break copy-on-write sharing so
+  // that its physical address holds still.
+  vmtouch(addr, sizeof(int), 0);
+  vmtouch(addr, sizeof(int), 1);
+  acquire(&p->mm->vmlock);
+  pa = futexpa(addr);
+  release(&p->mm->vmlock);
+  if(pa == 0)
+    return -1;
+
+  fq = fqhash(pa);
+  acquire(&fq->lock);
+  acquire(&p->mm->vmlock);
+  if(futexpa(addr) != pa || *(volatile int*)pa != val){
+    // changed, or remapped since we looked.
+    release(&p->mm->vmlock);
+    release(&fq->lock);
+    return -1;
+  }
+  release(&p->mm->vmlock);
+
+  w.pa = pa;
+  w.woken = 0;
+  w.next = fq->head;
+  fq->head = &w;
+  while(!w.woken && !p->killed)
+    sleep(&w, &fq->lock);
+  if(!w.woken){
+    for(pp = &fq->head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&fq->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes waiting on the int at addr.
+// Returns how many were woken.
+static int
+futex_wake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct futexq *fq;
+  struct futexw *w, **pp;
+  uint64 pa;
+  int woken = 0;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+  acquire(&p->mm->vmlock);
+  pa = futexpa(addr);
+  release(&p->mm->vmlock);
+  if(pa == 0)
+    return 0;  // nobody can be waiting on it
+
+  fq = fqhash(pa);
+  acquire(&fq->lock);
+  for(pp = &fq->head; (w = *pp) != 0 && woken < n; ){
+    if(w->pa == pa){
+      *pp = w->next;
+      w->woken = 1;
+      wakeup(w);
+      woken++;
+    } else {
+      pp = &w->next;
+    }
+  }
+  release(&fq->lock);
+  return woken;
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake(addr, n);
+}
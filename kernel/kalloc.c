@@ -1,82 +1,382 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, and page-table pages. Allocates
+// whole 4096-byte pages. Smaller kernel objects
+// (pipes, files, inodes) come from kmalloc(), which
+// hands out pieces of a buddy-managed heap.
+//
+// Building with KALLOC_DEBUG (make KALLOCDEBUG=1) fills
+// freed and newly allocated pages with junk, to catch
+// dangling references and uninitialized use.
+//
+// kzalloc() hands out zeroed pages from a pool that the
+// kzero kernel process refills in the background, so
+// callers that need zeroed memory don't pay for zeroing.
+//
+// At boot, free memory is handed to the allocator in
+// NKCHUNK chunks, each built into a list without locking
+// and spliced onto the freeing CPU's list at once. kinit()
+// frees the first; the other harts free more while hart 0
+// sets up the rest of the kernel, kalloc() frees one when
+// it runs out meanwhile, and every hart frees what is left
+// before it starts scheduling.
+//
+// Each allocation is tagged with what it is for (see
+// memstat.h), and kfree() remembers the tag, so memstat()
+// can say who holds memory without walking anything.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
+#include "trace.h"
+#include "memstat.h"
 
-void freerange(void *pa_start, void *pa_end);
+static struct run *zpop(void);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+static char *pgbase; // first page owned by the page allocator.
+
+#define NKCHUNK (4*NCPU)
+static int kchunk;   // next chunk to free, taken atomically
+
+// Number of references to each physical page, so copy-on-write
+// fork can share pages. kfree() only frees a page when its
+// count drops to zero. Updated with atomics, not a lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int pgref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// Each allocated page's tag, and how many pages have each.
+// The counts too are updated with atomics.
+static uchar pgtag[(PHYSTOP - KERNBASE) / PGSIZE];
+static uint64 ntag[NMTAG];
+
 struct run {
   struct run *next;
 };
 
-struct {
+// One free list per CPU, so harts allocating and freeing
+// pages don't contend. A CPU whose list runs dry steals
+// from the others.
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  uint64 nfree;      // pages on freelist
+} kmem[NCPU];
+
+// Pages already zeroed, except for the next pointer in
+// each's first word; allocated as far as pgref is concerned.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  pgbase = (char*)PGROUNDUP((uint64)end + KMHEAPSIZE);
+  bd_init(end, pgbase);
+  kfreechunk();
 }
 
+// The number of pages the allocator manages.
+uint64
+knpages(void)
+{
+  return ((char*)PHYSTOP - pgbase) / PGSIZE;
+}
+
+// Free the next of the boot-time chunks of memory onto this
+// CPU's list. Returns 0 if they have all been freed.
+int
+kfreechunk(void)
+{
+  struct run *head, **tail;
+  uint64 n, first, last, i;
+  int c;
+
+  if((c = __sync_fetch_and_add(&kchunk, 1)) >= NKCHUNK)
+    return 0;
+  n = knpages();
+  first = n * c / NKCHUNK;
+  last = n * (c + 1) / NKCHUNK;
+  if(first == last)
+    return 1;
+  head = 0;
+  tail = &head;
+  for(i = first; i < last; i++){
+    struct run *r = (struct run*)(pgbase + i * PGSIZE);
+    pgref[PA2REF(r)] = 0;
+    *tail = r;
+    tail = &r->next;
+  }
+
+  push_off();
+  struct kmem *km = &kmem[cpuid()];
+  acquire(&km->lock);
+  *tail = km->freelist;
+  km->freelist = head;
+  km->nfree += last - first;
+  release(&km->lock);
+  pop_off();
+  return 1;
+}
+
+// Free all the boot-time chunks not freed yet.
 void
-freerange(void *pa_start, void *pa_end)
+kinithart(void)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(kfreechunk())
+    ;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
 void
 kfree(void *pa)
 {
   struct run *r;
+  int n;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < pgbase || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((n = __sync_sub_and_fetch(&pgref[PA2REF(pa)], 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+  __sync_fetch_and_sub(&ntag[pgtag[PA2REF(pa)]], 1);
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  struct kmem *km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+  pop_off();
 }
 
-// Allocate one 4096-byte page of physical memory.
+// Account for page r, just allocated, to tag and to the
+// process running, and trace it.
+static void*
+allocated(struct run *r, int tag)
+{
+  struct proc *p;
+
+  pgtag[PA2REF(r)] = tag;
+  __sync_fetch_and_add(&ntag[tag], 1);
+  if((p = myproc()) != 0)
+    p->ru.npages++;
+  TRACE(TR_KALLOC, r, 0);
+  return (void*)r;
+}
+
+// Allocate one 4096-byte page of physical memory, for
+// the use tag names (MT_USER, ...).
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *
-kalloc(void)
+kalloc(int tag)
 {
   struct run *r;
+  int id, i;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+ again:
+  push_off();
+  id = cpuid();
+  // try this CPU's list first, then steal from the others.
+  for(i = 0; i < NCPU; i++){
+    struct kmem *km = &kmem[(id + i) % NCPU];
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
+    if(r)
+      break;
+  }
+  pop_off();
 
-  if(r)
+  // during boot, some of memory may not be free yet.
+  if(r == 0 && kfreechunk())
+    goto again;
+  if(r == 0 && (r = zpop()) != 0)
+    return allocated(r, tag);  // out of memory but for the zero pool
+  // the page cache grows into free memory; shrink it.
+  if(r == 0 && pcreclaim() > 0)
+    goto again;
+  // and have swapd page some user memory out, for next time.
+  if(r == 0)
+    swapkick();
+  if(r){
+    pgref[PA2REF(r)] = 1;
+#ifdef KALLOC_DEBUG
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+    allocated(r, tag);
+  }
+  return (void*)r;
+}
+
+// Allocate one zeroed page, as kalloc() does.
+void *
+kzalloc(int tag)
+{
+  struct run *r;
+
+  if((r = zpop()) != 0)
+    return allocated(r, tag);
+  if((r = kalloc(tag)) != 0)
+    memset(r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Take a page from the zero pool, or return 0 if empty.
+static struct run*
+zpop(void)
+{
+  struct run *r;
+  int low;
+
+  acquire(&kzero.lock);
+  if((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  // kzero sleeps only once the pool is full; wake it as
+  // the pool drops below half.
+  low = r != 0 && kzero.n == NZEROPAGES/2 - 1;
+  release(&kzero.lock);
+  if(low)
+    wakeup(&kzero);
+  if(r){
+    r->next = 0;
+    __sync_fetch_and_sub(&ntag[MT_ZERO], 1);  // allocated() retags it
+  }
+  return r;
+}
+
+// The kzero kernel process: keep the zero pool full,
+// at batch priority, so that it mostly uses idle time.
+void
+kzerod(void)
+{
+  struct proc *p = myproc();
+  struct run *r;
+
+  acquire(&p->lock);
+  p->prio = PRIO_BATCH;
+  release(&p->lock);
+
+  for(;;){
+    acquire(&kzero.lock);
+    while(kzero.n >= NZEROPAGES)
+      sleep(&kzero, &kzero.lock);
+    release(&kzero.lock);
+
+    if((r = kalloc(MT_ZERO)) == 0){
+      // out of memory: try again in a while.
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+      continue;
+    }
+    memset(r, 0, PGSIZE);
+
+    acquire(&kzero.lock);
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    release(&kzero.lock);
+  }
+}
+
+// Add a reference to an allocated page, which one
+// more kfree() will then be needed to release.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < pgbase || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&pgref[PA2REF(pa)], 1) < 1)
+    panic("kdup: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return pgref[PA2REF(pa)];
+}
+
+// Allocate n bytes of kernel memory, for objects
+// smaller than a page. Returns 0 if the memory
+// cannot be allocated.
+void *
+kmalloc(uint64 n)
+{
+  return bd_malloc(n);
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *p)
+{
+  bd_free(p);
+}
+
+// Count the free pages, on all CPUs' lists.
+uint64
+kfreepages(void)
+{
+  uint64 n;
+  int i;
+
+  n = 0;
+  for(i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;  // a snapshot; no need to lock
+  return n;
+}
+
+// memstat(struct memstat *ms): copy out how much physical
+// memory there is, how much is free, and what the rest is
+// being used for.
+uint64
+sys_memstat(void)
+{
+  struct memstat ms;
+  uint64 addr;
+  int i;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&ms, 0, sizeof(ms));
+  ms.total = knpages();
+  ms.free = kfreepages();
+  for(i = 0; i < NMTAG; i++)
+    ms.used[i] = ntag[i];
+  ms.heap = pgbase - end;
+  ms.heapused = bd_used();
+  swapstat(&ms);
+  return copyout(myproc()->pagetable, addr, (char*)&ms, sizeof(ms));
+}
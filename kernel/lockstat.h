@@ -0,0 +1,17 @@
+#define LS_SPIN   1   // a spinlock
+#define LS_SLEEP  2   // a sleeplock
+
+#define LSNAME 16
+
+// One lock's statistics, as copied out by lockstat().
+// Times are in r_time() ticks, 10,000,000 a second on qemu.
+struct lockstat {
+  char name[LSNAME];
+  int id;          // unique, in order of initialization
+  short kind;      // LS_SPIN or LS_SLEEP
+  short cpu;       // cpu that last acquired it
+  uint64 nacquire; // acquisitions
+  uint64 ncontend; // spins (spinlock) or sleeps (sleeplock) waiting for it
+  uint64 holdtot;  // total time held
+  uint64 holdmax;  // longest time held
+};
@@ -4,8 +4,10 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "trace.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +23,22 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Commits are grouped: when the last outstanding FS system
+// call ends, the transaction stays open for later calls to
+// join, unless it is close to filling the log. The logflush
+// kernel process commits open transactions once a tick, and
+// log_force() (fsync()) commits at once for callers that need
+// their updates durable before going on.
+//
+// A commit writes the log and its header and returns; the
+// loginstall kernel process then copies the blocks home and
+// clears the header, while the next transaction fills up in
+// the buffer cache. That one's commit waits for the install,
+// since it reuses the log. Installs write the log's copies,
+// through buffers of their own, not the cached home blocks,
+// which the open transaction may have changed since; those
+// stay pinned until installed.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -29,58 +47,144 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The header carries a checksum of the block numbers and
+// contents, so the header and blocks go out together, and a
+// transaction whose write didn't finish fails the check at
+// recovery and is ignored. Nothing clears the header after
+// an install: installing a transaction again does no harm,
+// and the next commit, which waits for the install, replaces
+// it.
+//
+// The in-memory /tmp (TMPDEV) has no log: its operations
+// need no transaction, and log_write() writes its blocks
+// straight to the RAM disk.
+
+// The most blocks a log can hold: as many block numbers
+// as fit in the header block.
+#define MAXLOGBLOCKS (BSIZE/sizeof(int) - 2)
+
+// log_write() finds blocks already in the transaction here.
+#define LOGHASH 512
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint sum;        // logsum() of the n blocks, summed
+  int block[MAXLOGBLOCKS];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // blocks a transaction may log, from the superblock.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by begin_opn() for them.
   int committing;  // in commit(), please wait.
+  int installing;  // loginstall has a committed transaction to install.
   int dev;
   struct logheader lh;
+  short hash[LOGHASH];   // index+1 in lh.block[], by block number
+  struct logheader ilh;  // the transaction being installed
+  struct buf ibuf[MAXSGBLOCKS];  // install_trans() writes home through these
 };
 struct log log[NDISK];
 
+// committed transactions loginstall hasn't installed yet.
+struct {
+  struct spinlock lock;
+  int n;
+} installq;
+
 static void recover_from_log(int);
 static void commit(int);
+static void commit_locked(int);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log[dev].lock, "log");
+  if(installq.lock.name == 0)
+    initlock(&installq.lock, "installq");
+  for(int i = 0; i < MAXSGBLOCKS; i++)
+    initsleeplock(&log[dev].ibuf[i].lock, "logibuf");
   log[dev].start = sb->logstart;
   log[dev].size = sb->nlog;
+  log[dev].cap = sb->nlog - 1;  // less the header block
+  if(log[dev].cap > MAXLOGBLOCKS)
+    log[dev].cap = MAXLOGBLOCKS;
+  if(log[dev].cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log[dev].dev = dev;
   recover_from_log(dev);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Blocks are installed in block-number order, so each run of
+// consecutive home blocks goes to the disk as one request.
+// The writes go through log[dev].ibuf[], pointing at the log
+// blocks' data, so the cached home blocks are left alone;
+// after a commit (not recovery) they are unpinned.
 static void
-install_trans(int dev)
+install_trans(int dev, struct logheader *lh, int recovering)
 {
-  int tail;
+  struct buf *lbuf[MAXSGBLOCKS], *ib[MAXSGBLOCKS], *dbuf;
+  int order[MAXLOGBLOCKS];
+  int i, j, k, n;
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *lbuf = bread(dev, log[dev].start+tail+1); // read log block
-    struct buf *dbuf = bread(dev, log[dev].lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  n = lh->n;
+  for (i = 0; i < n; i++) {
+    for (j = i; j > 0 && lh->block[order[j-1]] > lh->block[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  for (i = 0; i < n; i += k) {
+    for (k = 0; i+k < n && k < MAXSGBLOCKS; k++) {
+      int tail = order[i+k];
+      if (k > 0 && lh->block[tail] != ib[k-1]->blockno + 1)
+        break;
+      lbuf[k] = bread(dev, log[dev].start+tail+1); // read log block
+      ib[k] = &log[dev].ibuf[k];
+      acquiresleep(&ib[k]->lock);
+      ib[k]->dev = dev;
+      ib[k]->blockno = lh->block[tail];
+      ib[k]->data = lbuf[k]->data;
+    }
+    bstartv(ib, k, 1);  // write dst run to disk
+    for (j = 0; j < k; j++) {
+      bwait(ib[j]);
+      releasesleep(&ib[j]->lock);
+      brelse(lbuf[j]);
+      if (!recovering) {
+        dbuf = bread(dev, ib[j]->blockno);
+        bunpin(dbuf);
+        brelse(dbuf);
+      }
+    }
   }
 }
 
+// Checksum of entry i of a transaction, block blockno
+// with contents data: FNV-1a over 32-bit words.
+static uint
+logsum(int i, uint blockno, uchar *data)
+{
+  uint h = 2166136261U;
+  int j;
+
+  h = (h ^ i) * 16777619;
+  h = (h ^ blockno) * 16777619;
+  for (j = 0; j < BSIZE; j += sizeof(uint))
+    h = (h ^ *(uint*)(data + j)) * 16777619;
+  return h;
+}
+
 // Read the log header from disk into the in-memory log header
 static void
 read_head(int dev)
@@ -89,51 +193,96 @@ read_head(int dev)
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log[dev].lh.n = lh->n;
+  log[dev].lh.sum = lh->sum;
+  if (log[dev].lh.n < 0 || log[dev].lh.n > log[dev].cap)
+    log[dev].lh.n = 0;  // never a header we wrote
   for (i = 0; i < log[dev].lh.n; i++) {
     log[dev].lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Copy lh into the header block, whose buffer is locked.
 static void
-write_head(int dev)
+fill_head(struct buf *buf, struct logheader *lh)
 {
-  struct buf *buf = bread(dev, log[dev].start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log[dev].lh.n;
-  for (i = 0; i < log[dev].lh.n; i++) {
-    hb->block[i] = log[dev].lh.block[i];
+  hb->n = lh->n;
+  hb->sum = lh->sum;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
+}
+
+// Write in-memory log header to disk.
+static void
+write_head(int dev, struct logheader *lh)
+{
+  struct buf *buf = bread(dev, log[dev].start);
+  fill_head(buf, lh);
   bwrite(buf);
   brelse(buf);
 }
 
+// Do the log blocks on disk match the header's checksum?
+static int
+check_log(int dev)
+{
+  struct logheader *lh = &log[dev].lh;
+  struct buf *lbuf;
+  uint sum;
+  int i;
+
+  sum = lh->n * 16777619;
+  for (i = 0; i < lh->n; i++) {
+    lbuf = bread(dev, log[dev].start+i+1);
+    sum += logsum(i, lh->block[i], lbuf->data);
+    brelse(lbuf);
+  }
+  return sum == lh->sum;
+}
+
 static void
 recover_from_log(int dev)
 {
   read_head(dev);
-  install_trans(dev); // if committed, copy from log to disk
+  if (check_log(dev))
+    install_trans(dev, &log[dev].lh, 1); // if committed, copy from log to disk
   log[dev].lh.n = 0;
-  write_head(dev); // clear the log
+  write_head(dev, &log[dev].lh); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(int dev)
 {
+  begin_opn(dev, MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that writes
+// at most n distinct blocks, instead of begin_op(), so
+// that small calls reserve less of the log, and the page
+// cache's flusher can reserve more.
+void
+begin_opn(int dev, int n)
+{
+  if(dev == TMPDEV)
+    return;
+  if(n < 1 || n > log[dev].cap)
+    panic("begin_opn");
   acquire(&log[dev].lock);
   while(1){
     if(log[dev].committing){
       sleep(&log, &log[dev].lock);
-    } else if(log[dev].lh.n + (log[dev].outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log[dev].lh.n + log[dev].reserved + n > log[dev].cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log[dev].lock);
     } else {
       log[dev].outstanding += 1;
+      log[dev].reserved += n;
+      myproc()->logres = n;
+      TRACE(TR_BEGINOP, dev, log[dev].outstanding);
       release(&log[dev].lock);
       break;
     }
@@ -145,47 +294,117 @@ begin_op(int dev)
 void
 end_op(int dev)
 {
-  int do_commit = 0;
-
+  if(dev == TMPDEV)
+    return;
   acquire(&log[dev].lock);
   log[dev].outstanding -= 1;
+  log[dev].reserved -= myproc()->logres;
+  TRACE(TR_ENDOP, dev, log[dev].outstanding);
   if(log[dev].committing)
     panic("log[dev].committing");
-  if(log[dev].outstanding == 0){
-    do_commit = 1;
-    log[dev].committing = 1;
+  if(log[dev].outstanding == 0 && log[dev].lh.n + MAXOPBLOCKS > log[dev].cap){
+    // no room for another op to join; commit now.
+    commit_locked(dev);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log[dev].outstanding has decreased
-    // the amount of reserved space.
+    // the amount of reserved space. log_force() may be
+    // waiting for outstanding to reach zero.
     wakeup(&log);
   }
   release(&log[dev].lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit(dev);
-    acquire(&log[dev].lock);
-    log[dev].committing = 0;
-    wakeup(&log);
-    release(&log[dev].lock);
+// Commit the open transaction, which no FS system call is
+// in. Called and returns with log[dev].lock held.
+static void
+commit_locked(int dev)
+{
+  log[dev].committing = 1;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log[dev].lock);
+  commit(dev);
+  acquire(&log[dev].lock);
+  log[dev].committing = 0;
+  wakeup(&log);
+}
+
+// Make every FS system call on dev that has finished durable,
+// committing the open transaction without waiting for logflush.
+void
+log_force(int dev)
+{
+  if(dev == TMPDEV)
+    return;
+  acquire(&log[dev].lock);
+  while(log[dev].committing || log[dev].outstanding > 0)
+    sleep(&log, &log[dev].lock);
+  if(log[dev].lh.n > 0)
+    commit_locked(dev);
+  release(&log[dev].lock);
+}
+
+// Body of the logflush kernel process: once a tick, commit
+// each device's open transaction if no FS system call is in it.
+void
+logflush(void)
+{
+  int dev;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(dev = 0; dev < NDISK; dev++){
+      if(log[dev].size == 0)
+        continue;  // not mounted
+      acquire(&log[dev].lock);
+      if(log[dev].lh.n > 0 && log[dev].outstanding == 0 && !log[dev].committing)
+        commit_locked(dev);
+      release(&log[dev].lock);
+    }
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, and write the
+// header with their checksum; once it is all on disk, the
+// transaction has committed. The header and log blocks are
+// consecutive, so they are written MAXSGBLOCKS at a time in
+// one disk request each, last first, so that the checksum
+// is ready by the time the header goes.
 static void
 write_log(int dev)
 {
-  int tail;
+  struct logheader *lh = &log[dev].lh;
+  struct buf *to[MAXSGBLOCKS];
+  int first, i, k, pos;
+  uint sum;
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *to = bread(dev, log[dev].start+tail+1); // log block
-    struct buf *from = bread(dev, log[dev].lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  sum = lh->n * 16777619;
+  for (first = (lh->n / MAXSGBLOCKS) * MAXSGBLOCKS; first >= 0; first -= MAXSGBLOCKS) {
+    k = lh->n + 1 - first;
+    if (k > MAXSGBLOCKS)
+      k = MAXSGBLOCKS;
+    for (i = k-1; i >= 0; i--) {
+      pos = first + i;  // 0 is the header, pos the log block for entry pos-1
+      to[i] = bread(dev, log[dev].start+pos);
+      if (pos == 0) {
+        lh->sum = sum;
+        fill_head(to[i], lh);
+        continue;
+      }
+      struct buf *from = bread(dev, lh->block[pos-1]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+      sum += logsum(pos-1, lh->block[pos-1], to[i]->data);
+    }
+    bstartv(to, k, 1);  // write the log
+    for (i = 0; i < k; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
   }
 }
 
@@ -193,11 +412,54 @@ static void
 commit(int dev)
 {
   if (log[dev].lh.n > 0) {
-    write_log(dev);     // Write modified blocks from cache to log
-    write_head(dev);    // Write header to disk -- the real commit
-    install_trans(dev); // Now install writes to home locations
+    // the last transaction must be out of the log.
+    acquire(&log[dev].lock);
+    while(log[dev].installing)
+      sleep(&log, &log[dev].lock);
+    release(&log[dev].lock);
+
+    write_log(dev);     // Write blocks and header to the log -- the real commit
+
+    // hand it to loginstall, which writes the blocks home.
+    log[dev].ilh = log[dev].lh;
     log[dev].lh.n = 0;
-    write_head(dev);    // Erase the transaction from the log
+    memset(log[dev].hash, 0, sizeof(log[dev].hash));
+    acquire(&log[dev].lock);
+    log[dev].installing = 1;
+    release(&log[dev].lock);
+    acquire(&installq.lock);
+    installq.n++;
+    wakeup(&installq);
+    release(&installq.lock);
+  }
+}
+
+// Body of the loginstall kernel process: copy committed
+// transactions' blocks home, then free the log for the next.
+void
+loginstall(void)
+{
+  int dev;
+
+  for(;;){
+    acquire(&installq.lock);
+    while(installq.n == 0)
+      sleep(&installq, &installq.lock);
+    release(&installq.lock);
+
+    for(dev = 0; dev < NDISK; dev++){
+      if(log[dev].size == 0 || !log[dev].installing)
+        continue;
+      install_trans(dev, &log[dev].ilh, 0);
+
+      acquire(&log[dev].lock);
+      log[dev].installing = 0;
+      wakeup(&log);
+      release(&log[dev].lock);
+      acquire(&installq.lock);
+      installq.n--;
+      release(&installq.lock);
+    }
   }
 }
 
@@ -213,23 +475,27 @@ commit(int dev)
 void
 log_write(struct buf *b)
 {
-  int i;
+  int h, i;
 
   int dev = b->dev;
-  if (log[dev].lh.n >= LOGSIZE || log[dev].lh.n >= log[dev].size - 1)
+  if (dev == TMPDEV) {
+    bwrite(b);
+    return;
+  }
+  if (log[dev].lh.n >= log[dev].cap)
     panic("too big a transaction");
   if (log[dev].outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log[dev].lock);
-  for (i = 0; i < log[dev].lh.n; i++) {
-    if (log[dev].lh.block[i] == b->blockno)   // log absorbtion
-      break;
-  }
-  log[dev].lh.block[i] = b->blockno;
-  if (i == log[dev].lh.n) {  // Add new block to log?
+  h = b->blockno % LOGHASH;
+  while ((i = log[dev].hash[h]) != 0 && log[dev].lh.block[i-1] != b->blockno)
+    h = (h + 1) % LOGHASH;
+  if (i == 0) {  // Add new block to log? Otherwise log absorbtion
+    i = log[dev].lh.n++;
+    log[dev].lh.block[i] = b->blockno;
+    log[dev].hash[h] = i + 1;
     bpin(b);
-    log[dev].lh.n++;
   }
   release(&log[dev].lock);
 }
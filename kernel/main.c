@@ -9,6 +9,7 @@
 #include "defs.h"
 
 volatile static int started = 0;
+volatile static int kinited = 0;
 
 // start() jumps here in supervisor mode on all CPUs.
 void
@@ -21,21 +22,36 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    __sync_synchronize();
+    kinited = 1;     // let the other harts free memory meanwhile
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex wait queues
+    pollinit();      // poll() wakeups
+    shminit();       // shared memory segments
+    swapinit();      // swap area
+    profinit();      // profiler sample buffers
+    traceinit();     // trace event reader
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
-    fileinit();      // file table
-    virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
+    pcinit();        // page cache
+    for(int n = 0; n < NDISK; n++)
+      virtio_disk_init(n); // emulated hard disks
+    ramdiskinit();   // memory for /tmp
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
+    kinithart();     // the rest of memory
   } else {
+    while(kinited == 0)
+      ;
+    __sync_synchronize();
+    kinithart();      // help free memory
     while(started == 0)
       ;
     __sync_synchronize();
@@ -14,7 +14,8 @@
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
-// end -- start of kernel page allocation area
+// end -- kmalloc() heap, managed by the buddy allocator
+// end+KMHEAPSIZE -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
@@ -28,9 +29,18 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// the kernel reaches the CLINT in supervisor mode here, a
+// gigabyte up: the CLINT lies below USERTOP, in the gigabyte
+// a process's kernel page table shares with user memory.
+#define KCLINT (CLINT + (1L << 30))
+#define KCLINT_MSIP(hartid) (KCLINT + 4*(hartid))
+#define KCLINT_MTIMECMP(hartid) (KCLINT + 0x4000 + 8*(hartid))
+#define KCLINT_MTIME (KCLINT + 0xBFF8)
+
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -48,6 +58,10 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// bytes just after the kernel's data handed to the buddy
+// allocator for kmalloc()'s sub-page objects.
+#define KMHEAPSIZE (1024*1024)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -61,8 +75,20 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to USERTOP
 //   ...
+//   mmap() regions, down to MMAPBOTTOM
+//   TIMEPAGE (read-only, see timepage.h)
+//   trapframes of the other threads, TFTHREAD(NTHREAD-1) .. TFTHREAD(1)
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TFTHREAD(i) (TRAPFRAME - (i)*PGSIZE)
+#define TIMEPAGE TFTHREAD(NTHREAD)
+
+// A process's kernel page table shares the first gigabyte
+// of its user page table, which holds the kernel's device
+// mappings above PLIC (see kvmcreate()). So the heap must
+// end below PLIC, and mmap() must stay out of that gigabyte.
+#define USERTOP PLIC
+#define MMAPBOTTOM (1L << 30)
@@ -0,0 +1,21 @@
+// What each allocated page is for, as given to kalloc().
+#define MT_KERNEL  0   // anything not below
+#define MT_USER    1   // user memory
+#define MT_PGTBL   2   // page-table pages
+#define MT_KSTACK  3   // kernel stacks
+#define MT_PIPE    4   // pipe buffers
+#define MT_BUF     5   // buffer cache
+#define MT_PCACHE  6   // page cache
+#define MT_ZERO    7   // the pre-zeroed pool
+#define NMTAG      8
+
+// Physical memory, in pages, as copied out by memstat().
+struct memstat {
+  uint64 total;        // pages the page allocator manages
+  uint64 free;         // on its free lists
+  uint64 used[NMTAG];  // allocated, by tag
+  uint64 heap;         // bytes of the kmalloc() heap
+  uint64 heapused;     // of which allocated
+  uint64 swap;         // pages of swap
+  uint64 swapused;     // of which holding user pages
+};
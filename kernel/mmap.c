@@ -0,0 +1,367 @@
+//
+// Memory-mapped files: mmap() and munmap().
+//
+// Each process has a small table of VMAs (struct vma in
+// proc.h) describing its mapped regions. mmap() only records
+// the region; mmap_fault() maps pages from the page cache
+// on first touch. MAP_SHARED pages that the
+// process dirtied are written back to the file, through the
+// log, when they are unmapped. A shared memory segment's
+// descriptor maps the segment's own pages (see shm.c).
+//
+// Threads share their leader's table (p->mm). Its vmlock
+// covers the table and the page table; vmalock serializes
+// mmap() and munmap(), which sleep while writing back.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "memstat.h"
+
+// mappings go below the clock page and the threads' trapframes.
+#define MMAPTOP TIMEPAGE
+
+// Does any of p's mappings overlap [start, end)?
+// Caller must hold p->vmlock.
+int
+mmap_inrange(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && start < v->addr + v->len && v->addr < end)
+      return 1;
+  }
+  return 0;
+}
+
+static struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Write the mapped page at va, whose physical address is
+// pa, back to v's file. Only bytes inside the current file
+// size are written; mmap() never extends a file.
+static void
+mmap_writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  // same per-transaction limit as filewrite().
+  int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
+  int i, n1;
+
+  for(i = 0; i < PGSIZE; i += n1){
+    n1 = PGSIZE - i;
+    if(n1 > max)
+      n1 = max;
+    begin_op(ip->dev);
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op(ip->dev);
+      break;
+    }
+    if(off + i + n1 > ip->size)
+      n1 = ip->size - (off + i);
+    writei(ip, 0, pa + i, off + i, n1);
+    iunlock(ip);
+    end_op(ip->dev);
+  }
+}
+
+// Remove p's mappings of [va, va+len), all of which lie in v,
+// writing back dirty MAP_SHARED pages first. Either v is no longer
+// in p's table or p has no other threads, so no thread can
+// page the range back in meanwhile.
+static void
+mmap_unmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;  // never touched
+    if((v->flags & MAP_SHARED) && (*pte & PTE_D) && v->f->type == FD_INODE)
+      mmap_writeback(v, a, PTE2PA(*pte));
+  }
+  uvmunmapmm(p, va, len);
+}
+
+// Page in the mapped page containing va for process p,
+// the owner of the current process's address space.
+// Returns 0 on success, -1 if va is not mapped with the
+// needed permission or memory ran out.
+int
+mmap_fault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  struct file *f;
+  pte_t *pte;
+  char *mem, *sh;
+  uint off;
+  int perm, r, shared;
+
+  va = PGROUNDDOWN(va);
+  acquire(&p->vmlock);
+  if((v = vmalookup(p, va)) == 0 || (write && (v->prot & PROT_WRITE) == 0)){
+    release(&p->vmlock);
+    return -1;
+  }
+  f = filedup(v->f);
+  off = v->off + (va - v->addr);
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  shared = (v->flags & MAP_SHARED) != 0;
+  release(&p->vmlock);
+
+  if(f->type == FD_SHM){
+    // every process maps the segment's page itself.
+    mem = shmpage(f->shm, off / PGSIZE);
+  } else {
+    // a private mapping maps the page cache's page, read-only
+    // or copy-on-write; a shared one needs its own copy, since
+    // it is written back only when unmapped.
+    ilock(f->ip);
+    mem = pcget(f->ip, off / PGSIZE, 0);
+    iunlock(f->ip);
+    if(mem && shared){
+      if((sh = kalloc(MT_USER)) != 0)
+        memmove(sh, mem, PGSIZE);
+      kfree(mem);
+      mem = sh;
+    } else if(perm & PTE_W){
+      perm = (perm & ~PTE_W) | PTE_COW;
+    }
+  }
+  if(mem == 0){
+    fileclose(f);
+    return -1;
+  }
+
+  // another thread may have changed the mapping, or paged
+  // va in too, while we read.
+  r = -1;
+  acquire(&p->vmlock);
+  v = vmalookup(p, va);
+  if(v != 0 && v->f == f && v->off + (va - v->addr) == off){
+    if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+      r = 0;
+    else if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) == 0){
+      mem = 0;
+      r = 0;
+    }
+  }
+  release(&p->vmlock);
+  if(mem)
+    kfree(mem);
+  fileclose(f);
+  return r;
+}
+
+// Give child np copies of p's mappings.
+// Pages p has already faulted in are shared with np:
+// MAP_SHARED pages stay writable in both, MAP_PRIVATE
+// ones become copy-on-write.
+// Returns 0 on success, -1 on failure.
+int
+mmap_fork(struct proc *p, struct proc *np)
+{
+  int i, r = 0;
+
+  acquire(&p->vmlock);
+  for(i = 0; i < NVMA; i++){
+    if(!p->vma[i].used)
+      continue;
+    np->vma[i] = p->vma[i];
+    filedup(np->vma[i].f);
+    if(uvmshare(p->pagetable, np->pagetable, p->vma[i].addr, p->vma[i].len,
+                (p->vma[i].flags & MAP_PRIVATE) != 0) < 0){
+      r = -1;
+      break;
+    }
+  }
+  release(&p->vmlock);
+  return r;
+}
+
+// Remove all of p's mappings, as exit() and exec() need.
+// p has no other threads by now.
+void
+mmap_exit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    mmap_unmap(p, v, v->addr, v->len);
+    fileclose(v->f);
+    v->used = 0;
+  }
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, fd, off;
+  struct file *f;
+  struct proc *p = myproc();
+  struct proc *mm = p->mm;
+  struct vma *v, *free;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(fd < 0 || fd >= p->nofile || (f = p->ofile[fd]) == 0)
+    return -1;
+  if((f->type != FD_INODE && f->type != FD_SHM) || len == 0 || off < 0 ||
+     off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  // a segment is only shared, and has a fixed size.
+  if(f->type == FD_SHM &&
+     ((flags & MAP_PRIVATE) || off + PGROUNDUP(len) > shmsize(f->shm)))
+    return -1;
+  if(!f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)
+    return -1;
+  len = PGROUNDUP(len);
+  if(len > MMAPTOP)
+    return -1;
+
+  // an munmap() in another thread may still be clearing
+  // out a range that looks free in the table.
+  acquiresleep(&mm->vmalock);
+  acquire(&mm->vmlock);
+  free = 0;
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(!v->used){
+      free = v;
+      break;
+    }
+  }
+  if(free == 0)
+    goto bad;
+
+  // ignore the address hint; place the mapping in the
+  // highest gap below the thread trapframes that fits.
+  addr = MMAPTOP - len;
+  for(;;){
+    for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+      if(v->used && addr < v->addr + v->len && v->addr < addr + len)
+        break;
+    if(v == &mm->vma[NVMA])
+      break;
+    if(v->addr < len)
+      goto bad;
+    addr = v->addr - len;
+  }
+  if(addr < PGROUNDUP(mm->sz) || addr < MMAPBOTTOM)
+    goto bad;
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->off = off;
+  free->f = filedup(f);
+  free->used = 1;
+  release(&mm->vmlock);
+  releasesleep(&mm->vmalock);
+  return addr;
+
+ bad:
+  release(&mm->vmlock);
+  releasesleep(&mm->vmalock);
+  return -1;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len, end;
+  struct proc *mm = myproc()->mm;
+  struct vma *v, *nv, old;
+  int whole = 0;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  end = addr + len;
+
+  // take the range out of the table first, then unmap it
+  // without vmlock, since write-back sleeps.
+  acquiresleep(&mm->vmalock);
+  acquire(&mm->vmlock);
+  if((v = vmalookup(mm, addr)) == 0 || end > v->addr + v->len)
+    goto bad;
+  old = *v;
+
+  if(addr == v->addr && end == v->addr + v->len){
+    // the whole region.
+    v->used = 0;
+    whole = 1;
+  } else if(addr == v->addr){
+    // a prefix.
+    v->addr += len;
+    v->off += len;
+    v->len -= len;
+  } else if(end == v->addr + v->len){
+    // a suffix.
+    v->len -= len;
+  } else {
+    // a hole in the middle: split v in two.
+    for(nv = mm->vma; nv < &mm->vma[NVMA]; nv++)
+      if(!nv->used)
+        break;
+    if(nv == &mm->vma[NVMA])
+      goto bad;
+    *nv = *v;
+    nv->addr = end;
+    nv->off = v->off + (end - v->addr);
+    nv->len = v->addr + v->len - end;
+    filedup(nv->f);
+    v->len = addr - v->addr;
+  }
+  release(&mm->vmlock);
+
+  mmap_unmap(mm, &old, addr, len);
+  if(whole)
+    fileclose(old.f);
+  releasesleep(&mm->vmalock);
+  return 0;
+
+ bad:
+  release(&mm->vmlock);
+  releasesleep(&mm->vmalock);
+  return -1;
+}
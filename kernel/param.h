@@ -1,14 +1,41 @@
-#define NPROC        10  // maximum number of processes
+#define NPROC        10  // min processes (the table is sized from memory at boot)
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // initial open files per process
+#define MAXOFILE   1024  // max open files per process (NOFILE times a power of 2)
+#define NFILE       100  // open files per system (soft; file structs are kmalloc()ed)
+#define NINODE       50  // cached i-nodes before unused ones are recycled (soft)
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       0  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define MAXSPAWNACT  32  // max spawn() file actions
+#define MAXIOV       64  // max readv()/writev() buffers
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*10) // size of the on-disk log mkfs makes
+#define MAXSGBLOCKS  8   // max blocks in one disk request
+#define NBUF         (LOGSIZE+MAXSGBLOCKS)  // min size of disk block cache
+#define FSSIZE       100000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define NDISK        2
+#define NDISK        2   // virtio disks the root device is striped across
+#define STRIPE       4   // blocks on one disk before the next, see bio.c
+#define TMPDEV       NDISK   // device number of the in-memory /tmp
+#define SWAPDISK     1       // virtio disk whose swap area follows its share of the file system
+#define NSWAP        65536   // blocks of swap, see swap.c
+#define TMPSIZE      16384   // size of /tmp in blocks (memory is used as written)
+#define TMPINODES    1024    // inodes in /tmp
+#define NMOUNT       4       // mounted file systems, see mount()
+#define NVMA         16  // mmap()ed regions per process
+#define NSHM         16  // shared memory segments, see shm_open()
+#define SHMPAGES   1024  // max pages per segment
+#define SHMNAME      16  // segment name length, with the null
+#define NEXECSEG     4   // loadable segments per program, see exec()
+#define NTHREAD      16  // max threads per process, see clone()
+#define PIPEPAGES     4  // max pages buffered per pipe (power of 2)
+#define MAXRAHEAD     8  // max blocks read ahead of a sequential reader
+#define BALLOCRUN     8  // free blocks balloc() wants when it starts a new run
+#define NPRIO         2  // scheduling classes, see setprio()
+#define PRIO_NORMAL   0  //   interactive; runs first
+#define PRIO_BATCH    1  //   background jobs
+#define PRIOSHARE     8  // a waiting lower class gets one in this many picks
+#define NZEROPAGES   64  // pre-zeroed pages kept for kzalloc()
+#define NKSTACKPOOL  16  // freed kernel stacks kept for reuse
+#define NSYSCALL     64  // system call numbers with statistics, see sysstat()
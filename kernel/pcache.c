@@ -0,0 +1,474 @@
+//
+// Page cache: whole pages of regular files' contents, beside
+// the buffer cache, which keeps the file system's metadata.
+//
+// readi() copies file data out of here, reading pages in from
+// the buffer cache on a miss; exec() and mmap() map the cached
+// pages themselves, read-only or copy-on-write. A cached page
+// holds one reference of its own (kdup()), and each page table
+// mapping it holds another. Truncating a file drops its pages;
+// processes that have one mapped keep the old contents.
+//
+// writei() copies regular files' data in here and marks the
+// pages dirty, without allocating blocks or logging anything.
+// ip->size counts the dirty pages, ip->dsize only what is on
+// disk. The pcflush kernel process writes each dirty inode's
+// pages out once a tick, FLUSHPAGES to a transaction, lowest
+// first, so that everything below dsize is always on disk.
+// fsync() flushes the file at once, and a writer that finds
+// too much of memory dirty flushes its own file.
+//
+// The cache has no fixed size: it keeps whatever it has read
+// until kalloc() runs out of pages and calls pcreclaim(), which
+// frees the least recently used clean pages nobody has mapped.
+//
+// One spinlock covers the hash table, each inode's list of its
+// pages (ip->pages), the LRU list and the dirty list. Callers
+// of pcget() hold the inode's sleeplock, so that pages are
+// filled from a stable inode; nothing under pcache.lock
+// allocates memory. An inode on the dirty list holds a
+// reference, so it stays in the icache until flushed.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define NPCBUCKET 1021
+#define NRECLAIM 32   // pages pcreclaim() frees at a time
+#define FLUSHPAGES 16 // pages pcflush() writes per transaction
+// the data, the inode, up to four indirect and two bitmap blocks.
+#define FLUSHOPBLOCKS (FLUSHPAGES*(PGSIZE/BSIZE) + 7)
+
+struct cpage {
+  struct inode *ip;
+  uint pgno;            // file offset / PGSIZE
+  char *pa;
+  int dirty;            // newer than the disk
+  struct cpage *hnext, **hprev;   // hash chain
+  struct cpage *inext, **iprev;   // ip->pages
+  struct cpage *next, *prev;      // LRU list, newest first
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage *bucket[NPCBUCKET];
+  struct cpage lru;     // list head
+  int n;                // pages cached
+  struct inode *dirty;  // inodes with dirty pages, through dnext
+  int ndirty;           // dirty pages
+  int maxdirty;         // writers flush their own files past this
+} pcache;
+
+static inline struct cpage**
+pchash(struct inode *ip, uint pgno)
+{
+  return &pcache.bucket[((uint64)ip / sizeof(*ip) ^ pgno) % NPCBUCKET];
+}
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.next = pcache.lru.prev = &pcache.lru;
+  pcache.maxdirty = knpages() / 4;
+}
+
+// Take cp out of the cache. Caller must hold pcache.lock,
+// and kfree() cp->pa and kmfree() cp after releasing it.
+static void
+pcunlink(struct cpage *cp)
+{
+  if((*cp->hprev = cp->hnext) != 0)
+    cp->hnext->hprev = cp->hprev;
+  if((*cp->iprev = cp->inext) != 0)
+    cp->inext->iprev = cp->iprev;
+  cp->next->prev = cp->prev;
+  cp->prev->next = cp->next;
+  pcache.n--;
+  if(cp->dirty){
+    cp->ip->ndirty--;
+    pcache.ndirty--;
+  }
+}
+
+// Free a list of pages, linked through next, that
+// pcunlink() took out of the cache.
+static void
+pcfree(struct cpage *cp)
+{
+  struct cpage *next;
+
+  for(; cp; cp = next){
+    next = cp->next;
+    kfree(cp->pa);
+    kmfree(cp);
+  }
+}
+
+static struct cpage*
+pclookup(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+
+  for(cp = *pchash(ip, pgno); cp; cp = cp->hnext)
+    if(cp->ip == ip && cp->pgno == pgno)
+      return cp;
+  return 0;
+}
+
+// Return page pgno of ip's contents, zero past the end of
+// the file, with a reference for the caller, who drops it
+// with kfree(). Sets *miss if the page had to be read in.
+// Returns 0 if memory ran out or the read failed.
+// Caller must hold ip->lock, shared or not.
+char*
+pcget(struct inode *ip, uint pgno, int *miss)
+{
+  struct cpage *cp;
+  char *mem;
+  uint off, n;
+
+  acquire(&pcache.lock);
+  if((cp = pclookup(ip, pgno)) != 0){
+    // to the front of the LRU list.
+    cp->next->prev = cp->prev;
+    cp->prev->next = cp->next;
+    cp->next = pcache.lru.next;
+    cp->prev = &pcache.lru;
+    pcache.lru.next->prev = cp;
+    pcache.lru.next = cp;
+    kdup(cp->pa);
+    release(&pcache.lock);
+    return cp->pa;
+  }
+  release(&pcache.lock);
+  if(miss)
+    *miss = 1;
+
+  if((mem = kzalloc(MT_PCACHE)) == 0)
+    return 0;
+  off = pgno * PGSIZE;
+  if(off < ip->dsize){
+    n = ip->dsize - off < PGSIZE ? ip->dsize - off : PGSIZE;
+    if(readiblocks(ip, mem, off, n) < 0){
+      kfree(mem);
+      return 0;
+    }
+  }
+  if((cp = kmalloc(sizeof(*cp))) == 0)
+    return mem;  // not cached, but still good to use
+  cp->ip = ip;
+  cp->pgno = pgno;
+  cp->pa = mem;
+  cp->dirty = 0;
+
+  // another reader holding ip->lock shared may have
+  // read the same page meanwhile.
+  acquire(&pcache.lock);
+  if(pclookup(ip, pgno) != 0){
+    release(&pcache.lock);
+    kmfree(cp);
+    return mem;
+  }
+  if((cp->hnext = *pchash(ip, pgno)) != 0)
+    cp->hnext->hprev = &cp->hnext;
+  cp->hprev = pchash(ip, pgno);
+  *cp->hprev = cp;
+  if((cp->inext = ip->pages) != 0)
+    cp->inext->iprev = &cp->inext;
+  cp->iprev = &ip->pages;
+  ip->pages = cp;
+  cp->next = pcache.lru.next;
+  cp->prev = &pcache.lru;
+  pcache.lru.next->prev = cp;
+  pcache.lru.next = cp;
+  pcache.n++;
+  kdup(mem);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Copy n bytes of ip's contents at off, all inside the file,
+// to dst. Returns the number of pages that had to be read
+// in, or -1 if the copy failed.
+// Caller must hold ip->lock.
+int
+pcread(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  char *pa;
+  int miss, nmiss = 0;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    m = PGSIZE - off%PGSIZE;
+    if(m > n - tot)
+      m = n - tot;
+    miss = 0;
+    if((pa = pcget(ip, off / PGSIZE, &miss)) == 0)
+      return -1;
+    nmiss += miss;
+    if(either_copyout(user_dst, dst, pa + off%PGSIZE, m) == -1){
+      kfree(pa);
+      return -1;
+    }
+    kfree(pa);
+  }
+  return nmiss;
+}
+
+// Return page pgno of ip's contents, as pcget() does, for
+// the caller to write to: the page is in the cache, dirty,
+// and mapped by nobody else. Returns 0 if memory ran out.
+// Caller must hold ip->lock exclusively.
+static char*
+pcgetw(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+  char *pa, *mem, *old = 0;
+  int first = 0;
+
+  if((pa = pcget(ip, pgno, 0)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  if((cp = pclookup(ip, pgno)) == 0){
+    // kmalloc() failed; there is nowhere to keep it.
+    release(&pcache.lock);
+    kfree(pa);
+    return 0;
+  }
+  if(krefcnt(pa) > 2){
+    // mapped by a process, which keeps the old contents.
+    // holding ip->lock and a reference to pa keeps cp.
+    release(&pcache.lock);
+    if((mem = kalloc(MT_PCACHE)) == 0){
+      kfree(pa);
+      return 0;
+    }
+    memmove(mem, pa, PGSIZE);
+    acquire(&pcache.lock);
+    old = cp->pa;
+    cp->pa = pa = mem;
+    kdup(mem);
+  }
+  if(!cp->dirty){
+    cp->dirty = 1;
+    ip->ndirty++;
+    pcache.ndirty++;
+  }
+  if(!ip->ondirty){
+    ip->ondirty = 1;
+    ip->dnext = pcache.dirty;
+    pcache.dirty = ip;
+    first = 1;
+  }
+  release(&pcache.lock);
+  if(old){
+    // the cache's reference and ours.
+    kfree(old);
+    kfree(old);
+  }
+  // pcflushd() can't drop the list's reference before
+  // taking ip->lock, which the caller holds.
+  if(first)
+    idup(ip);
+  return pa;
+}
+
+// Copy n bytes from src to ip's contents at off, marking
+// the pages dirty. Returns the number of bytes copied.
+// Caller must hold ip->lock exclusively.
+uint
+pcwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  char *pa;
+
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    m = PGSIZE - off%PGSIZE;
+    if(m > n - tot)
+      m = n - tot;
+    if((pa = pcgetw(ip, off / PGSIZE)) == 0)
+      break;
+    if(either_copyin(pa + off%PGSIZE, user_src, src, m) == -1){
+      kfree(pa);
+      break;
+    }
+    kfree(pa);
+  }
+  return tot;
+}
+
+// Write all of ip's dirty pages to disk, FLUSHPAGES at a
+// time, each batch in a transaction of its own. Caller holds
+// a reference to ip, but not ip->lock or a transaction.
+void
+pcflush(struct inode *ip)
+{
+  struct cpage *cp, *batch[FLUSHPAGES];
+  uint pg[FLUSHPAGES], off, end;
+  char *pa[FLUSHPAGES];
+  int i, n, more;
+
+  do {
+    begin_opn(ip->dev, FLUSHOPBLOCKS);
+    ilock(ip);
+
+    // the lowest dirty pages, in order, so that pages
+    // below the new dsize are all on disk.
+    acquire(&pcache.lock);
+    n = 0;
+    for(cp = ip->pages; cp; cp = cp->inext){
+      if(!cp->dirty || (n == FLUSHPAGES && cp->pgno > batch[n-1]->pgno))
+        continue;
+      if(n < FLUSHPAGES)
+        n++;
+      for(i = n-1; i > 0 && batch[i-1]->pgno > cp->pgno; i--)
+        batch[i] = batch[i-1];
+      batch[i] = cp;
+    }
+    for(i = 0; i < n; i++){
+      cp = batch[i];
+      cp->dirty = 0;
+      ip->ndirty--;
+      pcache.ndirty--;
+      kdup(cp->pa);
+      pg[i] = cp->pgno;
+      pa[i] = cp->pa;
+    }
+    more = ip->ndirty > 0;
+    release(&pcache.lock);
+
+    for(i = 0; i < n; i++){
+      off = pg[i] * PGSIZE;
+      if(off < ip->size)
+        writeiblocks(ip, pa[i], off, ip->size - off < PGSIZE ? ip->size - off : PGSIZE);
+      kfree(pa[i]);
+    }
+    if(n > 0){
+      end = (pg[n-1] + 1) * PGSIZE;
+      if(end > ip->size)
+        end = ip->size;
+      if(end > ip->dsize)
+        ip->dsize = end;
+      iupdate(ip);
+    }
+
+    iunlock(ip);
+    end_op(ip->dev);
+  } while(more);
+}
+
+// Flush ip if too much of memory is dirty, so that writers
+// can't fill it faster than pcflushd() empties it.
+// Caller holds a reference to ip, but not ip->lock.
+void
+pcthrottle(struct inode *ip)
+{
+  int over;
+
+  acquire(&pcache.lock);
+  over = pcache.ndirty > pcache.maxdirty;
+  release(&pcache.lock);
+  if(over)
+    pcflush(ip);
+}
+
+// Body of the pcflush kernel process: once a tick, flush
+// every inode on the dirty list and drop its reference.
+void
+pcflushd(void)
+{
+  struct inode *ip;
+  uint dev;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(;;){
+      acquire(&pcache.lock);
+      if((ip = pcache.dirty) != 0){
+        pcache.dirty = ip->dnext;
+        ip->ondirty = 0;
+      }
+      release(&pcache.lock);
+      if(ip == 0)
+        break;
+      // a writer that dirties ip again meanwhile puts it
+      // back on the list, with a reference of its own.
+      pcflush(ip);
+      dev = ip->dev;
+      begin_opn(dev, FREEOPBLOCKS);
+      iput(ip);
+      end_op(dev);
+    }
+  }
+}
+
+// Drop ip's cached pages that overlap [off, off+n).
+void
+pcdrop(struct inode *ip, uint off, uint n)
+{
+  struct cpage *cp, *next, *dead = 0;
+
+  acquire(&pcache.lock);
+  for(cp = ip->pages; cp; cp = next){
+    next = cp->inext;
+    if(cp->pgno >= off / PGSIZE && (uint64)cp->pgno * PGSIZE < (uint64)off + n){
+      pcunlink(cp);
+      cp->next = dead;
+      dead = cp;
+    }
+  }
+  release(&pcache.lock);
+  pcfree(dead);
+}
+
+// Drop all of ip's cached pages: ip is being truncated, or
+// its icache entry recycled.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *cp, *dead = 0;
+
+  acquire(&pcache.lock);
+  while((cp = ip->pages) != 0){
+    pcunlink(cp);
+    cp->next = dead;
+    dead = cp;
+  }
+  release(&pcache.lock);
+  pcfree(dead);
+}
+
+// Free up to NRECLAIM of the least recently used pages
+// that only the cache refers to. kalloc() calls this when
+// it runs out. Returns the number freed.
+int
+pcreclaim(void)
+{
+  struct cpage *cp, *prev, *dead = 0;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.lru.prev; cp != &pcache.lru && n < NRECLAIM; cp = prev){
+    prev = cp->prev;
+    if(krefcnt(cp->pa) != 1 || cp->dirty)
+      continue;  // mapped by a process, or not on disk yet
+    pcunlink(cp);
+    cp->next = dead;
+    dead = cp;
+    n++;
+  }
+  release(&pcache.lock);
+  pcfree(dead);
+  return n;
+}
@@ -3,22 +3,48 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "memstat.h"
 
-#define PIPESIZE 512
+// A pipe buffers up to PIPESIZE bytes in a ring of pages,
+// each allocated the first time a writer reaches it.
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int polled;     // poll() has looked; call pollwakeup() on a change
 };
 
+// The state changed in a way a poller may be waiting for.
+static void
+pipepolled(struct pipe *pi)
+{
+  if(pi->polled){
+    pi->polled = 0;
+    pollwakeup();
+  }
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  kmfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +54,14 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmalloc(sizeof(*pi))) == 0)
     goto bad;
+  memset(pi->page, 0, sizeof(pi->page));
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->polled = 0;
   memset(&pi->lock, 0, sizeof(pi->lock));
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +75,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmfree((char*)pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,45 +94,69 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pipepolled(pi);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Copy in as much of the caller's data as fits, a contiguous
+// run of the ring at a time. The reader is woken only if it
+// may be asleep: when the pipe was empty or has filled up.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i;
-  char ch;
-  struct proc *pr = myproc();
+  int i, m, wake;
+  uint off;
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+  wake = 0;
+  i = 0;
+  while(i < n){
+    if(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
       if(pi->readopen == 0 || myproc()->killed){
         release(&pi->lock);
         return -1;
       }
       wakeup(&pi->nread);
+      wake = 0;
       sleep(&pi->nwrite, &pi->lock);
+      continue;
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    off = pi->nwrite % PIPESIZE;
+    m = n - i;
+    if(m > PIPESIZE - (pi->nwrite - pi->nread))
+      m = PIPESIZE - (pi->nwrite - pi->nread);
+    if(m > PGSIZE - off % PGSIZE)
+      m = PGSIZE - off % PGSIZE;
+    if(pi->page[off / PGSIZE] == 0 && (pi->page[off / PGSIZE] = kalloc(MT_PIPE)) == 0)
+      break;
+    if(either_copyin(pi->page[off / PGSIZE] + off % PGSIZE, user_src, addr + i, m) == -1)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    if(pi->nread == pi->nwrite)
+      wake = 1;
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
+  if(wake)
+    wakeup(&pi->nread);
+  if(i > 0)
+    pipepolled(pi);
   release(&pi->lock);
-  return n;
+  myproc()->ru.npipeout += i;
+  return (i == 0 && n > 0) ? -1 : i;
 }
 
+// Copy out up to n bytes, a contiguous run of the ring at
+// a time. Writers only sleep on a full pipe, so only wake
+// them if this read made room in one.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
-  int i;
-  struct proc *pr = myproc();
-  char ch;
+  int i, m, full;
+  uint off;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -114,14 +166,47 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  full = (pi->nwrite == pi->nread + PIPESIZE);
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PGSIZE - off % PGSIZE)
+      m = PGSIZE - off % PGSIZE;
+    if(either_copyout(user_dst, addr + i, pi->page[off / PGSIZE] + off % PGSIZE, m) == -1)
       break;
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(full && i > 0)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    pipepolled(pi);
   release(&pi->lock);
+  myproc()->ru.npipein += i;
   return i;
 }
+
+// What the end of pi that is writable, or not, is ready
+// for, for poll().
+int
+pipepoll(struct pipe *pi, int writable)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r |= POLLHUP | POLLOUT;  // write() won't block; it fails
+    else if(pi->nwrite != pi->nread + PIPESIZE)
+      r |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r |= POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP | POLLIN;  // read() returns 0
+  }
+  pi->polled = 1;
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,151 @@
+//
+// poll(): wait until any of several files is ready.
+//
+// A process can sleep on only one channel, so pollers all
+// sleep on pollseq. A pipe or the console that a poller has
+// looked at is marked polled; when its state next changes
+// it calls pollwakeup(), which bumps pollseq and wakes the
+// pollers to look again. A poller notes pollseq before it
+// looks, and sleeps only if it is unchanged, so a change
+// made while it was looking is not missed.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+
+// Lock order: a pipe's or the console's lock, then polllock.
+struct spinlock polllock;
+uint pollseq;
+int npolltimed;     // pollers with a timeout, woken each tick
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Something a poller looked at may be ready now.
+void
+pollwakeup(void)
+{
+  acquire(&polllock);
+  pollseq++;
+  release(&polllock);
+  wakeup(&pollseq);
+}
+
+// Called on each clock tick, so timeouts run out.
+void
+polltick(void)
+{
+  if(npolltimed > 0)
+    pollwakeup();
+}
+
+// The events in events that f is ready for.
+static int
+filepoll(struct file *f, int events)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+          devsw[f->major].poll)
+    r = devsw[f->major].poll(f);
+  else
+    r = POLLIN | POLLOUT;  // files and disks don't block
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events | POLLHUP);
+}
+
+// Set the revents of the n entries of fds. Returns how
+// many have any.
+static int
+pollscan(struct pollfd *fds, int n)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  int i, nready;
+
+  nready = 0;
+  for(i = 0; i < n; i++){
+    if(fds[i].fd < 0){
+      fds[i].revents = 0;  // ignored, as by POSIX
+      continue;
+    }
+    if(fds[i].fd >= p->nofile || (f = p->ofile[fds[i].fd]) == 0)
+      fds[i].revents = POLLNVAL;
+    else
+      fds[i].revents = filepoll(f, fds[i].events);
+    if(fds[i].revents)
+      nready++;
+  }
+  return nready;
+}
+
+// poll(struct pollfd *fds, int n, int timeout): wait until
+// one of the n files in fds is ready for the events asked
+// for, or timeout ticks have passed; forever if timeout is
+// negative. Sets each entry's revents, and returns how many
+// have any: 0 on a timeout, -1 on an error.
+uint64
+sys_poll(void)
+{
+  struct proc *p = myproc();
+  struct pollfd *fds;
+  uint64 addr;
+  uint seq, t0;
+  int n, timeout, nready;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > MAXOFILE)
+    return -1;
+  if((fds = kmalloc(n * sizeof(*fds) + 1)) == 0)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n * sizeof(*fds)) < 0){
+    kmfree(fds);
+    return -1;
+  }
+
+  t0 = ticks;
+  for(;;){
+    acquire(&polllock);
+    seq = pollseq;
+    release(&polllock);
+    if((nready = pollscan(fds, n)) > 0 || timeout == 0)
+      break;
+    if(p->killed){
+      nready = -1;
+      break;
+    }
+    if(timeout > 0 && ticks - t0 >= timeout)
+      break;
+    acquire(&polllock);
+    if(pollseq == seq){
+      if(timeout > 0)
+        npolltimed++;
+      sleep(&pollseq, &polllock);
+      if(timeout > 0)
+        npolltimed--;
+    }
+    release(&polllock);
+  }
+
+  if(nready >= 0 && copyout(p->pagetable, addr, (char*)fds, n * sizeof(*fds)) < 0)
+    nready = -1;
+  kmfree(fds);
+  return nready;
+}
@@ -0,0 +1,11 @@
+// poll() waits for any of an array of these to be ready.
+struct pollfd {
+  int fd;
+  short events;       // POLL* the caller wants
+  short revents;      // POLL* that are ready, set by poll()
+};
+
+#define POLLIN   0x1  // read() won't block
+#define POLLOUT  0x4  // write() won't block
+#define POLLHUP  0x10 // the other end of a pipe is closed; always reported
+#define POLLNVAL 0x20 // fd is not open; always reported
@@ -8,40 +8,143 @@
 #include "file.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
+#include "fcntl.h"
+#include "memstat.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table, sized at boot from free memory:
+// nproc proc structs, linked through p->nextproc.
+struct proc *proc;
+int nproc;
+
+// One process slot per PROCFRAC pages free at boot,
+// but at least NPROC. An unused slot costs only its
+// struct proc, since kernel stacks are allocated as
+// processes are.
+#define PROCFRAC 64
 
 struct proc *initproc;
 
-int nextpid = 1;
-struct spinlock pid_lock;
+int nextpid = 1;  // taken with an atomic add
+
+// Per-CPU lists of UNUSED process slots, so allocproc()
+// needn't search the table. freeproc() puts a slot on the
+// freeing CPU's list; allocproc() takes from its own CPU's
+// list first, then steals from the others.
+// Lock order: p->lock, then a list's lock.
+struct procfree {
+  struct spinlock lock;
+  struct proc *head;  // through p->freenext
+} procfree[NCPU];
+
+// Per-CPU queues of RUNNABLE processes, one FIFO list per
+// scheduling class. A process is on exactly one queue from
+// when it becomes RUNNABLE until a scheduler takes it off
+// to run it. Idle CPUs steal from the other queues.
+// Lock order: p->lock, then a queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];  // through p->rqnext
+  struct proc *tail[NPRIO];
+  int passed;  // picks since a waiting lower class last ran
+} runq[NCPU];
+
+// Sleeping processes, hashed by wait channel, so that
+// wakeup() only looks at processes sleeping on channels
+// that hash alike. A process is on its channel's queue
+// exactly while it is SLEEPING, and the queue's lock is
+// enough to wake it (see setrunnable()).
+// Lock order: p->lock, then a sleep queue's lock, then a
+// run queue's lock.
+#define NSLEEPQ 61
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;  // through p->sqnext
+} sleepq[NSLEEPQ];
+
+static inline struct sleepq*
+sqhash(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
+// CPUs waiting in wfi for something to run, a bit each;
+// setrunnable() sends one of them an IPI. Updated with
+// atomics.
+uint64 idlemask;
+
+// CPUs that have started scheduling, a bit each.
+uint64 onlinemask;
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
+static void setrunnable(struct proc *p);
+static void kickidle(int cpu, uint64 mask);
+static void addchild(struct proc *p, struct proc *np);
+static void ruadd(struct rusage *to, struct rusage *from);
 
 extern char trampoline[]; // trampoline.S
 
+// Each slot's kernel stack is mapped at KSTACK(i), below an
+// invalid guard page, only while a process uses the slot.
+// The pages of freed stacks are kept here, up to
+// NKSTACKPOOL of them, for the next processes made.
+struct {
+  struct spinlock lock;
+  char *page[NKSTACKPOOL];
+  int n;
+} kstackpool;
+
 void
 procinit(void)
 {
-  struct proc *p;
+  struct proc *p, *pend, **pp;
+  struct runq *rq;
+  struct sleepq *sq;
+  int n, i;
   
-  initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(i = 0; i < NCPU; i++)
+    initlock(&procfree[i].lock, "procfree");
+  initlock(&kstackpool.lock, "kstackpool");
+  for(rq = runq; rq < &runq[NCPU]; rq++)
+    initlock(&rq->lock, "runq");
+  for(sq = sleepq; sq < &sleepq[NSLEEPQ]; sq++)
+    initlock(&sq->lock, "sleepq");
+
+  n = knpages() / PROCFRAC;
+  if(n < NPROC)
+    n = NPROC;
+
+  // Carve the proc structs out of whole pages.
+  p = pend = 0;
+  pp = &proc;
+  for(i = 0; i < n; i++) {
+      if(p == pend){
+        if((p = (struct proc*)kzalloc(MT_KERNEL)) == 0)
+          panic("procinit");
+        pend = p + PGSIZE / sizeof(struct proc);
+      }
       initlock(&p->lock, "proc");
-
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
+      initlock(&p->vmlock, "vm");
+      initsleeplock(&p->vmalock, "vma");
+      p->affinity = ~0UL;
+
+      // The process's kernel stack goes high in memory,
+      // followed by an invalid guard page; allocproc()
+      // maps it.
+      p->kstack = KSTACK(i);
+      kvmstackinit(p->kstack);
+
+      *pp = p;
+      pp = &p->nextproc;
+      p->freenext = procfree[i % NCPU].head;
+      procfree[i % NCPU].head = p;
+      p++;
   }
+  nproc = n;
   kvminithart();
 }
 
@@ -76,17 +179,85 @@ myproc(void) {
 
 int
 allocpid() {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  return __sync_fetch_and_add(&nextpid, 1);
+}
 
-  return pid;
+// Put p, just made UNUSED, on this CPU's free list.
+// p->lock must be held.
+static void
+procput(struct proc *p)
+{
+  struct procfree *pf;
+
+  push_off();
+  pf = &procfree[cpuid()];
+  acquire(&pf->lock);
+  p->freenext = pf->head;
+  pf->head = p;
+  release(&pf->lock);
+  pop_off();
+}
+
+// Take an UNUSED slot off a free list, or return 0.
+static struct proc*
+procget(void)
+{
+  struct procfree *pf;
+  struct proc *p;
+  int id, i;
+
+  p = 0;
+  push_off();
+  id = cpuid();
+  for(i = 0; i < NCPU && p == 0; i++){
+    pf = &procfree[(id + i) % NCPU];
+    acquire(&pf->lock);
+    if((p = pf->head) != 0)
+      pf->head = p->freenext;
+    release(&pf->lock);
+  }
+  pop_off();
+  return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Map a kernel stack at va, reusing a page from the pool
+// if there is one. Returns 0, or -1 if out of memory.
+static int
+kstackmap(uint64 va)
+{
+  char *pa;
+
+  pa = 0;
+  acquire(&kstackpool.lock);
+  if(kstackpool.n > 0)
+    pa = kstackpool.page[--kstackpool.n];
+  release(&kstackpool.lock);
+  if(pa == 0 && (pa = kalloc(MT_KSTACK)) == 0)
+    return -1;
+  kvmmapstack(va, (uint64)pa);
+  return 0;
+}
+
+// Unmap the kernel stack at va, if any, and keep its page
+// in the pool, or free it if the pool is full.
+static void
+kstackunmap(uint64 va)
+{
+  char *pa;
+
+  if((pa = (char*)kvmunmapstack(va)) == 0)
+    return;
+  acquire(&kstackpool.lock);
+  if(kstackpool.n < NKSTACKPOOL){
+    kstackpool.page[kstackpool.n++] = pa;
+    pa = 0;
+  }
+  release(&kstackpool.lock);
+  if(pa)
+    kfree(pa);
+}
+
+// Take an UNUSED proc off a free list.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, return 0.
@@ -95,27 +266,33 @@ allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
-
-found:
+  if((p = procget()) == 0)
+    return 0;
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
   p->pid = allocpid();
+  p->state = USED;
 
-  // Allocate a trapframe page.
-  if((p->tf = (struct trapframe *)kalloc()) == 0){
+  // Allocate a trapframe page, and a kernel stack.
+  if((p->tf = (struct trapframe *)kalloc(MT_KERNEL)) == 0){
+    p->state = UNUSED;
+    procput(p);
     release(&p->lock);
     return 0;
   }
+  if(kstackmap(p->kstack) < 0){
+    kfree((void*)p->tf);
+    p->tf = 0;
+    p->state = UNUSED;
+    procput(p);
+    release(&p->lock);
+    return 0;
+  }
+  p->tfva = TRAPFRAME;
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  // The caller gives p a page table, or shares its own.
+  p->mm = p;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -132,20 +309,59 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if(p->mm != p){
+    // a thread: give back its trapframe slot in the
+    // page table, which belongs to the leader.
+    acquire(&p->mm->vmlock);
+    if(p->tfva != TRAPFRAME){
+      uvmunmap(p->pagetable, p->tfva, PGSIZE, 0);
+      p->mm->tfslots &= ~(1 << ((TRAPFRAME - p->tfva) / PGSIZE));
+    }
+    release(&p->mm->vmlock);
+  } else {
+    if(p->pagetable)
+      proc_freepagetable(p->pagetable, p->sz);
+    if(p->kpagetable)
+      kfree((void*)p->kpagetable);
+  }
+  p->pagetable = 0;
+  p->kpagetable = 0;
+  p->mm = 0;
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
+  // p has switched away for good, so its stack is idle.
+  kstackunmap(p->kstack);
+  p->tfva = 0;
+  if(p->ofile)
+    kmfree(p->ofile);
+  p->ofile = 0;
+  p->nofile = 0;
   p->sz = 0;
+  p->guard = 0;
   p->pid = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
+  p->prio = PRIO_NORMAL;
+  p->affinity = ~0UL;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->noclone = 0;
+  memset(p->vma, 0, sizeof(p->vma));
+  p->nseg = 0;
+  p->tfslots = 0;
+  p->swapva = 0;
+  memset(p->sysn, 0, sizeof(p->sysn));
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
+  memset(p->systime, 0, sizeof(p->systime));
+  p->alarmticks = 0;
+  p->inalarm = 0;
   p->state = UNUSED;
+  procput(p);
 }
 
 // Create a page table for a given process,
@@ -169,6 +385,11 @@ proc_pagetable(struct proc *p)
   mappages(pagetable, TRAPFRAME, PGSIZE,
            (uint64)(p->tf), PTE_R | PTE_W);
 
+  // the clock page, below the thread trapframes; shared by
+  // all processes, and read-only to them.
+  mappages(pagetable, TIMEPAGE, PGSIZE,
+           (uint64)timepage, PTE_R | PTE_U);
+
   return pagetable;
 }
 
@@ -179,6 +400,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
   uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
+  uvmunmap(pagetable, TIMEPAGE, PGSIZE, 0);
   if(sz > 0)
     uvmfree(pagetable, sz);
 }
@@ -203,6 +425,9 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
+  p->pagetable = proc_pagetable(p);
+  if((p->kpagetable = kvmcreate(p->pagetable)) == 0)
+    panic("userinit");
   
   // allocate one user page and copy init's instructions
   // and data into it.
@@ -215,30 +440,46 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  if(ofilegrow(&p->ofile, &p->nofile, NOFILE-1) < 0)
+    panic("userinit");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
+// Grow or shrink user memory by n bytes, setting *oldsz
+// to the size before.
 // Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz;
+  struct proc *mm = myproc()->mm;
+  int r = 0;
 
-  sz = p->sz;
+  acquire(&mm->vmlock);
+  sz = *oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // Only reserve the addresses; vmfault() allocates
+    // zeroed pages on first touch. Refuse more than
+    // physical memory could ever back.
+    if(sz + n > PHYSTOP - KERNBASE || sz + n > USERTOP ||
+       mmap_inrange(mm, PGROUNDUP(sz), sz + n))
+      r = -1;
+    else
+      sz += n;
+  } else if(n < 0 && sz + n < sz){
+    // vmfault() maps nothing past sz, so the pages there
+    // can go once the lock is released.
+    sz += n;
+    execshrink(mm, sz);
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  release(&mm->vmlock);
+  if(PGROUNDUP(sz) < PGROUNDUP(*oldsz))
+    uvmunmapmm(mm, PGROUNDUP(sz), *oldsz - PGROUNDUP(sz));
+  return r;
 }
 
 // Create a new process, copying the parent.
@@ -249,21 +490,48 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *mm = p->mm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((np->pagetable = proc_pagetable(np)) == 0 ||
+     (np->kpagetable = kvmcreate(np->pagetable)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  acquire(&mm->vmlock);
+  if(uvmcopy(p->pagetable, np->pagetable, mm->sz) < 0){
+    release(&mm->vmlock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = mm->sz;
+  np->guard = mm->guard;
+  release(&mm->vmlock);
 
-  np->parent = p;
+  // Copy mmap()ed regions.
+  if(mmap_fork(mm, np) < 0){
+    mmap_exit(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // the parent's other threads must see their pages turn
+  // copy-on-write before fork() returns.
+  tlbshootdown(mm);
+
+  if(ofilegrow(&np->ofile, &np->nofile, p->nofile-1) < 0){
+    mmap_exit(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->tf) = *(p->tf);
@@ -272,46 +540,262 @@ fork(void)
   np->tf->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
+  for(i = 0; i < p->nofile; i++)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  acquire(&mm->vmlock);
+  execdup(mm, np);
+  release(&mm->vmlock);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
+  np->prio = p->prio;
+  np->affinity = p->affinity;
+
+  // np is USED, so nothing else touches it while
+  // it is unlocked; parent-then-child order says
+  // p->lock must be taken first.
+  release(&np->lock);
+  addchild(p, np);
+
+  acquire(&np->lock);
+  np->rqcpu = p->rqcpu;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the program path with
+// arguments argv and the nofile-entry file table ofile,
+// without copying the caller's memory. Takes over ofile
+// and the references in it, whether or not it succeeds.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **ofile, int nofile)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    goto bad;
+  memset(np->tf, 0, sizeof(*np->tf));
+
+  // np is USED, so nothing else touches it while we
+  // sleep reading the program.
+  release(&np->lock);
+  argc = execproc(np, path, argv);
+  acquire(&np->lock);
+  if(argc < 0){
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
+  }
+  np->tf->a0 = argc;
+
+  np->ofile = ofile;
+  np->nofile = nofile;
+  np->cwd = idup(p->cwd);
+  np->prio = p->prio;
+  np->affinity = p->affinity;
+  pid = np->pid;
+  release(&np->lock);
+  addchild(p, np);
+
+  acquire(&np->lock);
+  np->rqcpu = p->rqcpu;
+  setrunnable(np);
+  release(&np->lock);
+  return pid;
 
-  np->state = RUNNABLE;
+ bad:
+  for(i = 0; i < nofile; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  kmfree(ofile);
+  return -1;
+}
 
+// Start a thread of the current process: a process that
+// shares its address space and runs fn(arg) on the user
+// stack whose top is stack. fn must not return. Like a fork()
+// child, the thread gets copies of the caller's open files.
+// Every thread is a child of the leader, which joins it with
+// waitpid() and takes it down in exit() and exec().
+// Returns the thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *mm = p->mm;
+
+  if(stack % 16 != 0)
+    return -1;
+  if((np = allocproc()) == 0)
+    return -1;
+  np->mm = mm;
+  np->pagetable = mm->pagetable;
+  np->kpagetable = mm->kpagetable;
+
+  // map np's trapframe in a free thread slot.
+  acquire(&mm->vmlock);
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((mm->tfslots & (1 << slot)) == 0)
+      break;
+  if(slot == NTHREAD || mappages(mm->pagetable, TFTHREAD(slot), PGSIZE,
+                                 (uint64)np->tf, PTE_R | PTE_W) != 0){
+    release(&mm->vmlock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  mm->tfslots |= 1 << slot;
+  np->tfva = TFTHREAD(slot);
+  release(&mm->vmlock);
+
+  if(ofilegrow(&np->ofile, &np->nofile, p->nofile-1) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->epc = fn;
+  np->tf->sp = stack;
+  np->tf->a0 = arg;
+  np->tf->gp = p->tf->gp;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->prio = p->prio;
+  np->affinity = p->affinity;
+  pid = np->pid;
   release(&np->lock);
 
+  // once the leader has begun reaping its threads for
+  // exit() or exec(), it must not gain new ones.
+  acquire(&mm->lock);
+  if(mm->noclone){
+    release(&mm->lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->parent = mm;
+  np->sibling = mm->children;
+  mm->children = np;
+  release(&mm->lock);
+
+  for(i = 0; i < p->nofile; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  acquire(&np->lock);
+  np->rqcpu = p->rqcpu;
+  setrunnable(np);
+  release(&np->lock);
   return pid;
 }
 
+// Make every other CPU that is running one of mm's threads
+// drop the TLB entries it has from before the caller changed
+// mm's page table, and wait until it has: it is sent an IPI,
+// and flushes its TLB in devintr(), or on switching away
+// from the thread. The caller must hold no spinlock, since
+// it yields while it waits, which lets this CPU do the same
+// for other callers.
+void
+tlbshootdown(struct proc *mm)
+{
+  uint gen[NCPU];
+  uint64 mask;
+  struct proc *p;
+  int i, me;
+
+  sfence_vma();  // this CPU's own
+  if(mm->tfslots == 0)
+    return;  // no threads
+  mask = 0;
+  push_off();
+  me = cpuid();
+  __sync_synchronize();  // the PTEs, then cpus[].proc
+  for(i = 0; i < NCPU; i++){
+    p = cpus[i].proc;
+    if(i != me && p && p->mm == mm){
+      gen[i] = cpus[i].tlbgen;
+      mask |= 1L << i;
+      ipi(i);
+    }
+  }
+  pop_off();
+  for(i = 0; i < NCPU; i++)
+    while((mask & (1L << i)) && *(volatile uint*)&cpus[i].tlbgen == gen[i])
+      yield();
+}
+
+// Kill p's threads and wait for each to exit, for exit()
+// and exec(). p must be the leader of its threads.
+void
+killthreads(struct proc *p)
+{
+  struct proc *np;
+  int pid;
+
+  acquire(&p->lock);
+  p->noclone = 1;
+  for(;;){
+    for(np = p->children; np != 0; np = np->sibling)
+      if(np->mm == p)
+        break;
+    if(np == 0)
+      break;
+    pid = np->pid;
+    release(&p->lock);
+    kill(pid);
+    waitpid(pid, 0, 0);
+    acquire(&p->lock);
+  }
+  p->noclone = 0;
+  release(&p->lock);
+}
+
+// Link np, which is USED and unlocked, into p's children.
+static void
+addchild(struct proc *p, struct proc *np)
+{
+  acquire(&p->lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&p->lock);
+}
+
 // Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Caller must hold initproc->lock and p->lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
-
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  struct proc *pp, *last;
+
+  if(p->children == 0)
+    return;
+  last = 0;
+  for(pp = p->children; pp != 0; pp = pp->sibling){
+    acquire(&pp->lock);
+    pp->parent = initproc;
+    release(&pp->lock);
+    last = pp;
   }
+  last->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  // init may have zombies to collect now.
+  wakeup1(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -325,8 +809,16 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  if(p->mm == p){
+    // the leader takes its threads with it.
+    killthreads(p);
+
+    // Unmap mmap()ed regions, writing back shared pages.
+    mmap_exit(p);
+  }
+
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
+  for(int fd = 0; fd < p->nofile; fd++){
     if(p->ofile[fd]){
       struct file *f = p->ofile[fd];
       fileclose(f);
@@ -334,33 +826,25 @@ exit(int status)
     }
   }
 
-  begin_op(ROOTDEV);
+  begin_opn(ROOTDEV, FREEOPBLOCKS);
   iput(p->cwd);
   end_op(ROOTDEV);
   p->cwd = 0;
+  if(p->exe){
+    execput(p->exe);
+    p->exe = 0;
+  }
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
+  // init is everyone's ancestor, so the parent-then-child rule
+  // lets us lock it first. holding it also keeps p->parent
+  // fixed, since reparenting needs init's lock too.
   acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
   struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
+
   // we need the parent's lock in order to wake it up from wait().
   // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
+  if(original_parent != initproc)
+    acquire(&original_parent->lock);
 
   acquire(&p->lock);
 
@@ -373,7 +857,9 @@ exit(int status)
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  if(original_parent != initproc)
+    release(&original_parent->lock);
+  release(&initproc->lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -385,8 +871,18 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *np;
-  int havekids, pid;
+  return waitpid(-1, addr, 0);
+}
+
+// Wait for the child with the given pid, or for any child
+// if pid is -1, to exit and return its pid. With WNOHANG,
+// return 0 at once if no such child has exited yet.
+// Return -1 if there is no such child.
+int
+waitpid(int pid, uint64 addr, int options)
+{
+  struct proc *np, **pp;
+  int havekids;
   struct proc *p = myproc();
 
   // hold p->lock for the whole time to avoid lost
@@ -394,40 +890,45 @@ wait(uint64 addr)
   acquire(&p->lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
+    // parent-then-child order lets us lock each while
+    // holding p->lock.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+    for(pp = &p->children; (np = *pp) != 0; pp = &np->sibling){
+      if(pid != -1 && np->pid != pid)
+        continue;
+      acquire(&np->lock);
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
           release(&p->lock);
-          return pid;
+          return -1;
         }
+        *pp = np->sibling;
+        ruadd(&p->cru, &np->ru);
+        ruadd(&p->cru, &np->cru);
+        freeproc(np);
         release(&np->lock);
+        release(&p->lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || p->killed){
+    // killthreads() waits even if p has been killed.
+    if(!havekids || (p->killed && !p->noclone)){
       release(&p->lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&p->lock);
+      return 0;
+    }
     
     // Wait for a child to exit.
     sleep(p, &p->lock);  //DOC: wait-sleep
@@ -435,9 +936,152 @@ wait(uint64 addr)
 }
 
 // Per-CPU process scheduler.
+// Mark p RUNNABLE and queue it on the CPU it last ran on,
+// or, if p may no longer run there, the first it may.
+// Caller must hold p->lock, or, if p is SLEEPING, the lock of
+// its sleep queue, having taken p off that queue. In the
+// latter case p may still be on its way into sched(); the
+// scheduler that picks p waits for p->lock, so p does not
+// run until it has switched out.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+  int c = p->prio;
+
+  if((p->affinity & (1L << p->rqcpu)) == 0)
+    p->rqcpu = __builtin_ctzl(p->affinity & onlinemask);
+  rq = &runq[p->rqcpu];
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[c])
+    rq->tail[c]->rqnext = p;
+  else
+    rq->head[c] = p;
+  rq->tail[c] = p;
+  release(&rq->lock);
+  kickidle(p->rqcpu, p->affinity);
+}
+
+// A process that may run on the CPUs in mask is queued on
+// cpu's run queue: if cpu is idle, or else another in mask
+// is, send it an IPI to come and run it (or steal it).
+// Clearing the CPU's bit first means only one waker sends
+// it one.
+static void
+kickidle(int cpu, uint64 mask)
+{
+  uint64 idle;
+
+  __sync_synchronize();  // the queue, then idlemask; see idle()
+  if((idle = idlemask & mask) == 0)
+    return;
+  if((idle & (1L << cpu)) == 0)
+    cpu = __builtin_ctzl(idle);
+  if(__sync_fetch_and_and(&idlemask, ~(1L << cpu)) & (1L << cpu))
+    ipi(cpu);
+}
+
+// Whether any run queue has a process CPU id may run.
+static int
+anyrunnable(int id)
+{
+  struct proc *p;
+  int i, c, found;
+
+  found = 0;
+  for(i = 0; i < NCPU && !found; i++){
+    acquire(&runq[i].lock);
+    for(c = 0; c < NPRIO && !found; c++)
+      for(p = runq[i].head[c]; p && !found; p = p->rqnext)
+        found = (p->affinity & (1L << id)) != 0;
+    release(&runq[i].lock);
+  }
+  return found;
+}
+
+// This CPU, id, has nothing to run: wait in wfi until an
+// interrupt, with its bit set in idlemask so that
+// setrunnable() will send an IPI. Every CPU but the first,
+// which keeps ticks, stops its clock meanwhile. Called
+// with interrupts off.
+static void
+idle(int id)
+{
+  __sync_fetch_and_or(&idlemask, 1L << id);
+  // a process queued before the bit was set sent no IPI.
+  if(!anyrunnable(id)){
+    if(id != 0)
+      timerstop();
+    asm volatile("wfi");
+    if(id != 0)
+      timerstart();
+  }
+  __sync_fetch_and_and(&idlemask, ~(1L << id));
+}
+
+// Take the first process in class c of rq that may run on
+// CPU id, or return 0 if there is none. rq->lock must be
+// held.
+static struct proc*
+rqtake(struct runq *rq, int c, int id)
+{
+  struct proc **pp, *p, *prev;
+
+  prev = 0;
+  for(pp = &rq->head[c]; (p = *pp) != 0; pp = &p->rqnext){
+    if(p->affinity & (1L << id)){
+      *pp = p->rqnext;
+      if(rq->tail[c] == p)
+        rq->tail[c] = prev;
+      return p;
+    }
+    prev = p;
+  }
+  return 0;
+}
+
+// Take a process that may run on CPU id off rq, or return
+// 0 if there is none. Picks the first process of the
+// highest class, except that a class with waiters below it
+// yields one pick in PRIOSHARE to the next class down, so
+// batch jobs cannot starve.
+static struct proc*
+rqpop(struct runq *rq, int id)
+{
+  struct proc *p;
+  int c, lower;
+
+  // unlocked peek, so idle CPUs don't fight over empty queues.
+  for(c = 0; c < NPRIO; c++)
+    if(rq->head[c])
+      break;
+  if(c == NPRIO)
+    return 0;
+
+  acquire(&rq->lock);
+  for(c = 0; c < NPRIO && rq->head[c] == 0; c++)
+    ;
+  if(c == NPRIO){
+    release(&rq->lock);
+    return 0;
+  }
+  for(lower = c + 1; lower < NPRIO && rq->head[lower] == 0; lower++)
+    ;
+  p = 0;
+  if(lower < NPRIO && ++rq->passed >= PRIOSHARE && (p = rqtake(rq, lower, id)) != 0)
+    rq->passed = 0;
+  for(; p == 0 && c < NPRIO; c++)
+    p = rqtake(rq, c, id);
+  release(&rq->lock);
+  return p;
+}
+
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the first on this CPU's
+//    run queue, or else one stolen from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,44 +1090,56 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  int i;
   
   c->proc = 0;
+  __sync_fetch_and_or(&onlinemask, 1L << id);
   for(;;){
     // Avoid deadlock by giving devices a chance to interrupt.
     intr_on();
 
-    // Run the for loop with interrupts off to avoid
-    // a race between an interrupt and WFI, which would
-    // cause a lost wakeup.
+    // Pick with interrupts off to avoid a race between
+    // an interrupt and WFI, which would cause a lost wakeup.
     intr_off();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->scheduler, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
-      }
+    p = rqpop(&runq[id], id);
+    for(i = 1; p == 0 && i < NCPU; i++)
+      p = rqpop(&runq[(id + i) % NCPU], id);
+    if(p == 0){
+      idle(id);
+      continue;
+    }
 
-      // ensure that release() doesn't enable interrupts.
-      // again to avoid a race between interrupt and WFI.
-      c->intena = 0;
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->rqcpu = id;
+    c->proc = p;
+    TRACE(TR_SWITCH, p->pid, 0);
+    p->tstamp = r_time();
+    kvmswitch(p->kpagetable);
+    swtch(&c->scheduler, &p->context);
+    // off p's page table while its lock is still held,
+    // since wait() may free it as soon as that is released.
+    kvminithart();
+    c->tlbgen++;  // kvminithart() flushed the TLB
+    p->ru.stime += r_time() - p->tstamp;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+
+    // ensure that release() doesn't enable interrupts.
+    // again to avoid a race between interrupt and WFI.
+    c->intena = 0;
 
-      release(&p->lock);
-    }
-    if(found == 0){
-      asm volatile("wfi");
-    }
+    release(&p->lock);
   }
 }
 
@@ -510,6 +1166,7 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  p->ru.nswitch++;
   swtch(&p->context, &mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -520,7 +1177,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -541,32 +1198,75 @@ forkret(void)
     // be run from main().
     first = 0;
     fsinit(minor(ROOTDEV));
+    tmpinit();
+    kproc("logflush", logflush);
+    kproc("loginstall", loginstall);
+    kproc("pcflush", pcflushd);
+    kproc("kzero", kzerod);
+    kproc("swap", swapd);
   }
 
   usertrapret();
 }
 
+// A kernel process's first scheduling by scheduler()
+// will swtch to kprocret.
+static void
+kprocret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kproc returned");
+}
+
+// Start a process that runs fn in the kernel and never
+// returns to user space. fn must not return.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq;
   
+  TRACE(TR_SLEEP, chan, 0);
+
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's sleep queue, we are
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
 
   // Go to sleep.
+  sq = sqhash(chan);
+  acquire(&sq->lock);
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
+
+  if(lk != &p->lock)
+    release(lk);
 
   sched();
 
@@ -585,15 +1285,38 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+  struct sleepq *sq = sqhash(chan);
+  struct proc *p, **pp;
+
+  TRACE(TR_WAKEUP, chan, 0);
+  acquire(&sq->lock);
+  for(pp = &sq->head; (p = *pp) != 0; ){
+    if(p->chan == chan){
+      *pp = p->sqnext;
+      setrunnable(p);
+    } else {
+      pp = &p->sqnext;
     }
-    release(&p->lock);
   }
+  release(&sq->lock);
+}
+
+// Wake p, which was SLEEPING, unless wakeup() already has.
+// Caller must hold p->lock, which keeps p->chan fixed.
+static void
+unsleep(struct proc *p)
+{
+  struct sleepq *sq = sqhash(p->chan);
+  struct proc **pp;
+
+  acquire(&sq->lock);
+  if(p->state == SLEEPING){
+    for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+      ;
+    *pp = p->sqnext;
+    setrunnable(p);
+  }
+  release(&sq->lock);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -604,7 +1327,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    unsleep(p);
   }
 }
 
@@ -616,13 +1339,13 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = proc; p != 0; p = p->nextproc){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        unsleep(p);
       }
       release(&p->lock);
       return 0;
@@ -632,6 +1355,130 @@ kill(int pid)
   return -1;
 }
 
+// Put the process with the given pid in scheduling
+// class prio, which takes effect the next time it
+// becomes RUNNABLE. Returns its old class, or -1.
+int
+setprio(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  for(p = proc; p != 0; p = p->nextproc){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->prio;
+      p->prio = prio;
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Let the process with the given pid run only on the CPUs
+// in mask, a bit each, from the next time it becomes
+// RUNNABLE; the caller moves at once. Returns 0, or -1 if
+// there is no such process or mask has no CPU that is up.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+
+  if((mask & onlinemask) == 0)
+    return -1;
+  for(p = proc; p != 0; p = p->nextproc){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->affinity = mask;
+      release(&p->lock);
+      if(p == myproc())
+        yield();
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// The CPUs the process with the given pid may run on that
+// are up, or 0 if there is no such process.
+uint64
+getaffinity(int pid)
+{
+  struct proc *p;
+  uint64 mask;
+
+  for(p = proc; p != 0; p = p->nextproc){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      mask = p->affinity & onlinemask;
+      release(&p->lock);
+      return mask;
+    }
+    release(&p->lock);
+  }
+  return 0;
+}
+
+static void
+ruadd(struct rusage *to, struct rusage *from)
+{
+  to->utime += from->utime;
+  to->stime += from->stime;
+  to->nswitch += from->nswitch;
+  to->nfault += from->nfault;
+  to->npages += from->npages;
+  to->nbread += from->nbread;
+  to->nbwrite += from->nbwrite;
+  to->npipein += from->npipein;
+  to->npipeout += from->npipeout;
+}
+
+// Copy out the resources used by the calling process, or,
+// if who is RUSAGE_CHILDREN, by the children it has waited
+// for and their own children. Returns 0, or -1 on error.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage ru;
+
+  if(who == RUSAGE_SELF){
+    ru = p->ru;
+    ru.stime += r_time() - p->tstamp;  // this system call so far
+  } else if(who == RUSAGE_CHILDREN){
+    ru = p->cru;
+  } else {
+    return -1;
+  }
+  return copyout(p->pagetable, addr, (char*)&ru, sizeof(ru));
+}
+
+// Copy the system call counters of the process with the
+// given pid into sysn and systime, which hold NSYSCALL each.
+// Returns 0, or -1 if there is no such process.
+int
+getsysacct(int pid, uint *sysn, uint64 *systime)
+{
+  struct proc *p;
+
+  for(p = proc; p != 0; p = p->nextproc){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      memmove(sysn, p->sysn, sizeof(p->sysn));
+      memmove(systime, p->systime, sizeof(p->systime));
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -670,6 +1517,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
@@ -679,7 +1527,7 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = proc; p != 0; p = p->nextproc){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -1,3 +1,5 @@
+#include "rusage.h"  // struct rusage, also used by user programs
+
 // Saved registers for kernel context switches.
 struct context {
   uint64 ra;
@@ -24,6 +26,7 @@ struct cpu {
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint tlbgen;                // TLB flushes, for tlbshootdown()
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,27 +83,96 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// A region of a file mapped by mmap().
+struct vma {
+  int used;
+  uint64 addr;        // page-aligned start
+  uint64 len;         // page-aligned length
+  int prot;           // PROT_*
+  int flags;          // MAP_SHARED or MAP_PRIVATE
+  struct file *f;     // mapped file, holding a reference
+  uint off;           // file offset of addr
+};
+
+// A loadable segment of the program exec() started. Its
+// file-backed pages are read in by execfault() on first touch;
+// the rest, up to memsz, are zero-filled like the heap.
+struct execseg {
+  uint64 va;          // page-aligned start
+  uint64 filesz;      // bytes that come from the file
+  uint64 memsz;
+  uint off;           // file offset of va
+  int share;          // read-only: pages come from the page cache
+  int perm;           // PTE_* for shared pages
+};
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
   struct spinlock lock;
+  struct proc *nextproc;       // Process table link; set at boot
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child, linked through sibling
+  struct proc *sibling;        // Next child of parent, under parent's lock
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int rqcpu;                   // CPU whose run queue p goes on
+  int prio;                    // Scheduling class, PRIO_*
+  uint64 affinity;             // CPUs p may run on, a bit each
+  int noclone;                 // Leader is reaping its threads; clone() fails
+
+  // the run or sleep queue's lock must be held when using these:
+  struct proc *rqnext;         // Next process on the run queue
+  struct proc *sqnext;         // Next process on the sleep queue
+
+  // the free list's lock must be held when using this:
+  struct proc *freenext;       // Next UNUSED slot on a free list
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // Page table
+  pagetable_t pagetable;       // Page table, the leader's for a thread
+  pagetable_t kpagetable;      // Kernel's, sharing pagetable's user pages; see kvmcreate()
+  struct proc *mm;             // Owner of the address space: p, or its leader
   struct trapframe *tf;        // data page for trampoline.S
+  uint64 tfva;                 // where tf is mapped: TRAPFRAME, or TFTHREAD(i)
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files, indexed by fd
+  int nofile;                  // Size of ofile[]; grows on demand
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // kernel process body, see kproc()
+  int logres;                  // log blocks reserved by begin_opn()
+  uint sysn[NSYSCALL];         // calls to each system call, see sysstat()
+  struct rusage ru;            // resources used; see getrusage()
+  struct rusage cru;           // and by waited-for children
+  uint64 tstamp;               // r_time() at the last user/kernel/switch boundary
+  uint64 systime[NSYSCALL];    // r_time() ticks spent in each
+  int alarmticks;              // sigalarm() interval in ticks run, or 0
+  int alarmleft;               // ticks until the next alarm
+  uint64 alarmfn;              // user address of the alarm handler
+  int inalarm;                 // handler running; alarmtf holds the registers
+  struct trapframe alarmtf;    // restored by sigreturn()
+
+  // the address space, shared by p's threads; only used in
+  // the leader (p->mm == p). vmlock must be held when using
+  // these, or when changing the page table:
+  struct spinlock vmlock;
+  uint64 sz;                   // Size of process memory (bytes)
+  uint64 guard;                // exec()'s stack guard page, or 0
+  struct vma vma[NVMA];        // mmap()ed regions
+  struct inode *exe;           // program the segments come from, or 0
+  struct execseg seg[NEXECSEG];
+  int nseg;
+  uint tfslots;                // TFTHREAD(i) in use for each bit i
+  uint64 swapva;               // where swapd's clock hand is, see swap.c
+  struct sleeplock vmalock;    // serializes mmap() and munmap(), which sleep
 };
+
+extern struct proc *proc;      // the process table, linked through nextproc
+extern int nproc;
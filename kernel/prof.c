@@ -0,0 +1,120 @@
+//
+// Sampling profiler.
+//
+// While profiling is on, every CPU records the pc its timer
+// interrupt arrived at, and which process was running, in a
+// ring of its own. profile(PROF_READ) drains the rings; the
+// profile program does so as it goes, and matches the pcs
+// against the .sym files on the file system.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "prof.h"
+
+#define NPROFBUF 256    // samples buffered per CPU
+
+struct profbuf {
+  struct spinlock lock;
+  uint r;               // samples read
+  uint w;               // samples written
+  uint dropped;         // samples lost to a full ring
+  struct profsample buf[NPROFBUF];
+} profbuf[NCPU];
+
+static int profiling;
+
+void
+profinit(void)
+{
+  struct profbuf *pb;
+
+  for(pb = profbuf; pb < &profbuf[NCPU]; pb++)
+    initlock(&pb->lock, "prof");
+}
+
+// Called at a timer interrupt with the interrupted pc.
+// Interrupts are off.
+void
+profsample(uint64 pc, int user)
+{
+  struct profbuf *pb;
+  struct profsample *s;
+  struct proc *p;
+
+  if(!profiling)
+    return;
+  pb = &profbuf[cpuid()];
+  p = myproc();
+  acquire(&pb->lock);
+  if(pb->w - pb->r == NPROFBUF){
+    pb->dropped++;
+  } else {
+    s = &pb->buf[pb->w++ % NPROFBUF];
+    s->pc = pc;
+    s->cpu = cpuid();
+    s->user = user;
+    if(p){
+      s->pid = p->pid;
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    } else {
+      s->pid = 0;
+      safestrcpy(s->name, "-", sizeof(s->name));
+    }
+  }
+  release(&pb->lock);
+}
+
+// profile(int cmd, struct profsample *buf, int n)
+uint64
+sys_profile(void)
+{
+  int cmd, n, i;
+  uint64 buf;
+  struct profbuf *pb;
+  struct profsample s;
+
+  if(argint(0, &cmd) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  switch(cmd){
+  case PROF_START:
+    for(pb = profbuf; pb < &profbuf[NCPU]; pb++){
+      acquire(&pb->lock);
+      pb->r = pb->w = pb->dropped = 0;
+      release(&pb->lock);
+    }
+    profiling = 1;
+    return 0;
+  case PROF_STOP:
+    profiling = 0;
+    n = 0;
+    for(pb = profbuf; pb < &profbuf[NCPU]; pb++)
+      n += pb->dropped;
+    return n;
+  case PROF_READ:
+    // one at a time, since copyout() may sleep.
+    i = 0;
+    for(pb = profbuf; pb < &profbuf[NCPU] && i < n; pb++){
+      for(;;){
+        acquire(&pb->lock);
+        if(pb->r == pb->w || i >= n){
+          release(&pb->lock);
+          break;
+        }
+        s = pb->buf[pb->r++ % NPROFBUF];
+        release(&pb->lock);
+        if(copyout(myproc()->pagetable, buf + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+          return -1;
+        i++;
+      }
+    }
+    return i;
+  }
+  return -1;
+}
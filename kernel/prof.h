@@ -0,0 +1,13 @@
+// profile() commands.
+#define PROF_START  1   // clear the sample buffers and start sampling
+#define PROF_STOP   2   // stop; returns the number of samples dropped
+#define PROF_READ   3   // copy out and remove buffered samples
+
+// One sample, taken by a CPU at a timer interrupt.
+struct profsample {
+  uint64 pc;       // interrupted pc
+  int pid;         // process running, or 0 if none
+  short cpu;
+  short user;      // pc is a user address
+  char name[16];   // process name, to find its .sym file
+};
@@ -1,5 +1,7 @@
 //
-// ramdisk that uses the disk image loaded by qemu -rdinit fs.img
+// RAM disk holding the /tmp file system (device TMPDEV).
+// Its blocks live in kalloc()ed pages, allocated as blocks
+// are first written; blocks never written read as zeros.
 //
 
 #include "types.h"
@@ -11,35 +13,67 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
+
+#define BPP (PGSIZE / BSIZE)   // blocks per page
+
+struct {
+  struct spinlock lock;   // protects the page[] slots
+  char *page[(TMPSIZE + BPP - 1) / BPP];
+} rd;
 
 void
 ramdiskinit(void)
 {
+  initlock(&rd.lock, "ramdisk");
+}
+
+// The page holding block b, allocating it if alloc is set.
+// Returns 0 if it has never been written and alloc is 0.
+static char*
+rdpage(uint b, int alloc)
+{
+  char *pg, *npg;
+
+  pg = rd.page[b / BPP];
+  if(pg || !alloc)
+    return pg;
+  // out of memory: wait for the page cache or an exiting
+  // process to give some back.
+  while((npg = kzalloc(MT_KERNEL)) == 0){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+  acquire(&rd.lock);
+  if((pg = rd.page[b / BPP]) == 0)
+    pg = rd.page[b / BPP] = npg;
+  else
+    kfree(npg);
+  release(&rd.lock);
+  return pg;
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Read or write b, which must be locked. Finishes at once,
+// so b->disk is never set.
 void
-ramdiskrw(struct buf *b)
+ramdiskrw(struct buf *b, int write)
 {
+  char *pg;
+
   if(!holdingsleep(&b->lock))
     panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= TMPSIZE)
     panic("ramdiskrw: blockno too big");
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
-
-  if(b->flags & B_DIRTY){
-    // write
-    memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
+  pg = rdpage(b->blockno, write);
+  if(write){
+    memmove(pg + (b->blockno % BPP) * BSIZE, b->data, BSIZE);
   } else {
-    // read
-    memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+    if(pg)
+      memmove(b->data, pg + (b->blockno % BPP) * BSIZE, BSIZE);
+    else
+      memset(b->data, 0, BSIZE);
+    b->valid = 1;
   }
 }
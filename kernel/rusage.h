@@ -0,0 +1,17 @@
+// getrusage() whos.
+#define RUSAGE_SELF      0   // the calling process
+#define RUSAGE_CHILDREN  1   // its waited-for children, and theirs
+
+// Resources used by a process. Times are in r_time() ticks,
+// 10,000,000 a second on qemu.
+struct rusage {
+  uint64 utime;     // running in user space
+  uint64 stime;     // running in the kernel
+  uint64 nswitch;   // context switches away from it
+  uint64 nfault;    // page faults, including copy-on-write
+  uint64 npages;    // pages kalloc()ed while it ran
+  uint64 nbread;    // blocks read from disk
+  uint64 nbwrite;   // blocks written to disk
+  uint64 npipein;   // bytes read from pipes
+  uint64 npipeout;  // bytes written to pipes
+};
@@ -0,0 +1,183 @@
+//
+// Shared memory segments: shm_open() and shm_unlink().
+//
+// A segment is a named run of zeroed pages that lasts until
+// it is unlinked and the last descriptor for it is closed;
+// a mapping holds a descriptor's file. mmap() with
+// MAP_SHARED maps a segment's descriptor, and mmap_fault()
+// maps the segment's own pages into each process that
+// touches them, taking a reference to the page for each
+// mapping, so producers and consumers exchange data with
+// no copying. Futexes in a segment work between processes,
+// since they are named by physical address.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
+
+struct shm {
+  char name[SHMNAME];
+  int ref;            // open files
+  int linked;         // still has its name
+  int npages;
+  char **page;        // kmalloc()ed; each allocated on first touch
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free sh's pages, once it has no name and no files.
+// Caller must hold shmtab.lock.
+static void
+shmfree(struct shm *sh)
+{
+  int i;
+
+  for(i = 0; i < sh->npages; i++)
+    if(sh->page[i])
+      kfree(sh->page[i]);
+  kmfree(sh->page);
+  sh->page = 0;
+  sh->npages = 0;
+  sh->name[0] = 0;
+}
+
+static struct shm*
+shmlookup(char *name)
+{
+  struct shm *sh;
+
+  for(sh = shmtab.shm; sh < &shmtab.shm[NSHM]; sh++)
+    if(sh->page && strncmp(sh->name, name, SHMNAME) == 0)
+      return sh;
+  return 0;
+}
+
+// Open the segment called name, first making it size bytes
+// long if there is none and size isn't 0. Returns it with a
+// reference for the caller's file, or 0.
+struct shm*
+shmopen(char *name, uint64 size)
+{
+  struct shm *sh;
+  char **page;
+  int n;
+
+  if(name[0] == 0 || size > (uint64)SHMPAGES * PGSIZE)
+    return 0;
+  n = PGROUNDUP(size) / PGSIZE;
+  // the page array, in case the segment is new.
+  page = 0;
+  if(n > 0 && (page = kmalloc(n * sizeof(char*))) == 0)
+    return 0;
+  if(page)
+    memset(page, 0, n * sizeof(char*));
+
+  acquire(&shmtab.lock);
+  if((sh = shmlookup(name)) == 0 && n > 0){
+    for(sh = shmtab.shm; sh < &shmtab.shm[NSHM]; sh++)
+      if(sh->page == 0)
+        break;
+    if(sh == &shmtab.shm[NSHM]){
+      sh = 0;
+    } else {
+      safestrcpy(sh->name, name, SHMNAME);
+      sh->linked = 1;
+      sh->ref = 0;
+      sh->npages = n;
+      sh->page = page;
+      page = 0;
+    }
+  }
+  if(sh)
+    sh->ref++;
+  release(&shmtab.lock);
+  if(page)
+    kmfree(page);
+  return sh;
+}
+
+// Drop a file's reference to sh.
+void
+shmclose(struct shm *sh)
+{
+  acquire(&shmtab.lock);
+  if(--sh->ref == 0 && !sh->linked)
+    shmfree(sh);
+  release(&shmtab.lock);
+}
+
+// The size of sh in bytes.
+uint64
+shmsize(struct shm *sh)
+{
+  return (uint64)sh->npages * PGSIZE;
+}
+
+// Page pgno of sh, allocating it if need be, with a
+// reference for the caller. Returns 0 if pgno is past the
+// end or memory ran out.
+char*
+shmpage(struct shm *sh, uint64 pgno)
+{
+  char *pa, *mem;
+
+  if(pgno >= sh->npages)
+    return 0;
+  mem = 0;
+  for(;;){
+    acquire(&shmtab.lock);
+    if(sh->page[pgno] == 0 && mem){
+      sh->page[pgno] = mem;
+      mem = 0;
+    }
+    if((pa = sh->page[pgno]) != 0)
+      kdup(pa);
+    release(&shmtab.lock);
+    if(pa)
+      break;
+    // allocate without the lock, and look again.
+    if((mem = kzalloc(MT_USER)) == 0)
+      return 0;
+  }
+  if(mem)
+    kfree(mem);  // another process allocated it meanwhile
+  return pa;
+}
+
+// Remove the name of the segment called name; it goes away
+// when the last file for it is closed. Returns 0, or -1 if
+// there is no such segment.
+int
+shmunlink(char *name)
+{
+  struct shm *sh;
+
+  acquire(&shmtab.lock);
+  if((sh = shmlookup(name)) == 0 || !sh->linked){
+    release(&shmtab.lock);
+    return -1;
+  }
+  sh->linked = 0;
+  sh->name[0] = 0;
+  if(sh->ref == 0)
+    shmfree(sh);
+  release(&shmtab.lock);
+  return 0;
+}
@@ -6,8 +6,12 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
+
+// All sleeplocks, for lockstat() (see spinlock.c).
+struct sleeplock *sleeplocks;
+extern int nextlockid;
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -16,30 +20,80 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->readers = lk->wwait = 0;
+  lk->n = lk->nsleep = 0;
+  lk->lastcpu = -1;
+  lk->holdtot = lk->holdmax = 0;
+  lk->id = __sync_fetch_and_add(&nextlockid, 1);
+  do {
+    lk->next = sleeplocks;
+  } while(!__sync_bool_compare_and_swap(&sleeplocks, lk->next, lk));
 }
 
+// A sleeplock is held either exclusively, by one process,
+// through acquiresleep(), or shared, by any number of
+// readers, through acquireshared(). Waiting writers keep new
+// readers out, so a stream of readers can't starve them.
+
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->n++;
+  lk->wwait++;
+  while (lk->locked || lk->readers > 0) {
+    lk->nsleep++;
     sleep(lk, &lk->lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->lastcpu = cpuid();
+  lk->t0 = r_time();
   release(&lk->lk);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+  uint64 t;
+
   acquire(&lk->lk);
+  t = r_time() - lk->t0;
+  lk->holdtot += t;
+  if(t > lk->holdmax)
+    lk->holdmax = t;
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+void
+acquireshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->n++;
+  while (lk->locked || lk->wwait > 0) {
+    lk->nsleep++;
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releaseshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releaseshared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Is the lock held exclusively by this process?
 int
 holdingsleep(struct sleeplock *lk)
 {
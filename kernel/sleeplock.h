@@ -6,5 +6,18 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  int readers;       // Processes holding it shared
+  int wwait;         // Processes waiting to hold it exclusively
+
+  // Statistics, for lockstat(); protected by lk. Hold
+  // times are of exclusive holds only.
+  uint n;            // acquiresleep() calls
+  uint nsleep;       // sleeps waiting for it
+  int id;
+  int lastcpu;
+  uint64 t0;
+  uint64 holdtot;
+  uint64 holdmax;
+  struct sleeplock *next; // in the list of all sleeplocks
 };
 
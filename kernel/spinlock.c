@@ -4,14 +4,19 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
 
-#define NLOCK 1000
-
-static int nlock;
-static struct spinlock *locks[NLOCK];
+// Every lock is on one of two lists, for lockstat(). Locks
+// are never freed, and are pushed onto the front with a
+// compare-and-swap, so the lists can be walked without a
+// lock.
+static struct spinlock *spinlocks;
+extern struct sleeplock *sleeplocks;  // sleeplock.c
+int nextlockid;
 
 // assumes locks are not freed
 void
@@ -20,32 +25,53 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->ticket = lk->serving = 0;
   lk->nts = 0;
   lk->n = 0;
-  if(nlock >= NLOCK)
-    panic("initlock");
-  locks[nlock] = lk;
-  nlock++;
+  lk->lastcpu = -1;
+  lk->holdtot = lk->holdmax = 0;
+  lk->id = __sync_fetch_and_add(&nextlockid, 1);
+  do {
+    lk->next = spinlocks;
+  } while(!__sync_bool_compare_and_swap(&spinlocks, lk->next, lk));
 }
 
+// acquire() and release() come in two builds. By default a
+// spinlock is a ticket lock: each acquirer takes the next
+// ticket with one atomic add and then only reads the serving
+// word until its number comes up, so CPUs are served in
+// order and spinning does not bounce the cache line with
+// writes. Built with TASLOCK, acquire() instead retries a
+// test-and-set on one word, as xv6 always did. Either way,
+// nts counts the times an acquirer found the lock busy and
+// had to go round again.
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void
 acquire(struct spinlock *lk)
 {
+  uint spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  __sync_fetch_and_add(&(lk->n), 1);
-    
+#ifdef TASLOCK
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-     __sync_fetch_and_add(&lk->nts, 1);
+    spins++;
+  }
+#else
+  uint ticket = __sync_fetch_and_add(&lk->ticket, 1);
+  while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != ticket) {
+    spins++;
   }
+  lk->locked = 1;
+#endif
   
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -54,16 +80,28 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for holding() and debugging.
+  // The counters are only written by the holder, so need no
+  // atomic adds.
   lk->cpu = mycpu();
+  lk->n++;
+  lk->nts += spins;
+  lk->lastcpu = cpuid();
+  lk->t0 = r_time();
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint64 t;
+
   if(!holding(lk))
     panic("release");
 
+  t = r_time() - lk->t0;
+  lk->holdtot += t;
+  if(t > lk->holdmax)
+    lk->holdmax = t;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -74,6 +112,7 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TASLOCK
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -82,6 +121,11 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#else
+  // serve the next ticket.
+  lk->locked = 0;
+  __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+#endif
 
   pop_off();
 }
@@ -136,45 +180,97 @@ sys_ntas(void)
 {
   int zero = 0;
   int tot = 0;
+  struct spinlock *lk, *top[5] = { 0 };
+  struct sleeplock *slk;
+  int i, j;
   
   if (argint(0, &zero) < 0) {
     return -1;
   }
   if(zero == 0) {
-    for(int i = 0; i < NLOCK; i++) {
-      if(locks[i] == 0)
-        break;
-      locks[i]->nts = 0;
-      locks[i]->n = 0;
+    for(lk = spinlocks; lk; lk = lk->next) {
+      lk->nts = 0;
+      lk->n = 0;
+      lk->holdtot = lk->holdmax = 0;
+    }
+    for(slk = sleeplocks; slk; slk = slk->next) {
+      slk->nsleep = 0;
+      slk->n = 0;
+      slk->holdtot = slk->holdmax = 0;
     }
     return 0;
   }
 
   printf("=== lock kmem/bcache stats\n");
-  for(int i = 0; i < NLOCK; i++) {
-    if(locks[i] == 0)
-      break;
-    if(strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
-       strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0) {
-      tot += locks[i]->nts;
-      print_lock(locks[i]);
+  for(lk = spinlocks; lk; lk = lk->next) {
+    if(strncmp(lk->name, "bcache", strlen("bcache")) == 0 ||
+       strncmp(lk->name, "kmem", strlen("kmem")) == 0) {
+      tot += lk->nts;
+      print_lock(lk);
     }
   }
 
   printf("=== top 5 contended locks:\n");
-  int last = 100000000;
-  // stupid way to compute top 5 contended locks
-  for(int t= 0; t < 5; t++) {
-    int top = 0;
-    for(int i = 0; i < NLOCK; i++) {
-      if(locks[i] == 0)
-        break;
-      if(locks[i]->nts > locks[top]->nts && locks[i]->nts < last) {
-        top = i;
-      }
-    }
-    print_lock(locks[top]);
-    last = locks[top]->nts;
+  // insert each lock into the sorted top 5.
+  for(lk = spinlocks; lk; lk = lk->next) {
+    for(i = 0; i < 5 && top[i] && top[i]->nts >= lk->nts; i++)
+      ;
+    if(i == 5)
+      continue;
+    for(j = 4; j > i; j--)
+      top[j] = top[j-1];
+    top[i] = lk;
   }
+  for(i = 0; i < 5 && top[i]; i++)
+    print_lock(top[i]);
   return tot;
 }
+
+// lockstat(struct lockstat *buf, int n): copy out the
+// statistics of up to n locks, spinlocks first, and return
+// how many locks there are.
+uint64
+sys_lockstat(void)
+{
+  uint64 buf;
+  int n, i;
+  struct spinlock *lk;
+  struct sleeplock *slk;
+  struct lockstat ls;
+  pagetable_t pagetable = myproc()->pagetable;
+
+  if(argaddr(0, &buf) < 0 || argint(1, &n) < 0)
+    return -1;
+  i = 0;
+  for(lk = spinlocks; lk; lk = lk->next, i++){
+    if(i >= n)
+      continue;
+    memset(&ls, 0, sizeof(ls));
+    safestrcpy(ls.name, lk->name, sizeof(ls.name));
+    ls.id = lk->id;
+    ls.kind = LS_SPIN;
+    ls.cpu = lk->lastcpu;
+    ls.nacquire = lk->n;
+    ls.ncontend = lk->nts;
+    ls.holdtot = lk->holdtot;
+    ls.holdmax = lk->holdmax;
+    if(copyout(pagetable, buf + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  for(slk = sleeplocks; slk; slk = slk->next, i++){
+    if(i >= n)
+      continue;
+    memset(&ls, 0, sizeof(ls));
+    safestrcpy(ls.name, slk->name, sizeof(ls.name));
+    ls.id = slk->id;
+    ls.kind = LS_SLEEP;
+    ls.cpu = slk->lastcpu;
+    ls.nacquire = slk->n;
+    ls.ncontend = slk->nsleep;
+    ls.holdtot = slk->holdtot;
+    ls.holdmax = slk->holdmax;
+    if(copyout(pagetable, buf + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  return i;
+}
@@ -1,11 +1,21 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint ticket;       // ticket lock: next ticket to hand out
+  uint serving;      // ticket lock: ticket now served
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-  uint n;
-  uint nts;
+
+  // Statistics, for lockstat():
+  uint n;            // acquire() calls
+  uint nts;          // spins finding it held
+  int id;
+  int lastcpu;       // cpu that last acquired it
+  uint64 t0;         // r_time() at acquisition
+  uint64 holdtot;
+  uint64 holdmax;
+  struct spinlock *next; // in the list of all spinlocks
 };
 
@@ -13,6 +13,9 @@ __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 // scratch area for timer interrupt, one per CPU.
 uint64 mscratch0[NCPU * 32];
 
+// cycles between clock interrupts; about 1/10th second in qemu.
+#define INTERVAL 1000000
+
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
@@ -41,6 +44,11 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let supervisor mode read the time CSR, for r_time().
+  w_mcounteren(r_mcounteren() | 2);
+  // and user mode, for clock_cycles().
+  w_scounteren(r_scounteren() | 2);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -49,8 +57,8 @@ start()
   asm volatile("mret");
 }
 
-// set up to receive timer interrupts in machine mode,
-// which arrive at timervec in kernelvec.S,
+// set up to receive timer interrupts and IPIs in machine
+// mode, which arrive at timervec in kernelvec.S,
 // which turns them into software interrupts for
 // devintr() in trap.c.
 void
@@ -60,16 +68,19 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + INTERVAL;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
   // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[6] : set by timervec on a timer interrupt, see clockticked().
+  // scratch[7] : address of CLINT MSIP register, for IPIs.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
-  scratch[5] = interval;
+  scratch[5] = INTERVAL;
+  scratch[6] = 0;
+  scratch[7] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -78,6 +89,39 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// Stop this CPU's clock interrupts, while it is idle. The
+// far-off deadline leaves room for timervec's additions.
+void
+timerstop(void)
+{
+  *(uint64*)KCLINT_MTIMECMP(cpuid()) = ~0UL >> 1;
+}
+
+// Start them again, a full interval from now.
+void
+timerstart(void)
+{
+  *(uint64*)KCLINT_MTIMECMP(cpuid()) = *(uint64*)KCLINT_MTIME + INTERVAL;
+}
+
+// Send CPU id an IPI: timervec there raises a supervisor
+// software interrupt, as for a clock interrupt, which
+// brings it out of wfi.
+void
+ipi(int id)
+{
+  *(uint32*)KCLINT_MSIP(id) = 1;
+}
+
+// Whether a clock interrupt has come to this CPU since the
+// last call; if not, a software interrupt was an IPI. The
+// swap can't be split by timervec, which sets the flag.
+int
+clockticked(void)
+{
+  return __sync_lock_test_and_set(&mscratch0[32 * cpuid() + 6], 0) != 0;
 }
@@ -8,4 +8,11 @@ struct stat {
   short type;  // Type of file
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
+  uint rawin;  // Current readahead window in blocks
+};
+
+// readv() and writev() buffers.
+struct iovec {
+  void *base;
+  uint64 len;
 };
@@ -0,0 +1,15 @@
+// One system call for submit() to make. op is its number
+// and arg its first arguments; submit() fills in res with
+// what it returned. With SQE_LINK, arg[0] is instead the
+// result of the earlier entry link, and the call is skipped,
+// returning -1, if that result was negative; so an open()
+// can be followed by calls on the descriptor it returns.
+struct sqe {
+  uint64 res;   // first, at the entry's own address
+  int op;
+  int flags;
+  int link;
+  uint64 arg[4];
+};
+
+#define SQE_LINK 0x1
@@ -0,0 +1,340 @@
+//
+// Swapping: when memory runs out, the swapd kernel process
+// writes user pages out to a swap area on disk SWAPDISK,
+// past that disk's share of the file system, and frees
+// them; vmfault() reads a page back in when the process
+// touches it again.
+//
+// A swapped-out page's PTE has PTE_V clear and PTE_SWAP set,
+// keeps the page's other flags, and names its swap slot in
+// place of a physical address. fork() shares slots as it
+// shares pages, so each slot has a count of the PTEs naming
+// it, and is free when that is 0.
+//
+// swapd picks pages with a clock: it visits processes in
+// turn and walks each one's pages from where it stopped the
+// last time (p->swapva), clearing PTE_A on pages that were
+// used since, and evicting those that weren't. It takes only
+// pages below p->sz that no one else holds a reference to,
+// so never page cache, mapped file or shared memory pages,
+// and only from processes that are not running and have no
+// threads, so that no CPU has a stale TLB entry for a page
+// it evicts: a process switches page tables, and flushes its
+// TLB, each time it is scheduled.
+//
+// A page is unmapped first and then written out, so a fault
+// may come for it while the write is under way; the slot
+// keeps the page until the write is done, and the fault
+// copies it from there.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define BPP (PGSIZE / BSIZE)       // blocks per page
+#define NSLOT (NSWAP / BPP)        // swap slots, a page each
+#define SWAPSTART (FSSIZE / NDISK) // first block of swap on SWAPDISK
+#define SWAPBATCH 16               // pages written out at a time
+#define SWAPSCAN 64                // PTEs looked at per process visit
+#define SWAPFREE 256               // free pages swapd wants
+
+#define SWAPPTE(s, flags) (PA2PTE((uint64)(s) * PGSIZE) | PTE_SWAP | (flags))
+#define PTE2SLOT(pte) (PTE2PA(pte) / PGSIZE)
+
+struct {
+  struct spinlock lock;
+  ushort ref[NSLOT];  // PTEs naming each slot, and readers and writers
+  char *pa[NSLOT];    // page being written out to each slot, if any
+  int next;           // where to look for a free slot
+  int nused;
+  int want;           // someone ran out of memory; swapd sleeps on this
+  uint gen;           // passes swapd has made; faults wait on this
+  int freed;          // did the last pass leave memory free?
+  struct proc *hand;  // next process for the clock to visit
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Read or write swap slot s from or to page pa, and wait.
+static void
+swapio(int s, char *pa, int write)
+{
+  struct buf b[BPP], *bs[BPP];
+  int i;
+
+  memset(b, 0, sizeof(b));
+  for(i = 0; i < BPP; i++){
+    b[i].blockno = SWAPSTART + s * BPP + i;
+    b[i].data = (uchar*)pa + i * BSIZE;
+    bs[i] = &b[i];
+  }
+  virtio_disk_submit(SWAPDISK, bs, BPP, SWAPSTART + s * BPP, write);
+  for(i = 0; i < BPP; i++)
+    virtio_disk_wait(SWAPDISK, &b[i]);
+}
+
+// A free slot, with one reference, or -1.
+// Caller must hold swap.lock.
+static int
+slotalloc(void)
+{
+  int i, s;
+
+  for(i = 0; i < NSLOT; i++){
+    s = (swap.next + i) % NSLOT;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = (s + 1) % NSLOT;
+      swap.nused++;
+      return s;
+    }
+  }
+  return -1;
+}
+
+// Drop a reference to slot s.
+// Caller must hold swap.lock.
+static void
+slotput(int s)
+{
+  if(swap.ref[s] == 0)
+    panic("slotput");
+  if(--swap.ref[s] == 0)
+    swap.nused--;
+}
+
+// Another PTE names the slot swapped-out PTE pte names.
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(swap.ref[PTE2SLOT(pte)] == 0xFFFF)
+    panic("swapdup");
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// A PTE naming a slot is gone.
+void
+swapfree(pte_t pte)
+{
+  acquire(&swap.lock);
+  slotput(PTE2SLOT(pte));
+  release(&swap.lock);
+}
+
+// Bring the page at va in mm's address space back from
+// swap, unless another thread already has.
+// Returns 0, or -1 if out of memory.
+int
+swapin(struct proc *mm, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem, *pa;
+  int s;
+
+  if((mem = kalloc(MT_USER)) == 0)
+    return -1;
+  acquire(&mm->vmlock);
+  if((pte = walk(mm->pagetable, va, 0)) == 0 || (*pte & PTE_SWAP) == 0){
+    release(&mm->vmlock);
+    kfree(mem);
+    return 0;
+  }
+  old = *pte;
+  s = PTE2SLOT(old);
+  acquire(&swap.lock);
+  swap.ref[s]++;  // hold s while reading it
+  if((pa = swap.pa[s]) != 0)
+    memmove(mem, pa, PGSIZE);  // still being written out
+  release(&swap.lock);
+  release(&mm->vmlock);
+
+  if(pa == 0)
+    swapio(s, mem, 0);
+
+  acquire(&mm->vmlock);
+  acquire(&swap.lock);
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && *pte == old){
+    *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V;
+    mem = 0;
+    slotput(s);
+  }
+  slotput(s);
+  release(&swap.lock);
+  release(&mm->vmlock);
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Can swapd take pages from p? Only from a user process
+// that isn't running and has no threads.
+// Caller must hold p->lock.
+static int
+swappable(struct proc *p)
+{
+  return (p->state == SLEEPING || p->state == RUNNABLE) &&
+    p->mm == p && p->tfslots == 0 && p->pagetable != 0 && p->kfn == 0;
+}
+
+// Visit p with the clock: unmap up to max of its pages that
+// haven't been used since the last visit, giving each a slot,
+// and return them in pas[] and their slots in slots[].
+// Caller must hold p->lock and p->vmlock.
+static int
+swapscan(struct proc *p, char **pas, int *slots, int max)
+{
+  pte_t *pte;
+  uint64 va, pa;
+  int i, n, s;
+
+  n = 0;
+  va = p->swapva;
+  for(i = 0; i < SWAPSCAN && n < max && p->sz > 0; i++, va += PGSIZE){
+    if(va >= p->sz)
+      va = 0;
+    if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0 ||
+       (*pte & PTE_U) == 0 || !PTE_LEAF(*pte))
+      continue;
+    if(*pte & PTE_A){
+      // used since the last visit; a second chance.
+      *pte &= ~PTE_A;
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    if(krefcnt((void*)pa) != 1 || mmap_inrange(p, va, va + PGSIZE))
+      continue;
+    acquire(&swap.lock);
+    if((s = slotalloc()) >= 0){
+      swap.ref[s]++;  // swapd's, until written
+      swap.pa[s] = (char*)pa;
+    }
+    release(&swap.lock);
+    if(s < 0)
+      break;  // swap is full
+    *pte = SWAPPTE(s, PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D));
+    pas[n] = (char*)pa;
+    slots[n] = s;
+    n++;
+  }
+  p->swapva = va;
+  return n;
+}
+
+// Write out and free up to SWAPBATCH pages, from the next
+// processes the clock comes to. Returns how many.
+static int
+swapout(void)
+{
+  char *pas[SWAPBATCH];
+  int slots[SWAPBATCH];
+  struct proc *p;
+  int i, n, visits;
+
+  n = 0;
+  for(visits = 0; visits < nproc && n < SWAPBATCH; visits++){
+    if((p = swap.hand) == 0)
+      p = proc;
+    swap.hand = p->nextproc;
+    acquire(&p->lock);
+    if(swappable(p)){
+      acquire(&p->vmlock);
+      n += swapscan(p, pas + n, slots + n, SWAPBATCH - n);
+      release(&p->vmlock);
+    }
+    release(&p->lock);
+  }
+
+  for(i = 0; i < n; i++){
+    swapio(slots[i], pas[i], 1);
+    acquire(&swap.lock);
+    swap.pa[slots[i]] = 0;
+    slotput(slots[i]);
+    release(&swap.lock);
+    kfree(pas[i]);
+  }
+  return n;
+}
+
+// Body of the swapd kernel process: when woken because
+// memory ran out, swap pages out until SWAPFREE pages are
+// free or there is nothing more it can take, then wake the
+// processes waiting for memory.
+void
+swapd(void)
+{
+  int n, total;
+
+  for(;;){
+    acquire(&swap.lock);
+    while(!swap.want)
+      sleep(&swap.want, &swap.lock);
+    swap.want = 0;
+    release(&swap.lock);
+
+    total = 0;
+    while(kfreepages() < SWAPFREE && (n = swapout()) > 0)
+      total += n;
+
+    acquire(&swap.lock);
+    swap.gen++;
+    swap.freed = total > 0 || kfreepages() >= SWAPFREE;
+    wakeup(&swap.gen);
+    release(&swap.lock);
+  }
+}
+
+// Ask swapd to free some memory, without waiting; kalloc()
+// calls this when it runs out.
+void
+swapkick(void)
+{
+  if(swap.want)
+    return;
+  acquire(&swap.lock);
+  swap.want = 1;
+  wakeup(&swap.want);
+  release(&swap.lock);
+}
+
+// Wait for swapd to free some memory, for a process that
+// ran out. Returns 1 if it did, so that the caller should
+// try again, or 0 if it couldn't or the caller was killed.
+int
+swapwait(void)
+{
+  struct proc *p = myproc();
+  uint gen;
+  int ok;
+
+  acquire(&swap.lock);
+  gen = swap.gen;
+  swap.want = 1;
+  wakeup(&swap.want);
+  while(swap.gen == gen && !p->killed)
+    sleep(&swap.gen, &swap.lock);
+  ok = swap.gen != gen && swap.freed;
+  release(&swap.lock);
+  return ok;
+}
+
+// Fill in memstat()'s swap counts.
+void
+swapstat(struct memstat *ms)
+{
+  ms->swap = NSLOT;
+  ms->swapused = swap.nused;
+}
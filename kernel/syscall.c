@@ -3,16 +3,20 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "sysstat.h"
+#include "submit.h"
 #include "defs.h"
+#include "memstat.h"
 
 // Fetch the uint64 at addr from the current process.
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -105,6 +109,35 @@ extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_ntas(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_setprio(void);
+extern uint64 sys_waitpid(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_trace(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_sigalarm(void);
+extern uint64 sys_sigreturn(void);
+extern uint64 sys_submit(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_getaffinity(void);
+extern uint64 sys_shm_open(void);
+extern uint64 sys_shm_unlink(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -129,20 +162,196 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_ntas]    sys_ntas,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_spawn]   sys_spawn,
+[SYS_splice]  sys_splice,
+[SYS_fsync]   sys_fsync,
+[SYS_setprio] sys_setprio,
+[SYS_waitpid] sys_waitpid,
+[SYS_clone]   sys_clone,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_lockstat] sys_lockstat,
+[SYS_sysstat] sys_sysstat,
+[SYS_profile] sys_profile,
+[SYS_trace]   sys_trace,
+[SYS_getrusage] sys_getrusage,
+[SYS_getdents] sys_getdents,
+[SYS_sigalarm] sys_sigalarm,
+[SYS_sigreturn] sys_sigreturn,
+[SYS_submit]  sys_submit,
+[SYS_poll]    sys_poll,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_memstat] sys_memstat,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
+[SYS_shm_open] sys_shm_open,
+[SYS_shm_unlink] sys_shm_unlink,
 };
 
+// Each CPU keeps its own system-wide statistics, so that
+// counting needs neither a lock nor atomic adds.
+static struct sysstat sysstats[NCPU][NSYSCALL];
+
+// Account a call to system call num that took t ticks.
+static void
+sysacct(struct proc *p, int num, uint64 t)
+{
+  struct sysstat *s;
+  uint64 x;
+  int b;
+
+  if(num >= NSYSCALL)
+    panic("sysacct: raise NSYSCALL");
+  p->sysn[num]++;
+  p->systime[num] += t;
+  b = 0;
+  for(x = t; x > 1 && b < NSYSHIST-1; x >>= 1)
+    b++;
+  push_off();
+  s = &sysstats[cpuid()][num];
+  s->count++;
+  s->time += t;
+  s->hist[b]++;
+  pop_off();
+}
+
 void
 syscall(void)
 {
   int num;
   struct proc *p = myproc();
+  uint64 t0;
 
   num = p->tf->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    t0 = r_time();
     p->tf->a0 = syscalls[num]();
+    sysacct(p, num, r_time() - t0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->tf->a0 = -1;
   }
 }
+
+// The calls submit() will make: those that neither change
+// nor depend on the trapframe, and leave the process as it is.
+static char batchable[NELEM(syscalls)] = {
+[SYS_read]    1,
+[SYS_write]   1,
+[SYS_open]    1,
+[SYS_close]   1,
+[SYS_fstat]   1,
+[SYS_dup]     1,
+[SYS_link]    1,
+[SYS_unlink]  1,
+[SYS_mkdir]   1,
+[SYS_mknod]   1,
+[SYS_fsync]   1,
+[SYS_getdents] 1,
+[SYS_getpid]  1,
+[SYS_uptime]  1,
+[SYS_pread]   1,
+[SYS_pwrite]  1,
+[SYS_readv]   1,
+[SYS_writev]  1,
+};
+
+// submit(struct sqe *q, int n): make the n system calls in
+// q, in order, with one trap, setting each entry's res.
+// Returns how many were made, which is less than n only if
+// q is bad part way or the process was killed.
+uint64
+sys_submit(void)
+{
+  struct proc *p = myproc();
+  struct trapframe *tf = p->tf;
+  struct sqe e;
+  uint64 q, res, t0;
+  int n, i;
+
+  if(argaddr(0, &q) < 0 || argint(1, &n) < 0)
+    return -1;
+  for(i = 0; i < n && !p->killed; i++){
+    if(copyin(p->pagetable, (char*)&e, q + i*sizeof(e), sizeof(e)) < 0)
+      break;
+    res = -1;
+    if(e.flags & SQE_LINK){
+      if(e.link < 0 || e.link >= i ||
+         copyin(p->pagetable, (char*)&e.arg[0],
+                q + e.link*sizeof(e), sizeof(uint64)) < 0 ||
+         (int)e.arg[0] < 0)
+        goto done;
+    }
+    if(e.op <= 0 || e.op >= NELEM(syscalls) || !batchable[e.op])
+      goto done;
+    // the calls fetch their arguments from the trapframe,
+    // which syscall() sets a0 of when submit() returns.
+    tf->a0 = e.arg[0];
+    tf->a1 = e.arg[1];
+    tf->a2 = e.arg[2];
+    tf->a3 = e.arg[3];
+    t0 = r_time();
+    res = syscalls[e.op]();
+    sysacct(p, e.op, r_time() - t0);
+  done:
+    if(copyout(p->pagetable, q + i*sizeof(e), (char*)&res, sizeof(res)) < 0)
+      break;
+  }
+  return i;
+}
+
+// sysstat(int pid, struct sysstat *buf, int n): copy out the
+// statistics of system calls 0 to n-1, those of process pid,
+// or system-wide if pid is 0. Returns how many system call
+// numbers there are.
+uint64
+sys_sysstat(void)
+{
+  int pid, n, i, c, b, found;
+  uint64 buf;
+  struct sysstat st;
+  uint *sysn;
+  uint64 *systime;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n > NSYSCALL)
+    n = NSYSCALL;
+
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      memset(&st, 0, sizeof(st));
+      for(c = 0; c < NCPU; c++){
+        st.count += sysstats[c][i].count;
+        st.time += sysstats[c][i].time;
+        for(b = 0; b < NSYSHIST; b++)
+          st.hist[b] += sysstats[c][i].hist[b];
+      }
+      if(copyout(myproc()->pagetable, buf + i*sizeof(st), (char*)&st, sizeof(st)) < 0)
+        return -1;
+    }
+    return NSYSCALL;
+  }
+
+  // copy p's counters out from under p->lock, since copyout()
+  // may sleep.
+  if((sysn = (uint*)kalloc(MT_KERNEL)) == 0)
+    return -1;
+  systime = (uint64*)(sysn + NSYSCALL);
+  found = getsysacct(pid, sysn, systime) == 0;
+  for(i = 0; found && i < n; i++){
+    memset(&st, 0, sizeof(st));
+    st.count = sysn[i];
+    st.time = systime[i];
+    if(copyout(myproc()->pagetable, buf + i*sizeof(st), (char*)&st, sizeof(st)) < 0)
+      found = 0;
+  }
+  kfree(sysn);
+  return found ? NSYSCALL : -1;
+}
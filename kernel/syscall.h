@@ -23,3 +23,32 @@
 
 // System calls for labs
 #define SYS_ntas   22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_spawn  25
+#define SYS_splice 26
+#define SYS_fsync  27
+#define SYS_setprio 28
+#define SYS_waitpid 29
+#define SYS_clone  30
+#define SYS_futex_wait 31
+#define SYS_futex_wake 32
+#define SYS_lockstat 33
+#define SYS_sysstat 34
+#define SYS_profile 35
+#define SYS_trace  36
+#define SYS_getrusage 37
+#define SYS_getdents 38
+#define SYS_sigalarm 39
+#define SYS_sigreturn 40
+#define SYS_submit 41
+#define SYS_poll   42
+#define SYS_pread  43
+#define SYS_pwrite 44
+#define SYS_readv  45
+#define SYS_writev 46
+#define SYS_memstat 47
+#define SYS_setaffinity 48
+#define SYS_getaffinity 49
+#define SYS_shm_open 50
+#define SYS_shm_unlink 51
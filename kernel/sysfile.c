@@ -10,11 +10,12 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "memstat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +27,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= myproc()->nofile || (f=myproc()->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -43,13 +44,14 @@ fdalloc(struct file *f)
   int fd;
   struct proc *p = myproc();
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
+  for(fd = 0; fd < p->nofile; fd++){
+    if(p->ofile[fd] == 0)
+      break;
   }
-  return -1;
+  if(ofilegrow(&p->ofile, &p->nofile, fd) < 0)
+    return -1;
+  p->ofile[fd] = f;
+  return fd;
 }
 
 uint64
@@ -91,6 +93,126 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// pread(fd, buf, n, off), pwrite(fd, buf, n, off): read or
+// write at offset off of a file, leaving its offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, (uint64*)&iov.base) < 0 ||
+     argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, (uint64*)&iov.base) < 0 ||
+     argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the array of n iovecs whose address is system call
+// argument arg into a kmalloc()ed copy. Returns it, or 0 if
+// the array or any of its lengths is bad.
+static struct iovec*
+argiov(int arg, int n)
+{
+  struct iovec *iov;
+  uint64 addr, tot;
+  int i;
+
+  if(argaddr(arg, &addr) < 0 || n < 0 || n > MAXIOV)
+    return 0;
+  if((iov = kmalloc(n * sizeof(*iov) + 1)) == 0)
+    return 0;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, n * sizeof(*iov)) < 0)
+    goto bad;
+  tot = 0;
+  for(i = 0; i < n; i++){
+    // the total must fit in the int returned.
+    if(iov[i].len > 0x7fffffff || (tot += iov[i].len) > 0x7fffffff)
+      goto bad;
+  }
+  return iov;
+
+ bad:
+  kmfree(iov);
+  return 0;
+}
+
+// readv(fd, iov, n), writev(fd, iov, n): read or write the
+// n buffers iov describes, in order, as one request.
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int n, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || (iov = argiov(1, n)) == 0)
+    return -1;
+  r = filereadv(f, iov, n, -1);
+  kmfree(iov);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int n, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || (iov = argiov(1, n)) == 0)
+    return -1;
+  r = filewritev(f, iov, n, -1);
+  kmfree(iov);
+  return r;
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  pcflush(f->ip);
+  log_force(f->ip->dev);
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
@@ -115,6 +237,21 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// getdents(fd, buf, n): read the next of directory fd's
+// entries into buf, as many whole struct dirstats as fit in
+// n bytes. Returns the number of bytes, 0 at the end.
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 buf;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filegetdents(f, buf, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -125,7 +262,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op(ROOTDEV);
+  begin_opn(ROOTDEV, LINKOPBLOCKS);
   if((ip = namei(old)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -165,34 +302,17 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op(ROOTDEV);
+  begin_opn(ROOTDEV, LINKOPBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -206,6 +326,10 @@ sys_unlink(void)
 
   if((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  if(mounted(ip)){
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
@@ -215,9 +339,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -283,17 +405,13 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path with omode, as open() does.
+// Returns a new file reference, or 0.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op(ROOTDEV);
 
@@ -301,33 +419,31 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op(ROOTDEV);
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op(ROOTDEV);
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op(ROOTDEV);
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op(ROOTDEV);
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op(ROOTDEV);
-    return -1;
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -345,6 +461,25 @@ sys_open(void)
   iunlock(ip);
   end_op(ROOTDEV);
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -391,7 +526,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op(ROOTDEV);
+  begin_opn(ROOTDEV, FREEOPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -409,19 +544,27 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user argument vector at uargv into argv[MAXARG],
+// one kalloc()ed page per string. Returns 0, or -1 with
+// nothing left allocated.
+static int
+fetchargv(uint64 uargv, char **argv)
+{
+  int i;
+  uint64 uarg;
+
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -431,24 +574,119 @@ sys_exec(void)
       argv[i] = 0;
       break;
     }
-    argv[i] = kalloc();
+    argv[i] = kalloc(MT_KERNEL);
     if(argv[i] == 0)
-      panic("sys_exec kalloc");
+      panic("fetchargv kalloc");
     if(fetchstr(uarg, argv[i], PGSIZE) < 0){
       goto bad;
     }
   }
+  return 0;
+
+ bad:
+  freeargv(argv);
+  return -1;
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
   int ret = exec(path, argv);
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  freeargv(argv);
+  return ret;
+}
 
+// Apply one spawn() file action to a child's file table
+// *pofile, which has *pn entries.
+static int
+spawnact(struct file ***pofile, int *pn, struct spawnact *act)
+{
+  char path[MAXPATH];
+  struct file *f, **ofile;
+
+  if(ofilegrow(pofile, pn, act->fd) < 0)
+    return -1;
+  ofile = *pofile;
+  if(act->type == SPAWN_DUP2){
+    if(act->srcfd < 0 || act->srcfd >= *pn || (f = ofile[act->srcfd]) == 0)
+      return -1;
+    if(act->srcfd == act->fd)
+      return 0;
+    filedup(f);
+  } else if(act->type == SPAWN_CLOSE){
+    f = 0;
+  } else if(act->type == SPAWN_OPEN){
+    if(fetchstr((uint64)act->path, path, MAXPATH) < 0)
+      return -1;
+    if((f = openfile(path, act->omode)) == 0)
+      return -1;
+  } else {
+    return -1;
+  }
+  if(ofile[act->fd])
+    fileclose(ofile[act->fd]);
+  ofile[act->fd] = f;
+  return 0;
+}
+
+// spawn(path, argv, actions): start path in a new child
+// process with the caller's open files, modified by the
+// actions list (which may be 0), instead of fork()+exec().
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file **ofile;
+  struct spawnact act;
+  uint64 uargv, uact;
+  struct proc *p = myproc();
+  int i, n, ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uact) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  ofile = 0;
+  n = 0;
+  if(ofilegrow(&ofile, &n, p->nofile-1) < 0){
+    freeargv(argv);
+    return -1;
+  }
+  for(i = 0; i < p->nofile; i++)
+    ofile[i] = p->ofile[i] ? filedup(p->ofile[i]) : 0;
+  for(i = 0; uact != 0; i++, uact += sizeof(act)){
+    if(i >= MAXSPAWNACT)
+      goto bad;
+    if(copyin(p->pagetable, (char*)&act, uact, sizeof(act)) < 0)
+      goto bad;
+    if(act.type == SPAWN_END)
+      break;
+    if(spawnact(&ofile, &n, &act) < 0)
+      goto bad;
+  }
+
+  ret = spawn(path, argv, ofile, n);
+  freeargv(argv);
   return ret;
 
  bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  for(i = 0; i < n; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  kmfree(ofile);
+  freeargv(argv);
   return -1;
 }
 
@@ -483,3 +721,46 @@ sys_pipe(void)
   return 0;
 }
 
+
+// shm_open(name, size): a descriptor for the shared memory
+// segment called name, which mmap() maps. If there is none
+// and size isn't 0, makes one of size bytes, zeroed.
+uint64
+sys_shm_open(void)
+{
+  char name[SHMNAME];
+  struct file *f;
+  struct shm *sh;
+  uint64 size;
+  int fd;
+
+  if(argstr(0, name, sizeof(name)) < 0 || argaddr(1, &size) < 0)
+    return -1;
+  if((sh = shmopen(name, size)) == 0)
+    return -1;
+  if((f = filealloc()) == 0){
+    shmclose(sh);
+    return -1;
+  }
+  f->type = FD_SHM;
+  f->shm = sh;
+  f->readable = 1;
+  f->writable = 1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// shm_unlink(name): remove a segment's name. It goes away
+// once nothing has it open or mapped.
+uint64
+sys_shm_unlink(void)
+{
+  char name[SHMNAME];
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  return shmunlink(name);
+}
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 
 uint64
@@ -38,16 +39,36 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_waitpid(void)
+{
+  int pid, options;
+  uint64 p;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &p) < 0 || argint(2, &options) < 0)
+    return -1;
+  return waitpid(pid, p, options);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
 uint64
 sys_sbrk(void)
 {
-  int addr;
+  uint64 addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -83,6 +104,82 @@ sys_kill(void)
   return kill(pid);
 }
 
+// setprio(pid, prio): change a process's scheduling class.
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 p;
+
+  if(argint(0, &who) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return getrusage(who, p);
+}
+
+uint64
+sys_setprio(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setprio(pid, prio);
+}
+
+// setaffinity(pid, mask): run only on the CPUs in mask.
+// getaffinity(pid): the CPUs a process may run on.
+uint64
+sys_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return 0;
+  return getaffinity(pid);
+}
+
+// sigalarm(n, fn): call fn every n ticks the process runs,
+// or stop if n is 0. fn ends by calling sigreturn().
+uint64
+sys_sigalarm(void)
+{
+  struct proc *p = myproc();
+  uint64 fn;
+  int n;
+
+  if(argint(0, &n) < 0 || argaddr(1, &fn) < 0 || n < 0)
+    return -1;
+  p->alarmfn = fn;
+  p->alarmleft = n;
+  p->alarmticks = n;
+  return 0;
+}
+
+// Return from an alarm handler to where the alarm came,
+// with every register as it was.
+uint64
+sys_sigreturn(void)
+{
+  struct proc *p = myproc();
+
+  if(!p->inalarm)
+    return -1;
+  *p->tf = p->alarmtf;
+  p->inalarm = 0;
+  return p->tf->a0;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -0,0 +1,13 @@
+#define NSYSHIST 24   // latency histogram buckets
+
+// Statistics for one system call, as copied out by
+// sysstat(). Times are in r_time() ticks, 10,000,000 a
+// second on qemu, from entry to syscall() until it returns.
+struct sysstat {
+  uint64 count;
+  uint64 time;
+  // hist[i] counts calls taking [2^i, 2^(i+1)) ticks; hist[0]
+  // also those under one, and the last those above.
+  // Only kept system-wide, not per process.
+  uint64 hist[NSYSHIST];
+};
@@ -0,0 +1,8 @@
+// the page at TIMEPAGE, which the kernel keeps up to date and
+// every process can read, so that reading the clock doesn't
+// need a system call.
+struct timepage {
+  volatile uint ticks;    // as uptime() returns
+  uint64 boot;            // r_time() when the kernel booted
+  uint64 hz;              // r_time() counts per second
+};
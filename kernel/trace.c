@@ -0,0 +1,111 @@
+//
+// Trace events.
+//
+// A tracepoint, TRACE(type, a0, a1), costs a load and a
+// branch unless tracemask enables its type. Then it appends
+// an event to its CPU's ring, which only that CPU writes,
+// with interrupts off, and only trace(TRACE_READ) reads, so
+// neither side needs a lock: the writer publishes an event
+// by advancing w after filling it in, the reader frees its
+// slot by advancing r after copying it. An event that finds
+// the ring full is counted and dropped.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "trace.h"
+
+#define NTRACEBUF 1024  // events buffered per CPU
+
+struct tracebuf {
+  uint r;               // events read
+  uint w;               // events written
+  uint dropped;
+  struct traceev ev[NTRACEBUF];
+} tracebuf[NCPU];
+
+uint tracemask;
+static struct sleeplock readlock;  // one reader at a time
+
+void
+traceinit(void)
+{
+  initsleeplock(&readlock, "trace");
+}
+
+void
+tracerec(int type, uint64 a0, uint64 a1)
+{
+  struct tracebuf *tb;
+  struct traceev *e;
+  struct proc *p;
+  uint w;
+
+  p = myproc();
+  push_off();
+  tb = &tracebuf[cpuid()];
+  w = tb->w;
+  if(w - __atomic_load_n(&tb->r, __ATOMIC_ACQUIRE) >= NTRACEBUF){
+    tb->dropped++;
+  } else {
+    e = &tb->ev[w % NTRACEBUF];
+    e->time = r_time();
+    e->type = type;
+    e->cpu = cpuid();
+    e->pid = p ? p->pid : 0;
+    e->a0 = a0;
+    e->a1 = a1;
+    __atomic_store_n(&tb->w, w + 1, __ATOMIC_RELEASE);
+  }
+  pop_off();
+}
+
+// trace(int cmd, struct traceev *buf, int n)
+uint64
+sys_trace(void)
+{
+  int cmd, n, i;
+  uint64 buf;
+  uint r, w, old;
+  struct tracebuf *tb;
+
+  if(argint(0, &cmd) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  switch(cmd){
+  case TRACE_MASK:
+    old = tracemask;
+    tracemask = n;
+    return old;
+  case TRACE_LOST:
+    n = 0;
+    for(tb = tracebuf; tb < &tracebuf[NCPU]; tb++){
+      n += tb->dropped;
+      tb->dropped = 0;
+    }
+    return n;
+  case TRACE_READ:
+    i = 0;
+    acquiresleep(&readlock);
+    for(tb = tracebuf; tb < &tracebuf[NCPU] && i < n; tb++){
+      r = tb->r;
+      w = __atomic_load_n(&tb->w, __ATOMIC_ACQUIRE);
+      for(; r != w && i < n; r++, i++){
+        if(copyout(myproc()->pagetable, buf + i*sizeof(struct traceev),
+                   (char*)&tb->ev[r % NTRACEBUF], sizeof(struct traceev)) < 0){
+          releasesleep(&readlock);
+          return -1;
+        }
+      }
+      __atomic_store_n(&tb->r, r, __ATOMIC_RELEASE);
+    }
+    releasesleep(&readlock);
+    return i;
+  }
+  return -1;
+}
@@ -0,0 +1,27 @@
+// Trace event types. trace(TRACE_MASK, ...) takes a mask of
+// (1 << type) bits to enable.
+#define TR_SWITCH   1   // scheduler() runs a process     a0: pid
+#define TR_SLEEP    2   // sleep()                        a0: chan
+#define TR_WAKEUP   3   // wakeup()                       a0: chan
+#define TR_BREAD    4   // bread()                        a0: dev  a1: blockno
+#define TR_BWRITE   5   // bwrite()                       a0: dev  a1: blockno
+#define TR_DISKDONE 6   // virtio_disk_intr() finishes    a0: disk a1: blockno
+#define TR_BEGINOP  7   // begin_op() admits an FS call   a0: dev  a1: outstanding
+#define TR_ENDOP    8   // end_op()                       a0: dev  a1: outstanding
+#define TR_KALLOC   9   // kalloc()                       a0: pa
+#define TR_DISKSTART 10 // vstart() issues a request      a0: disk a1: nblocks<<32 | block
+#define NTRTYPE     11
+
+// trace() commands.
+#define TRACE_MASK  1   // set the event mask to n; returns the old one
+#define TRACE_READ  2   // copy out and remove up to n buffered events
+#define TRACE_LOST  3   // return and clear the count of dropped events
+
+struct traceev {
+  uint64 time;     // r_time()
+  ushort type;     // TR_*
+  ushort cpu;
+  int pid;         // process running, or 0 if none
+  uint64 a0;
+  uint64 a1;
+};
@@ -3,13 +3,18 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "timepage.h"
+#include "memstat.h"
 
 struct spinlock tickslock;
 uint ticks;
+struct timepage *timepage;
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopyfault[], ucopyend[];  // ucopy.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -23,6 +28,11 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((timepage = kalloc(MT_KERNEL)) == 0)
+    panic("trapinit");
+  memset(timepage, 0, PGSIZE);
+  timepage->hz = 10000000;
+  timepage->boot = r_time();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -49,6 +59,10 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  uint64 now = r_time();
+
+  p->ru.utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->tf->epc = r_sepc();
@@ -70,6 +84,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) != 0){
+    // page fault on a copy-on-write or mmap()ed page; now resolved.
   } else {
     printf("usertrap(): unexpected scause %p (%s) pid=%d\n", r_scause(), scause_desc(r_scause()), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -79,6 +96,16 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
+  // time for the sigalarm() handler? it runs, with the pc
+  // the alarm interrupted as its argument, until sigreturn().
+  if(which_dev == 2 && p->alarmticks && !p->inalarm && --p->alarmleft <= 0){
+    p->alarmtf = *p->tf;
+    p->alarmleft = p->alarmticks;
+    p->inalarm = 1;
+    p->tf->epc = p->alarmfn;
+    p->tf->a0 = p->alarmtf.epc;
+  }
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
     yield();
@@ -98,6 +125,10 @@ usertrapret(void)
   // now from kerneltrap() to usertrap().
   intr_off();
 
+  uint64 now = r_time();
+  p->ru.stime += now - p->tstamp;
+  p->tstamp = now;
+
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
@@ -127,7 +158,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -145,6 +176,24 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopy && sepc < (uint64)ucopyend){
+    // a copy to or from user memory touched a page not yet
+    // present, or copy-on-write: fault it in and retry, or
+    // give up on the copy. vmfault() may sleep, so let
+    // interrupts in if the copier had them on.
+    uint64 va = r_stval();
+    if(sstatus & SSTATUS_SPIE)
+      intr_on();
+    if(vmfault(myproc()->pagetable, va, scause == 15) == 0)
+      sepc = (uint64)ucopyfault;
+    intr_off();
+    sfence_vma();
+    w_sepc(sepc);
+    w_sstatus(sstatus);
+    return;
+  }
+
   if((which_dev = devintr()) == 0){
     printf("scause %p (%s)\n", scause, scause_desc(scause));
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -166,8 +215,10 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  timepage->ticks = ticks;
   wakeup(&ticks);
   release(&tickslock);
+  polltick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -201,16 +252,29 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip, before asking which it was, so
+    // that a tick arriving meanwhile raises it again.
+    w_sip(r_sip() & ~2);
+
+    // an IPI may be from tlbshootdown(), and a tick can
+    // hide one, so flush on either.
+    sfence_vma();
+    mycpu()->tlbgen++;
+
+    // otherwise an IPI only needs to bring a CPU out of wfi;
+    // the scheduler then looks at the run queues.
+    if(!clockticked())
+      return 1;
 
     if(cpuid() == 0){
       clockintr();
     }
-    
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
+    // sepc and sstatus.SPP still describe the interrupted code.
+    profsample(r_sepc(), (r_sstatus() & SSTATUS_SPP) == 0);
 
     return 2;
   } else {
@@ -7,6 +7,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -26,10 +27,27 @@
 #define ISR 2 // interrupt status register
 #define LCR 3 // line control register
 #define LSR 5 // line status register
+#define IER_RX_ENABLE (1<<0)
+#define IER_TX_ENABLE (1<<1)
+#define LSR_TX_IDLE   (1<<5) // THR and transmit FIFO are empty
+#define UART_FIFO     16     // transmit FIFO depth
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+// the transmit output buffer. writers copy into it and
+// go; uartstart() feeds the UART from it, a FIFO-full at a
+// time, and each transmit-empty interrupt does it again.
+struct spinlock uart_tx_lock;
+#define UART_TX_BUF_SIZE 512
+char uart_tx_buf[UART_TX_BUF_SIZE];
+uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
+uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
+
+extern volatile int panicked; // from printf.c
+
+static void uartstart(void);
+
 void
 uartinit(void)
 {
@@ -52,18 +70,71 @@ uartinit(void)
   // reset and enable FIFOs.
   WriteReg(FCR, 0x07);
 
-  // enable receive interrupts.
-  WriteReg(IER, 0x01);
+  initlock(&uart_tx_lock, "uart");
+
+  // enable transmit and receive interrupts.
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+}
+
+// add n bytes from s to the output buffer, sleeping while
+// it is full, and start sending them. the bytes of one call
+// stay in order; callers serialize whole writes.
+// not for use from interrupts or by the kernel's printf().
+void
+uartwrite(char *s, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+  if(panicked){
+    for(;;)
+      ;
+  }
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full; wait for uartstart() to make room.
+      uartstart();
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = s[i];
+  }
+  uartstart();
+  release(&uart_tx_lock);
 }
 
-// write one output character to the UART.
+// write one output character to the UART, waiting for it
+// to be ready rather than using the output buffer; for
+// the kernel's printf() and for echoing input, which may
+// run in interrupts.
 void
 uartputc(int c)
 {
+  push_off();
+  if(panicked){
+    for(;;)
+      ;
+  }
   // wait for Transmit Holding Empty to be set in LSR.
-  while((ReadReg(LSR) & (1 << 5)) == 0)
+  while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
   WriteReg(THR, c);
+  pop_off();
+}
+
+// if the UART is idle, move up to a FIFO-full of waiting
+// characters into it.
+// caller must hold uart_tx_lock.
+static void
+uartstart(void)
+{
+  int i;
+
+  if(uart_tx_w == uart_tx_r || (ReadReg(LSR) & LSR_TX_IDLE) == 0)
+    return;  // nothing to send, or the UART is still busy
+  for(i = 0; i < UART_FIFO && uart_tx_r != uart_tx_w; i++)
+    WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+  // uartwrite() may be waiting for space.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
@@ -79,14 +150,21 @@ uartgetc(void)
   }
 }
 
-// trap.c calls here when the uart interrupts.
+// trap.c calls here when the uart interrupts, because input
+// has arrived, or the uart is ready for more output, or both.
 void
 uartintr(void)
 {
+  ReadReg(ISR);  // acknowledge the interrupt
+
   while(1){
     int c = uartgetc();
     if(c == -1)
       break;
     consoleintr(c);
   }
+
+  acquire(&uart_tx_lock);
+  uartstart();
+  release(&uart_tx_lock);
 }
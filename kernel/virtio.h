@@ -45,7 +45,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 struct VRingDesc {
   uint64 addr;
@@ -69,4 +69,11 @@ struct UsedArea {
   uint16 flags;
   uint16 id;
   struct VRingUsedElem elems[NUM];
+  uint16 avail_event;  // with VIRTIO_RING_F_EVENT_IDX
 };
+
+// with VIRTIO_RING_F_EVENT_IDX, the driver (device) need only
+// notify (interrupt) the other side when its index moves
+// from old to new past the event index the other side set.
+#define VRING_NEED_EVENT(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
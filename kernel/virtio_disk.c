@@ -5,6 +5,33 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// Requests go through a small I/O scheduler on their way to
+// the ring. virtio_disk_submit() puts each buffer on one of
+// two queues per disk, reads and writes, each sorted by
+// block, and vstart() moves them onto the ring as there are
+// descriptors for them. It serves reads first, since some
+// process is usually waiting for them, unless the oldest
+// write has waited WRITEWAIT ticks. Within a queue it goes up
+// the disk from where the last request ended, then back to
+// the start (C-LOOK), and merges buffers for consecutive
+// blocks into one request of up to MAXMERGE blocks.
+//
+// Requests for the same block still reach the disk in the
+// order they were submitted: they stay in order on a queue,
+// and one waits while an older one for its block is on the
+// ring or on the other queue, since the device may finish
+// requests on the ring in any order.
+//
+// With VIRTIO_RING_F_EVENT_IDX, the driver and the device
+// each tell the other how far it has looked, and neither
+// signals the other about work the other will find anyway:
+// vstart() notifies the device once for everything it puts on
+// the ring, and only if the device may have stopped looking;
+// the device interrupts only for the first request to finish
+// after virtio_disk_intr() has caught up, so one interrupt
+// collects every request that finishes while it runs. Only
+// buffers someone waits for are woken.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -16,10 +43,20 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "trace.h"
 
 // the address of virtio mmio register r.
 #define R(n, r) ((volatile uint32 *)(VIRTION(n) + (r)))
 
+#define MAXMERGE 16   // max blocks in one request, at most NUM-2
+#define WRITEWAIT 2   // ticks a write may wait behind reads
+
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
 struct disk {
   // memory for virtio descriptors &c for queue 0.
   // this is a global instead of allocated because it has
@@ -33,16 +70,32 @@ struct disk {
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 used_idx; // we've looked this far in used[2..NUM], mod 2^16.
+  int evidx;       // VIRTIO_RING_F_EVENT_IDX negotiated?
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // write and status are indexed by the first descriptor
+  // index of a chain, b by the index of each data descriptor.
   struct {
     struct buf *b;
+    char write;
     char status;
   } info[NUM];
 
+  // request headers, one per possible chain, since the
+  // submitter no longer waits with one on its stack.
+  // indexed like info[].
+  struct virtio_blk_outhdr ops[NUM];
+
+  // the I/O scheduler's queues, through b->qnext, each
+  // sorted by b->qblock, and the block after the last
+  // request started.
+  struct buf *rq;
+  struct buf *wq;
+  uint pos;
+  uint seq;  // for b->qseq
+
   // initialized?
   int init;
 
@@ -84,9 +137,9 @@ virtio_disk_init(int n)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(n, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk[n].evidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -110,8 +163,8 @@ virtio_disk_init(int n)
   *R(n, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk[n].pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+  // avail = pages + 0x200 -- 2 * uint16, then num * uint16, then used_event
+  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem, then avail_event
 
   disk[n].desc = (struct VRingDesc *) disk[n].pages;
   disk[n].avail = (uint16*)(((char*)disk[n].desc) + NUM*sizeof(struct VRingDesc));
@@ -147,7 +200,6 @@ free_desc(int n, int i)
     panic("virtio_disk_intr 2");
   disk[n].desc[i].addr = 0;
   disk[n].free[i] = 1;
-  wakeup(&disk[n].free[0]);
 }
 
 // free a chain of descriptors.
@@ -163,10 +215,11 @@ free_chain(int n, int i)
   }
 }
 
+// allocate cnt descriptors, or none.
 static int
-alloc3_desc(int n, int *idx)
+alloc_descs(int n, int *idx, int cnt)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < cnt; i++){
     idx[i] = alloc_desc(n);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -177,106 +230,286 @@ alloc3_desc(int n, int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(int n, struct buf *b, int write)
+// Put one request reading or writing the nb buffers bs[],
+// at consecutive blocks of disk n from bs[0]->qblock on,
+// on the ring, without notifying the device. Returns 0, or
+// -1 if there aren't enough free descriptors.
+// Caller must hold vdisk_lock.
+static int
+vissue(int n, struct buf **bs, int nb, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk[n].vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(n, idx) == 0) {
-      break;
-    }
-    sleep(&disk[n].free[0], &disk[n].vdisk_lock);
-  }
+  uint64 sector = (uint64)bs[0]->qblock * (BSIZE / 512);
+  int idx[NUM];
+  int i;
+
+  // the spec says that legacy block operations use one
+  // descriptor for type/reserved/sector, then the data,
+  // which may be split over several descriptors, then one
+  // for a 1-byte status result.
+  if(alloc_descs(n, idx, nb + 2) < 0)
+    return -1;
   
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk[n].ops[idx[0]];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk[n].desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk[n].desc[idx[0]].len = sizeof(buf0);
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  disk[n].desc[idx[0]].addr = (uint64) buf0;
+  disk[n].desc[idx[0]].len = sizeof(*buf0);
   disk[n].desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk[n].desc[idx[0]].next = idx[1];
 
-  disk[n].desc[idx[1]].addr = (uint64) b->data;
-  disk[n].desc[idx[1]].len = BSIZE;
-  if(write)
-    disk[n].desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk[n].desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk[n].desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk[n].desc[idx[1]].next = idx[2];
+  for(i = 1; i <= nb; i++){
+    struct buf *b = bs[i-1];
+    disk[n].desc[idx[i]].addr = (uint64) b->data;
+    disk[n].desc[idx[i]].len = BSIZE;
+    if(write)
+      disk[n].desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk[n].desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk[n].desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk[n].desc[idx[i]].next = idx[i+1];
+
+    // record struct buf for virtio_disk_intr().
+    disk[n].info[idx[i]].b = b;
+  }
 
   disk[n].info[idx[0]].status = 0;
-  disk[n].desc[idx[2]].addr = (uint64) &disk[n].info[idx[0]].status;
-  disk[n].desc[idx[2]].len = 1;
-  disk[n].desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk[n].desc[idx[2]].next = 0;
+  disk[n].desc[idx[nb+1]].addr = (uint64) &disk[n].info[idx[0]].status;
+  disk[n].desc[idx[nb+1]].len = 1;
+  disk[n].desc[idx[nb+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk[n].desc[idx[nb+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[n].info[idx[0]].b = b;
+  disk[n].info[idx[0]].write = write;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
   // we only tell device the first index in our chain of descriptors.
+  // vstart() tells the device.
   disk[n].avail[2 + (disk[n].avail[1] % NUM)] = idx[0];
   __sync_synchronize();
   disk[n].avail[1] = disk[n].avail[1] + 1;
 
-  *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  TRACE(TR_DISKSTART, n, (uint64)nb << 32 | bs[0]->qblock);
+  return 0;
+}
+
+// Has the oldest write on disk n's queue waited too long?
+// Caller must hold vdisk_lock.
+static int
+overdue(int n)
+{
+  struct buf *b;
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk[n].vdisk_lock);
+  for(b = disk[n].wq; b; b = b->qnext)
+    if(ticks - b->qtime >= WRITEWAIT)
+      return 1;
+  return 0;
+}
+
+// Must b, on disk n's read or write queue, wait for an older
+// request for its block, on the ring or on the other queue?
+// Caller must hold vdisk_lock.
+static int
+vblocked(int n, struct buf *b, int write)
+{
+  struct buf *o;
+  int i;
+
+  for(i = 0; i < NUM; i++)
+    if((o = disk[n].info[i].b) != 0 && o->qblock == b->qblock)
+      return 1;
+  for(o = write ? disk[n].rq : disk[n].wq; o && o->qblock <= b->qblock; o = o->qnext)
+    if(o->qblock == b->qblock && (int)(o->qseq - b->qseq) < 0)
+      return 1;
+  return 0;
+}
+
+// The link to the buffer on disk n's read or write queue to
+// start the next request with: the first at or past pos, or
+// else the lowest, that needn't wait. 0 if there is none.
+// Caller must hold vdisk_lock.
+static struct buf**
+vnext(int n, int write)
+{
+  struct buf **qp, **pp;
+
+  qp = write ? &disk[n].wq : &disk[n].rq;
+  for(pp = qp; *pp; pp = &(*pp)->qnext)
+    if((*pp)->qblock >= disk[n].pos && !vblocked(n, *pp, write))
+      return pp;
+  for(pp = qp; *pp && (*pp)->qblock < disk[n].pos; pp = &(*pp)->qnext)
+    if(!vblocked(n, *pp, write))
+      return pp;
+  return 0;
+}
+
+// Tell disk n about the requests put on the ring since
+// avail[1] was old, if it needs telling.
+// Caller must hold vdisk_lock.
+static void
+vnotify(int n, uint16 old)
+{
+  if(disk[n].avail[1] == old)
+    return;
+  // the new avail[1] must be visible before reading
+  // avail_event, or both sides could miss the other.
+  __sync_synchronize();
+  if(!disk[n].evidx ||
+     VRING_NEED_EVENT(disk[n].used->avail_event, disk[n].avail[1], old))
+    *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// Move requests from disk n's queues onto the ring, while
+// there are descriptors for them, and notify the device
+// once.
+// Caller must hold vdisk_lock.
+static void
+vstart(int n)
+{
+  struct buf *bs[MAXMERGE], **pp, *b;
+  uint16 old;
+  int nb, write;
+
+  old = disk[n].avail[1];
+  for(;;){
+    write = disk[n].rq == 0 || (disk[n].wq && overdue(n));
+    if((pp = vnext(n, write)) == 0 && (pp = vnext(n, write = !write)) == 0)
+      break;
+    // with the buffers for the blocks right after it.
+    nb = 0;
+    for(b = *pp; b && nb < MAXMERGE; b = b->qnext){
+      if(nb > 0 && (b->qblock != bs[nb-1]->qblock + 1 || vblocked(n, b, write)))
+        break;
+      bs[nb++] = b;
+    }
+    if(vissue(n, bs, nb, write) < 0)
+      break;  // virtio_disk_intr() calls again as requests finish
+    *pp = b;
+    disk[n].pos = bs[nb-1]->qblock + 1;
   }
+  vnotify(n, old);
+}
 
-  disk[n].info[idx[0]].b = 0;
-  free_chain(n, idx[0]);
+// Queue the nb buffers bs[], for consecutive blocks of disk
+// n from blockno on, to be read or written, and return
+// without waiting.
+// Each b->disk stays 1 until virtio_disk_intr() sees its
+// request finish; a finished read also marks them valid.
+void
+virtio_disk_submit(int n, struct buf **bs, int nb, uint blockno, int write)
+{
+  struct buf *b, **pp;
+  int i;
+
+  if(nb < 1)
+    panic("virtio_disk_submit");
 
+  acquire(&disk[n].vdisk_lock);
+  pp = write ? &disk[n].wq : &disk[n].rq;
+  for(i = 0; i < nb; i++){
+    b = bs[i];
+    b->disk = 1;
+    b->qwait = 0;
+    b->qblock = blockno + i;
+    b->qtime = ticks;
+    b->qseq = disk[n].seq++;
+    // bs[] is in order, so look on from the last one; a
+    // request goes after those already queued for its block.
+    while(*pp && (*pp)->qblock <= b->qblock)
+      pp = &(*pp)->qnext;
+    b->qnext = *pp;
+    *pp = b;
+    pp = &b->qnext;
+  }
+  vstart(n);
   release(&disk[n].vdisk_lock);
 }
 
+// Wait for a request submitted for b to finish.
 void
-virtio_disk_intr(int n)
+virtio_disk_wait(int n, struct buf *b)
 {
   acquire(&disk[n].vdisk_lock);
+  while(b->disk == 1) {
+    b->qwait = 1;
+    sleep(b, &disk[n].vdisk_lock);
+  }
+  release(&disk[n].vdisk_lock);
+}
 
-  while((disk[n].used_idx % NUM) != (disk[n].used->id % NUM)){
-    int id = disk[n].used->elems[disk[n].used_idx].id;
+void
+virtio_disk_rw(int n, struct buf *b, uint blockno, int write)
+{
+  virtio_disk_submit(n, &b, 1, blockno, write);
+  virtio_disk_wait(n, b);
+}
 
-    if(disk[n].info[id].status != 0)
-      panic("virtio_disk_intr status");
-    
-    disk[n].info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk[n].info[id].b);
+// Finish every request the device has completed on disk n,
+// waking the processes waiting for their buffers, and start
+// queued ones in their place.
+void
+virtio_disk_intr(int n)
+{
+  struct buf *b;
+  int i;
 
-    disk[n].used_idx = (disk[n].used_idx + 1) % NUM;
+  acquire(&disk[n].vdisk_lock);
+
+  // the device raises the interrupt again for a request
+  // that finishes after this.
+  *R(n, VIRTIO_MMIO_INTERRUPT_ACK) = *R(n, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+
+  for(;;){
+    __sync_synchronize();
+    while(disk[n].used_idx != disk[n].used->id){
+      int id = disk[n].used->elems[disk[n].used_idx % NUM].id;
+
+      if(disk[n].info[id].status != 0)
+        panic("virtio_disk_intr status");
+
+      // the data descriptors are the ones between the header
+      // and the status descriptor, which ends the chain.
+      for(i = disk[n].desc[id].next; disk[n].desc[i].flags & VRING_DESC_F_NEXT;
+          i = disk[n].desc[i].next){
+        b = disk[n].info[i].b;
+        if(!disk[n].info[id].write)
+          b->valid = 1;
+        __sync_synchronize();
+        b->disk = 0;   // disk is done with buf
+        TRACE(TR_DISKDONE, n, b->blockno);
+        if(b->qwait){
+          b->qwait = 0;
+          wakeup(b);
+        }
+        disk[n].info[i].b = 0;
+      }
+
+      free_chain(n, id);
+
+      disk[n].used_idx++;
+    }
+    if(!disk[n].evidx)
+      break;
+    // ask for an interrupt when the next request finishes,
+    // then look again for one that finished before the
+    // device could see that.
+    disk[n].avail[2 + NUM] = disk[n].used_idx;
+    __sync_synchronize();
+    if(disk[n].used_idx == disk[n].used->id)
+      break;
   }
 
+  // the finished requests' descriptors are free for more.
+  vstart(n);
+
   release(&disk[n].vdisk_lock);
 }
-
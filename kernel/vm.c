@@ -5,6 +5,12 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "memstat.h"
+
+#define UNMAPBATCH 64  // pages uvmunmapmm() frees per TLB shootdown
 
 /*
  * the kernel's page table.
@@ -25,7 +31,7 @@ void print(pagetable_t);
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
+  kernel_pagetable = (pagetable_t) kalloc(MT_PGTBL);
   memset(kernel_pagetable, 0, PGSIZE);
 
   // uart registers
@@ -37,8 +43,8 @@ kvminit()
   // virtio mmio disk interface 1
   kvmmap(VIRTION(1), VIRTION(1), PGSIZE, PTE_R | PTE_W);
 
-  // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  // CLINT, at its alias above USERTOP
+  kvmmap(KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -63,6 +69,48 @@ kvminithart()
   sfence_vma();
 }
 
+// Make a kernel page table for the process whose user page
+// table is pagetable: the kernel's, except that the first
+// gigabyte is pagetable's own, so that copyin() and copyout()
+// reach user pages below USERTOP directly, and see every
+// change to them with no work to keep the two in step. The
+// kernel's device mappings above USERTOP are shared into
+// pagetable for this, without PTE_U; uvmfree() takes them
+// out again. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t l1, kl1, kpagetable;
+  int i;
+
+  if((pagetable[0] & PTE_V) == 0){
+    if((l1 = (pagetable_t)kzalloc(MT_PGTBL)) == 0)
+      return 0;
+    pagetable[0] = PA2PTE(l1) | PTE_V;
+  }
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, USERTOP); i < 512; i++)
+    l1[i] = kl1[i];
+
+  if((kpagetable = (pagetable_t)kalloc(MT_PGTBL)) == 0)
+    return 0;
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  kpagetable[0] = pagetable[0];
+  return kpagetable;
+}
+
+// Switch to kernel page table kpagetable, as made by
+// kvmcreate(), or to the kernel's own if it is 0.
+void
+kvmswitch(pagetable_t kpagetable)
+{
+  if(kpagetable == 0)
+    kpagetable = kernel_pagetable;
+  w_satp(MAKE_SATP(kpagetable));
+  sfence_vma();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -75,7 +123,12 @@ kvminithart()
 //   21..39 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..12 -- 12 bits of byte offset within the page.
-static pte_t *
+//
+// If va lies in a megapage, the level-1 leaf PTE that maps
+// it is returned instead. Only the kernel's mappings are
+// megapages (see kvmmap()), some shared into user page
+// tables by kvmcreate().
+pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
   if(va >= MAXVA)
@@ -84,11 +137,12 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc(MT_PGTBL)) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -118,14 +172,102 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Map the 2-megabyte page at va to pa with a single leaf
+// PTE in the level-1 page table, creating that table if
+// need be. Both addresses must be MEGAPGSIZE-aligned.
+static void
+kvmmapmega(uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+  pagetable_t l1;
+
+  pte = &kernel_pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    if(PTE_LEAF(*pte))
+      panic("kvmmapmega: remap");
+    l1 = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((l1 = (pagetable_t)kzalloc(MT_PGTBL)) == 0)
+      panic("kvmmapmega");
+    *pte = PA2PTE(l1) | PTE_V;
+  }
+  pte = &l1[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("kvmmapmega: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// where va and pa are both 2-megabyte aligned the range is
+// mapped with megapages, which saves most of the page-table
+// pages of the direct map and many TLB entries with them;
+// the ragged ends get ordinary pages.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 end, n;
+
+  end = va + sz;
+  while(va < end){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && end - va >= MEGAPGSIZE){
+      kvmmapmega(va, pa, perm);
+      n = MEGAPGSIZE;
+    } else {
+      // ordinary pages up to the next megapage boundary.
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > end - va)
+        n = end - va;
+      if(mappages(kernel_pagetable, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+  }
+}
+
+// Make the page-table pages for a kernel stack at va, so
+// that kvmmapstack() never has to allocate one. Only used
+// when booting.
+void
+kvmstackinit(uint64 va)
+{
+  if(walk(kernel_pagetable, va, 1) == 0)
+    panic("kvmstackinit");
+}
+
+// Map page pa as the kernel stack at va. The kernel page
+// tables of processes share this mapping, through the
+// level-1 table above it.
+void
+kvmmapstack(uint64 va, uint64 pa)
+{
+  pte_t *pte;
+
+  if((pte = walk(kernel_pagetable, va, 0)) == 0)
+    panic("kvmmapstack");
+  if(*pte & PTE_V)
+    panic("kvmmapstack: remap");
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+}
+
+// Unmap the kernel stack at va. Returns its page, or 0 if
+// none was mapped. Other harts may hold the old mapping in
+// their TLBs, but each flushes its TLB before it next runs
+// a process, and nothing else uses the stack.
+uint64
+kvmunmapstack(uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if((pte = walk(kernel_pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  *pte = 0;
+  sfence_vma();
+  return pa;
 }
 
 // translate a kernel virtual address to
@@ -145,6 +287,10 @@ kvmpa(uint64 va)
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
   pa = PTE2PA(*pte);
+  // walk() stopped early if the level-2 entry's table holds
+  // a megapage leaf for va.
+  if(pte == (pagetable_t)PTE2PA(kernel_pagetable[PX(2, va)]) + PX(1, va))
+    off = va % MEGAPGSIZE;
   return pa+off;
 }
 
@@ -175,8 +321,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
-// physical memory.
+// pages in the range that were never faulted in are
+// skipped. Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 {
@@ -187,12 +333,14 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0){
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
+    if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_SWAP)){
+      if(do_free)
+        swapfree(*pte);
+      *pte = 0;
+      goto next;
     }
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      goto next;  // lazily allocated, never touched
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -200,11 +348,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+  next:
     if(a == last)
       break;
     a += PGSIZE;
     pa += PGSIZE;
   }
+  // the kernel reaches user pages through its own TLB
+  // entries too; see kvmcreate().
+  sfence_vma();
 }
 
 // create an empty user page table.
@@ -212,10 +364,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc(MT_PGTBL);
   if(pagetable == 0)
     panic("uvmcreate: out of memory");
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -229,8 +380,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc(MT_USER);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -249,12 +399,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   oldsz = PGROUNDUP(oldsz);
   a = oldsz;
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc(MT_USER);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -306,39 +455,56 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  pagetable_t l1;
+  int i;
+
   uvmunmap(pagetable, 0, sz, 1);
+  // the device mappings kvmcreate() shared belong to the kernel.
+  if(pagetable[0] & PTE_V){
+    l1 = (pagetable_t)PTE2PA(pagetable[0]);
+    for(i = PX(1, USERTOP); i < 512; i++)
+      l1[i] = 0;
+  }
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table but not the physical
+// memory: writable pages become read-only and
+// copy-on-write in both, and uvmcow() copies
+// them when either side first writes.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = walk(old, i, 0)) != 0 && (*pte & PTE_SWAP)){
+      // swapped out: share the slot.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      *npte = *pte;
+      swapdup(*pte);
+      continue;
+    }
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;  // lazily allocated, never touched
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kdup((void*)pa);
   }
+  // flush the parent's stale writable TLB entries, which
+  // its kernel could write through before userret's sfence.vma.
+  sfence_vma();
   return 0;
 
  err:
@@ -346,6 +512,163 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Share the pages that are present in old's [va, va+len)
+// with new, skipping pages never faulted in. If cow,
+// writable pages become copy-on-write in both.
+// returns 0 on success, -1 on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int cow)
+{
+  pte_t *pte;
+  uint64 a, pa;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if((pte = walk(old, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE2PA(*pte);
+    // old still owns writing back what it dirtied.
+    if(mappages(new, a, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_D) != 0)
+      return -1;
+    kdup((void*)pa);
+  }
+  if(cow)
+    sfence_vma();
+  return 0;
+}
+
+// Handle a write to copy-on-write page va: give the
+// caller a private, writable copy, or just make the page
+// writable if nobody else shares it any more. *old is set
+// to the page a copy replaced, or 0; the caller must kfree()
+// it once no TLB has it (see tlbshootdown()).
+// Returns 0 on success, -1 if va is not a COW page or
+// memory ran out.
+int
+uvmcow(pagetable_t pagetable, uint64 va, char **old)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  *old = 0;
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc(MT_USER)) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  *old = (char*)pa;
+  return 0;
+}
+
+// Resolve a fault by the current process, whose page table
+// is pagetable, on user address va: copy a COW page being
+// written, page in the program's text or data, bring a page
+// back from swap, allocate a zeroed page for heap grown by
+// sbrk(), or page in a mapped file page. Threads sharing the
+// page table may fault on the same page at once; the address
+// space's vmlock orders them. If memory is short, waits for
+// swapd to free some and tries again.
+// Returns the physical address now mapped at va, or 0 if
+// the access is invalid.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct proc *mm;
+  pte_t *pte;
+  char *mem, *old;
+  uint64 pa;
+  int oom;
+
+  if(va >= MAXVA || p == 0 || pagetable != p->pagetable)
+    return 0;
+  p->ru.nfault++;
+  mm = p->mm;
+  va = PGROUNDDOWN(va);
+ again:
+  pa = 0;
+  oom = 0;
+  old = 0;
+  acquire(&mm->vmlock);
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW)){
+      if(uvmcow(pagetable, va, &old) == 0)
+        pa = walkaddr(pagetable, va);
+      else
+        oom = 1;
+    } else if((*pte & PTE_U) && (!write || (*pte & PTE_W))){
+      pa = PTE2PA(*pte);  // another thread got here first
+    }
+  } else if(pte != 0 && (*pte & PTE_SWAP)){
+    release(&mm->vmlock);
+    if(swapin(mm, va) == 0 || swapwait())
+      goto again;  // to break COW sharing, if need be
+    return 0;
+  } else if(va < mm->sz && execpage(mm, va)){
+    release(&mm->vmlock);
+    if(execfault(mm, va) == 0)
+      return walkaddr(pagetable, va);
+    return 0;
+  } else if(va < mm->sz){
+    if((mem = kzalloc(MT_USER)) != 0){
+      if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0)
+        kfree(mem);
+      else
+        pa = (uint64)mem;
+    }
+    oom = pa == 0;
+  } else {
+    release(&mm->vmlock);
+    if(mmap_fault(mm, va, write) == 0)
+      return walkaddr(pagetable, va);
+    return 0;
+  }
+  release(&mm->vmlock);
+  if(old){
+    // other threads may still read the page copied from.
+    tlbshootdown(mm);
+    kfree(old);
+  }
+  if(oom && swapwait())
+    goto again;
+  return pa;
+}
+
+// Fault in the current process's pages of [va, va+len)
+// up front, for copies done while holding a spinlock,
+// which must not sleep on the disk. Failures are ignored;
+// the copy itself will then fail.
+void
+vmtouch(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW)))
+      vmfault(p->pagetable, a, write);
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -359,6 +682,79 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Take the pages of [va, va+len) out of mm's page table and
+// free them. Another thread of mm could go on using a page
+// through its CPU's TLB until tlbshootdown(), so the pages
+// are freed after that, UNMAPBATCH at a time.
+// Caller must hold no spinlock.
+void
+uvmunmapmm(struct proc *mm, uint64 va, uint64 len)
+{
+  uint64 pas[UNMAPBATCH], a;
+  pte_t *pte;
+  int i, n;
+
+  a = PGROUNDDOWN(va);
+  while(a < va + len){
+    n = 0;
+    acquire(&mm->vmlock);
+    for(; a < va + len && n < UNMAPBATCH; a += PGSIZE){
+      if((pte = walk(mm->pagetable, a, 0)) != 0 && (*pte & PTE_SWAP)){
+        swapfree(*pte);
+        *pte = 0;
+        continue;
+      }
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;  // lazily allocated, never touched
+      pas[n++] = PTE2PA(*pte);
+      *pte = 0;
+    }
+    release(&mm->vmlock);
+    if(n == 0)
+      continue;
+    tlbshootdown(mm);
+    for(i = 0; i < n; i++)
+      kfree((void*)pas[i]);
+  }
+}
+
+// Mark the present pages of [va, va+len) in pagetable dirty,
+// as a store by the process would: copyout() writes them
+// through mappings whose PTE_D the hardware may not set, and
+// mmap_unmap() writes back only dirty MAP_SHARED pages.
+static void
+uvmdirty(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  pte_t *pte;
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      __sync_fetch_and_or(pte, PTE_D);  // other threads' harts set PTE_A
+}
+
+// Can [va, va+len) in pagetable be reached directly, through
+// the current process's kernel page table? The range must
+// lie below USERTOP, and miss the stack guard page, which
+// the kernel could reach though the process can't.
+// Pages there that aren't yet present, or are copy-on-write,
+// are faulted in by kerneltrap() as the copy touches them.
+static int
+ucopyok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 guard;
+
+  if(p == 0 || pagetable != p->pagetable || p->kpagetable == 0)
+    return 0;
+  if(va + len < va || va + len > USERTOP)
+    return 0;
+  guard = p->mm->guard;
+  if(guard && va < guard + PGSIZE && guard < va + len)
+    return 0;
+  return r_satp() == MAKE_SATP(p->kpagetable);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -366,16 +762,34 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+
+  // if the direct copy fails part way, the page by page
+  // one below finds out why.
+  if(ucopyok(pagetable, dstva, len) && ucopy((char*)dstva, src, len) == 0){
+    uvmdirty(pagetable, dstva, len);
+    return 0;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    if(va0 >= MAXVA)
+      return -1;
+    // the kernel writes through the direct map, which
+    // bypasses PTE_W, so break COW sharing by hand, and
+    // refuse read-only pages such as TIMEPAGE.
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0)
+      pa0 = vmfault(pagetable, va0, 1);
+    else
+      pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    uvmdirty(pagetable, va0, n);
 
     len -= n;
     src += n;
@@ -392,10 +806,13 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(ucopyok(pagetable, srcva, len) && ucopy(dst, (char*)srcva, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -419,10 +836,13 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(ucopyok(pagetable, srcva, max) && ucopystr(dst, (char*)srcva, max) == 0)
+    return 0;
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -19,6 +19,14 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+//
+// The file system is striped across NDISK disk images, STRIPE
+// blocks on each in turn, as the kernel's bio.c expects. The
+// image is built in memory and each disk's share written out
+// at the end in one sequential pass, up to the last block in
+// use; the rest of the file is left a hole, which reads as
+// zeroes. Disk SWAPDISK's image has NSWAP more blocks of hole
+// after its share, for the kernel's swap area.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
@@ -26,14 +34,15 @@ int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
-int fsfd;
+int fsfd[NDISK];
+uchar *img;   // FSSIZE blocks
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
+void flush(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
@@ -71,22 +80,31 @@ main(int argc, char *argv[])
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
+  static char ibuf[64*BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc < 1 + NDISK){
+    fprintf(stderr, "Usage: mkfs fs.img fs1.img... files...\n");
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
-  if(fsfd < 0){
-    perror(argv[1]);
+  assert(FSSIZE % (STRIPE * NDISK) == 0);
+
+  for(i = 0; i < NDISK; i++){
+    fsfd[i] = open(argv[1+i], O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if(fsfd[i] < 0){
+      perror(argv[1+i]);
+      exit(1);
+    }
+  }
+  if((img = calloc(FSSIZE, BSIZE)) == 0){
+    perror("calloc");
     exit(1);
   }
 
@@ -108,9 +126,6 @@ main(int argc, char *argv[])
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
@@ -128,15 +143,25 @@ main(int argc, char *argv[])
   strcpy(de.name, "..");
   iappend(rootino, &de, sizeof(de));
 
-  for(i = 2; i < argc; i++){
-    // get rid of "user/"
+  // the kernel mounts its in-memory file system on /tmp.
+  inum = ialloc(T_DIR);
+  bzero(&de, sizeof(de));
+  de.inum = xshort(inum);
+  strcpy(de.name, "tmp");
+  iappend(rootino, &de, sizeof(de));
+  strcpy(de.name, ".");
+  iappend(inum, &de, sizeof(de));
+  de.inum = xshort(rootino);
+  strcpy(de.name, "..");
+  iappend(inum, &de, sizeof(de));
+
+  for(i = 1 + NDISK; i < argc; i++){
+    // get rid of "user/", "kernel/" &c.
     char *shortname;
-    if(strncmp(argv[i], "user/", 5) == 0)
-      shortname = argv[i] + 5;
+    if((shortname = rindex(argv[i], '/')) != 0)
+      shortname++;
     else
       shortname = argv[i];
-    
-    assert(index(shortname, '/') == 0);
 
     if((fd = open(argv[i], 0)) < 0){
       perror(argv[i]);
@@ -157,8 +182,8 @@ main(int argc, char *argv[])
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    while((cc = read(fd, ibuf, sizeof(ibuf))) > 0)
+      iappend(inum, ibuf, cc);
 
     close(fd);
   }
@@ -172,22 +197,52 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  flush();
   exit(0);
 }
 
+// Write each disk image: its stripes up to the last block in
+// use, gathered into one buffer, and a hole for the rest,
+// and for the swap area.
 void
-wsect(uint sec, void *buf)
+flush(void)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
-    exit(1);
+  static uchar dimg[FSSIZE / NDISK * BSIZE];
+  uchar *p, *end;
+  uint s, d, size;
+  ssize_t n;
+
+  for(d = 0; d < NDISK; d++){
+    size = FSSIZE / NDISK + (d == SWAPDISK ? NSWAP : 0);
+    if(ftruncate(fsfd[d], (off_t)size * BSIZE) < 0){
+      perror("ftruncate");
+      exit(1);
+    }
+    end = dimg;
+    for(s = d; s * STRIPE < freeblock; s += NDISK){
+      memmove(end, img + (size_t)s * STRIPE * BSIZE, STRIPE * BSIZE);
+      end += STRIPE * BSIZE;
+    }
+    for(p = dimg; p < end; p += n){
+      if((n = write(fsfd[d], p, end - p)) <= 0){
+        perror("write");
+        exit(1);
+      }
+    }
+    if(close(fsfd[d]) < 0){
+      perror("close");
+      exit(1);
+    }
   }
 }
 
+void
+wsect(uint sec, void *buf)
+{
+  assert(sec < FSSIZE);
+  memmove(img + (size_t)sec * BSIZE, buf, BSIZE);
+}
+
 void
 winode(uint inum, struct dinode *ip)
 {
@@ -218,14 +273,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  assert(sec < FSSIZE);
+  memmove(buf, img + (size_t)sec * BSIZE, BSIZE);
 }
 
 uint
@@ -245,17 +294,16 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar *bm;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
+  assert(used <= nbitmap*BSIZE*8);
+  bm = img + (size_t)xint(sb.bmapstart) * BSIZE;
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bm[i/8] = bm[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: write bitmap blocks at sector %d\n", xint(sb.bmapstart));
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -275,7 +323,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    assert(fbn < NDIRECT + NINDIRECT);  // mkfs only writes small files
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
@@ -0,0 +1,115 @@
+// Test setaffinity() and getaffinity(): masks are checked
+// and inherited, and a pinned process still runs. Then time a
+// pipe ping-pong, argv[1] round trips, between processes
+// pinned to two CPUs and between unpinned ones.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int n = 2000;
+
+// Bounce a byte between two processes n times, the parent
+// on CPU mask a and the child on b, or anywhere if either
+// is 0. Returns the time taken in microseconds.
+uint64
+pingpong(uint64 a, uint64 b)
+{
+  int p1[2], p2[2], i, pid, st;
+  uint64 t;
+  char c;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("affinitytest: pipe\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("affinitytest: fork\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(b && setaffinity(getpid(), b) < 0){
+      printf("affinitytest: setaffinity child\n");
+      exit(1);
+    }
+    for(i = 0; i < n; i++)
+      if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1){
+        printf("affinitytest: child ping\n");
+        exit(1);
+      }
+    exit(0);
+  }
+  if(a && setaffinity(getpid(), a) < 0){
+    printf("affinitytest: setaffinity parent\n");
+    exit(1);
+  }
+  t = clock_cycles();
+  for(i = 0; i < n; i++)
+    if(write(p1[1], "x", 1) != 1 || read(p2[0], &c, 1) != 1){
+      printf("affinitytest: parent ping\n");
+      exit(1);
+    }
+  t = (clock_cycles() - t) * 1000000 / clock_hz();
+  wait(&st);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 all, first, second, tfree, tpin;
+  int pid, st;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  if((all = getaffinity(getpid())) == 0){
+    printf("affinitytest: getaffinity\n");
+    exit(1);
+  }
+  if(getaffinity(-1) != 0){
+    printf("affinitytest: getaffinity of no process\n");
+    exit(1);
+  }
+  if(setaffinity(getpid(), 0) != -1){
+    printf("affinitytest: empty mask\n");
+    exit(1);
+  }
+  if(setaffinity(-1, all) != -1){
+    printf("affinitytest: setaffinity of no process\n");
+    exit(1);
+  }
+  first = all & -all;
+
+  // a pinned process runs, and its children inherit the pin.
+  if(setaffinity(getpid(), first) < 0 || getaffinity(getpid()) != first){
+    printf("affinitytest: pin\n");
+    exit(1);
+  }
+  if((pid = fork()) == 0)
+    exit(getaffinity(getpid()) == first ? 0 : 1);
+  if(wait(&st) != pid || st != 0){
+    printf("affinitytest: child not pinned\n");
+    exit(1);
+  }
+  if(setaffinity(getpid(), all) < 0 || getaffinity(getpid()) != all){
+    printf("affinitytest: unpin\n");
+    exit(1);
+  }
+
+  if((second = (all & ~first) & -(all & ~first)) == 0){
+    printf("affinitytest: one CPU; no ping-pong\n");
+  } else {
+    tfree = pingpong(0, 0);
+    tpin = pingpong(first, second);
+    setaffinity(getpid(), all);
+    printf("affinitytest: %d round trips in %l us, pinned in %l us\n", n, tfree, tpin);
+  }
+
+  printf("affinitytest: OK\n");
+  exit(0);
+}
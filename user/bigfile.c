@@ -9,6 +9,7 @@ main()
 {
   char buf[BSIZE];
   int fd, i, blocks;
+  uint64 t0, us;
 
   fd = open("big.file", O_CREATE | O_WRONLY);
   if(fd < 0){
@@ -16,6 +17,7 @@ main()
     exit(-1);
   }
 
+  t0 = clock_cycles();
   blocks = 0;
   while(1){
     *(int*)buf = blocks;
@@ -28,10 +30,14 @@ main()
   }
 
   printf("\nwrote %d blocks\n", blocks);
-  if(blocks != 65803) {
+  if(blocks != MAXFILE) {
     printf("bigfile: file is too small\n");
     exit(-1);
   }
+  // to the disks, for the time.
+  fsync(fd);
+  us = (clock_cycles() - t0) * 1000000 / clock_hz();
+  printf("bigfile: %l KB/s\n", us ? (uint64)blocks * BSIZE / 1024 * 1000000 / us : 0);
   
   close(fd);
   fd = open("big.file", O_RDONLY);
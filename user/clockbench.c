@@ -0,0 +1,82 @@
+//
+// clockbench: the cost of reading the clock with uptime(),
+// against uptime_fast() and clock_cycles(), which read it
+// without a system call; and checks that they agree.
+//
+// usage: clockbench [count]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+volatile uint64 sink;
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000, i, pid, status, fds[2];
+  uint64 t0, t, hz;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1)
+    n = 1;
+  hz = clock_hz();
+
+  t0 = clock_cycles();
+  for(i = 0; i < n; i++)
+    sink += uptime();
+  t = clock_cycles() - t0;
+  printf("uptime\t\t%d calls\t%l ns/call\n", n, t * (1000000000 / hz) / n);
+
+  t0 = clock_cycles();
+  for(i = 0; i < n; i++)
+    sink += uptime_fast();
+  t = clock_cycles() - t0;
+  printf("uptime_fast\t%d calls\t%l ns/call\n", n, t * (1000000000 / hz) / n);
+
+  t0 = clock_cycles();
+  for(i = 0; i < n; i++)
+    sink += clock_cycles();
+  t = clock_cycles() - t0;
+  printf("clock_cycles\t%d calls\t%l ns/call\n", n, t * (1000000000 / hz) / n);
+
+  // a tick may come between the two reads.
+  t = uptime();
+  if(uptime_fast() - t > 1){
+    printf("clockbench: uptime_fast() %d, uptime() %d\n", uptime_fast(), (int)t);
+    exit(1);
+  }
+  t0 = clock_cycles();
+  sleep(2);
+  if(clock_cycles() - t0 < hz / 100){
+    printf("clockbench: clock_cycles() did not advance over sleep(2)\n");
+    exit(1);
+  }
+
+  // the page is read-only, to user code and to system calls.
+  if((pid = fork()) == 0){
+    *(volatile uint*)TIMEPAGE = 0;
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  if(status != -1){
+    printf("clockbench: wrote the time page\n");
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("clockbench: pipe failed\n");
+    exit(1);
+  }
+  write(fds[1], "xxxx", 4);
+  if(read(fds[0], (void*)TIMEPAGE, 4) != -1){
+    printf("clockbench: read() into the time page\n");
+    exit(1);
+  }
+  printf("clockbench: ok\n");
+  exit(0);
+}
@@ -0,0 +1,175 @@
+// Test big, indexed directories: argv[1] names (links to
+// one file, since inodes are few) that can all be found and
+// listed, removed and put back, and a name DIRSIZ long.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+int n = 2000;
+struct dirstat ds[40];
+
+void
+entname(char *buf, int i)
+{
+  snprintf(buf, 32, "dt/entry-%d", i);
+}
+
+// microseconds to open every step'th name from i0 on.
+uint64
+openall(int i0, int step, int want)
+{
+  char name[32];
+  uint64 t0;
+  int i, fd;
+
+  t0 = clock_cycles();
+  for(i = i0; i < n; i += step){
+    entname(name, i);
+    fd = open(name, O_RDONLY);
+    if(want && fd < 0){
+      printf("dirtest: cannot open %s\n", name);
+      exit(1);
+    }
+    if(!want && fd >= 0){
+      printf("dirtest: still there: %s\n", name);
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  return (clock_cycles() - t0) * 1000000 / clock_hz();
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[32], path[DIRSIZ+8], lng[DIRSIZ+1];
+  struct dirent de;
+  int i, j, fd, found;
+  uint64 t;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  if(mkdir("dt") < 0){
+    printf("dirtest: mkdir dt\n");
+    exit(1);
+  }
+  if((fd = open("dt/f", O_CREATE|O_WRONLY)) < 0){
+    printf("dirtest: create dt/f\n");
+    exit(1);
+  }
+  close(fd);
+
+  t = clock_cycles();
+  for(i = 0; i < n; i++){
+    entname(name, i);
+    if(link("dt/f", name) < 0){
+      printf("dirtest: link %s\n", name);
+      exit(1);
+    }
+  }
+  t = (clock_cycles() - t) * 1000000 / clock_hz();
+  printf("dirtest: %d links in %l us\n", n, t);
+
+  t = openall(0, 1, 1);
+  printf("dirtest: %d opens in %l us\n", n, t);
+
+  // getdents() sees them all, and ".", ".." and f.
+  if((fd = open("dt", O_RDONLY)) < 0){
+    printf("dirtest: open dt\n");
+    exit(1);
+  }
+  found = 0;
+  while((i = getdents(fd, ds, sizeof(ds))) > 0)
+    for(j = 0; j < i / sizeof(ds[0]); j++)
+      if(ds[j].type == T_FILE && ds[j].nlink == n + 1)
+        found++;
+  close(fd);
+  if(found != n + 1){
+    printf("dirtest: getdents missed entries\n");
+    exit(1);
+  }
+  if(link("dt/f", "dt/entry-0") == 0){
+    printf("dirtest: linked twice: dt/entry-0\n");
+    exit(1);
+  }
+  if(open("dt/entry-none", O_RDONLY) >= 0){
+    printf("dirtest: found dt/entry-none\n");
+    exit(1);
+  }
+
+  // remove every other name, and check the rest.
+  for(i = 0; i < n; i += 2){
+    entname(name, i);
+    if(unlink(name) < 0){
+      printf("dirtest: unlink %s\n", name);
+      exit(1);
+    }
+  }
+  openall(0, 2, 0);
+  openall(1, 2, 1);
+  if(unlink("dt") == 0){
+    printf("dirtest: removed non-empty dt\n");
+    exit(1);
+  }
+
+  // put them back, into the holes.
+  for(i = 0; i < n; i += 2){
+    entname(name, i);
+    if(link("dt/f", name) < 0){
+      printf("dirtest: relink %s\n", name);
+      exit(1);
+    }
+  }
+  openall(0, 1, 1);
+
+  // a name as long as a dirent holds.
+  for(i = 0; i < DIRSIZ; i++)
+    lng[i] = 'a' + i % 26;
+  lng[DIRSIZ] = 0;
+  snprintf(path, sizeof(path), "dt/%s", lng);
+  if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+    printf("dirtest: create %s\n", path);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dt", O_RDONLY)) < 0){
+    printf("dirtest: open dt\n");
+    exit(1);
+  }
+  found = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0 && memcmp(de.name, lng, DIRSIZ) == 0)
+      found = 1;
+  close(fd);
+  if(!found){
+    printf("dirtest: no dirent for %s\n", path);
+    exit(1);
+  }
+  if(unlink(path) < 0){
+    printf("dirtest: unlink %s\n", path);
+    exit(1);
+  }
+
+  for(i = 0; i < n; i++){
+    entname(name, i);
+    if(unlink(name) < 0){
+      printf("dirtest: unlink %s\n", name);
+      exit(1);
+    }
+  }
+  if(unlink("dt/f") < 0){
+    printf("dirtest: unlink dt/f\n");
+    exit(1);
+  }
+  if(unlink("dt") < 0){
+    printf("dirtest: unlink dt\n");
+    exit(1);
+  }
+  printf("dirtest: ok\n");
+  exit(0);
+}
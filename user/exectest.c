@@ -0,0 +1,112 @@
+// Test demand-paged exec(): text is shared and read-only,
+// and a rewritten binary is seen by the next exec.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// in .data, so paged in from the file.
+char databuf[4096] = { 1 };
+
+int
+run(char *prog, char *arg)
+{
+  char *argv[] = { prog, arg, 0 };
+  int pid, status;
+
+  if((pid = fork()) < 0){
+    printf("exectest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(prog, argv);
+    exit(99);
+  }
+  waitpid(pid, &status, 0);
+  return status;
+}
+
+// overwrite to with from, in place.
+void
+copy(char *from, char *to)
+{
+  int fd0, fd1, n;
+  static char buf[1024];
+
+  if((fd0 = open(from, O_RDONLY)) < 0 || (fd1 = open(to, O_CREATE|O_WRONLY)) < 0){
+    printf("exectest: cannot copy %s to %s\n", from, to);
+    exit(1);
+  }
+  while((n = read(fd0, buf, sizeof(buf))) > 0)
+    write(fd1, buf, n);
+  close(fd0);
+  close(fd1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, status, fd, bad;
+
+  if(argc > 2 && strcmp(argv[1], "-exit") == 0)
+    exit(atoi(argv[2]));
+  if(argc > 1 && strcmp(argv[1], "-text") == 0){
+    *(volatile char*)main = 0;
+    exit(0);
+  }
+
+  // text is read-only.
+  if((status = run("exectest", "-text")) != -1){
+    printf("exectest: wrote to text, status %d\n", status);
+    exit(1);
+  }
+
+  // many processes at once running the same text.
+  for(i = 0; i < 8; i++){
+    if((pid = fork()) == 0){
+      char *av[] = { "exectest", "-exit", "3", 0 };
+      exec(av[0], av);
+      exit(99);
+    }
+  }
+  bad = 0;
+  for(i = 0; i < 8; i++){
+    wait(&status);
+    if(status != 3)
+      bad = 1;
+  }
+  if(bad){
+    printf("exectest: concurrent exec failed\n");
+    exit(1);
+  }
+
+  // reading a program into its own data pages mustn't
+  // deadlock on its inode.
+  if((fd = open("exectest", O_RDONLY)) < 0){
+    printf("exectest: cannot open exectest\n");
+    exit(1);
+  }
+  if(read(fd, databuf, sizeof(databuf)) != sizeof(databuf)){
+    printf("exectest: read into data failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // a binary rewritten in place runs its new contents.
+  unlink("etcopy");
+  copy("exectest", "etcopy");
+  if((status = run("etcopy", "-text")) != -1){
+    printf("exectest: etcopy -text gave %d\n", status);
+    exit(1);
+  }
+  copy("echo", "etcopy");
+  if((status = run("etcopy", 0)) != 0){
+    printf("exectest: rewritten etcopy gave %d\n", status);
+    exit(1);
+  }
+  unlink("etcopy");
+
+  printf("exectest: ok\n");
+  exit(0);
+}
@@ -0,0 +1,198 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void wait_test();
+void mutex_test();
+void cond_test();
+
+int
+main(int argc, char *argv[])
+{
+  wait_test();
+  mutex_test();
+  cond_test();
+  printf("futextest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("futextest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+#define NT 4
+
+char stack[NT][4096] __attribute__((aligned(16)));
+
+int
+start(void (*fn)(void*), void *arg, int i)
+{
+  int pid;
+
+  if((pid = clone(fn, arg, stack[i] + sizeof(stack[i]))) <= 0)
+    err("clone");
+  return pid;
+}
+
+volatile int word;
+volatile int started;
+
+void
+waiter(void *arg)
+{
+  started = 1;
+  while(word == 0)
+    futex_wait(&word, 0);
+  exit(0);
+}
+
+//
+// futex_wait() returns at once if the word has changed,
+// and a sleeping waiter is released by futex_wake().
+//
+void
+wait_test()
+{
+  int pid, t0;
+
+  testname = "wait";
+  word = 1;
+  if(futex_wait(&word, 0) != -1)
+    err("wait on changed word");
+  if(futex_wake(&word, 1) != 0)
+    err("wake with no waiters");
+  if(futex_wait((volatile int*)((char*)&word + 1), 1) != -1)
+    err("misaligned wait");
+
+  word = 0;
+  started = 0;
+  pid = start(waiter, 0, 0);
+  while(!started)
+    ;
+  sleep(2);
+  word = 1;
+  t0 = uptime();
+  while(futex_wake(&word, 1) == 0 && uptime() - t0 < 100)
+    sleep(1);
+  if(waitpid(pid, 0, 0) != pid)
+    err("waitpid");
+  printf("wait_test OK\n");
+}
+
+struct mutex mu;
+int count;
+
+void
+adder(void *arg)
+{
+  for(int i = 0; i < 10000; i++){
+    mutex_lock(&mu);
+    count++;
+    if(i % 1000 == 0)
+      sleep(1);  // hold it long enough to be contended
+    mutex_unlock(&mu);
+  }
+  exit(0);
+}
+
+//
+// a mutex keeps a plain counter consistent.
+//
+void
+mutex_test()
+{
+  int pids[NT];
+
+  testname = "mutex";
+  mutex_init(&mu);
+  count = 0;
+  for(int i = 0; i < NT; i++)
+    pids[i] = start(adder, 0, i);
+  for(int i = 0; i < NT; i++)
+    waitpid(pids[i], 0, 0);
+  if(count != NT * 10000)
+    err("count");
+  if(!mutex_trylock(&mu) || mutex_trylock(&mu))
+    err("trylock");
+  mutex_unlock(&mu);
+  printf("mutex_test OK\n");
+}
+
+#define NSLOT 8
+#define NITEM 2000
+
+struct cond notempty, notfull;
+int buf[NSLOT];
+int head, tail;
+int sum;
+
+void
+producer(void *arg)
+{
+  for(int i = 1; i <= NITEM; i++){
+    mutex_lock(&mu);
+    while(tail - head == NSLOT)
+      cond_wait(&notfull, &mu);
+    buf[tail++ % NSLOT] = i;
+    cond_signal(&notempty);
+    mutex_unlock(&mu);
+  }
+  exit(0);
+}
+
+void
+consumer(void *arg)
+{
+  int v;
+
+  for(;;){
+    mutex_lock(&mu);
+    while(head == tail)
+      cond_wait(&notempty, &mu);
+    v = buf[head++ % NSLOT];
+    cond_signal(&notfull);
+    mutex_unlock(&mu);
+    if(v < 0)
+      exit(0);
+    __sync_fetch_and_add(&sum, v);
+  }
+}
+
+//
+// producers and consumers over a bounded buffer.
+//
+void
+cond_test()
+{
+  int pids[NT];
+
+  testname = "cond";
+  mutex_init(&mu);
+  cond_init(&notempty);
+  cond_init(&notfull);
+  head = tail = sum = 0;
+  for(int i = 0; i < NT; i++)
+    pids[i] = start(i < NT/2 ? producer : consumer, 0, i);
+  for(int i = 0; i < NT/2; i++)
+    waitpid(pids[i], 0, 0);
+
+  // one end marker per consumer.
+  for(int i = 0; i < NT/2; i++){
+    mutex_lock(&mu);
+    while(tail - head == NSLOT)
+      cond_wait(&notfull, &mu);
+    buf[tail++ % NSLOT] = -1;
+    cond_broadcast(&notempty);
+    mutex_unlock(&mu);
+  }
+  for(int i = NT/2; i < NT; i++)
+    waitpid(pids[i], 0, 0);
+  if(sum != (NT/2) * NITEM * (NITEM + 1) / 2)
+    err("sum");
+  printf("cond_test OK\n");
+}
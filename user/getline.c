@@ -0,0 +1,112 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Buffered line input. Each of fds 0..NIBUF-1 gets a read
+// buffer on first use, so reading a file line by line takes
+// one read() per IBUFSZ bytes rather than one per byte.
+// Data read ahead stays in the buffer: a program that hands
+// a buffered fd to a child should not expect the child to
+// see it. close() drops the fd's buffer (see ulib.c).
+
+#define NIBUF  8
+#define IBUFSZ 512
+
+struct ibuf {
+  int pos;              // next unconsumed char in buf
+  int len;              // chars read into buf
+  char buf[IBUFSZ];
+};
+
+static struct ibuf *ibufs[NIBUF];
+
+static void
+ibdrop(int fd)
+{
+  if(fd >= 0 && fd < NIBUF && ibufs[fd])
+    ibufs[fd]->pos = ibufs[fd]->len = 0;
+}
+
+// Return the next char from fd, or -1 at end of input.
+static int
+ibgetc(int fd)
+{
+  struct ibuf *b;
+  char c;
+
+  if(fd < 0 || fd >= NIBUF)
+    return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+  if((b = ibufs[fd]) == 0){
+    if((b = malloc(sizeof(*b))) == 0)
+      return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+    b->pos = b->len = 0;
+    ibufs[fd] = b;
+    stdio_drop = ibdrop;
+  }
+  if(b->pos == b->len){
+    b->pos = 0;
+    if((b->len = read(fd, b->buf, sizeof(b->buf))) <= 0){
+      b->len = 0;
+      return -1;
+    }
+  }
+  return (uchar)b->buf[b->pos++];
+}
+
+// Read a line from fd into buf, keeping its newline, and
+// stopping short after max-1 chars.
+// Returns buf, or 0 at end of input.
+char*
+fgets(char *buf, int max, int fd)
+{
+  int i, c = 0;
+
+  for(i = 0; i+1 < max; ){
+    if((c = ibgetc(fd)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  buf[i] = '\0';
+  return i == 0 && c < 0 ? 0 : buf;
+}
+
+char*
+gets(char *buf, int max)
+{
+  fgets(buf, max, 0);
+  return buf;
+}
+
+// Read a whole line from fd, newline included, into *linep,
+// a malloc()ed buffer of *capp bytes that is grown as
+// needed; *linep may start out 0.
+// Returns the line's length, or -1 at end of input or if
+// out of memory.
+int
+getline(char **linep, uint *capp, int fd)
+{
+  char *nb;
+  int n = 0, c = 0;
+
+  for(;;){
+    if(*linep == 0 || n + 1 >= *capp){
+      if((nb = malloc(*capp ? 2 * *capp : 128)) == 0)
+        return -1;
+      if(*linep){
+        memmove(nb, *linep, n);
+        free(*linep);
+      }
+      *linep = nb;
+      *capp = *capp ? 2 * *capp : 128;
+    }
+    if((c = ibgetc(fd)) < 0)
+      break;
+    (*linep)[n++] = c;
+    if(c == '\n')
+      break;
+  }
+  (*linep)[n] = '\0';
+  return n == 0 && c < 0 ? -1 : n;
+}
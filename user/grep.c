@@ -1,35 +1,292 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled once. A plain string is found by
+// scanning the input for its first byte and comparing the
+// rest; anything else becomes a DFA, built as lines need
+// its states, which makes one table lookup per input byte.
+// Input is read in big chunks and searched in place, and
+// matching lines are written out in big chunks too.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+#define BUFSZ (64*1024)
+#define MAXELEM 63     // pattern elements a DFA state's set can hold
+#define NDSTATE 128    // DFA states cached at once
+#define BIT(i) ((uint64)1 << (i))
+
+char *buf;
+uint bufcap;
+char out[BUFSZ];
+int nout;
+
+// The compiled pattern.
+int literal;           // no operators: just look for lit
+char *lit;
+int litlen;
+int bol, eol;          // anchored by ^, $
+int nelem;
+struct elem {
+  int c;               // byte to match, or -1 for .
+  int star;            // any number of them
+} elem[MAXELEM];
+
+// A DFA state: the set of elements the match could be at,
+// bit nelem meaning all of them matched, and the next state
+// for each byte, or -1 if not yet known.
+struct dstate {
+  uint64 set;
+  short next[256];
+} dstate[NDSTATE];
+int ndstate;
+uint64 startset;
+
 int match(char*, char*);
 
 void
-grep(char *pattern, int fd)
+flushout(void)
+{
+  if(nout > 0 && write(1, out, nout) != nout){
+    fprintf(2, "grep: write error\n");
+    exit(1);
+  }
+  nout = 0;
+}
+
+// Copy the line [p, end) to the output, with a newline.
+void
+emit(char *p, char *end)
+{
+  int n = end - p;
+
+  if(nout + n + 1 > sizeof(out))
+    flushout();
+  if(n + 1 > sizeof(out)){
+    write(1, p, n);
+    write(1, "\n", 1);
+    return;
+  }
+  memmove(out + nout, p, n);
+  out[nout + n] = '\n';
+  nout += n + 1;
+}
+
+// Add to s the elements reachable from it by skipping
+// starred elements, which can match nothing.
+uint64
+closure(uint64 s)
+{
+  int i;
+
+  for(i = 0; i < nelem; i++)
+    if((s & BIT(i)) && elem[i].star)
+      s |= BIT(i+1);
+  return s;
+}
+
+// The set after reading byte c in set s.
+uint64
+step(uint64 s, int c)
 {
-  int n, m;
-  char *p, *q;
-
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
+  uint64 t = 0;
+  int i;
+
+  for(i = 0; i < nelem; i++){
+    if((s & BIT(i)) && (elem[i].c == -1 || elem[i].c == c))
+      t |= BIT(elem[i].star ? i : i+1);
+  }
+  t = closure(t);
+  if(!bol)
+    t |= startset;  // a match can start anywhere
+  return t;
+}
+
+// The DFA state for set s.
+int
+dfind(uint64 s)
+{
+  int i;
+
+  for(i = 0; i < ndstate; i++)
+    if(dstate[i].set == s)
+      return i;
+  if(ndstate == NDSTATE){
+    // full: start over.
+    for(i = 0; i < NDSTATE; i++)
+      memset(dstate[i].next, 0xff, sizeof(dstate[i].next));
+    ndstate = 0;
+  }
+  i = ndstate++;
+  dstate[i].set = s;
+  memset(dstate[i].next, 0xff, sizeof(dstate[i].next));
+  return i;
+}
+
+void
+compile(char *re)
+{
+  char *p;
+
+  literal = 1;
+  if(*re == '^'){
+    bol = 1;
+    re++;
+    literal = 0;
+  }
+  for(p = re; *p; p++)
+    if(*p == '.' || *p == '*' || (*p == '$' && p[1] == 0))
+      literal = 0;
+  if(literal && *re){
+    lit = re;
+    litlen = strlen(re);
+    return;
+  }
+  literal = 0;
+
+  for(p = re; *p; ){
+    if(*p == '$' && p[1] == 0){
+      eol = 1;
+      break;
+    }
+    if(nelem == MAXELEM){
+      nelem = -1;  // too big for a DFA
+      return;
+    }
+    elem[nelem].c = *p == '.' ? -1 : (uchar)*p;
+    elem[nelem].star = p[1] == '*';
+    p += elem[nelem].star ? 2 : 1;
+    nelem++;
+  }
+  startset = closure(1);
+}
+
+// The line that ends at the first newline at or after p.
+char*
+linend(char *p)
+{
+  while(*p != '\n')
+    p++;
+  return p;
+}
+
+// Search the complete lines in [p, end), which ends with a
+// newline, for lit.
+void
+scanlit(char *p, char *end)
+{
+  char c0 = lit[0], *q, *ls, *le;
+
+  for(q = p; q + litlen <= end; ){
+    if(*q != c0 || memcmp(q, lit, litlen) != 0){
+      q++;
+      continue;
+    }
+    for(ls = q; ls > p && ls[-1] != '\n'; ls--)
+      ;
+    le = linend(q);
+    emit(ls, le);
+    p = q = le + 1;  // go on after this line
+  }
+}
+
+// Search the complete lines in [p, end) with the DFA.
+void
+scandfa(char *p, char *end)
+{
+  int s, next, hit;
+  uint64 acc = BIT(nelem), set;
+  char *q;
+
+  while(p < end){
+    s = dfind(startset);
+    hit = 0;
+    for(q = p; *q != '\n'; q++){
+      if(!eol && (dstate[s].set & acc)){
+        hit = 1;
+        break;
       }
-      p = q+1;
+      if(dstate[s].set == 0)
+        break;  // only anchored patterns die
+      if((next = dstate[s].next[(uchar)*q]) < 0){
+        set = dstate[s].set;
+        next = dfind(step(set, (uchar)*q));
+        if(dstate[s].set == set)  // unless the cache started over
+          dstate[s].next[(uchar)*q] = next;
+      }
+      s = next;
     }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    if(!hit && *q == '\n' && (dstate[s].set & acc))
+      hit = 1;
+    q = linend(q);
+    if(hit)
+      emit(p, q);
+    p = q + 1;
+  }
+}
+
+// Search the complete lines in [p, end) with match().
+void
+scanslow(char *pattern, char *p, char *end)
+{
+  char *q;
+
+  while(p < end){
+    q = linend(p);
+    *q = 0;
+    if(match(pattern, p))
+      emit(p, q);
+    *q = '\n';
+    p = q + 1;
+  }
+}
+
+void
+scan(char *pattern, char *p, char *end)
+{
+  if(literal)
+    scanlit(p, end);
+  else if(nelem >= 0)
+    scandfa(p, end);
+  else
+    scanslow(pattern, p, end);
+}
+
+void
+grep(char *pattern, int fd)
+{
+  uint n;
+  int m;
+  char *nl, *nbuf;
+
+  n = 0;
+  for(;;){
+    if(n + 1 >= bufcap){
+      // a line longer than the buffer.
+      if((nbuf = malloc(bufcap * 2)) == 0){
+        fprintf(2, "grep: out of memory\n");
+        exit(1);
+      }
+      memmove(nbuf, buf, n);
+      free(buf);
+      buf = nbuf;
+      bufcap *= 2;
     }
+    // keep a byte free to end an unfinished last line.
+    if((m = read(fd, buf + n, bufcap - 1 - n)) <= 0)
+      break;
+    n += m;
+    for(nl = buf + n; nl > buf && nl[-1] != '\n'; nl--)
+      ;
+    if(nl == buf)
+      continue;
+    scan(pattern, buf, nl);
+    n -= nl - buf;
+    memmove(buf, nl, n);
+  }
+  if(n > 0){
+    buf[n] = '\n';
+    scan(pattern, buf, buf + n + 1);
   }
 }
 
@@ -44,25 +301,35 @@ main(int argc, char *argv[])
     exit(1);
   }
   pattern = argv[1];
+  compile(pattern);
+  bufcap = BUFSZ;
+  if((buf = malloc(bufcap)) == 0){
+    fprintf(2, "grep: out of memory\n");
+    exit(1);
+  }
 
   if(argc <= 2){
     grep(pattern, 0);
+    flushout();
     exit(0);
   }
 
   for(i = 2; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
+      flushout();
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
     grep(pattern, fd);
     close(fd);
   }
+  flushout();
   exit(0);
 }
 
 // Regexp matcher from Kernighan & Pike,
 // The Practice of Programming, Chapter 9.
+// Used for patterns too long for the DFA.
 
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
@@ -102,4 +369,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
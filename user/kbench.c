@@ -0,0 +1,300 @@
+//
+// kbench: kernel benchmarks that report numbers, for
+// comparing one kernel (or CPUS setting) with another.
+//
+// usage: kbench [-r rounds] [bench ...]
+//
+// Benches are fork, pipe, files, rw, syscall and sbrk; the
+// default is all of them. Each result is one line,
+//
+//   kbench <bench> <what> <value> <unit>
+//
+// and the best of the rounds is reported. The last line is
+// "kbench: done". make kbench boots the kernel, runs this,
+// and keeps just these lines.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+char buf[32768];
+int rounds = 3;
+
+// nanoseconds between clock_cycles() a and b.
+uint64
+ns(uint64 a, uint64 b)
+{
+  return (b - a) * (1000000000 / clock_hz());
+}
+
+// per op, or per second of the best round.
+void
+report(char *bench, char *what, uint64 best, uint64 ops, char *unit)
+{
+  if(strcmp(unit, "ns") == 0)
+    printf("kbench %s %s %l ns\n", bench, what, best / ops);
+  else if(strcmp(unit, "us") == 0)
+    printf("kbench %s %s %l us\n", bench, what, best / ops / 1000);
+  else if(strcmp(unit, "KB/s") == 0)
+    printf("kbench %s %s %l KB/s\n", bench, what, ops * 1000000 / (best / 1000 + 1));
+  else
+    printf("kbench %s %s %l %s\n", bench, what, ops * 1000000000 / (best + 1), unit);
+}
+
+void
+fail(char *what)
+{
+  fprintf(2, "kbench: %s failed\n", what);
+  exit(1);
+}
+
+// fork, exec a program that exits at once, and wait.
+void
+benchfork(void)
+{
+  int r, i, n = 50, pid;
+  uint64 t0, t, best;
+  char *argv[] = { "kbench", "-exit", 0 };
+
+  best = ~0L;
+  for(r = 0; r < rounds; r++){
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++){
+      if((pid = fork()) < 0)
+        fail("fork");
+      if(pid == 0){
+        exec(argv[0], argv);
+        exit(1);
+      }
+      waitpid(pid, 0, 0);
+    }
+    if((t = ns(t0, clock_cycles())) < best)
+      best = t;
+  }
+  report("fork", "fork+exec+wait", best, n, "us");
+
+  best = ~0L;
+  for(r = 0; r < rounds; r++){
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++){
+      if((pid = fork()) < 0)
+        fail("fork");
+      if(pid == 0)
+        exit(0);
+      waitpid(pid, 0, 0);
+    }
+    if((t = ns(t0, clock_cycles())) < best)
+      best = t;
+  }
+  report("fork", "fork+wait", best, n, "us");
+}
+
+// a child writes total bytes in chunks of size; we read them.
+void
+benchpipe(void)
+{
+  static int sizes[] = { 64, 512, 4096, 32768 };
+  int s, r, fds[2], pid, n, total = 4*1024*1024, got;
+  uint64 t0, t, best;
+  char what[32];
+
+  for(s = 0; s < NELEM(sizes); s++){
+    best = ~0L;
+    for(r = 0; r < rounds; r++){
+      if(pipe(fds) < 0)
+        fail("pipe");
+      t0 = clock_cycles();
+      if((pid = fork()) < 0)
+        fail("fork");
+      if(pid == 0){
+        close(fds[0]);
+        for(n = 0; n < total; n += sizes[s])
+          if(write(fds[1], buf, sizes[s]) != sizes[s])
+            exit(1);
+        exit(0);
+      }
+      close(fds[1]);
+      for(got = 0; (n = read(fds[0], buf, sizeof(buf))) > 0; got += n)
+        ;
+      close(fds[0]);
+      waitpid(pid, 0, 0);
+      if(got != total)
+        fail("pipe read");
+      if((t = ns(t0, clock_cycles())) < best)
+        best = t;
+    }
+    snprintf(what, sizeof(what), "write%d", sizes[s]);
+    report("pipe", what, best, total / 1024, "KB/s");
+  }
+}
+
+// create and unlink many small files in one directory.
+void
+benchfiles(void)
+{
+  int r, i, n = 100, fd;
+  uint64 t0, t, bestc, bestu;
+  char name[16];
+
+  bestc = bestu = ~0L;
+  for(r = 0; r < rounds; r++){
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++){
+      snprintf(name, sizeof(name), "kb%d", i);
+      if((fd = open(name, O_CREATE|O_WRONLY)) < 0)
+        fail("create");
+      write(fd, buf, 100);
+      close(fd);
+    }
+    if((t = ns(t0, clock_cycles())) < bestc)
+      bestc = t;
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++){
+      snprintf(name, sizeof(name), "kb%d", i);
+      if(unlink(name) < 0)
+        fail("unlink");
+    }
+    if((t = ns(t0, clock_cycles())) < bestu)
+      bestu = t;
+  }
+  report("files", "create", bestc, n, "ops/s");
+  report("files", "unlink", bestu, n, "ops/s");
+}
+
+// sequential writes, then reads, of a 2 MB file.
+void
+benchrw(void)
+{
+  int r, fd, n, total = 2*1024*1024, chunk = 8192;
+  uint64 t0, t, bestw, bestr;
+
+  bestw = bestr = ~0L;
+  for(r = 0; r < rounds; r++){
+    unlink("kbfile");
+    t0 = clock_cycles();
+    if((fd = open("kbfile", O_CREATE|O_WRONLY)) < 0)
+      fail("create");
+    for(n = 0; n < total; n += chunk)
+      if(write(fd, buf, chunk) != chunk)
+        fail("write");
+    fsync(fd);
+    close(fd);
+    if((t = ns(t0, clock_cycles())) < bestw)
+      bestw = t;
+
+    t0 = clock_cycles();
+    if((fd = open("kbfile", O_RDONLY)) < 0)
+      fail("open");
+    for(n = 0; n < total; n += chunk)
+      if(read(fd, buf, chunk) != chunk)
+        fail("read");
+    close(fd);
+    if((t = ns(t0, clock_cycles())) < bestr)
+      bestr = t;
+  }
+  unlink("kbfile");
+  report("rw", "write", bestw, total / 1024, "KB/s");
+  report("rw", "read", bestr, total / 1024, "KB/s");
+}
+
+// the cheapest system call there is.
+void
+benchsyscall(void)
+{
+  int r, i, n = 20000;
+  uint64 t0, t, best;
+
+  best = ~0L;
+  for(r = 0; r < rounds; r++){
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++)
+      getpid();
+    if((t = ns(t0, clock_cycles())) < best)
+      best = t;
+  }
+  report("syscall", "getpid", best, n, "ns");
+}
+
+// grow the heap, fault each page in, and give it back.
+void
+benchsbrk(void)
+{
+  int r, i, n = 1024;
+  uint64 t0, t, bests, bestf;
+  char *p;
+
+  bests = bestf = ~0L;
+  for(r = 0; r < rounds; r++){
+    t0 = clock_cycles();
+    if((p = sbrk(n * 4096)) == (char*)-1)
+      fail("sbrk");
+    if((t = ns(t0, clock_cycles())) < bests)
+      bests = t;
+    t0 = clock_cycles();
+    for(i = 0; i < n; i++)
+      p[i * 4096] = 1;
+    if((t = ns(t0, clock_cycles())) < bestf)
+      bestf = t;
+    sbrk(-n * 4096);
+  }
+  report("sbrk", "sbrk", bests, 1, "ns");
+  report("sbrk", "fault", bestf, n, "ns");
+}
+
+struct bench {
+  char *name;
+  void (*fn)(void);
+};
+
+struct bench benches[] = {
+  { "fork", benchfork },
+  { "pipe", benchpipe },
+  { "files", benchfiles },
+  { "rw", benchrw },
+  { "syscall", benchsyscall },
+  { "sbrk", benchsbrk },
+};
+
+void
+usage(void)
+{
+  fprintf(2, "usage: kbench [-r rounds] [bench ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, b;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-exit") == 0)
+      exit(0);
+    else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      rounds = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(rounds < 1)
+    rounds = 1;
+
+  if(i == argc){
+    for(b = 0; b < NELEM(benches); b++)
+      benches[b].fn();
+  } else {
+    for(; i < argc; i++){
+      for(b = 0; b < NELEM(benches); b++)
+        if(strcmp(benches[b].name, argv[i]) == 0)
+          break;
+      if(b == NELEM(benches))
+        usage();
+      benches[b].fn();
+    }
+  }
+  printf("kbench: done\n");
+  exit(0);
+}
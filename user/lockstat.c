@@ -0,0 +1,202 @@
+//
+// lockstat: show the kernel's lock statistics.
+//
+// usage: lockstat [-l] [-s acquire|contend|hold|max] [-n count] [cmd [arg ...]]
+//
+// With a command, runs it and shows what changed while it
+// ran; without, shows the totals since boot (or since the
+// last ntas(0)). Locks of the same name and kind are summed
+// into one line unless -l is given. Lines are sorted on the
+// -s field, most first; contend is the default.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct row {
+  struct lockstat ls;
+  int nlocks;       // locks summed into this row
+};
+
+int sortkey = 'c';
+
+// take a snapshot of all locks, sorted by id.
+struct lockstat*
+snapshot(int *np)
+{
+  struct lockstat *ls, t;
+  int n, max, i, j;
+
+  ls = 0;
+  max = 0;
+  // locks may be created between the calls; allow for some.
+  while((n = lockstat(ls, max)) > max){
+    free(ls);
+    max = n + 64;
+    if((ls = malloc(max * sizeof(*ls))) == 0){
+      fprintf(2, "lockstat: out of memory\n");
+      exit(1);
+    }
+  }
+  if(n < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+  // the kernel lists the newest first: mostly reversed.
+  for(i = 1; i < n; i++){
+    t = ls[i];
+    for(j = i; j > 0 && ls[j-1].id > t.id; j--)
+      ls[j] = ls[j-1];
+    ls[j] = t;
+  }
+  *np = n;
+  return ls;
+}
+
+// subtract the earlier snapshot a from b, matching by id;
+// locks created since a are left as they are.
+void
+diff(struct lockstat *b, int nb, struct lockstat *a, int na)
+{
+  int i, j;
+
+  for(i = j = 0; i < nb; i++){
+    while(j < na && a[j].id < b[i].id)
+      j++;
+    if(j < na && a[j].id == b[i].id){
+      b[i].nacquire -= a[j].nacquire;
+      b[i].ncontend -= a[j].ncontend;
+      b[i].holdtot -= a[j].holdtot;
+      // holdmax can't be differenced; keep the latest.
+    }
+  }
+}
+
+uint64
+key(struct row *r)
+{
+  switch(sortkey){
+  case 'a':
+    return r->ls.nacquire;
+  case 'h':
+    return r->ls.holdtot;
+  case 'm':
+    return r->ls.holdmax;
+  default:
+    return r->ls.ncontend;
+  }
+}
+
+// lines of the report, summing locks by name unless each.
+struct row*
+rows(struct lockstat *ls, int n, int each, int *nrp)
+{
+  struct row *r;
+  int i, j, nr;
+
+  if((r = malloc(n * sizeof(*r) + 1)) == 0){
+    fprintf(2, "lockstat: out of memory\n");
+    exit(1);
+  }
+  nr = 0;
+  for(i = 0; i < n; i++){
+    if(ls[i].nacquire == 0)
+      continue;
+    j = nr;
+    if(!each)
+      for(j = 0; j < nr; j++)
+        if(r[j].ls.kind == ls[i].kind && strcmp(r[j].ls.name, ls[i].name) == 0)
+          break;
+    if(j == nr){
+      r[nr].ls = ls[i];
+      r[nr].nlocks = 1;
+      nr++;
+      continue;
+    }
+    r[j].nlocks++;
+    r[j].ls.nacquire += ls[i].nacquire;
+    r[j].ls.ncontend += ls[i].ncontend;
+    r[j].ls.holdtot += ls[i].holdtot;
+    if(ls[i].holdmax > r[j].ls.holdmax)
+      r[j].ls.holdmax = ls[i].holdmax;
+    r[j].ls.cpu = -1;
+  }
+  *nrp = nr;
+  return r;
+}
+
+void
+sortrows(struct row *r, int n)
+{
+  struct row t;
+  int gap, i, j;
+
+  for(gap = n/2; gap > 0; gap /= 2)
+    for(i = gap; i < n; i++){
+      t = r[i];
+      for(j = i; j >= gap && key(&r[j-gap]) < key(&t); j -= gap)
+        r[j] = r[j-gap];
+      r[j] = t;
+    }
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: lockstat [-l] [-s acquire|contend|hold|max] [-n count] [cmd [arg ...]]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat *a, *b;
+  struct row *r;
+  int na, nb, nr, i, pid, each = 0, count = 20;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-l") == 0){
+      each = 1;
+    } else if(strcmp(argv[i], "-s") == 0 && i+1 < argc){
+      sortkey = argv[++i][0];
+      if(strchr("achm", sortkey) == 0)
+        usage();
+    } else if(strcmp(argv[i], "-n") == 0 && i+1 < argc){
+      count = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+
+  a = 0;
+  na = 0;
+  if(i < argc){
+    a = snapshot(&na);
+    if((pid = fork()) < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[i], argv + i);
+      fprintf(2, "lockstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    waitpid(pid, 0, 0);
+  }
+  b = snapshot(&nb);
+  if(a)
+    diff(b, nb, a, na);
+
+  r = rows(b, nb, each, &nr);
+  sortrows(r, nr);
+  // times are in microseconds; r_time() ticks at 10 MHz.
+  printf("name\tkind\tlocks\tcpu\tacquire\tcontend\thold us\tmax us\n");
+  for(i = 0; i < nr && i < count; i++){
+    printf("%s\t%s\t%d\t%d\t%l\t%l\t%l\t%l\n", r[i].ls.name,
+           r[i].ls.kind == LS_SLEEP ? "sleep" : "spin", r[i].nlocks, r[i].ls.cpu,
+           r[i].ls.nacquire, r[i].ls.ncontend, r[i].ls.holdtot / 10, r[i].ls.holdmax / 10);
+  }
+  exit(0);
+}
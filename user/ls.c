@@ -25,9 +25,8 @@ fmtname(char *path)
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  static struct dirstat ds[32];
+  int fd, i, n;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -47,23 +46,16 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    // the entries come with their types and sizes,
+    // many to a call.
+    while((n = getdents(fd, ds, sizeof(ds))) > 0){
+      for(i = 0; i < n / sizeof(ds[0]); i++){
+        if(ds[i].type == 0){
+          printf("ls: cannot stat %s/%s\n", path, ds[i].name);
+          continue;
+        }
+        printf("%s %d %d %l\n", fmtname(ds[i].name), ds[i].type, ds[i].inum, ds[i].size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
@@ -0,0 +1,303 @@
+//
+// mallocbench: malloc()/free() throughput, against the old
+// K&R first-fit allocator, kept below as krmalloc()/krfree().
+//
+// usage: mallocbench [rounds]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+krmorecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = krmorecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+struct mutex krlock;
+
+void*
+lockedkrmalloc(uint n)
+{
+  void *p;
+
+  mutex_lock(&krlock);
+  p = krmalloc(n);
+  mutex_unlock(&krlock);
+  return p;
+}
+
+void
+lockedkrfree(void *p)
+{
+  mutex_lock(&krlock);
+  krfree(p);
+  mutex_unlock(&krlock);
+}
+
+struct allocator {
+  char *name;
+  void *(*alloc)(uint);
+  void (*free)(void*);
+};
+
+struct allocator allocators[] = {
+  { "umalloc", malloc, free },
+  { "k&r", krmalloc, krfree },
+};
+
+// the old allocator needs a lock to be shared by threads.
+struct allocator parallocators[] = {
+  { "umalloc", malloc, free },
+  { "k&r+lock", lockedkrmalloc, lockedkrfree },
+};
+
+#define NLIVE 2000
+#define NPAR  4
+
+uint
+rnd(uint *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+// allocate and free one small block at a time.
+int
+pairs(struct allocator *a, int n, void **live, uint *seed)
+{
+  int i;
+  void *p;
+
+  for(i = 0; i < n; i++){
+    if((p = a->alloc(16 + i % 64)) == 0)
+      return -1;
+    a->free(p);
+  }
+  return 2 * n;
+}
+
+// keep NLIVE blocks of mixed small sizes alive, freeing
+// and replacing them in random order, as a fragmented
+// heap would see.
+int
+churn(struct allocator *a, int n, void **live, uint *seed)
+{
+  int i, j;
+
+  for(i = 0; i < NLIVE; i++)
+    if((live[i] = a->alloc(8 + rnd(seed) % 500)) == 0)
+      return -1;
+  for(i = 0; i < n; i++){
+    j = rnd(seed) % NLIVE;
+    a->free(live[j]);
+    if((live[j] = a->alloc(8 + rnd(seed) % 500)) == 0)
+      return -1;
+  }
+  for(i = 0; i < NLIVE; i++)
+    a->free(live[i]);
+  return 2 * (NLIVE + n);
+}
+
+// allocate and free large buffers among small ones.
+int
+large(struct allocator *a, int n, void **live, uint *seed)
+{
+  int i, j;
+
+  for(i = 0; i < NLIVE / 10; i++)
+    if((live[i] = a->alloc(32)) == 0)
+      return -1;
+  for(i = 0; i < n; i++){
+    j = rnd(seed) % (NLIVE / 10);
+    a->free(live[j]);
+    if((live[j] = a->alloc(rnd(seed) % 8 ? 32 : 8192 + rnd(seed) % 32768)) == 0)
+      return -1;
+  }
+  for(i = 0; i < NLIVE / 10; i++)
+    a->free(live[i]);
+  return 2 * (NLIVE / 10 + n);
+}
+
+struct bench {
+  char *name;
+  int (*fn)(struct allocator*, int, void**, uint*);
+  int n;
+};
+
+struct bench benches[] = {
+  { "pairs", pairs, 20000 },
+  { "churn", churn, 20000 },
+  { "large", large, 2000 },
+};
+
+void *live[NPAR][NLIVE];
+char stacks[NPAR][4096] __attribute__((aligned(16)));
+struct allocator *para;
+int parops[NPAR];
+int rounds = 1;
+
+// one of NPAR threads running churn side by side. The
+// blocks it leaves behind are freed by the main thread, as
+// with work handed from one thread to another.
+void
+parchurn(void *arg)
+{
+  int id = (int)(uint64)arg, r, i, t;
+  uint seed = id + 1;
+
+  for(r = 0; r < rounds; r++){
+    if((t = churn(para, 5000, live[id], &seed)) < 0)
+      exit(1);
+    parops[id] += t;
+  }
+  for(i = 0; i < NLIVE; i++)
+    if((live[id][i] = para->alloc(64)) == 0)
+      exit(1);
+  parops[id] += 2 * NLIVE;
+  if(para->free == free)
+    malloc_thread_done();
+  exit(0);
+}
+
+void
+runpar(struct allocator *a)
+{
+  int pids[NPAR], i, j, ops = 0, t0, t;
+
+  para = a;
+  memset(parops, 0, sizeof(parops));
+  t0 = uptime();
+  for(i = 0; i < NPAR; i++)
+    if((pids[i] = clone(parchurn, (void*)(uint64)i, stacks[i] + sizeof(stacks[i]))) < 0){
+      fprintf(2, "mallocbench: clone failed\n");
+      exit(1);
+    }
+  for(i = 0; i < NPAR; i++)
+    waitpid(pids[i], 0, 0);
+  // free the leftovers from a thread that did not make them.
+  for(i = 0; i < NPAR; i++)
+    for(j = 0; j < NLIVE; j++)
+      a->free(live[i][j]);
+  t = uptime() - t0;
+  for(i = 0; i < NPAR; i++)
+    ops += parops[i];
+  printf("par%d\t%s\t%d ops\t%d ticks\t%d ops/sec\n", NPAR, a->name,
+         ops, t, t > 0 ? ops * 10 / t : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int r, b, i, ops, t0, t;
+  struct allocator *a;
+  uint seed;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1)
+    rounds = 1;
+  mutex_init(&krlock);
+  for(b = 0; b < NELEM(benches); b++){
+    for(i = 0; i < NELEM(allocators); i++){
+      a = &allocators[i];
+      seed = 1;
+      ops = 0;
+      t0 = uptime();
+      for(r = 0; r < rounds; r++){
+        if((t = benches[b].fn(a, benches[b].n, live[0], &seed)) < 0){
+          fprintf(2, "mallocbench: %s: %s: out of memory\n", benches[b].name, a->name);
+          exit(1);
+        }
+        ops += t;
+      }
+      t = uptime() - t0;
+      // a tick is about 1/10th of a second.
+      printf("%s\t%s\t%d ops\t%d ticks\t%d ops/sec\n", benches[b].name, a->name,
+             ops, t, t > 0 ? ops * 10 / t : 0);
+    }
+  }
+  for(i = 0; i < NELEM(parallocators); i++)
+    runpar(&parallocators[i]);
+  exit(0);
+}
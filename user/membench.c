@@ -0,0 +1,166 @@
+//
+// membench: memset()/memmove()/memcmp() throughput, against
+// the byte loops they replaced, on whole pages and on short
+// misaligned runs.
+//
+// usage: membench [rounds]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+#define PGSIZE 4096
+
+void*
+bytememset(void *dst, int c, uint n)
+{
+  char *cdst = (char *) dst;
+  int i;
+  for(i = 0; i < n; i++){
+    cdst[i] = c;
+  }
+  return dst;
+}
+
+void*
+bytememmove(void *vdst, const void *vsrc, int n)
+{
+  char *dst;
+  const char *src;
+
+  dst = vdst;
+  src = vsrc;
+  if (src > dst) {
+    while(n-- > 0)
+      *dst++ = *src++;
+  } else {
+    dst += n;
+    src += n;
+    while(n-- > 0)
+      *--dst = *--src;
+  }
+  return vdst;
+}
+
+int
+bytememcmp(const void *s1, const void *s2, uint n)
+{
+  const char *p1 = s1, *p2 = s2;
+  while (n-- > 0) {
+    if (*p1 != *p2) {
+      return *p1 - *p2;
+    }
+    p1++;
+    p2++;
+  }
+  return 0;
+}
+
+struct impl {
+  char *name;
+  void *(*set)(void*, int, uint);
+  void *(*move)(void*, const void*, int);
+  int (*cmp)(const void*, const void*, uint);
+};
+
+struct impl impls[] = {
+  { "word", memset, memmove, memcmp },
+  { "byte", bytememset, bytememmove, bytememcmp },
+};
+
+char a[2*PGSIZE] __attribute__((aligned(PGSIZE)));
+char b[2*PGSIZE] __attribute__((aligned(PGSIZE)));
+volatile int sink;
+
+// each returns the bytes it touched.
+int
+setpage(struct impl *m, int n)
+{
+  for(int i = 0; i < n; i++)
+    m->set(a, i, PGSIZE);
+  return n * PGSIZE;
+}
+
+int
+movepage(struct impl *m, int n)
+{
+  for(int i = 0; i < n; i++)
+    m->move(b, a, PGSIZE);
+  return n * PGSIZE;
+}
+
+int
+cmppage(struct impl *m, int n)
+{
+  memset(a, 7, PGSIZE);
+  memset(b, 7, PGSIZE);
+  for(int i = 0; i < n; i++)
+    sink += m->cmp(a, b, PGSIZE);
+  return n * PGSIZE;
+}
+
+// short copies at odd offsets, as in path names and
+// directory entries.
+int
+moveshort(struct impl *m, int n)
+{
+  int bytes = 0;
+
+  for(int i = 0; i < n; i++){
+    m->move(b + (i & 7), a + 3, 14 + (i & 31));
+    bytes += 14 + (i & 31);
+  }
+  return bytes;
+}
+
+// an overlapping move, as in memmove() within one buffer.
+int
+moveoverlap(struct impl *m, int n)
+{
+  for(int i = 0; i < n; i++)
+    m->move(a + 64, a, PGSIZE);
+  return n * PGSIZE;
+}
+
+struct bench {
+  char *name;
+  int (*fn)(struct impl*, int);
+  int n;
+};
+
+struct bench benches[] = {
+  { "memset 4k", setpage, 2000 },
+  { "memmove 4k", movepage, 2000 },
+  { "memcmp 4k", cmppage, 2000 },
+  { "memmove short", moveshort, 200000 },
+  { "memmove overlap", moveoverlap, 2000 },
+};
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 1, r, b, i, t0, t;
+  uint64 bytes;
+  struct impl *m;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1)
+    rounds = 1;
+  for(b = 0; b < NELEM(benches); b++){
+    for(i = 0; i < NELEM(impls); i++){
+      m = &impls[i];
+      bytes = 0;
+      t0 = uptime();
+      for(r = 0; r < rounds; r++)
+        bytes += benches[b].fn(m, benches[b].n);
+      t = uptime() - t0;
+      // a tick is about 1/10th of a second.
+      printf("%s\t%s\t%d KB\t%d ticks\t%d KB/sec\n", benches[b].name, m->name,
+             (int)(bytes / 1024), t, t > 0 ? (int)(bytes * 10 / 1024 / t) : 0);
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,84 @@
+//
+// memstat: show how physical memory is being used.
+//
+// usage: memstat [cmd [arg ...]]
+//
+// Shows the pages the page allocator manages, how many are
+// free, what the others hold, and how many user pages are
+// out in swap, with the kmalloc() heap below. With a
+// command, runs it and shows what changed between before it
+// started and after it exited, such as pages left in the
+// caches.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+char *tags[NMTAG] = {
+[MT_KERNEL] "kernel",
+[MT_USER]   "user",
+[MT_PGTBL]  "pgtbl",
+[MT_KSTACK] "kstack",
+[MT_PIPE]   "pipe",
+[MT_BUF]    "buf",
+[MT_PCACHE] "pcache",
+[MT_ZERO]   "zero",
+};
+
+void
+get(struct memstat *ms)
+{
+  if(memstat(ms) < 0){
+    fprintf(2, "memstat: memstat failed\n");
+    exit(1);
+  }
+}
+
+// a row: pages and KB, or their change if diff.
+void
+row(char *name, uint64 now, uint64 was, int diff)
+{
+  if(diff)
+    printf("%s\t%d\t%d\n", name, (int)(now - was), (int)(now - was) * 4);
+  else
+    printf("%s\t%d\t%d\n", name, (int)now, (int)now * 4);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat a, b;
+  int i, pid, diff;
+
+  memset(&a, 0, sizeof(a));
+  diff = argc > 1;
+  if(diff){
+    get(&a);
+    if((pid = fork()) < 0){
+      fprintf(2, "memstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "memstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    waitpid(pid, 0, 0);
+  }
+  get(&b);
+
+  printf("\tpages\tKB\n");
+  if(!diff)
+    row("total", b.total, a.total, diff);
+  row("free", b.free, a.free, diff);
+  for(i = 0; i < NMTAG; i++)
+    row(tags[i], b.used[i], a.used[i], diff);
+  row("swap", b.swapused, a.swapused, diff);
+  if(diff)
+    printf("heap\t\t%d\n", (int)(b.heapused - a.heapused) / 1024);
+  else
+    printf("heap\t\t%d of %d\n", (int)b.heapused / 1024, (int)b.heap / 1024);
+  exit(0);
+}
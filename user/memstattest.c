@@ -0,0 +1,124 @@
+// memstat() counts should add up, and follow user pages,
+// pipe buffers and kernel stacks as they come and go.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define NPG 64
+#define NKID 24
+
+void
+get(struct memstat *ms)
+{
+  if(memstat(ms) < 0){
+    printf("memstattest: memstat\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat a, b;
+  uint64 sum;
+  char *p, buf[512];
+  int i, fds[2], st;
+
+  // other processes may allocate between the counts.
+  get(&a);
+  sum = a.free;
+  for(i = 0; i < NMTAG; i++)
+    sum += a.used[i];
+  if(sum + 16 < a.total || sum > a.total + 16){
+    printf("memstattest: counts don't add up\n");
+    exit(1);
+  }
+  if(a.heapused == 0 || a.heapused > a.heap){
+    printf("memstattest: heap\n");
+    exit(1);
+  }
+  if(memstat((struct memstat*)0xffffffffff00) != -1){
+    printf("memstattest: bad address\n");
+    exit(1);
+  }
+
+  // user pages.
+  if((p = sbrk(NPG * 4096)) == (char*)-1){
+    printf("memstattest: sbrk\n");
+    exit(1);
+  }
+  for(i = 0; i < NPG; i++)
+    p[i * 4096] = 1;
+  get(&b);
+  if(b.used[MT_USER] < a.used[MT_USER] + NPG || b.free + NPG > a.free){
+    printf("memstattest: user pages not counted\n");
+    exit(1);
+  }
+  sbrk(-NPG * 4096);
+  get(&a);
+  if(a.used[MT_USER] + NPG > b.used[MT_USER]){
+    printf("memstattest: user pages not uncounted\n");
+    exit(1);
+  }
+
+  // pipe buffers.
+  if(pipe(fds) < 0){
+    printf("memstattest: pipe\n");
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+    printf("memstattest: write\n");
+    exit(1);
+  }
+  get(&b);
+  if(b.used[MT_PIPE] <= a.used[MT_PIPE]){
+    printf("memstattest: pipe buffer not counted\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  get(&a);
+  if(a.used[MT_PIPE] >= b.used[MT_PIPE]){
+    printf("memstattest: pipe buffer not uncounted\n");
+    exit(1);
+  }
+
+  // kernel stacks: one per live process, and no more than
+  // the pool keeps once they exit.
+  get(&a);
+  if(pipe(fds) < 0){
+    printf("memstattest: pipe\n");
+    exit(1);
+  }
+  for(i = 0; i < NKID; i++){
+    if(fork() == 0){
+      close(fds[1]);
+      read(fds[0], buf, 1);
+      exit(0);
+    }
+  }
+  get(&b);
+  if(b.used[MT_KSTACK] < NKID){
+    printf("memstattest: children without kernel stacks\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < NKID; i++)
+    if(wait(&st) < 0){
+      printf("memstattest: wait\n");
+      exit(1);
+    }
+  get(&b);
+  if(b.used[MT_KSTACK] > a.used[MT_KSTACK] + NKSTACKPOOL){
+    printf("memstattest: kernel stacks not freed\n");
+    exit(1);
+  }
+
+  printf("memstattest: OK\n");
+  exit(0);
+}
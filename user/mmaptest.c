@@ -8,6 +8,7 @@
 
 void mmap_test();
 void fork_test();
+void read_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -17,6 +18,7 @@ main(int argc, char *argv[])
 {
   mmap_test();
   fork_test();
+  read_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -269,3 +271,59 @@ fork_test(void)
   printf("fork_test OK\n");
 }
 
+
+//
+// read() into a MAP_SHARED mapping; the kernel, not the
+// process, writes the page, and munmap() must still write
+// it back.
+//
+void
+read_test(void)
+{
+  int fd, i;
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("read_test starting\n");
+  testname = "read_test";
+
+  makefile(f);
+  unlink("mmap.src");
+  if((fd = open("mmap.src", O_RDWR | O_CREATE)) == -1)
+    err("open mmap.src");
+  memset(buf, 'R', BSIZE);
+  for(i = 0; i < PGSIZE/BSIZE; i++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write mmap.src");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap (6)");
+  close(fd);
+
+  // the first page is never touched by the process itself.
+  if((fd = open("mmap.src", O_RDONLY)) == -1)
+    err("open mmap.src");
+  if(read(fd, p, PGSIZE) != PGSIZE)
+    err("read into mapping");
+  close(fd);
+  if(munmap(p, PGSIZE*2) == -1)
+    err("munmap (5)");
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    if(read(fd, buf, BSIZE) != BSIZE)
+      err("read (2)");
+    if(buf[0] != 'R' || buf[BSIZE-1] != 'R')
+      err("file does not contain the data read()");
+  }
+  close(fd);
+  unlink(f);
+  unlink("mmap.src");
+
+  printf("read_test OK\n");
+}
@@ -0,0 +1,345 @@
+//
+// M:N user-level threads. Any number of mthreads run over a
+// few workers, kernel threads made with clone(). Each worker
+// keeps a deque of ready mthreads: it pushes new ones on the
+// bottom and pops from there, and when it runs dry it steals
+// from the top of another worker's deque. An mthread blocked
+// in a system call holds up only its own worker.
+//
+// tls()->mthread points at the current worker's struct
+// worker; tp is per kernel thread, and thread_switch()
+// leaves it alone.
+//
+// A worker that finds no work for a while sleeps in
+// futex_wait() on wakeseq, which kick() bumps whenever
+// there is something new to look at.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MT_MAXWORKER  16      // NTHREAD in kernel/param.h
+#define MT_STACK      8192    // stack bytes per mthread
+#define MT_WSTACK     4096    // stack bytes per worker loop
+#define MT_SPINS      1000    // idle polls before sleeping
+
+// Registers saved by thread_switch(): ra, sp, s0-s11.
+struct context {
+  uint64 ra;
+  uint64 sp;
+  uint64 s[12];
+};
+
+struct mthread {
+  struct context ctx;
+  void (*fn)(void*);
+  void *arg;
+  int done;                 // finished; the worker frees it
+  char *stack;
+};
+
+// A deque of ready mthreads. top and bottom only grow, and
+// buf[i & (cap-1)] holds entry i for top <= i < bottom.
+struct deque {
+  int lock;
+  struct mthread **buf;
+  uint cap;                 // a power of 2, or 0
+  uint top;                 // thieves take from here
+  uint bottom;              // the owner pushes and pops here
+};
+
+struct worker {
+  struct context sched;     // the worker loop, between mthreads
+  struct mthread *cur;      // mthread running, or 0
+  struct deque dq;
+  int pid;                  // clone()d thread; 0 for the caller
+  char *stack;
+};
+
+extern void thread_switch(uint64, uint64);
+
+static struct worker workers[MT_MAXWORKER];
+static volatile int nworker;
+static volatile int live;       // mthreads created, not yet finished
+static volatile int stopping;   // mthread_run() is done; workers exit
+static volatile int wakeseq;    // bumped by kick()
+static volatile int nsleep;     // workers in futex_wait(&wakeseq)
+
+static void
+lock(int *l)
+{
+  while(__sync_lock_test_and_set(l, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+unlock(int *l)
+{
+  __sync_synchronize();
+  __sync_lock_release(l);
+}
+
+static inline struct worker*
+self(void)
+{
+  return tls()->mthread;
+}
+
+// Add t to d, at the bottom, or at the top if back is set,
+// so that it runs after everything already queued.
+// Returns 0, or -1 if out of memory.
+static int
+dqpush(struct deque *d, struct mthread *t, int back)
+{
+  struct mthread **nb;
+  uint i, ncap;
+
+  lock(&d->lock);
+  if(d->bottom - d->top == d->cap){
+    ncap = d->cap ? 2 * d->cap : 16;
+    if((nb = malloc(ncap * sizeof(*nb))) == 0){
+      unlock(&d->lock);
+      return -1;
+    }
+    for(i = d->top; i != d->bottom; i++)
+      nb[i & (ncap-1)] = d->buf[i & (d->cap-1)];
+    if(d->buf)
+      free(d->buf);
+    d->buf = nb;
+    d->cap = ncap;
+  }
+  if(back)
+    d->buf[--d->top & (d->cap-1)] = t;
+  else
+    d->buf[d->bottom++ & (d->cap-1)] = t;
+  unlock(&d->lock);
+  return 0;
+}
+
+// Take the newest mthread off d's bottom, for its owner.
+static struct mthread*
+dqpop(struct deque *d)
+{
+  struct mthread *t = 0;
+
+  lock(&d->lock);
+  if(d->top != d->bottom)
+    t = d->buf[--d->bottom & (d->cap-1)];
+  unlock(&d->lock);
+  return t;
+}
+
+// Take the oldest mthread off d's top, for a thief.
+static struct mthread*
+dqsteal(struct deque *d)
+{
+  struct mthread *t = 0;
+
+  if(d->top == d->bottom)
+    return 0;  // looks empty; don't bother the owner
+  lock(&d->lock);
+  if(d->top != d->bottom)
+    t = d->buf[d->top++ & (d->cap-1)];
+  unlock(&d->lock);
+  return t;
+}
+
+static struct mthread*
+steal(struct worker *w)
+{
+  struct mthread *t;
+  int i, n = nworker;
+
+  for(i = 1; i < n; i++)
+    if((t = dqsteal(&workers[(w - workers + i) % n].dq)) != 0)
+      return t;
+  return 0;
+}
+
+// Tell sleeping workers there is new work, or that the
+// conditions schedule() waits for may have changed.
+static void
+kick(int all)
+{
+  __sync_fetch_and_add(&wakeseq, 1);
+  if(nsleep > 0)
+    futex_wake(&wakeseq, all ? MT_MAXWORKER : 1);
+}
+
+static struct mthread*
+next(struct worker *w)
+{
+  struct mthread *t;
+
+  if((t = dqpop(&w->dq)) == 0)
+    t = steal(w);
+  return t;
+}
+
+// Run mthreads on w until all are done (for the caller of
+// mthread_run()) or until stopping (for the others).
+static void
+schedule(struct worker *w, int untildone)
+{
+  struct mthread *t;
+  int idle = 0, seq;
+
+  while(untildone ? live > 0 : !stopping){
+    if((t = next(w)) == 0){
+      if(++idle < MT_SPINS)
+        continue;
+      idle = 0;
+      // look once more after announcing ourselves, so that
+      // a kick() between the look and the wait is not lost.
+      seq = wakeseq;
+      __sync_fetch_and_add(&nsleep, 1);
+      if((t = next(w)) == 0 && (untildone ? live > 0 : !stopping))
+        futex_wait(&wakeseq, seq);
+      __sync_fetch_and_sub(&nsleep, 1);
+      if(t == 0)
+        continue;
+    }
+    idle = 0;
+    do {
+      w->cur = t;
+      thread_switch((uint64)&w->sched, (uint64)&t->ctx);
+      w->cur = 0;
+      // t has stopped using its stack: now it may be
+      // freed, or queued for another worker to resume.
+      if(t->done){
+        free(t->stack);
+        free(t);
+        if(__sync_fetch_and_sub(&live, 1) == 1)
+          kick(1);  // for mthread_run()
+        break;
+      }
+    } while(dqpush(&w->dq, t, 1) < 0);
+  }
+}
+
+static void
+workermain(void *arg)
+{
+  if(tls() == 0)
+    exit(1);
+  tls()->mthread = arg;
+  schedule(arg, 0);
+  malloc_thread_done();
+  exit(0);
+}
+
+// Every mthread starts here, on its own stack.
+static void
+mtstart(void)
+{
+  struct mthread *t = self()->cur;
+
+  t->fn(t->arg);
+  mthread_exit();
+}
+
+// Start n workers in all, counting the calling thread,
+// which joins them in mthread_run().
+// Returns 0, or -1 if no worker could be started.
+int
+mthread_init(int n)
+{
+  struct worker *w;
+  int i;
+
+  if(n < 1 || n > MT_MAXWORKER)
+    return -1;
+  memset(workers, 0, sizeof(workers));
+  live = 0;
+  stopping = 0;
+  nsleep = 0;
+  if(tls() == 0)
+    return -1;
+  tls()->mthread = &workers[0];
+  nworker = 1;
+  for(i = 1; i < n; i++){
+    w = &workers[i];
+    if((w->stack = malloc(MT_WSTACK)) == 0)
+      break;
+    nworker = i + 1;  // before w can look for work
+    if((w->pid = clone(workermain, w, w->stack + MT_WSTACK)) < 0){
+      nworker = i;
+      free(w->stack);
+      w->stack = 0;
+      break;
+    }
+  }
+  return 0;
+}
+
+// Create an mthread running fn(arg). It may run on any
+// worker, and ends when fn returns or calls mthread_exit().
+// Returns 0, or -1 if out of memory.
+int
+mthread_create(void (*fn)(void*), void *arg)
+{
+  struct mthread *t;
+
+  if((t = malloc(sizeof(*t))) == 0)
+    return -1;
+  if((t->stack = malloc(MT_STACK)) == 0){
+    free(t);
+    return -1;
+  }
+  memset(&t->ctx, 0, sizeof(t->ctx));
+  t->ctx.ra = (uint64)mtstart;
+  t->ctx.sp = (uint64)(t->stack + MT_STACK) & ~15L;
+  t->fn = fn;
+  t->arg = arg;
+  t->done = 0;
+  __sync_fetch_and_add(&live, 1);
+  if(dqpush(&self()->dq, t, 0) < 0){
+    __sync_fetch_and_sub(&live, 1);
+    free(t->stack);
+    free(t);
+    return -1;
+  }
+  kick(0);
+  return 0;
+}
+
+// Let the other ready mthreads run first.
+void
+mthread_yield(void)
+{
+  struct worker *w = self();
+
+  thread_switch((uint64)&w->cur->ctx, (uint64)&w->sched);
+}
+
+void
+mthread_exit(void)
+{
+  struct worker *w = self();
+
+  w->cur->done = 1;
+  thread_switch((uint64)&w->cur->ctx, (uint64)&w->sched);
+  for(;;)
+    ;  // not reached; the worker frees the mthread
+}
+
+// Run mthreads on the calling thread as a worker until
+// every mthread has finished, then stop the other workers.
+void
+mthread_run(void)
+{
+  int i;
+
+  schedule(&workers[0], 1);
+  stopping = 1;
+  kick(1);
+  for(i = 1; i < nworker; i++){
+    waitpid(workers[i].pid, 0, 0);
+    free(workers[i].stack);
+  }
+  for(i = 0; i < nworker; i++)
+    if(workers[i].dq.buf)
+      free(workers[i].dq.buf);
+  nworker = 0;
+}
@@ -0,0 +1,205 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void clone_test();
+void share_test();
+void fork_test();
+void mthread_test();
+
+int
+main(int argc, char *argv[])
+{
+  clone_test();
+  share_test();
+  fork_test();
+  mthread_test();
+  printf("mthreadtest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("mthreadtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+volatile int counter;
+char stack[4][4096] __attribute__((aligned(16)));
+
+void
+bump(void *arg)
+{
+  for(int i = 0; i < 1000; i++)
+    __sync_fetch_and_add(&counter, (uint64)arg);
+  exit(0);
+}
+
+//
+// threads share the caller's memory and are joined
+// with waitpid().
+//
+void
+clone_test()
+{
+  int pids[4];
+
+  testname = "clone";
+  counter = 0;
+  for(int i = 0; i < 4; i++)
+    if((pids[i] = clone(bump, (void*)(uint64)(i + 1), stack[i] + sizeof(stack[i]))) <= 0)
+      err("clone");
+  for(int i = 0; i < 4; i++)
+    if(waitpid(pids[i], 0, 0) != pids[i])
+      err("waitpid");
+  if(counter != 1000 * (1 + 2 + 3 + 4))
+    err("counter");
+  printf("clone_test OK\n");
+}
+
+volatile char *heap;
+
+void
+grow(void *arg)
+{
+  // let the thread's sbrk() show up in the leader.
+  heap = sbrk(4096);
+  heap[0] = 'x';
+  exit(0);
+}
+
+void
+spin(void *arg)
+{
+  for(;;)
+    counter++;
+}
+
+//
+// sbrk() in a thread grows the shared address space, and the
+// leader's exit() takes its threads with it.
+//
+void
+share_test()
+{
+  int pid, xstatus;
+
+  testname = "share";
+  heap = 0;
+  if((pid = clone(grow, 0, stack[0] + sizeof(stack[0]))) <= 0)
+    err("clone");
+  waitpid(pid, 0, 0);
+  if(heap == 0 || heap[0] != 'x')
+    err("heap not shared");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(clone(spin, 0, stack[1] + sizeof(stack[1])) <= 0)
+      exit(1);
+    sleep(1);
+    exit(0);  // must not hang on the spinning thread
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("exit with threads");
+  printf("share_test OK\n");
+}
+
+volatile uint64 stamp;
+volatile int stop;
+
+void
+stamper(void *arg)
+{
+  while(!stop)
+    stamp++;
+  exit(0);
+}
+
+//
+// a thread that keeps writing while its leader forks must
+// not write into the child's copy once fork() returns.
+//
+void
+fork_test()
+{
+  int tid, pid, xstatus;
+  uint64 s;
+
+  testname = "fork";
+  stamp = 0;
+  stop = 0;
+  if((tid = clone(stamper, 0, stack[0] + sizeof(stack[0]))) <= 0)
+    err("clone");
+  while(stamp == 0)
+    ;
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    s = stamp;
+    sleep(2);
+    exit(stamp != s);
+  }
+  wait(&xstatus);
+  stop = 1;
+  if(waitpid(tid, 0, 0) != tid)
+    err("waitpid");
+  if(xstatus != 0)
+    err("child saw the parent's thread write");
+  printf("fork_test OK\n");
+}
+
+#define NTASK 64
+
+volatile int total;
+volatile int children;
+
+void
+child(void *arg)
+{
+  __sync_fetch_and_add(&children, 1);
+}
+
+void
+task(void *arg)
+{
+  int n = (int)(uint64)arg;
+
+  for(int i = 1; i <= 100; i++){
+    __sync_fetch_and_add(&total, n * i);
+    if(i % 10 == 0)
+      mthread_yield();
+  }
+  if(n % 2 == 0 && mthread_create(child, 0) < 0)
+    err("nested create");
+}
+
+//
+// many mthreads over a few workers, yielding and creating more.
+//
+void
+mthread_test()
+{
+  int want = 0;
+
+  testname = "mthread";
+  total = 0;
+  children = 0;
+  if(mthread_init(4) < 0)
+    err("init");
+  for(int n = 0; n < NTASK; n++){
+    if(mthread_create(task, (void*)(uint64)n) < 0)
+      err("create");
+    want += n * 5050;
+  }
+  mthread_run();
+  if(total != want)
+    err("total");
+  if(children != NTASK / 2)
+    err("children");
+  printf("mthread_test OK\n");
+}
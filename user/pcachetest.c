@@ -0,0 +1,130 @@
+// File data read through the page cache must stay right
+// across writes, mmap() and memory pressure.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define NPAGE 64
+
+char buf[PGSIZE];
+
+// byte i of page pg, in version v of the file.
+char
+pattern(int v, int pg, int i)
+{
+  return v * 31 + pg * 7 + i;
+}
+
+void
+check(int v, int pg0, int pg1, char *what)
+{
+  int fd, pg, i;
+
+  if((fd = open("pc.file", O_RDONLY)) < 0){
+    printf("pcachetest: open\n");
+    exit(1);
+  }
+  for(pg = 0; pg < NPAGE; pg++){
+    if(read(fd, buf, PGSIZE) != PGSIZE){
+      printf("pcachetest: short read\n");
+      exit(1);
+    }
+    for(i = 0; i < PGSIZE; i++)
+      if(buf[i] != pattern(pg >= pg0 && pg < pg1 ? v : 0, pg, i)){
+        printf("pcachetest: %s\n", what);
+        exit(1);
+      }
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pg, i, pid, status;
+  char *p;
+
+  unlink("pc.file");
+  if((fd = open("pc.file", O_CREATE|O_WRONLY)) < 0){
+    printf("pcachetest: create\n");
+    exit(1);
+  }
+  for(pg = 0; pg < NPAGE; pg++){
+    for(i = 0; i < PGSIZE; i++)
+      buf[i] = pattern(0, pg, i);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("pcachetest: write\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  check(0, 0, 0, "first read");
+  check(0, 0, 0, "second read");
+
+  // rewrite the middle.
+  if((fd = open("pc.file", O_WRONLY)) < 0){
+    printf("pcachetest: open for write\n");
+    exit(1);
+  }
+  for(pg = 0; pg < 10; pg++){
+    for(i = 0; i < PGSIZE; i++)
+      buf[i] = pattern(0, pg, i);
+    write(fd, buf, PGSIZE);
+  }
+  for(pg = 10; pg < 20; pg++){
+    for(i = 0; i < PGSIZE; i++)
+      buf[i] = pattern(1, pg, i);
+    write(fd, buf, PGSIZE);
+  }
+  close(fd);
+  check(1, 10, 20, "read after rewrite");
+
+  // writes to a private mapping stay private.
+  if((fd = open("pc.file", O_RDWR)) < 0){
+    printf("pcachetest: open for mmap\n");
+    exit(1);
+  }
+  if((p = mmap(0, NPAGE * PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) == (char*)-1){
+    printf("pcachetest: mmap private\n");
+    exit(1);
+  }
+  if(p[15 * PGSIZE + 5] != pattern(1, 15, 5)){
+    printf("pcachetest: private mapping contents\n");
+    exit(1);
+  }
+  for(i = 0; i < NPAGE * PGSIZE; i += PGSIZE)
+    p[i] = 0x55;
+  munmap(p, NPAGE * PGSIZE);
+  check(1, 10, 20, "read after private mmap writes");
+
+  // writes to a shared mapping reach readers once unmapped.
+  if((p = mmap(0, NPAGE * PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == (char*)-1){
+    printf("pcachetest: mmap shared\n");
+    exit(1);
+  }
+  for(pg = 20; pg < 30; pg++)
+    for(i = 0; i < PGSIZE; i++)
+      p[pg * PGSIZE + i] = pattern(1, pg, i);
+  munmap(p, NPAGE * PGSIZE);
+  close(fd);
+  check(1, 10, 30, "read after shared mmap writes");
+
+  // the cache gives its pages back when memory runs short:
+  // a child touches all it can get, until it is killed.
+  if((pid = fork()) == 0){
+    for(;;){
+      if((p = sbrk(PGSIZE)) == (char*)-1)
+        exit(0);
+      *p = 1;
+    }
+  }
+  waitpid(pid, &status, 0);
+  check(1, 10, 30, "read after memory pressure");
+
+  unlink("pc.file");
+  printf("pcachetest: ok\n");
+  exit(0);
+}
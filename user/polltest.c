@@ -0,0 +1,80 @@
+// tests for poll() on pipes.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/poll.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct pollfd fds[3];
+  int a[2], b[2], t0, n, st;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("polltest: pipe\n");
+    exit(1);
+  }
+
+  // empty pipes: not readable, but writable.
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = a[1];
+  fds[2].events = POLLOUT;
+  if(poll(fds, 2, 0) != 0 || fds[0].revents || fds[1].revents){
+    printf("polltest: empty pipe readable\n");
+    exit(1);
+  }
+  if(poll(fds + 2, 1, 0) != 1 || fds[2].revents != POLLOUT){
+    printf("polltest: empty pipe not writable\n");
+    exit(1);
+  }
+
+  // the timeout runs out.
+  t0 = uptime();
+  if(poll(fds, 2, 5) != 0){
+    printf("polltest: timeout\n");
+    exit(1);
+  }
+  if(uptime() - t0 < 5){
+    printf("polltest: timeout too short\n");
+    exit(1);
+  }
+
+  // a write by another process wakes the poller.
+  if(fork() == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if((n = poll(fds, 2, -1)) != 1 || fds[0].revents || fds[1].revents != POLLIN){
+    printf("polltest: no wakeup on write\n");
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("polltest: read\n");
+    exit(1);
+  }
+  wait(&st);
+
+  // hangup once the writers are gone.
+  close(b[1]);
+  if(poll(fds + 1, 1, -1) != 1 || (fds[1].revents & POLLHUP) == 0){
+    printf("polltest: no hangup\n");
+    exit(1);
+  }
+
+  // negative fds are skipped; closed ones are reported.
+  close(b[0]);
+  fds[0].fd = -1;
+  if(poll(fds, 2, 0) != 1 || fds[0].revents || fds[1].revents != POLLNVAL){
+    printf("polltest: closed fd\n");
+    exit(1);
+  }
+
+  printf("polltest: OK\n");
+  exit(0);
+}
@@ -6,14 +6,104 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output buffering. printf()/fprintf() collect output in a
+// buffer per fd and write() it out when the buffer fills --
+// or, on the console, at the end of each line; on fd 2, at
+// the end of each call. fork(), exec(), spawn(), close() and
+// exit() flush first (see ulib.c), so buffered output is
+// neither lost nor written twice. Programs that mix printf()
+// with write() on one fd must fflush() in between.
+
+#define NOBUF   8       // fds with their own buffer
+#define OBUFSZ  512
+
+enum { UNKNOWN, PERCALL, LINE, FULL };
+
+struct obuf {
+  struct mutex lock;
+  int fd;
+  int mode;
+  int n;
+  char buf[OBUFSZ];
+};
+
+static struct obuf obufs[NOBUF];
+
 static void
-putc(int fd, char c)
+obflush(struct obuf *b)
 {
-  write(fd, &c, 1);
+  if(b->n > 0)
+    write(b->fd, b->buf, b->n);
+  b->n = 0;
+}
+
+static void
+putc(struct obuf *b, char c)
+{
+  b->buf[b->n++] = c;
+  if(b->n == OBUFSZ || (c == '\n' && b->mode == LINE))
+    obflush(b);
+}
+
+// Lock and return fd's buffer, or set up tmp as one that
+// lasts for one call.
+static struct obuf*
+obget(int fd, struct obuf *tmp)
+{
+  struct obuf *b;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOBUF){
+    tmp->fd = fd;
+    tmp->mode = PERCALL;
+    tmp->n = 0;
+    return tmp;
+  }
+  b = &obufs[fd];
+  mutex_lock(&b->lock);
+  if(b->mode == UNKNOWN){
+    b->fd = fd;
+    if(fd == 2)
+      b->mode = PERCALL;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      b->mode = LINE;
+    else
+      b->mode = FULL;
+    stdio_flush = fflush;
+  }
+  return b;
+}
+
+static void
+obput(struct obuf *b)
+{
+  if(b->mode == PERCALL)
+    obflush(b);
+  if(b->fd >= 0 && b->fd < NOBUF)
+    mutex_unlock(&b->lock);
+}
+
+// Write out fd's buffered output, or every fd's if fd < 0,
+// and forget what fd was connected to.
+void
+fflush(int fd)
+{
+  struct obuf *b;
+
+  if(fd >= NOBUF)
+    return;  // never buffered
+  for(b = obufs; b < &obufs[NOBUF]; b++){
+    if(fd >= 0 && b != &obufs[fd])
+      continue;
+    mutex_lock(&b->lock);
+    obflush(b);
+    b->mode = UNKNOWN;
+    mutex_unlock(&b->lock);
+  }
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct obuf *b, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,7 +125,7 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(b, buf[i]);
 }
 
 static int
@@ -69,12 +159,12 @@ snprintint(char *str, int size, int xx, int base, int sgn)
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct obuf *b, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(b, '0');
+  putc(b, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(b, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 static int
@@ -103,7 +193,9 @@ vprintf(int fd, const char *fmt, va_list ap)
 {
   char *s;
   int c, i, state;
+  struct obuf tmp, *b;
 
+  b = obget(fd, &tmp);
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -111,37 +203,38 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(b, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(b, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(b, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(b, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(b, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(b, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(b, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(b, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(b, '%');
+        putc(b, c);
       }
       state = 0;
     }
   }
+  obput(b);
 }
 
 void
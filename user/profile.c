@@ -0,0 +1,274 @@
+//
+// profile: sample where the CPUs spend their time while a
+// command runs, and print a histogram by function.
+//
+// usage: profile [-n count] cmd [arg ...]
+//
+// Kernel pcs are looked up in /kernel.sym, and a process's
+// user pcs in /<name>.sym, where name is the process's name;
+// the Makefile puts both on the file system. Samples are
+// taken at each timer interrupt, about ten a second per CPU.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+struct sym {
+  uint64 addr;
+  char *name;
+};
+
+// the symbols of one program, or of the kernel.
+struct image {
+  char name[16];
+  struct sym *syms;     // by address
+  int nsym;
+  struct image *next;
+};
+
+// one line of the histogram.
+struct hit {
+  struct image *im;
+  char *sym;
+  int n;
+};
+
+struct profsample *samples;
+int nsample, maxsample;
+struct hit *hits;
+int nhit, maxhit;
+struct image *images;
+
+void*
+grow(void *p, int *max, int size)
+{
+  void *np;
+
+  if((np = malloc((*max ? 2 * *max : 256) * size)) == 0){
+    fprintf(2, "profile: out of memory\n");
+    exit(1);
+  }
+  if(p){
+    memmove(np, p, *max * size);
+    free(p);
+  }
+  *max = *max ? 2 * *max : 256;
+  return np;
+}
+
+// drain the kernel's sample buffers.
+void
+collect(void)
+{
+  int n;
+
+  for(;;){
+    if(nsample == maxsample)
+      samples = grow(samples, &maxsample, sizeof(*samples));
+    if((n = profile(PROF_READ, samples + nsample, maxsample - nsample)) <= 0)
+      break;
+    nsample += n;
+  }
+}
+
+uint64
+hex(char *s)
+{
+  uint64 x = 0;
+
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x * 16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x * 16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  return x;
+}
+
+// read a .sym file: lines of "address name", as written by
+// the Makefile's objdump -t. Leaves out section names and
+// source file names.
+void
+readsyms(struct image *im, char *file)
+{
+  struct stat st;
+  char *buf, *p, *line, *name;
+  int fd, n, max, len;
+  struct sym t;
+  int i, j;
+
+  im->syms = 0;
+  im->nsym = 0;
+  if((fd = open(file, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+    close(fd);
+    return;
+  }
+  for(n = 0; n < st.size; n += i)
+    if((i = read(fd, buf + n, st.size - n)) <= 0)
+      break;
+  buf[n] = 0;
+  close(fd);
+
+  max = 0;
+  for(p = buf; *p; ){
+    line = p;
+    while(*p && *p != '\n')
+      p++;
+    if(*p)
+      *p++ = 0;
+    if((name = strchr(line, ' ')) == 0)
+      continue;
+    *name++ = 0;
+    len = strlen(name);
+    if(name[0] == '.' || name[0] == 0 || (len > 2 && name[len-2] == '.'))
+      continue;
+    if(im->nsym == max)
+      im->syms = grow(im->syms, &max, sizeof(struct sym));
+    im->syms[im->nsym].addr = hex(line);
+    im->syms[im->nsym].name = name;
+    im->nsym++;
+  }
+
+  // mostly sorted already.
+  for(i = 1; i < im->nsym; i++){
+    t = im->syms[i];
+    for(j = i; j > 0 && im->syms[j-1].addr > t.addr; j--)
+      im->syms[j] = im->syms[j-1];
+    im->syms[j] = t;
+  }
+}
+
+struct image*
+image(char *name)
+{
+  struct image *im;
+  char file[32];
+
+  for(im = images; im; im = im->next)
+    if(strcmp(im->name, name) == 0)
+      return im;
+  if((im = malloc(sizeof(*im))) == 0){
+    fprintf(2, "profile: out of memory\n");
+    exit(1);
+  }
+  strcpy(im->name, name);
+  snprintf(file, sizeof(file), "/%s.sym", name);
+  readsyms(im, file);
+  im->next = images;
+  images = im;
+  return im;
+}
+
+// the name of the function containing pc, or "?".
+char*
+lookup(struct image *im, uint64 pc)
+{
+  int lo = 0, hi = im->nsym, mid;
+
+  // find the last symbol at or below pc.
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(im->syms[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo == 0 ? "?" : im->syms[lo-1].name;
+}
+
+void
+count(struct image *im, char *sym)
+{
+  int i;
+
+  for(i = 0; i < nhit; i++)
+    if(hits[i].im == im && hits[i].sym == sym){
+      hits[i].n++;
+      return;
+    }
+  if(nhit == maxhit)
+    hits = grow(hits, &maxhit, sizeof(*hits));
+  hits[nhit].im = im;
+  hits[nhit].sym = sym;
+  hits[nhit].n = 1;
+  nhit++;
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: profile [-n count] cmd [arg ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, pid, dropped, top = 30, nkernel;
+  struct image *kernel, *im;
+  struct profsample *s;
+  struct hit t;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      top = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(i >= argc)
+    usage();
+
+  if(profile(PROF_START, 0, 0) < 0){
+    fprintf(2, "profile: cannot start profiling\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    fprintf(2, "profile: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[i], argv + i);
+    fprintf(2, "profile: exec %s failed\n", argv[i]);
+    exit(1);
+  }
+  // keep the kernel's buffers from filling up.
+  while(waitpid(pid, 0, WNOHANG) == 0){
+    sleep(5);
+    collect();
+  }
+  dropped = profile(PROF_STOP, 0, 0);
+  collect();
+
+  kernel = image("kernel");
+  nkernel = 0;
+  for(s = samples; s < samples + nsample; s++){
+    if(s->user){
+      im = image(s->name);
+    } else {
+      im = kernel;
+      nkernel++;
+    }
+    count(im, lookup(im, s->pc));
+  }
+
+  for(i = 1; i < nhit; i++){
+    t = hits[i];
+    for(j = i; j > 0 && hits[j-1].n < t.n; j--)
+      hits[j] = hits[j-1];
+    hits[j] = t;
+  }
+
+  printf("%d samples, %d in the kernel, %d dropped\n", nsample, nkernel, dropped);
+  printf("samples\t%%\timage\tfunction\n");
+  for(i = 0; i < nhit && i < top; i++)
+    printf("%d\t%d\t%s\t%s\n", hits[i].n, hits[i].n * 100 / nsample,
+           hits[i].im->name, hits[i].sym);
+  exit(0);
+}
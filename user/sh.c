@@ -134,9 +134,7 @@ int
 getcmd(char *buf, int nbuf)
 {
   fprintf(2, "$ ");
-  memset(buf, 0, nbuf);
-  gets(buf, nbuf);
-  if(buf[0] == 0) // EOF
+  if(fgets(buf, nbuf, 0) == 0) // EOF
     return -1;
   return 0;
 }
@@ -0,0 +1,141 @@
+// Check shm_open(), mmap() and shm_unlink() on shared memory
+// segments, then have a producer hand buffers through one to
+// consumer processes, with futexes to wake them.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCONS 3
+#define NROUND 20
+#define SEGSZ (64*1024)
+
+struct hdr {
+  volatile int seq;    // round the buffer holds
+  volatile int acks;   // consumers done with it, all rounds
+};
+#define BUF(h) ((char*)(h) + 4096)
+#define BUFSZ (SEGSZ - 4096)
+
+struct hdr*
+map(int fd)
+{
+  char *p;
+
+  if((p = mmap(0, SEGSZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == (char*)-1){
+    printf("shmtest: mmap\n");
+    exit(1);
+  }
+  return (struct hdr*)p;
+}
+
+void
+consumer(void)
+{
+  struct hdr *h;
+  int fd, r, i, seq;
+  char *b;
+
+  if((fd = shm_open("shmtest", 0)) < 0){
+    printf("shmtest: consumer shm_open\n");
+    exit(1);
+  }
+  h = map(fd);
+  close(fd);
+  b = BUF(h);
+  for(r = 1; r <= NROUND; r++){
+    while((seq = h->seq) < r)
+      futex_wait(&h->seq, seq);
+    for(i = 0; i < BUFSZ; i++)
+      if(b[i] != (char)(r + i)){
+        printf("shmtest: consumer saw a bad buffer\n");
+        exit(1);
+      }
+    __sync_fetch_and_add(&h->acks, 1);
+    futex_wake(&h->acks, 1);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct hdr *h;
+  int fd, i, r, n, st;
+  char c, *b;
+
+  shm_unlink("shmtest");
+  if(shm_open("shmtest", 0) != -1){
+    printf("shmtest: opened a missing segment\n");
+    exit(1);
+  }
+  if((fd = shm_open("shmtest", SEGSZ)) < 0){
+    printf("shmtest: shm_open\n");
+    exit(1);
+  }
+  if(read(fd, &c, 1) != -1 || write(fd, &c, 1) != -1){
+    printf("shmtest: read or write of a segment\n");
+    exit(1);
+  }
+  if(mmap(0, SEGSZ, PROT_READ, MAP_PRIVATE, fd, 0) != (char*)-1){
+    printf("shmtest: private mapping\n");
+    exit(1);
+  }
+  if(mmap(0, SEGSZ + 4096, PROT_READ, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("shmtest: mapping past the end\n");
+    exit(1);
+  }
+  h = map(fd);
+  close(fd);
+  if(h->seq != 0 || h->acks != 0){
+    printf("shmtest: segment not zeroed\n");
+    exit(1);
+  }
+
+  for(i = 0; i < NCONS; i++){
+    if((n = fork()) < 0){
+      printf("shmtest: fork\n");
+      exit(1);
+    }
+    if(n == 0)
+      consumer();
+  }
+
+  // hand out NROUND buffers, each once all have seen the last.
+  b = BUF(h);
+  for(r = 1; r <= NROUND; r++){
+    for(i = 0; i < BUFSZ; i++)
+      b[i] = r + i;
+    h->seq = r;
+    futex_wake(&h->seq, NCONS);
+    while((n = h->acks) < r * NCONS)
+      futex_wait(&h->acks, n);
+  }
+  for(i = 0; i < NCONS; i++)
+    if(wait(&st) < 0 || st != 0){
+      printf("shmtest: consumer failed\n");
+      exit(1);
+    }
+
+  // unlinked, it can't be opened, but stays mapped.
+  if(shm_unlink("shmtest") != 0 || shm_unlink("shmtest") != -1){
+    printf("shmtest: shm_unlink\n");
+    exit(1);
+  }
+  if(shm_open("shmtest", 0) != -1){
+    printf("shmtest: opened an unlinked segment\n");
+    exit(1);
+  }
+  if(h->seq != NROUND){
+    printf("shmtest: mapping lost\n");
+    exit(1);
+  }
+  if(munmap(h, SEGSZ) < 0){
+    printf("shmtest: munmap\n");
+    exit(1);
+  }
+
+  printf("shmtest: OK\n");
+  exit(0);
+}
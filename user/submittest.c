@@ -0,0 +1,129 @@
+// Test submit(), which makes a batch of system calls with
+// one trap, and time argv[1] small writes with and without it.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/submit.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+int n = 2000;
+struct sqe q[64];
+
+void
+entry(struct sqe *e, int op, uint64 a0, uint64 a1, uint64 a2)
+{
+  memset(e, 0, sizeof(*e));
+  e->op = op;
+  e->arg[0] = a0;
+  e->arg[1] = a1;
+  e->arg[2] = a2;
+}
+
+void
+link0(struct sqe *e)
+{
+  e->flags = SQE_LINK;
+  e->link = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char buf[16];
+  struct stat st;
+  uint64 t1, tn;
+  int i, j, fd;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  // create, write, read back, close.
+  unlink("st.f");
+  entry(&q[0], SYS_open, (uint64)"st.f", O_CREATE|O_RDWR, 0);
+  entry(&q[1], SYS_write, 0, (uint64)"hello", 5);
+  link0(&q[1]);
+  entry(&q[2], SYS_fstat, 0, (uint64)&st, 0);
+  link0(&q[2]);
+  entry(&q[3], SYS_close, 0, 0, 0);
+  link0(&q[3]);
+  if(submit(q, 4) != 4){
+    printf("submittest: submit did not make every call\n");
+    exit(1);
+  }
+  if((int)q[0].res < 0 || q[1].res != 5 || q[2].res != 0 || q[3].res != 0){
+    printf("submittest: bad results\n");
+    exit(1);
+  }
+  if(st.size != 5){
+    printf("submittest: fstat in a batch saw the wrong size\n");
+    exit(1);
+  }
+  if(stat("st.f", &st) < 0 || st.size != 5 || st.type != T_FILE){
+    printf("submittest: stat\n");
+    exit(1);
+  }
+  if((fd = open("st.f", O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != 5 ||
+     memcmp(buf, "hello", 5) != 0){
+    printf("submittest: write in a batch did not land\n");
+    exit(1);
+  }
+  close(fd);
+
+  // a failed open skips the calls linked to it.
+  entry(&q[0], SYS_open, (uint64)"st.nothere", O_RDONLY, 0);
+  entry(&q[1], SYS_close, 0, 0, 0);
+  link0(&q[1]);
+  if(submit(q, 2) != 2 || (int)q[0].res >= 0 || (int)q[1].res != -1){
+    printf("submittest: failed open did not skip its links\n");
+    exit(1);
+  }
+  if(stat("st.nothere", &st) >= 0){
+    printf("submittest: stat of a missing file\n");
+    exit(1);
+  }
+
+  // fork is not made from a batch; later entries still are.
+  entry(&q[0], SYS_fork, 0, 0, 0);
+  entry(&q[1], SYS_getpid, 0, 0, 0);
+  if(submit(q, 2) != 2 || (int)q[0].res != -1 || q[1].res != getpid()){
+    printf("submittest: fork in a batch\n");
+    exit(1);
+  }
+  if(submit((struct sqe*)0xffffffffff00, 1) != 0){
+    printf("submittest: bad queue address\n");
+    exit(1);
+  }
+
+  // small writes, one trap each and 64 to a trap.
+  if((fd = open("st.f", O_WRONLY)) < 0){
+    printf("submittest: open\n");
+    exit(1);
+  }
+  t1 = clock_cycles();
+  for(i = 0; i < n; i++)
+    if(write(fd, "x", 1) != 1){
+      printf("submittest: write\n");
+      exit(1);
+    }
+  t1 = (clock_cycles() - t1) * 1000000 / clock_hz();
+  tn = clock_cycles();
+  for(i = 0; i < n; i += NELEM(q)){
+    for(j = 0; j < NELEM(q); j++)
+      entry(&q[j], SYS_write, fd, (uint64)"x", 1);
+    if(submit(q, NELEM(q)) != NELEM(q)){
+      printf("submittest: batched writes\n");
+      exit(1);
+    }
+  }
+  tn = (clock_cycles() - tn) * 1000000 / clock_hz();
+  close(fd);
+  unlink("st.f");
+  printf("submittest: %d writes in %l us, batched in %l us\n", n, t1, tn);
+
+  printf("submittest: OK\n");
+  exit(0);
+}
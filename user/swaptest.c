@@ -0,0 +1,112 @@
+// Touch more pages than are free and read them all back,
+// in the process and in a fork child, while swapd pages them
+// out; then see that the swap slots are freed.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define PG 4096
+
+void
+get(struct memstat *ms)
+{
+  if(memstat(ms) < 0){
+    printf("swaptest: memstat\n");
+    exit(1);
+  }
+}
+
+// the word each page starts and ends with.
+uint64
+mark(uint64 i, int gen)
+{
+  return i * 2654435761UL + gen;
+}
+
+void
+fill(char *p, uint64 n, int gen)
+{
+  uint64 i;
+
+  for(i = 0; i < n; i++){
+    *(uint64*)(p + i*PG) = mark(i, gen);
+    *(uint64*)(p + i*PG + PG - 8) = mark(i, gen);
+  }
+}
+
+void
+check(char *p, uint64 n, uint64 step, int gen)
+{
+  uint64 i;
+
+  for(i = 0; i < n; i += step){
+    if(*(uint64*)(p + i*PG) != mark(i, gen) ||
+       *(uint64*)(p + i*PG + PG - 8) != mark(i, gen)){
+      printf("swaptest: page %d of %d is wrong\n", (int)i, (int)n);
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat a, b;
+  uint64 n, extra;
+  char *p;
+  int pid, st;
+
+  get(&a);
+  if(a.swap == 0){
+    printf("swaptest: no swap; skipped\n");
+    exit(0);
+  }
+  // a quarter more than is free, but well within swap.
+  extra = a.free / 4;
+  if(extra > a.swap / 2)
+    extra = a.swap / 2;
+  n = a.free + extra;
+  printf("swaptest: %d pages, %d free, %d of swap\n", (int)n, (int)a.free, (int)a.swap);
+
+  if((p = sbrk(n * PG)) == (char*)-1){
+    printf("swaptest: sbrk\n");
+    exit(1);
+  }
+  fill(p, n, 1);
+  get(&b);
+  if(b.swapused < a.swapused + extra / 2){
+    printf("swaptest: pages not swapped out\n");
+    exit(1);
+  }
+  check(p, n, 1, 1);
+
+  // the child shares the swapped-out pages with its parent.
+  if((pid = fork()) < 0){
+    printf("swaptest: fork\n");
+    exit(1);
+  }
+  if(pid == 0){
+    check(p, n, 7, 1);
+    exit(0);
+  }
+  if(waitpid(pid, &st, 0) != pid || st != 0){
+    printf("swaptest: child saw wrong contents\n");
+    exit(1);
+  }
+
+  // rewrite everything, now copy-on-write or swapped.
+  fill(p, n, 2);
+  check(p, n, 1, 2);
+
+  sbrk(-(n * PG));
+  get(&b);
+  if(b.swapused > a.swapused + 16){
+    printf("swaptest: swap slots not freed\n");
+    exit(1);
+  }
+
+  printf("swaptest: OK\n");
+  exit(0);
+}
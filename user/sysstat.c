@@ -0,0 +1,159 @@
+//
+// sysstat: show system call counts and latencies.
+//
+// usage: sysstat [-h] [-p pid] [cmd [arg ...]]
+//
+// With a command, runs it and shows the system-wide calls
+// made while it ran; with -p, the calls process pid has made
+// so far; otherwise the system-wide totals since boot. Calls
+// are listed by total time, most first. -h adds each call's
+// latency histogram (system-wide only).
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+char *names[NSYSCALL] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_ntas]    "ntas",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_spawn]   "spawn",
+[SYS_splice]  "splice",
+[SYS_fsync]   "fsync",
+[SYS_setprio] "setprio",
+[SYS_waitpid] "waitpid",
+[SYS_clone]   "clone",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+[SYS_lockstat] "lockstat",
+[SYS_sysstat] "sysstat",
+[SYS_profile] "profile",
+[SYS_trace]   "trace",
+[SYS_getrusage] "getrusage",
+[SYS_getdents] "getdents",
+[SYS_sigalarm] "sigalarm",
+[SYS_sigreturn] "sigreturn",
+[SYS_submit]  "submit",
+[SYS_poll]    "poll",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_memstat] "memstat",
+[SYS_setaffinity] "setaffinity",
+[SYS_getaffinity] "getaffinity",
+[SYS_shm_open] "shm_open",
+[SYS_shm_unlink] "shm_unlink",
+};
+
+struct sysstat before[NSYSCALL], after[NSYSCALL];
+
+void
+get(int pid, struct sysstat *st)
+{
+  if(sysstat(pid, st, NSYSCALL) < 0){
+    fprintf(2, "sysstat: no process %d\n", pid);
+    exit(1);
+  }
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: sysstat [-h] [-p pid] [cmd [arg ...]]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, b, pid = 0, hist = 0, order[NSYSCALL], cpid;
+  struct sysstat *s;
+  char *name, num[16];
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-h") == 0)
+      hist = 1;
+    else if(strcmp(argv[i], "-p") == 0 && i+1 < argc && pid == 0)
+      pid = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(pid != 0 && i < argc)
+    usage();
+
+  if(i < argc){
+    get(0, before);
+    if((cpid = fork()) < 0){
+      fprintf(2, "sysstat: fork failed\n");
+      exit(1);
+    }
+    if(cpid == 0){
+      exec(argv[i], argv + i);
+      fprintf(2, "sysstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    waitpid(cpid, 0, 0);
+  }
+  get(pid, after);
+  for(i = 0; i < NSYSCALL; i++){
+    after[i].count -= before[i].count;
+    after[i].time -= before[i].time;
+    for(b = 0; b < NSYSHIST; b++)
+      after[i].hist[b] -= before[i].hist[b];
+  }
+
+  // by total time, most first.
+  for(i = 0; i < NSYSCALL; i++){
+    for(j = i; j > 0 && after[order[j-1]].time < after[i].time; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  // times are in microseconds; r_time() ticks at 10 MHz.
+  printf("call\tcount\ttotal us\tavg us\n");
+  for(i = 0; i < NSYSCALL; i++){
+    s = &after[order[i]];
+    if(s->count == 0)
+      continue;
+    if((name = names[order[i]]) == 0){
+      snprintf(num, sizeof(num), "sys%d", order[i]);
+      name = num;
+    }
+    printf("%s\t%l\t%l\t%l\n", name, s->count, s->time / 10, s->time / 10 / s->count);
+    if(!hist || pid != 0)
+      continue;
+    // a tick is 100 ns.
+    for(b = 0; b < NSYSHIST-1; b++)
+      if(s->hist[b])
+        printf("\t< %l ns\t%l\n", ((uint64)2 << b) * 100, s->hist[b]);
+    if(s->hist[b])
+      printf("\t>= %l ns\t%l\n", ((uint64)1 << b) * 100, s->hist[b]);
+  }
+  exit(0);
+}
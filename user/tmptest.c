@@ -0,0 +1,136 @@
+// tests for the in-memory file system on /tmp, and a timing
+// of small files there against the disk.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SIZE (100*1000)
+#define NSMALL 200
+
+char buf[SIZE];
+
+// microseconds to create, write, read and remove NSMALL
+// small files in directory dir.
+uint64
+smallfiles(char *dir)
+{
+  char name[32];
+  uint64 t0;
+  int i, fd;
+
+  t0 = clock_cycles();
+  for(i = 0; i < NSMALL; i++){
+    snprintf(name, sizeof(name), "%s/small%d", dir, i);
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+      printf("tmptest: create small file\n");
+      exit(1);
+    }
+    if(write(fd, buf, 512) != 512){
+      printf("tmptest: write small file\n");
+      exit(1);
+    }
+    close(fd);
+    if((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, 512) != 512){
+      printf("tmptest: read small file\n");
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) < 0){
+      printf("tmptest: unlink small file\n");
+      exit(1);
+    }
+  }
+  return (clock_cycles() - t0) * 1000000 / clock_hz();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stat root, tmp, st;
+  int fd, i;
+
+  if(stat("/", &root) < 0 || stat("/tmp", &tmp) < 0){
+    printf("tmptest: stat\n");
+    exit(1);
+  }
+  if(tmp.dev == root.dev || tmp.type != T_DIR){
+    printf("tmptest: /tmp is not mounted\n");
+    exit(1);
+  }
+
+  // a file written to /tmp reads back.
+  unlink("/tmp/d/f");
+  unlink("/tmp/d");
+  if(mkdir("/tmp/d") < 0){
+    printf("tmptest: mkdir\n");
+    exit(1);
+  }
+  if((fd = open("/tmp/d/f", O_CREATE|O_RDWR)) < 0){
+    printf("tmptest: create\n");
+    exit(1);
+  }
+  for(i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, SIZE) != SIZE){
+    printf("tmptest: write\n");
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 0, SIZE);
+  if((fd = open("/tmp/d/f", O_RDONLY)) < 0){
+    printf("tmptest: open\n");
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.dev != tmp.dev || st.size != SIZE){
+    printf("tmptest: fstat\n");
+    exit(1);
+  }
+  if(read(fd, buf, SIZE) != SIZE){
+    printf("tmptest: read\n");
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < SIZE; i++)
+    if(buf[i] != i % 251){
+      printf("tmptest: wrong contents\n");
+      exit(1);
+    }
+
+  // ".." leads out of /tmp.
+  if(stat("/tmp/d/../../README", &st) < 0 || st.dev != root.dev){
+    printf("tmptest: /tmp/d/../../README\n");
+    exit(1);
+  }
+  if(chdir("/tmp/d") < 0 || chdir("../..") < 0 || stat(".", &st) < 0){
+    printf("tmptest: chdir\n");
+    exit(1);
+  }
+  if(st.dev != root.dev || st.ino != root.ino){
+    printf("tmptest: ../.. from /tmp/d is not /\n");
+    exit(1);
+  }
+
+  if(link("/tmp/d/f", "/tmplink") == 0){
+    printf("tmptest: linked across file systems\n");
+    exit(1);
+  }
+  if(unlink("/tmp") == 0){
+    printf("tmptest: removed /tmp\n");
+    exit(1);
+  }
+  if(unlink("/tmp/d") == 0){
+    printf("tmptest: removed non-empty /tmp/d\n");
+    exit(1);
+  }
+  if(unlink("/tmp/d/f") < 0 || unlink("/tmp/d") < 0){
+    printf("tmptest: unlink\n");
+    exit(1);
+  }
+
+  printf("tmptest: %d small files: /tmp %l us, disk %l us\n",
+         NSMALL, smallfiles("/tmp"), smallfiles("."));
+  printf("tmptest: ok\n");
+  exit(0);
+}
@@ -0,0 +1,202 @@
+//
+// trace: record kernel trace events while a command runs,
+// and print them in time order.
+//
+// usage: trace [-e event,...] cmd [arg ...]
+//
+// Events are switch, sleep, wakeup, bread, bwrite, disk,
+// beginop, endop and kalloc; the default is all of them but
+// wakeup and kalloc, which are frequent. Times are in
+// microseconds from the first event.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+char *names[NTRTYPE] = {
+[TR_SWITCH]   "switch",
+[TR_SLEEP]    "sleep",
+[TR_WAKEUP]   "wakeup",
+[TR_BREAD]    "bread",
+[TR_BWRITE]   "bwrite",
+[TR_DISKDONE] "disk",
+[TR_BEGINOP]  "beginop",
+[TR_ENDOP]    "endop",
+[TR_KALLOC]   "kalloc",
+[TR_DISKSTART] "diskstart",
+};
+
+struct traceev *ev;
+int nev, maxev;
+
+// drain the kernel's buffers into ev[].
+void
+collect(void)
+{
+  struct traceev *nb;
+  int n;
+
+  for(;;){
+    if(nev == maxev){
+      if((nb = malloc((maxev ? 2*maxev : 1024) * sizeof(*ev))) == 0){
+        fprintf(2, "trace: out of memory\n");
+        exit(1);
+      }
+      memmove(nb, ev, nev * sizeof(*ev));
+      free(ev);
+      ev = nb;
+      maxev = maxev ? 2*maxev : 1024;
+    }
+    if((n = trace(TRACE_READ, ev + nev, maxev - nev)) <= 0)
+      break;
+    nev += n;
+  }
+}
+
+// each CPU's events are in time order already; merge them.
+void
+sort(void)
+{
+  struct traceev *tmp, *t;
+  int w, i, lo, mid, hi, a, b;
+
+  if((tmp = malloc(nev * sizeof(*ev) + 1)) == 0){
+    fprintf(2, "trace: out of memory\n");
+    exit(1);
+  }
+  for(w = 1; w < nev; w *= 2){
+    for(lo = 0; lo < nev; lo += 2*w){
+      mid = lo + w < nev ? lo + w : nev;
+      hi = lo + 2*w < nev ? lo + 2*w : nev;
+      a = lo;
+      b = mid;
+      for(i = lo; i < hi; i++){
+        if(a < mid && (b >= hi || ev[a].time <= ev[b].time))
+          tmp[i] = ev[a++];
+        else
+          tmp[i] = ev[b++];
+      }
+    }
+    t = ev;
+    ev = tmp;
+    tmp = t;
+  }
+  free(tmp);
+}
+
+int
+parsemask(char *s)
+{
+  int mask = 0, t;
+  char *e;
+
+  while(*s){
+    if((e = strchr(s, ',')) != 0)
+      *e = 0;
+    for(t = 1; t < NTRTYPE; t++)
+      if(names[t] && strcmp(names[t], s) == 0)
+        break;
+    if(t == NTRTYPE){
+      fprintf(2, "trace: unknown event %s\n", s);
+      exit(1);
+    }
+    mask |= 1 << t;
+    if(e == 0)
+      break;
+    s = e + 1;
+  }
+  return mask;
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: trace [-e event,...] cmd [arg ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, lost, mask;
+  struct traceev *e;
+  uint64 t0;
+
+  mask = ~((1 << TR_WAKEUP) | (1 << TR_KALLOC) | 1) & ((1 << NTRTYPE) - 1);
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-e") == 0 && i+1 < argc)
+      mask = parsemask(argv[++i]);
+    else
+      usage();
+  }
+  if(i >= argc)
+    usage();
+
+  // throw away whatever an earlier run left behind.
+  trace(TRACE_MASK, 0, 0);
+  collect();
+  nev = 0;
+  trace(TRACE_LOST, 0, 0);
+
+  trace(TRACE_MASK, 0, mask);
+  if((pid = fork()) < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[i], argv + i);
+    fprintf(2, "trace: exec %s failed\n", argv[i]);
+    exit(1);
+  }
+  // keep the kernel's buffers from filling up.
+  while(waitpid(pid, 0, WNOHANG) == 0){
+    sleep(1);
+    collect();
+  }
+  trace(TRACE_MASK, 0, 0);
+  collect();
+  lost = trace(TRACE_LOST, 0, 0);
+
+  sort();
+  t0 = nev > 0 ? ev[0].time : 0;
+  // a tick of r_time() is 100 ns.
+  printf("us\tcpu\tpid\tevent\n");
+  for(e = ev; e < ev + nev; e++){
+    printf("%l\t%d\t%d\t", (e->time - t0) / 10, e->cpu, e->pid);
+    switch(e->type){
+    case TR_SWITCH:
+      printf("switch to %d\n", (int)e->a0);
+      break;
+    case TR_SLEEP:
+    case TR_WAKEUP:
+      printf("%s %p\n", names[e->type], e->a0);
+      break;
+    case TR_BREAD:
+    case TR_BWRITE:
+      printf("%s dev %d block %d\n", names[e->type], (int)e->a0, (int)e->a1);
+      break;
+    case TR_DISKDONE:
+      printf("disk %d done block %d\n", (int)e->a0, (int)e->a1);
+      break;
+    case TR_DISKSTART:
+      printf("disk %d start block %d, %d blocks\n", (int)e->a0,
+             (int)(e->a1 & 0xffffffff), (int)(e->a1 >> 32));
+      break;
+    case TR_BEGINOP:
+    case TR_ENDOP:
+      printf("%s dev %d outstanding %d\n", names[e->type], (int)e->a0, (int)e->a1);
+      break;
+    case TR_KALLOC:
+      printf("kalloc %p\n", e->a0);
+      break;
+    default:
+      printf("event %d\n", e->type);
+    }
+  }
+  if(lost > 0)
+    printf("%d events lost\n", lost);
+  exit(0);
+}
@@ -3,6 +3,9 @@
 #include "user/tsh.h"
 #include "kernel/fcntl.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/rusage.h"
 
 #define YES     1
 #define NO      0
@@ -13,9 +16,17 @@ static char *default_prompt = "tsh> ";
 
 typedef struct BufferedLine {
     int len;                                // number of items (chars) in the buffer
-    char buffer[TSH_MAX_CMD_LINE_LENGTH];   // buffer to hold the data
+    uint cap;                               // size of buffer, grown by getline()
+    char *buffer;                           // buffer to hold the data
 } BufferedLine;
 
+// Where commands come from: the console, a pipe, or a script.
+// getline() reads it a block at a time.
+typedef struct Input {
+    int fd;
+    int interactive;                        // print prompts?
+} Input;
+
 typedef enum TokenType {
     TOKEN_INVALID,
     TOKEN_WORD,
@@ -36,9 +47,61 @@ typedef struct Token {
 
 typedef struct TokenList {
     int len;
-    Token tokens[TSH_MAX_NUM_TOKENS];
+    Token *tokens;      // in the arena, one slot per char of the line
 } TokenList;
 
+// Everything parsed from a line lives in an arena: a list of
+// malloc'd chunks carved out by bumping a pointer. Before the
+// next line the arena is emptied in O(1), keeping its chunks,
+// so a line may hold any number of tokens and commands.
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    int size;                   // usable bytes after the header
+} ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk *first;          // every chunk, kept across resets
+    ArenaChunk *cur;            // chunk being carved, 0 after a reset
+    int used;                   // bytes of cur handed out
+} Arena;
+
+// Returns n bytes, 8-byte aligned, or 0 if out of memory.
+static void *
+arenaAlloc(Arena *a, int n) {
+    ArenaChunk *c;
+
+    n = (n + 7) & ~7;
+    if (a->cur == 0 || a->used + n > a->cur->size) {
+        // move on to the next kept chunk big enough, or make one.
+        for (c = a->cur ? a->cur->next : a->first; c && c->size < n; c = c->next)
+            ;
+        if (c == 0) {
+            int size = n > TSH_ARENA_CHUNK_SIZE ? n : TSH_ARENA_CHUNK_SIZE;
+            if ((c = malloc(sizeof(ArenaChunk) + size)) == 0)
+                return 0;
+            c->size = size;
+            if (a->cur) {
+                c->next = a->cur->next;
+                a->cur->next = c;
+            } else {
+                c->next = a->first;
+                a->first = c;
+            }
+        }
+        a->cur = c;
+        a->used = 0;
+    }
+    void *v = (char *)(a->cur + 1) + a->used;
+    a->used += n;
+    return v;
+}
+
+static void
+arenaReset(Arena *a) {
+    a->cur = 0;
+    a->used = 0;
+}
+
 enum RedirectionType {
     REDIRECT_INPUT,
     REDIRECT_OUTPUT,
@@ -73,6 +136,7 @@ struct Pipeline;
 #define CMD_PIPELINE_TOO_LONG                   0x0f
 #define CMD_TOO_MANY_COMMANDS                   0x10
 #define CMD_UNKNOWN_TYPE                        0x20
+#define CMD_OUT_OF_MEMORY                       0x40
 
 #define CMD_BACKGROUND_MODE                     0x010000
 
@@ -82,6 +146,7 @@ typedef struct Command {
     union {
         struct SimpleCommand *simple;
         struct Pipeline *pipeline;
+        struct ListCommand *list;
     } cmd;
 } Command;
 
@@ -90,7 +155,8 @@ typedef struct SimpleCommand {
     int flag;
     char *name;
     int argc;
-    char *argv[TSH_MAX_NUM_ARGUMENTS + 1];
+    char **argv;        // argc entries and a 0
+
     Redirection redirects[3];
 } SimpleCommand;
 
@@ -99,16 +165,18 @@ typedef struct Pipeline {
     enum CommandType type;
     int flag;
     int len;
-    Command commands[TSH_MAX_PIPELINE_LENGTH];
+    Command *commands;
 } Pipeline;
 
-// The following three members stores private data
-struct CommandData {
-    int n_simples;
-    SimpleCommand _simples[TSH_MAX_CMD_LIST_LENGTH];
-    Pipeline _pipeline;
-    Command cmd;
-};
+// A list of commands separated by ';' or '&', from a whole
+// line or from inside a ( ... ) group. An element that '&'
+// ends has CMD_BACKGROUND_MODE in its flag.
+typedef struct ListCommand {
+    enum CommandType type;
+    int flag;
+    int len;
+    Command *commands;
+} ListCommand;
 
 void
 PrintCommand(Command *cmd, char *indent) {
@@ -134,6 +202,12 @@ PrintCommand(Command *cmd, char *indent) {
             PrintCommand(&(pipeline->commands[i]), "\t");
         }
         printf("\tEND;\n");
+    } else if (cmd->type == CMD_LIST) {
+        ListCommand *list = cmd->cmd.list;
+        printf("%sList: len=%d flag=%x\n", indent, list->len, list->flag);
+        for (int i = 0; i < list->len; i++)
+            PrintCommand(&(list->commands[i]), "\t");
+        printf("%s\tEND;\n", indent);
     } else {
         Debug("Unknown command type (%d)", cmd->type);
     }
@@ -152,33 +226,12 @@ find_next_toke_with_type(int token_type, Token *tokens, Token *tail) {
 }
 
 int
-ParseSimpleCommand(Token *start, Token *tail, SimpleCommand *simple) {
+ParseSimpleCommand(Token *start, Token *tail, SimpleCommand *simple, Arena *arena) {
     simple->type = CMD_EMPTY;
+    simple->flag = 0;
+    simple->name = 0;
     Token *p = start;
 
-    // get the command path
-    if (p < tail && p->type == TOKEN_WORD) {
-        simple->type = CMD_SIMPLE;
-        simple->name = p->value;
-        simple->flag = 0;   // clear flags
-    }
-
-    // get the arguments
-    int i = 0;
-    while (p < tail && p->type == TOKEN_WORD && i < TSH_MAX_NUM_ARGUMENTS) {
-        simple->argv[i] = p->value;
-        p++;
-        i++;
-    }
-    simple->argv[i] = 0;
-    simple->argc = i;
-    if (i > TSH_MAX_NUM_ARGUMENTS) {
-        simple->flag |= CMD_TOO_MANY_ARGUMENTS;
-        ErrorU("too many arguments");
-        return simple->flag;
-    }
-
-    // get the redirection(s), if there is any
     for (int i = 0; i < 3; i++) {
         simple->redirects[i].type = REDIRECT_NONE;
         simple->redirects[i].source_fd = i;
@@ -186,6 +239,25 @@ ParseSimpleCommand(Token *start, Token *tail, SimpleCommand *simple) {
         simple->redirects[i].path = 0;
     }
 
+    // get the command path and the arguments
+    int n = 0;
+    while (p + n < tail && p[n].type == TOKEN_WORD)
+        n++;
+    if ((simple->argv = arenaAlloc(arena, (n + 1) * sizeof(char *))) == 0) {
+        simple->flag |= CMD_OUT_OF_MEMORY;
+        ErrorS("Out of memory");
+        return simple->flag;
+    }
+    for (int i = 0; i < n; i++)
+        simple->argv[i] = p++->value;
+    simple->argv[n] = 0;
+    simple->argc = n;
+    if (n > 0) {
+        simple->type = CMD_SIMPLE;
+        simple->name = simple->argv[0];
+    }
+
+    // get the redirection(s), if there is any
     while (p < tail) {
         int fd = 1;
         if (p->type == TOKEN_REDIRECT_INPUT) {
@@ -248,180 +320,371 @@ static void set_command(Command *command, enum CommandType type, void *concrete_
         SimpleCommand *simple = (SimpleCommand *)concrete_command;
         command->cmd.simple = simple;
         command->flag = simple->flag;
+    } else if (type == CMD_LIST) {
+        ListCommand *list = (ListCommand *)concrete_command;
+        command->cmd.list = list;
+        command->flag = list->flag;
     } else {
         command->type = CMD_INVALID;
         command->flag = CMD_UNKNOWN_TYPE;
     }
 }
 
-void
-ParsePipeline(Token *head, Token *tail, struct CommandData *cmd_data) {
-    Token *prev, *curr;
-    Command *command = &(cmd_data->cmd);
-
-    curr = prev = head;
-    Pipeline *pipeline = &(cmd_data->_pipeline);
-    while (curr < tail && pipeline->len < TSH_MAX_PIPELINE_LENGTH && cmd_data->n_simples < TSH_MAX_CMD_LIST_LENGTH) {
-        curr = find_next_toke_with_type(TOKEN_PIPE, prev, tail);
-        if (curr < tail) {
-            if (pipeline->len == 0) {
-                init_pipeline(pipeline);
-                if (command->type != CMD_LIST) {
-                    set_command(command, CMD_PIPELINE, pipeline);
-                }
-            }
+static void
+parse_out_of_memory(Command *command) {
+    command->type = CMD_INVALID;
+    command->flag = CMD_OUT_OF_MEMORY;
+    ErrorS("Out of memory");
+}
 
-            SimpleCommand *simple = &cmd_data->_simples[cmd_data->n_simples++];
-            ParseSimpleCommand(prev, curr, simple);
+// Parse the pipeline in [head, tail) into command, which
+// becomes a simple command if there is no '|'.
+void
+ParsePipeline(Token *head, Token *tail, Arena *arena, Command *command) {
+    Token *prev = head, *curr;
+    int n = 1;
 
-            set_command(&(pipeline->commands[pipeline->len]), CMD_SIMPLE, simple);
-            pipeline->len++;
+    for (curr = head; curr < tail; curr++)
+        if (curr->type == TOKEN_PIPE)
+            n++;
 
-            curr++;
-            prev = curr;
-        }
+    SimpleCommand *simples = arenaAlloc(arena, n * sizeof(SimpleCommand));
+    if (simples == 0) {
+        parse_out_of_memory(command);
+        return;
+    }
+    if (n == 1) {   /* simple command */
+        ParseSimpleCommand(head, tail, simples, arena);
+        set_command(command, CMD_SIMPLE, simples);
+        return;
     }
 
-    if (cmd_data->n_simples >= TSH_MAX_CMD_LIST_LENGTH) { /* check too many command error */
-        pipeline->flag |= CMD_TOO_MANY_COMMANDS;
-        command->flag |= pipeline->flag;
-        ErrorU("Too many commands");
+    Pipeline *pipeline = arenaAlloc(arena, sizeof(Pipeline));
+    if (pipeline == 0 || (pipeline->commands = arenaAlloc(arena, n * sizeof(Command))) == 0) {
+        parse_out_of_memory(command);
         return;
     }
-    SimpleCommand *simple = &cmd_data->_simples[cmd_data->n_simples++];
-    ParseSimpleCommand(prev, tail, simple);
-    if (pipeline->len == 0) {   /* simple command */
-        set_command(command, CMD_SIMPLE, simple);
+    init_pipeline(pipeline);
+    for (int i = 0; i < n; i++) {
+        curr = find_next_toke_with_type(TOKEN_PIPE, prev, tail);
+        ParseSimpleCommand(prev, curr, &simples[i], arena);
+        set_command(&(pipeline->commands[i]), CMD_SIMPLE, &simples[i]);
+        pipeline->flag |= simples[i].flag & 0xffff;
+        pipeline->len++;
+        prev = curr + 1;
+    }
+    set_command(command, CMD_PIPELINE, pipeline);
+}
+
+// Find the token closing the group that opens at p, or tail.
+static Token *
+find_group_end(Token *p, Token *tail) {
+    int depth = 0;
+    for (; p < tail; p++) {
+        if (p->type == TOKEN_GROUP_START)
+            depth++;
+        else if (p->type == TOKEN_GROUP_END && --depth == 0)
+            return p;
+    }
+    return tail;
+}
+
+static int
+is_list_separator(Token *p) {
+    return p->type == TOKEN_LIST || p->type == TOKEN_BACKGROUND;
+}
+
+// Parse the ';' and '&' separated list in [head, tail) into
+// command. An element may be a ( ... ) group, parsed as a
+// nested list.
+void
+ParseList(Token *head, Token *tail, Arena *arena, Command *command) {
+    Token *p;
+    int n = 1;
+
+    // at most one element per separator outside a group, plus one.
+    for (p = head; p < tail; p++) {
+        if (p->type == TOKEN_GROUP_START && (p = find_group_end(p, tail)) == tail)
+            break;
+        if (is_list_separator(p))
+            n++;
     }
 
-    if (pipeline->len >= TSH_MAX_PIPELINE_LENGTH) { /* check pipeline too long error*/
-        pipeline->flag |= CMD_PIPELINE_TOO_LONG;
-        command->flag |= pipeline->flag;
-        ErrorU("Pipeline too long");
+    ListCommand *list = arenaAlloc(arena, sizeof(ListCommand));
+    if (list == 0 || (list->commands = arenaAlloc(arena, n * sizeof(Command))) == 0) {
+        parse_out_of_memory(command);
         return;
     }
+    list->type = CMD_LIST;
+    list->flag = 0;
+    list->len = 0;
 
-    if (pipeline->len > 0) { /* last pipeline element */
-        set_command(&(pipeline->commands[pipeline->len]), CMD_SIMPLE, simple);
-        pipeline->len++;
+    p = head;
+    while (p < tail) {
+        Token *end;
+        Command *elem = &list->commands[list->len];
+
+        if (p->type == TOKEN_GROUP_START) {
+            Token *close = find_group_end(p, tail);
+            if (close == tail) {
+                list->flag |= CMD_SYNTAX_ERROR;
+                ErrorU("Syntax error - missing )");
+                break;
+            }
+            ParseList(p + 1, close, arena, elem);
+            end = close + 1;
+            if (end < tail && !is_list_separator(end)) {
+                list->flag |= CMD_SYNTAX_ERROR;
+                ErrorU("Syntax error - unexpected token after )");
+                break;
+            }
+        } else {
+            for (end = p; end < tail && !is_list_separator(end); end++)
+                ;
+            ParsePipeline(p, end, arena, elem);
+        }
+        list->flag |= elem->flag & 0xffff;
+
+        if (end < tail && end->type == TOKEN_BACKGROUND)
+            elem->flag |= CMD_BACKGROUND_MODE;
+        // skip empty elements, as after a trailing ';'
+        if (!(elem->type == CMD_SIMPLE && elem->cmd.simple->type == CMD_EMPTY))
+            list->len++;
+        p = end < tail ? end + 1 : tail;
     }
-    return;
+    set_command(command, CMD_LIST, list);
 }
 
 void
-ParseCommand(Token *head, Token *tail, struct CommandData *cmd_data) {
-    ParsePipeline(head, tail, cmd_data);
+ParseCommand(Token *head, Token *tail, Arena *arena, Command *command) {
+    ParseList(head, tail, arena, command);
 }
 
+// A background job: the processes of a command run with &.
+typedef struct Job {
+    int id;                                 // job number, 0 if the slot is free
+    int running;                            // processes not yet reaped
+    int npids;
+    int *pids;                              // 0 once reaped; malloc'd
+    char name[TSH_MAX_FILENAME_LENGTH];     // first program's name
+} Job;
+
 typedef struct ShellState {
     int should_run;
     int last_exit_status;
     char *prompt;
+    Input input;
     BufferedLine cmdline;
     TokenList tokens;
     Command *cmd;
     char *name;
 
-    struct CommandData _cmd_data;
+    Job jobs[TSH_MAX_JOBS];
+    int last_job_id;
+    int in_group;       // running a ( ... ) group in a child shell
+
+    Arena arena;        // the current line's tokens and commands
+    Command _cmd;
 } ShellState;
 
 ShellState this_shell;
 
-int
-ReadLine(BufferedLine *line) {
-    char *p, c;
-    int nleft;
+// Note that pid has exited, and retire its job once
+// all of the job's processes have.
+static void
+JobExited(ShellState *shell, int pid) {
+    for (int i = 0; i < TSH_MAX_JOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->id == 0)
+            continue;
+        for (int k = 0; k < job->npids; k++) {
+            if (job->pids[k] == pid) {
+                job->pids[k] = 0;
+                if (--job->running == 0) {
+                    if (!shell->in_group)
+                        printf("[%d] Done\t%s\n", job->id, job->name);
+                    job->id = 0;
+                    free(job->pids);
+                }
+                return;
+            }
+        }
+    }
+}
 
-    p = line->buffer;
-    nleft = sizeof(line->buffer);
+// Block until job id, or every job if id is 0, has finished.
+static void
+WaitJobs(ShellState *shell, int id) {
+    int st;
 
-    while (nleft > 0) {
-        if (read(0, &c, sizeof(c)) != 1)    // no data to read, end-of-file or error
-            break;
-        if (c == '\n' || c == EOF)          // stop after seeing a new line
+    for (int i = 0; i < TSH_MAX_JOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->id == 0 || (id != 0 && job->id != id))
+            continue;
+        for (int k = 0; k < job->npids; k++) {
+            int pid = job->pids[k];
+            if (pid > 0 && waitpid(pid, &st, 0) == pid)
+                JobExited(shell, pid);
+        }
+    }
+}
+
+// Record the n processes in pids (failed ones are <= 0)
+// as a background job. If the job table is full, run
+// the job in the foreground instead.
+static void
+AddJob(ShellState *shell, int *pids, int n, char *name) {
+    Job *job = 0;
+    int st;
+
+    for (int i = 0; i < TSH_MAX_JOBS; i++) {
+        if (shell->jobs[i].id == 0) {
+            job = &shell->jobs[i];
             break;
-        *p++ = c;
-        nleft--;
+        }
+    }
+    if (job == 0 || (job->pids = malloc(n * sizeof(int))) == 0) {
+        ErrorU("Too many jobs; waiting for this one\n");
+        for (int k = 0; k < n; k++)
+            if (pids[k] > 0)
+                waitpid(pids[k], &st, 0);
+        return;
+    }
+
+    job->running = 0;
+    job->npids = n;
+    for (int k = 0; k < n; k++) {
+        job->pids[k] = pids[k] > 0 ? pids[k] : 0;
+        if (job->pids[k])
+            job->running++;
     }
-    line->len = sizeof(line->buffer) - nleft; // update the number of chars in the buffer
-    line->buffer[line->len] = '\0';            // end the buffer with '\0'
+    if (job->running == 0) {
+        free(job->pids);
+        return;
+    }
+    job->id = ++shell->last_job_id;
+    job->name[0] = 0;
+    if (strlen(name) < sizeof(job->name))
+        strcpy(job->name, name);
+    if (!shell->in_group)
+        printf("[%d] %d\n", job->id, pids[n - 1]);
+}
 
-    return line->len;
+// Collect background processes that have exited, without
+// blocking, and report the jobs that are done.
+static void
+ReapJobs(ShellState *shell) {
+    int pid, st;
+
+    while ((pid = waitpid(-1, &st, WNOHANG)) > 0)
+        JobExited(shell, pid);
 }
 
-void ClearLine(BufferedLine *line) {      // file the buffer with 0
-    char *p = line->buffer;
-    char *tail = line->buffer + sizeof(line->buffer);
-    while (p < tail) *p++ = '\0';
+// The jobs builtin.
+static void
+ListJobs(ShellState *shell) {
+    for (int i = 0; i < TSH_MAX_JOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->id == 0)
+            continue;
+        printf("[%d] Running\t%s\n", job->id, job->name);
+    }
+}
+
+// Read the next line of in into line, without its newline.
+// Returns the line's length, or -1 at end of input.
+int
+ReadLine(Input *in, BufferedLine *line) {
+    int n = getline(&line->buffer, &line->cap, in->fd);
+
+    if (n < 0)
+        return -1;
+    if (n > 0 && line->buffer[n - 1] == '\n')
+        line->buffer[--n] = '\0';
+    line->len = n;
+    return n;
+}
+
+void ClearLine(BufferedLine *line) {
     line->len = 0;
+    if (line->buffer)
+        line->buffer[0] = '\0';
 }
 
-static char whitespace[] = " \t\r\n\v";
-static char symbols[] = "<|>&;";
+// Character classes for the scanner; 0 is a word char.
+#define CC_SPACE    0x1
+#define CC_SYMBOL   0x2
 
-void Tokenize(BufferedLine *line, TokenList *tl) {
+static const uchar charclass[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['\n'] = CC_SPACE, ['\v'] = CC_SPACE,
+    ['<'] = CC_SYMBOL, ['|'] = CC_SYMBOL, ['>'] = CC_SYMBOL, ['&'] = CC_SYMBOL,
+    [';'] = CC_SYMBOL, ['('] = CC_SYMBOL, [')'] = CC_SYMBOL,
+};
+
+#define CHARCLASS(c) charclass[(uchar)(c)]
+
+// Split line into tl, ending each word in place by zeroing
+// the space or symbol after it. Returns 0, or -1 if out of
+// memory.
+int Tokenize(BufferedLine *line, TokenList *tl, Arena *arena) {
     char *p = line->buffer;
-    char *tail = line->buffer + strlen(line->buffer);
+    char *tail = line->buffer + line->len;
     int idx = 0;
-    char next_char = '\0';
-
-    while (p < tail && idx < sizeof(tl->tokens)) {
-        while (p < tail && strchr(whitespace, *p)) // skip leading whitespace
-            p++;
-        if (p == tail) break;
 
-        next_char = *p;
-        if (!strchr(symbols, next_char)) { // find a word token
-            tl->tokens[idx].type = TOKEN_WORD;
-            tl->tokens[idx].value = p;
-            idx++;
+    // no token is shorter than one char.
+    if ((tl->tokens = arenaAlloc(arena, (line->len + 1) * sizeof(Token))) == 0)
+        return -1;
 
-            while (p < tail && !strchr(whitespace, *p) && !strchr(symbols, *p))
-                p++;
-            next_char = *p;
-            *p = '\0';
+    while (p < tail) {
+        int cls = CHARCLASS(*p);
+        if (cls & CC_SPACE) {
+            *p++ = '\0';
+            continue;
         }
 
-        if (strchr(whitespace, next_char)) {
-            p++;
+        Token *t = &tl->tokens[idx++];
+        t->value = p;
+        if (cls == 0) {             // a word token
+            t->type = TOKEN_WORD;
+            while (p < tail && CHARCLASS(*p) == 0)
+                p++;
             continue;
         }
 
-        if (strchr(symbols, next_char)) {  // a symbol token
-            if (next_char == '>' && *(p + 1) == '>') { // Handle the case of ">>"
-                tl->tokens[idx].type = TOKEN_REDIRECT_OUTPUT_APPEND;
-                tl->tokens[idx].value = p;
-                p += 2;
-                idx++;
-                continue;
-            }
-
-            switch (next_char) { // set correct token type
-                case '<':
-                    tl->tokens[idx].type = TOKEN_REDIRECT_INPUT;
-                    break;
-                case '>':
-                    tl->tokens[idx].type = TOKEN_REDIRECT_OUTPUT;
-                    break;
-                case '|':
-                    tl->tokens[idx].type = TOKEN_PIPE;
-                    break;
-                case '&':
-                    tl->tokens[idx].type = TOKEN_BACKGROUND;
-                    break;
-                case ';':
-                    tl->tokens[idx].type = TOKEN_LIST;
-                    break;
-                default:
-                    tl->tokens[idx].type = TOKEN_INVALID;
-            }
-            tl->tokens[idx].value = p;
-            p++;
-            idx++;
-            continue;
+        switch (*p) {               // a symbol token
+            case '<':
+                t->type = TOKEN_REDIRECT_INPUT;
+                break;
+            case '>':
+                t->type = TOKEN_REDIRECT_OUTPUT;
+                if (p + 1 < tail && p[1] == '>') { // Handle the case of ">>"
+                    t->type = TOKEN_REDIRECT_OUTPUT_APPEND;
+                    *p++ = '\0';
+                }
+                break;
+            case '|':
+                t->type = TOKEN_PIPE;
+                break;
+            case '&':
+                t->type = TOKEN_BACKGROUND;
+                break;
+            case ';':
+                t->type = TOKEN_LIST;
+                break;
+            case '(':
+                t->type = TOKEN_GROUP_START;
+                break;
+            case ')':
+                t->type = TOKEN_GROUP_END;
+                break;
+            default:
+                t->type = TOKEN_INVALID;
         }
+        *p++ = '\0';
     }
     tl->len = idx;
+    return 0;
 }
 
 void
@@ -437,160 +700,597 @@ PrintTokenList(TokenList *tl) {
     printf("\n");
 }
 
+// Read and parse the next command. Returns the length of
+// its line, 0 for a blank line, comment or error, or -1 once
+// the input runs out.
 int
 GetCommand(ShellState *shell) {
-    write(1, shell->prompt, strlen(shell->prompt));
+    if (shell->input.interactive) {
+        fflush(1);
+        write(1, shell->prompt, strlen(shell->prompt));
+    }
     ClearLine(&shell->cmdline);
     int ret;
-    if (0 < (ret = ReadLine(&shell->cmdline))) {
+    if (0 < (ret = ReadLine(&shell->input, &shell->cmdline))) {
+        if (shell->cmdline.buffer[0] == '#')    // a script comment
+            return 0;
 
-      Tokenize(&shell->cmdline, &shell->tokens);
-	// PrintTokenList(&shell->tokens);
         struct TokenList *tl = &(shell->tokens);
+        arenaReset(&shell->arena);
+        if (Tokenize(&shell->cmdline, tl, &shell->arena) < 0) {
+            ErrorS("Out of memory\n");
+            return 0;
+        }
+	// PrintTokenList(&shell->tokens);
 
-        shell->_cmd_data.n_simples = 0;
-        shell->_cmd_data._pipeline.len = 0;
-        ParseCommand(tl->tokens, tl->tokens + tl->len, &shell->_cmd_data);
-        shell->cmd = &(shell->_cmd_data.cmd);
+        ParseCommand(tl->tokens, tl->tokens + tl->len, &shell->arena, &shell->_cmd);
+        shell->cmd = &(shell->_cmd);
 
 	// PrintCommand(shell->cmd, "");
     }
-    else {
+    else if (ret < 0) {
         shell->should_run = NO;
-        shell->last_exit_status = ret;
     }
     return ret;
 }
 
 
-int runPipelineCommnad(Pipeline *pipeline) {
+// The command hash table: names looked up along the search
+// path, mapped to the program paths they resolved to, so a
+// repeated command is spawned without searching again.
+// "hash -r" forgets them all.
+
+typedef struct HashedCommand {
+    char name[TSH_MAX_FILENAME_LENGTH];     // empty if the slot is free
+    char path[TSH_MAX_FILENAME_LENGTH];
+    int hits;
+} HashedCommand;
+
+static HashedCommand hashed[TSH_HASH_SIZE];
+static char search_path[TSH_MAX_PATH_DIRS][TSH_MAX_FILENAME_LENGTH] = { "/" };
+static int search_path_len = 1;
+
+static HashedCommand *
+hashSlot(char *name) {
+    uint h = 0;
+    for (char *p = name; *p; p++)
+        h = h * 31 + *p;
+    return &hashed[h % TSH_HASH_SIZE];
+}
+
+static void
+hashClear(void) {
+    for (int i = 0; i < TSH_HASH_SIZE; i++)
+        hashed[i].name[0] = '\0';
+}
+
+// Look name up along the search path, caching what it
+// resolves to in buf. Returns buf, or 0 if no directory
+// holds a program of that name.
+static char *
+resolveCommand(char *name, char *buf, int size) {
+    struct stat st;
+
+    if (strchr(name, '/') || strlen(name) >= TSH_MAX_FILENAME_LENGTH)
+        return name;
+    HashedCommand *h = hashSlot(name);
+    if (h->name[0] && strcmp(h->name, name) == 0) {
+        h->hits++;
+        return h->path;
+    }
+    for (int i = 0; i < search_path_len; i++) {
+        char *dir = search_path[i];
+        int n = strlen(dir);
+        if (n + 1 + strlen(name) + 1 > size)
+            continue;
+        strcpy(buf, dir);
+        if (n > 0 && dir[n - 1] != '/')
+            buf[n++] = '/';
+        strcpy(buf + n, name);
+        if (stat(buf, &st) < 0 || st.type != T_FILE)
+            continue;
+        // relative directories depend on the cwd; don't hash them.
+        if (dir[0] == '/' && strlen(buf) < TSH_MAX_FILENAME_LENGTH) {
+            strcpy(h->name, name);
+            strcpy(h->path, buf);
+            h->hits = 1;
+        }
+        return buf;
+    }
+    return 0;
+}
+
+// spawn() the program name resolves to. A hashed path that
+// has gone stale is dropped and the search path retried.
+static int
+spawnCommand(char *name, char **argv, struct spawnact *actions) {
+    char buf[TSH_MAX_FILENAME_LENGTH + DIRSIZ + 2];
+    char *path;
+    int pid;
+
+    if ((path = resolveCommand(name, buf, sizeof(buf))) == 0)
+        return -1;
+    if ((pid = spawn(path, argv, actions)) >= 0 || path == name)
+        return pid;
+    HashedCommand *h = hashSlot(name);
+    if (path != h->path)
+        return -1;
+    h->name[0] = '\0';
+    if ((path = resolveCommand(name, buf, sizeof(buf))) == 0)
+        return -1;
+    return spawn(path, argv, actions);
+}
+
+// uprof on    start sampling where the shell spends its time
+// uprof off   stop, and print the samples by function
+static int
+uprofBuiltin(SimpleCommand *cmd) {
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "on") == 0)
+        return uprofstart() < 0;
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "off") == 0) {
+        uprofstop();
+        uprofdump("/tsh.sym");
+        return 0;
+    }
+    fprintf(2, "usage: uprof on|off\n");
+    return 1;
+}
+
+// hash      list the hashed commands
+// hash -r   forget them
+static int
+hashBuiltin(SimpleCommand *cmd) {
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-r") == 0) {
+        hashClear();
+        return 0;
+    } else if (cmd->argc > 1) {
+        fprintf(2, "usage: hash [-r]\n");
+        return 1;
+    }
+    printf("hits\tcommand\n");
+    for (int i = 0; i < TSH_HASH_SIZE; i++)
+        if (hashed[i].name[0])
+            printf("%d\t%s\n", hashed[i].hits, hashed[i].path);
+    return 0;
+}
+
+// path          print the search path
+// path dir ...  search these directories, in order
+static int
+pathBuiltin(SimpleCommand *cmd) {
+    if (cmd->argc == 1) {
+        for (int i = 0; i < search_path_len; i++)
+            printf("%s%s", search_path[i], i + 1 < search_path_len ? " " : "\n");
+        return 0;
+    }
+    if (cmd->argc - 1 > TSH_MAX_PATH_DIRS) {
+        fprintf(2, "path: too many directories\n");
+        return 1;
+    }
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strlen(cmd->argv[i]) >= TSH_MAX_FILENAME_LENGTH) {
+            fprintf(2, "path: %s: name too long\n", cmd->argv[i]);
+            return 1;
+        }
+    }
+    for (int i = 1; i < cmd->argc; i++)
+        strcpy(search_path[i - 1], cmd->argv[i]);
+    search_path_len = cmd->argc - 1;
+    hashClear();
+    return 0;
+}
+
+// Whether pipeline stages are pinned to CPUs; see pinStage().
+static int pin_stages;
+
+// pin on    run each pipeline stage on a CPU of its own,
+//           next to the stages it talks to
+// pin off   let them run anywhere
+static int
+pinBuiltin(SimpleCommand *cmd) {
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "on") == 0) {
+        pin_stages = 1;
+        return 0;
+    }
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "off") == 0) {
+        pin_stages = 0;
+        return 0;
+    }
+    fprintf(2, "usage: pin on|off\n");
+    return 1;
+}
+
+// Pin stage x of a pipeline, process pid, to the x'th of
+// the CPUs the shell may use, wrapping around, so that
+// each pipe's writer and reader sit on neighbouring CPUs
+// and keep their caches rather than trading places.
+static void
+pinStage(int pid, int x) {
+    uint64 cpus = getaffinity(getpid());
+    int n = 0;
+
+    for (uint64 m = cpus; m; m &= m - 1)
+        n++;
+    if (n < 2)
+        return;
+    for (x %= n; x > 0; x--)
+        cpus &= cpus - 1;
+    setaffinity(pid, cpus & -cpus);
+}
+
+// Append a spawn() action to the list at *next.
+static void
+addAction(struct spawnact **next, int type, int fd, int srcfd, char *path, int omode) {
+    struct spawnact *a = (*next)++;
+    a->type = type;
+    a->fd = fd;
+    a->srcfd = srcfd;
+    a->path = path;
+    a->omode = omode;
+}
+
+// Keep a script's descriptor out of the commands it runs.
+static void
+addInputClose(struct spawnact **next) {
+    if (this_shell.input.fd > 2)
+        addAction(next, SPAWN_CLOSE, this_shell.input.fd, 0, 0, 0);
+}
+
+// Add the actions for command's redirection of fd, if it has one.
+static void
+addRedirect(struct spawnact **next, SimpleCommand *command, int fd) {
+    Redirection *r = &command->redirects[fd];
+    if (r->type == REDIRECT_NONE)
+        return;
+    if (r->dest_fd >= 0)
+        addAction(next, SPAWN_DUP2, fd, r->dest_fd, 0, 0);
+    else if (r->type == REDIRECT_INPUT)
+        addAction(next, SPAWN_OPEN, fd, 0, r->path, O_RDONLY);
+    else
+        addAction(next, SPAWN_OPEN, fd, 0, r->path, O_WRONLY | O_CREATE);
+}
+
+// Run every stage of pipeline at once, stage x reading from
+// pipe x-1 and writing to pipe x. Returns the exit status of
+// the last stage.
+int runPipelineCommnad(Pipeline *pipeline, int bg) {
     int numCommands = pipeline->len;
+    int *pids = arenaAlloc(&this_shell.arena, 2 * numCommands * sizeof(int));
+    int *status = pids + numCommands;
+    int prevRead = -1;
     int pipeFD[2];
 
-    pipe(pipeFD);
+    if(pids == 0){
+      ErrorS("Out of memory\n");
+      return -1;
+    }
 
     for(int x = 0; x < numCommands; x++){
       SimpleCommand *command = pipeline->commands[x].cmd.simple;
-      int fdIn = -1;
-      int fdOut = -1;
-      if(fork()==0){
-	if(x == 0){
-	  close(1);
-	  dup(pipeFD[1]);
-	  close(pipeFD[0]);
-	  close(pipeFD[1]);
-	  for(int redirectCounter = 0; redirectCounter < 3; redirectCounter++){
-	    if(command->redirects[redirectCounter].type == REDIRECT_INPUT){
-	      if(command->redirects[redirectCounter].dest_fd >= 0){
-		fdIn = command->redirects[redirectCounter].dest_fd;
-	      } else {
-		fdIn = open(command->redirects[redirectCounter].path, O_RDONLY);
-	      }
-	    }
-	  }
-	  if(fdIn >= 0){
-	    close(0);
-	    dup(fdIn);
-	    close(fdIn);
-	  }
-	}
-	else if(x == numCommands - 1){
-	  close(0);
-	  dup(pipeFD[0]);
-	  close(pipeFD[0]);
-	  close(pipeFD[1]);
-	  for(int redirectCounter = 0; redirectCounter < 3; redirectCounter++){
-	    if(command->redirects[redirectCounter].type == REDIRECT_OUTPUT){
-	      if(command->redirects[redirectCounter].dest_fd >= 0){
-		fdOut = command->redirects[redirectCounter].dest_fd;
-	      } else {
-		fdOut = open(command->redirects[redirectCounter].path, O_WRONLY | O_CREATE);
-	      }
-	    }
-	  }
-	  if(fdOut >= 0){
-	    close(1);
-	    dup(fdOut);
-	    close(fdOut);
-	  }
-	} else {
-	  close(1);
-	  dup(pipeFD[0]);
-	  close(0);
-	  dup(pipeFD[1]);
-	  close(pipeFD[0]);
-	  close(pipeFD[1]);
-	}
-	exec(command->name,command->argv);
+      struct spawnact actions[9], *next = actions;
+      int last = (x == numCommands - 1);
+
+      pipeFD[0] = pipeFD[1] = -1;
+      if(!last && pipe(pipeFD) < 0){
+	ErrorS("Pipe failed\n");
+	numCommands = x;  // run no further stages
+	break;
       }
-    }
-    close(pipeFD[0]);
-    close(pipeFD[1]);
-    for(int x = 0; x < pipeline->len; x++){
-      wait(0);
-    }
-    return 0;
-}
 
-int runSimpleCommand(SimpleCommand *cmd) {
-  int pid = fork();
-  if(pid == 0){
-    if(cmd->type == CMD_EMPTY) {
-      exit(0);
-    } else if (cmd->type == CMD_INVALID) {
-      ErrorU("Invalid command\n");
-      exit(1);
-    } else {
-      if(cmd->redirects[0].type == REDIRECT_INPUT){
-	int fd = open(cmd->redirects[0].path, O_RDONLY);
-	if(fd < 0) {
-	  ErrorS("Cannot open file descriptor");
-	  exit(1);
-	}
-	close(0);
-	dup(fd);
-	close(fd);
+      if(prevRead >= 0){
+	addAction(&next, SPAWN_DUP2, 0, prevRead, 0, 0);
+	addAction(&next, SPAWN_CLOSE, prevRead, 0, 0, 0);
+      } else if(command->redirects[0].type == REDIRECT_INPUT){
+	addRedirect(&next, command, 0);
+      }
+      addInputClose(&next);
+      if(!last){
+	addAction(&next, SPAWN_DUP2, 1, pipeFD[1], 0, 0);
+	addAction(&next, SPAWN_CLOSE, pipeFD[0], 0, 0, 0);
+	addAction(&next, SPAWN_CLOSE, pipeFD[1], 0, 0, 0);
+      } else if(command->redirects[1].type == REDIRECT_OUTPUT){
+	addRedirect(&next, command, 1);
       }
-      if(cmd->redirects[1].type == REDIRECT_OUTPUT){
-	int fd = open(cmd->redirects[1].path, O_WRONLY | O_CREATE);
-	if(fd < 0) {
-	  ErrorS("Cannot open file descriptor");
-	  exit(1);
-	}
-	if(fd != 1){
-	  close(1);
-	  dup(fd);
-	  close(fd);
-	}
-	
+      addAction(&next, SPAWN_END, 0, 0, 0, 0);
+
+      // even if this stage fails to start, keep going so the
+      // stages after it see end-of-file.
+      if((pids[x] = spawnCommand(command->name, command->argv, actions)) < 0)
+	ErrorU("Command not found!\n");
+      else {
+	if(bg)
+	  setprio(pids[x], PRIO_BATCH);
+	if(pin_stages)
+	  pinStage(pids[x], x);
       }
-      
-      exec(cmd->name, cmd->argv);
-      ErrorU("Command not found!\n");
-      exit(1);
+      status[x] = -1;
+
+      if(prevRead >= 0)
+	close(prevRead);
+      if(!last)
+	close(pipeFD[1]);
+      prevRead = pipeFD[0];
+    }
+    if(prevRead >= 0)
+      close(prevRead);
+
+    if(bg){
+      AddJob(&this_shell, pids, numCommands,
+             pipeline->commands[0].cmd.simple->name);
+      return 0;
     }
+
+    // reap only our own stages; background jobs are
+    // collected between prompts.
+    for(int x = 0; x < numCommands; x++)
+      if(pids[x] > 0)
+	waitpid(pids[x], &status[x], 0);
+    return numCommands > 0 ? status[numCommands - 1] : -1;
+}
+
+int runSimpleCommand(SimpleCommand *cmd, int bg) {
+  struct spawnact actions[4], *next = actions;
+
+  if(cmd->type == CMD_EMPTY) {
+    return 0;
+  } else if (cmd->type == CMD_INVALID) {
+    ErrorU("Invalid command\n");
+    return 1;
+  }
+
+  if(cmd->redirects[0].type == REDIRECT_INPUT)
+    addAction(&next, SPAWN_OPEN, 0, 0, cmd->redirects[0].path, O_RDONLY);
+  if(cmd->redirects[1].type == REDIRECT_OUTPUT)
+    addAction(&next, SPAWN_OPEN, 1, 0, cmd->redirects[1].path, O_WRONLY | O_CREATE);
+  addInputClose(&next);
+  addAction(&next, SPAWN_END, 0, 0, 0, 0);
+
+  // spawn() builds the child straight from the program
+  // image; no copy of the shell is ever made.
+  int pid = spawnCommand(cmd->name, cmd->argv, actions);
+  if (pid > 0 && bg) {
+    setprio(pid, PRIO_BATCH);  // keep the prompt responsive
+    AddJob(&this_shell, &pid, 1, cmd->name);
+    return 0;
   } else if (pid > 0) {
     int status;
-    wait(&status);
+    waitpid(pid, &status, 0);
     return status;
   } else {
-    ErrorS("Fork failed\n");
+    ErrorU("Command not found or cannot open redirection!\n");
     return -1;
   }
 }
 
-int
-RunCommand(ShellState *shell) {
-    Command *command = shell->cmd;
-    if (command->type == CMD_EMPTY) {
-        return 1;
+static int RunList(ShellState *shell, ListCommand *list);
 
-    } else if (command->type == CMD_INVALID) {
-        ErrorU("invalid command");
+// Run a ( ... ) group in a child copy of the shell, whose
+// background elements run concurrently and are all joined
+// before the group finishes.
+static int
+runGroup(ShellState *shell, ListCommand *list, int bg) {
+    int pid, status;
+
+    if ((pid = fork()) < 0) {
+        ErrorS("Fork failed\n");
         return -1;
+    }
+    if (pid == 0) {
+        // the parent's jobs are not our children.
+        for (int i = 0; i < TSH_MAX_JOBS; i++)
+            shell->jobs[i].id = 0;
+        shell->in_group = YES;
+        status = RunList(shell, list);
+        WaitJobs(shell, 0);
+        exit(status);
+    }
+    if (bg) {
+        setprio(pid, PRIO_BATCH);
+        AddJob(shell, &pid, 1, "( ... )");
+        return 0;
+    }
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+// In-process versions of the most common utilities. They
+// behave like the programs in user/ but save a spawn(), and
+// run only for plain foreground commands: anything with a
+// redirection, a pipe or a '&' still runs the real program.
+
+static int
+utilEcho(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        write(1, argv[i], strlen(argv[i]));
+        write(1, i + 1 < argc ? " " : "\n", 1);
+    }
+    return 0;
+}
+
+static int
+utilCat(int argc, char **argv) {
+    static char buf[512];
+    int fd, n;
+
+    for (int i = 1; i < argc; i++) {
+        if ((fd = open(argv[i], O_RDONLY)) < 0) {
+            printf("cat: cannot open %s\n", argv[i]);
+            return 1;
+        }
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            if (write(1, buf, n) != n) {
+                printf("cat: write error\n");
+                close(fd);
+                return 1;
+            }
+        }
+        close(fd);
+        if (n < 0) {
+            printf("cat: read error\n");
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    } else if (command->type == CMD_SIMPLE) {
+// Blank-padded last element of path, as ls prints it.
+static char *
+lsName(char *path) {
+    static char buf[DIRSIZ + 1];
+    char *p;
+
+    for (p = path + strlen(path); p >= path && *p != '/'; p--)
+        ;
+    p++;
+    if (strlen(p) >= DIRSIZ)
+        return p;
+    memmove(buf, p, strlen(p));
+    memset(buf + strlen(p), ' ', DIRSIZ - strlen(p));
+    buf[DIRSIZ] = '\0';
+    return buf;
+}
+
+static void
+lsPath(char *path) {
+    char buf[512], *p;
+    int fd;
+    struct dirent de;
+    struct stat st;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(2, "ls: cannot open %s\n", path);
+        return;
+    }
+    if (fstat(fd, &st) < 0) {
+        fprintf(2, "ls: cannot stat %s\n", path);
+        close(fd);
+        return;
+    }
+    if (st.type != T_DIR) {
+        printf("%s %d %d %l\n", lsName(path), st.type, st.ino, st.size);
+    } else if (strlen(path) + 1 + DIRSIZ + 1 > sizeof(buf)) {
+        printf("ls: path too long\n");
+    } else {
+        strcpy(buf, path);
+        p = buf + strlen(buf);
+        *p++ = '/';
+        while (read(fd, &de, sizeof(de)) == sizeof(de)) {
+            if (de.inum == 0)
+                continue;
+            memmove(p, de.name, DIRSIZ);
+            p[DIRSIZ] = '\0';
+            if (stat(buf, &st) < 0) {
+                printf("ls: cannot stat %s\n", buf);
+                continue;
+            }
+            printf("%s %d %d %d\n", lsName(buf), st.type, st.ino, st.size);
+        }
+    }
+    close(fd);
+}
+
+static int
+utilLs(int argc, char **argv) {
+    if (argc < 2)
+        lsPath(".");
+    for (int i = 1; i < argc; i++)
+        lsPath(argv[i]);
+    return 0;
+}
+
+typedef struct Utility {
+    char *name;
+    int (*fn)(int argc, char **argv);
+    int minargs;    // fewer arguments need the real program (cat reads stdin)
+    int enabled;    // cleared by "enable -n name"
+} Utility;
+
+static Utility utilities[] = {
+    { "echo", utilEcho, 1, YES },
+    { "cat",  utilCat,  2, YES },
+    { "ls",   utilLs,   1, YES },
+};
+
+#define NUTILITY (sizeof(utilities) / sizeof(utilities[0]))
+
+static Utility *
+findUtility(char *name) {
+    for (int i = 0; i < NUTILITY; i++)
+        if (strcmp(utilities[i].name, name) == 0)
+            return &utilities[i];
+    return 0;
+}
+
+// enable            list the in-process utilities
+// enable name ...   run them in-process
+// enable -n name... always run the real programs
+static int
+enableBuiltin(SimpleCommand *cmd) {
+    int on = YES, i = 1, status = 0;
+
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+        on = NO;
+        i++;
+    }
+    if (i == cmd->argc) {
+        for (int j = 0; j < NUTILITY; j++)
+            printf("enable %s%s\n", utilities[j].enabled ? "" : "-n ",
+                   utilities[j].name);
+        return 0;
+    }
+    for (; i < cmd->argc; i++) {
+        Utility *u = findUtility(cmd->argv[i]);
+        if (u == 0) {
+            fprintf(2, "enable: %s: not an in-process utility\n", cmd->argv[i]);
+            status = 1;
+            continue;
+        }
+        u->enabled = on;
+    }
+    return status;
+}
+
+// Run cmd in-process if it is an enabled utility with no
+// redirections. Returns 0 and sets *status if it ran.
+static int
+runUtility(SimpleCommand *cmd, int *status) {
+    Utility *u = findUtility(cmd->name);
+
+    if (u == 0 || !u->enabled || cmd->argc < u->minargs)
+        return -1;
+    if (cmd->redirects[0].type != REDIRECT_NONE ||
+        cmd->redirects[1].type != REDIRECT_NONE)
+        return -1;
+    *status = u->fn(cmd->argc, cmd->argv);
+    fflush(1);  // before any later command's output
+    return 0;
+}
+
+static int timeElement(ShellState *shell, Command *command);
+
+// The simple command that command starts with, if any.
+static SimpleCommand *
+firstSimple(Command *command) {
+    if (command->type == CMD_SIMPLE && command->cmd.simple->type == CMD_SIMPLE)
+        return command->cmd.simple;
+    if (command->type == CMD_PIPELINE && command->cmd.pipeline->len > 0)
+        return firstSimple(&command->cmd.pipeline->commands[0]);
+    return 0;
+}
+
+// Run one element of a list: a builtin, a program, a
+// pipeline or a group. Returns its exit status.
+static int
+RunElement(ShellState *shell, Command *command) {
+    int bg = (command->flag & CMD_BACKGROUND_MODE) != 0;
+    SimpleCommand *first = firstSimple(command);
+
+    if (!bg && first && first->argc > 1 && strcmp(first->name, "time") == 0)
+        return timeElement(shell, command);
+    if (command->type == CMD_SIMPLE) {
         SimpleCommand *cmd = command->cmd.simple;
+        if (cmd->type != CMD_SIMPLE)
+            return runSimpleCommand(cmd, bg);
         if (strcmp(cmd->name, "quit") == 0) {
             shell->should_run = NO;
             if (cmd->argc > 1) {
@@ -607,13 +1307,92 @@ RunCommand(ShellState *shell) {
 	  }
 	  if(chdir(dir) < 0) {
 	    ErrorU("Directory does not exist or cannot be found!\n");
+	    return 1;
 	  }
-        } else {
-            runSimpleCommand(cmd);
+	  return 0;
+        } else if (strcmp(cmd->name, "jobs") == 0) {
+	  ListJobs(shell);
+	  return 0;
+        } else if (strcmp(cmd->name, "wait") == 0) {
+	  WaitJobs(shell, cmd->argc > 1 ? atoi(cmd->argv[1]) : 0);
+	  return 0;
+        } else if (strcmp(cmd->name, "enable") == 0) {
+	  return enableBuiltin(cmd);
+        } else if (strcmp(cmd->name, "hash") == 0) {
+	  return hashBuiltin(cmd);
+        } else if (strcmp(cmd->name, "uprof") == 0) {
+	  return uprofBuiltin(cmd);
+        } else if (strcmp(cmd->name, "path") == 0) {
+	  return pathBuiltin(cmd);
+        } else if (strcmp(cmd->name, "pin") == 0) {
+	  return pinBuiltin(cmd);
         }
+        int status;
+        if (!bg && runUtility(cmd, &status) == 0)
+            return status;
+        return runSimpleCommand(cmd, bg);
     } else if (command->type == CMD_PIPELINE) {
-        Pipeline *pipeline = command->cmd.pipeline;
-        runPipelineCommnad(pipeline);
+        return runPipelineCommnad(command->cmd.pipeline, bg);
+    } else if (command->type == CMD_LIST) {
+        return runGroup(shell, command->cmd.list, bg);
+    }
+    ErrorU("invalid command");
+    return -1;
+}
+
+// The time builtin: "time cmd" or "time cmd | cmd ...".
+// Runs the rest of the command, then prints the resources it
+// used: those of the children it ran, and the shell's own for
+// utilities run in-process.
+static int
+timeElement(ShellState *shell, Command *command) {
+    SimpleCommand *first = firstSimple(command);
+    struct rusage s0, c0, s1, c1;
+    int t0, status;
+
+    first->argc--;
+    first->argv++;
+    first->name = first->argv[0];
+    getrusage(RUSAGE_SELF, &s0);
+    getrusage(RUSAGE_CHILDREN, &c0);
+    t0 = uptime();
+    status = RunElement(shell, command);
+    getrusage(RUSAGE_SELF, &s1);
+    getrusage(RUSAGE_CHILDREN, &c1);
+
+    // r_time() ticks are 100 ns, uptime() ticks about 100 ms.
+#define D(f) ((s1.f - s0.f) + (c1.f - c0.f))
+    fprintf(2, "real %dms user %lms sys %lms\n", (uptime() - t0) * 100,
+            D(utime) / 10000, D(stime) / 10000);
+    fprintf(2, "switches %l faults %l pages %l bread %l bwrite %l pipe in %l out %l\n",
+            D(nswitch), D(nfault), D(npages), D(nbread), D(nbwrite), D(npipein), D(npipeout));
+#undef D
+    return status;
+}
+
+// Run the elements of list in order, not waiting for
+// those that '&' ends. Returns the last one's status.
+static int
+RunList(ShellState *shell, ListCommand *list) {
+    int status = 0;
+
+    for (int i = 0; i < list->len && shell->should_run; i++)
+        status = RunElement(shell, &list->commands[i]);
+    return status;
+}
+
+int
+RunCommand(ShellState *shell) {
+    Command *command = shell->cmd;
+    if (command->type == CMD_EMPTY) {
+        return 1;
+
+    } else if (command->type == CMD_INVALID || (command->flag & 0xffff)) {
+        // the parser has already said what is wrong.
+        return -1;
+
+    } else if (command->type == CMD_LIST) {
+        RunList(shell, command->cmd.list);
     }
     return 0;
 }
@@ -625,9 +1404,28 @@ main(int argc, char *argv[]) {
     this_shell.prompt = default_prompt;
     this_shell.name = "tsh";
     this_shell.should_run = 1;
-    this_shell.cmd = &(this_shell._cmd_data.cmd);
+    this_shell.cmd = &(this_shell._cmd);
+    this_shell.cmdline.cap = TSH_MAX_CMD_LINE_LENGTH + 1;
+    if ((this_shell.cmdline.buffer = malloc(this_shell.cmdline.cap)) == 0) {
+        ErrorS("Out of memory\n");
+        exit(1);
+    }
+
+    // "tsh script" runs the script; otherwise commands come
+    // from stdin, with prompts only if that is the console.
+    if (argc > 1) {
+        if ((this_shell.input.fd = open(argv[1], O_RDONLY)) < 0) {
+            fprintf(2, "%s: cannot open %s\n", this_shell.name, argv[1]);
+            exit(1);
+        }
+    } else {
+        struct stat st;
+        this_shell.input.fd = 0;
+        this_shell.input.interactive = fstat(0, &st) == 0 && st.type == T_DEVICE;
+    }
 
     while (this_shell.should_run) {
+        ReapJobs(&this_shell);
         if (0 < GetCommand(&this_shell)) {
             RunCommand(&this_shell);
         }
@@ -12,6 +12,10 @@
 #define TSH_MAX_CMD_LIST_LENGTH     6
 #define TSH_MAX_PIPELINE_LENGTH     6
 #define TSH_MAX_FILENAME_LENGTH     64
+#define TSH_MAX_JOBS                8
+#define TSH_HASH_SIZE               31
+#define TSH_MAX_PATH_DIRS           8
+#define TSH_ARENA_CHUNK_SIZE        4096
 
 // tsh_util.c
 #define ErrorU(cause)  tsh_error("An error has occurred", (cause), __FILE__, __LINE__)
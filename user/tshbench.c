@@ -0,0 +1,191 @@
+//
+// tshbench: how long tsh takes to run typical command lines,
+// from the line being typed to the shell being ready for the
+// next one.
+//
+// usage: tshbench [-n count] [-s shell] [scenario ...]
+//
+// Runs one shell with its input and output on pipes. Each
+// command line is followed by "echo @@done", which tsh runs
+// in-process, and is timed until that line comes back. Each
+// scenario prints one line,
+//
+//   tshbench <scenario> <count> <min> <median> <p90> <max> us
+//
+// with the latencies in microseconds, from clock_cycles().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+#define MAXN 200
+
+struct scenario {
+  char *name;
+  char *lines;      // sent as one command, timed as one
+};
+
+struct scenario scenarios[] = {
+  { "builtin", "echo hi > tb.out\n" },
+  { "simple", "/echo hi\n" },
+  { "redirect", "/cat < tb.in > tb.out\n" },
+  { "pipe2", "/cat tb.in | /cat > tb.out\n" },
+  { "pipe3", "/cat tb.in | /cat | /cat > tb.out\n" },
+  { "pipe4", "/cat tb.in | /cat | /cat | /cat > tb.out\n" },
+  { "pipe5", "/cat tb.in | /cat | /cat | /cat | /cat > tb.out\n" },
+  { "pipe6", "/cat tb.in | /cat | /cat | /cat | /cat | /cat > tb.out\n" },
+  { "pipe3pin", "pin on\n/cat tb.in | /cat | /cat > tb.out\npin off\n" },
+  { "bg4", "/echo a > tb.1 &\n/echo b > tb.2 &\n/echo c > tb.3 &\n/echo d > tb.4 &\nwait\n" },
+};
+
+int tosh, fromsh;
+char buf[1024];
+int nbuf;
+
+// read the shell's output until the marker line.
+void
+waitdone(void)
+{
+  char *m = "@@done\n";
+  int n, i, ml = strlen(m);
+
+  for(;;){
+    for(i = 0; i + ml <= nbuf; i++)
+      if(memcmp(buf + i, m, ml) == 0){
+        nbuf = 0;
+        return;
+      }
+    // keep a partial marker at the end.
+    if(nbuf > ml){
+      memmove(buf, buf + nbuf - ml, ml);
+      nbuf = ml;
+    }
+    if((n = read(fromsh, buf + nbuf, sizeof(buf) - nbuf)) <= 0){
+      fprintf(2, "tshbench: shell exited\n");
+      exit(1);
+    }
+    nbuf += n;
+  }
+}
+
+void
+send(char *s)
+{
+  if(write(tosh, s, strlen(s)) != strlen(s)){
+    fprintf(2, "tshbench: write to shell failed\n");
+    exit(1);
+  }
+}
+
+void
+run(struct scenario *s, int n)
+{
+  uint64 t[MAXN], x, t0;
+  int i, j;
+
+  // once untimed, to warm the caches.
+  send(s->lines);
+  send("echo @@done\n");
+  waitdone();
+  for(i = 0; i < n; i++){
+    t0 = clock_cycles();
+    send(s->lines);
+    send("echo @@done\n");
+    waitdone();
+    x = (clock_cycles() - t0) * 1000000 / clock_hz();
+    for(j = i; j > 0 && t[j-1] > x; j--)
+      t[j] = t[j-1];
+    t[j] = x;
+  }
+  printf("tshbench %s %d %l %l %l %l us\n", s->name, n,
+         t[0], t[n/2], t[n*9/10], t[n-1]);
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: tshbench [-n count] [-s shell] [scenario ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, s, n = 20, in[2], out[2], pid, fd;
+  char *shell = "tsh", *shargv[2];
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      n = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      shell = argv[++i];
+    else
+      usage();
+  }
+  if(n < 1 || n > MAXN)
+    n = n < 1 ? 1 : MAXN;
+
+  unlink("tb.in");
+  if((fd = open("tb.in", O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "tshbench: cannot create tb.in\n");
+    exit(1);
+  }
+  for(s = 0; s < 16; s++)
+    write(fd, "a line of text for cat to copy\n", 31);
+  close(fd);
+
+  if(pipe(in) < 0 || pipe(out) < 0){
+    fprintf(2, "tshbench: pipe failed\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    fprintf(2, "tshbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(2);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    shargv[0] = shell;
+    shargv[1] = 0;
+    exec(shell, shargv);
+    fprintf(2, "tshbench: exec %s failed\n", shell);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+  tosh = in[1];
+  fromsh = out[0];
+
+  for(s = 0; s < NELEM(scenarios); s++){
+    if(i < argc){
+      for(j = i; j < argc; j++)
+        if(strcmp(argv[j], scenarios[s].name) == 0)
+          break;
+      if(j == argc)
+        continue;
+    }
+    run(&scenarios[s], n);
+  }
+
+  close(tosh);
+  waitpid(pid, 0, 0);
+  close(fromsh);
+  unlink("tb.in");
+  unlink("tb.out");
+  unlink("tb.1");
+  unlink("tb.2");
+  unlink("tb.3");
+  unlink("tb.4");
+  exit(0);
+}
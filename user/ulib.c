@@ -1,8 +1,63 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/timepage.h"
+#include "kernel/syscall.h"
+#include "kernel/submit.h"
 #include "user/user.h"
 
+// Set by printf.c once it is holding output in a buffer;
+// stdio_flush(fd) writes out fd's, or all if fd < 0.
+void (*stdio_flush)(int);
+// Set by getline.c; stdio_drop(fd) discards input read
+// ahead from fd.
+void (*stdio_drop)(int);
+
+int
+fork(void)
+{
+  if(stdio_flush)
+    stdio_flush(-1);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdio_flush)
+    stdio_flush(-1);
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(stdio_flush)
+    stdio_flush(-1);
+  return _exec(path, argv);
+}
+
+int
+spawn(char *path, char **argv, struct spawnact *acts)
+{
+  if(stdio_flush)
+    stdio_flush(-1);
+  return _spawn(path, argv, acts);
+}
+
+int
+close(int fd)
+{
+  if(stdio_flush)
+    stdio_flush(fd);
+  if(stdio_drop)
+    stdio_drop(fd);
+  return _close(fd);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -32,14 +87,37 @@ strlen(const char *s)
   return n;
 }
 
+// Word-at-a-time memset(), memcmp() and memmove(), as in
+// kernel/string.c.
+
+typedef uint64 __attribute__((may_alias)) word;
+#define WSIZE     sizeof(word)
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w, *wd;
+
+  while(n > 0 && !WALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wd = (word*)cdst;
+  for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8){
+    wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+    wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+  }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wd++ = w;
+  cdst = (char*)wd;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -52,36 +130,26 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
+// open(), fstat() and close() with one trap.
 int
 stat(const char *n, struct stat *st)
 {
-  int fd;
-  int r;
+  struct sqe q[3];
 
-  fd = open(n, O_RDONLY);
-  if(fd < 0)
+  memset(q, 0, sizeof(q));
+  q[0].op = SYS_open;
+  q[0].arg[0] = (uint64)n;
+  q[0].arg[1] = O_RDONLY;
+  q[1].op = SYS_fstat;
+  q[1].flags = SQE_LINK;
+  q[1].link = 0;
+  q[1].arg[1] = (uint64)st;
+  q[2].op = SYS_close;
+  q[2].flags = SQE_LINK;
+  q[2].link = 0;
+  if(submit(q, 3) != 3)
     return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
+  return (int)q[1].res;
 }
 
 int
@@ -96,36 +164,87 @@ atoi(const char *s)
 }
 
 void*
-memmove(void *vdst, const void *vsrc, int n)
+memmove(void *dst, const void *src, int n0)
 {
-  char *dst;
-  const char *src;
+  uint n = n0 > 0 ? n0 : 0;
+  const char *s;
+  char *d;
+  const word *ws;
+  word *wd;
+  int words;
 
-  dst = vdst;
-  src = vsrc;
-  if (src > dst) {
+  s = src;
+  d = dst;
+  words = ((uint64)s & (WSIZE-1)) == ((uint64)d & (WSIZE-1));
+  if(s < d && s + n > d){
+    s += n;
+    d += n;
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const word*)s;
+      wd = (word*)d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE){
+        ws -= 8, wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
-      *dst++ = *src++;
+      *--d = *--s;
   } else {
-    dst += n;
-    src += n;
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const word*)s;
+      wd = (word*)d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
-      *--dst = *--src;
+      *d++ = *s++;
   }
-  return vdst;
+
+  return dst;
 }
 
 int
-memcmp(const void *s1, const void *s2, uint n)
+memcmp(const void *v1, const void *v2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
-  while (n-- > 0) {
-    if (*p1 != *p2) {
-      return *p1 - *p2;
+  const uchar *s1, *s2;
+
+  s1 = v1;
+  s2 = v2;
+  if(((uint64)s1 & (WSIZE-1)) == ((uint64)s2 & (WSIZE-1))){
+    while(n > 0 && !WALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
     }
-    p1++;
-    p2++;
+    // skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE && *(word*)s1 == *(word*)s2; n -= WSIZE)
+      s1 += WSIZE, s2 += WSIZE;
   }
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+
   return 0;
 }
 
@@ -134,3 +253,122 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Mutexes and condition variables on futexes, after
+// Drepper's "Futexes Are Tricky". A mutex's state is 0 when
+// unlocked, 1 when locked, and 2 when locked and some thread
+// may be waiting in futex_wait().
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_val_compare_and_swap(&m->state, 0, 1) == 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    // there may be waiters.
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Atomically unlock m and wait for cond_signal() or
+// cond_broadcast(); relock m before returning. Wakeups may
+// be spurious, so callers re-check their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
+
+// The calling thread's struct tls, or 0 if out of memory.
+// exec() and clone() start threads with tp clear. It comes
+// from sbrk() rather than malloc(), which itself needs it.
+struct tls*
+tls(void)
+{
+  struct tls *t;
+  char *p;
+
+  asm volatile("mv %0, tp" : "=r" (t));
+  if(t != 0)
+    return t;
+  if((p = sbrk(sizeof(*t) + 8)) == (char*)-1)
+    return 0;
+  t = (struct tls*)(((uint64)p + 7) & ~7L);
+  memset(t, 0, sizeof(*t));
+  asm volatile("mv tp, %0" : : "r" (t));
+  return t;
+}
+
+// uptime() without a system call: the kernel keeps the tick
+// count in the page at TIMEPAGE.
+int
+uptime_fast(void)
+{
+  return ((struct timepage*)TIMEPAGE)->ticks;
+}
+
+// the time CSR, which counts clock_hz() times a second.
+uint64
+clock_cycles(void)
+{
+  uint64 x;
+
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+uint64
+clock_hz(void)
+{
+  return ((struct timepage*)TIMEPAGE)->hz;
+}
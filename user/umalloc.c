@@ -2,89 +2,376 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Small blocks, of up to MAXSMALL bytes with their header,
+// are rounded up to a size class and recycled through that
+// class's free list, so malloc() and free() are O(1). New
+// small blocks are carved off a bump region that grows by
+// CHUNK bytes of sbrk() memory at a time.
+//
+// Large blocks are whole pages straight from sbrk(). Free
+// ones sit on an address-ordered list, merged with their
+// neighbours as in Kernighan and Ritchie's allocator, and
+// a free block that ends at the break is handed back to
+// the kernel with sbrk(-n).
+//
+// The lists above form the central heap, under heaplock.
+// In front of it each thread has a cache (struct mcache),
+// with a free list per class that only its owner touches;
+// it refills from and spills to the central heap BATCH
+// blocks at a time. An allocated small block records its
+// cache, and a block freed by another thread goes onto that
+// cache's remote list with a compare-and-swap, for the
+// owner to take back when it runs short. A thread that is
+// done with malloc() calls malloc_thread_done(), and its
+// cache is adopted by the next new thread, remote list and
+// all.
+
+#define MAXSMALL  4096
+#define CHUNK     (16*PGSIZE)
+#define LARGE     0xff          // h->cls of a large block
+#define BATCH     16            // blocks moved to or from a cache at once
+#define MAXCACHE  (4*BATCH)     // most blocks a cache keeps per class
 
 typedef long Align;
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *next;   // on a free list; the owning
+                          // struct mcache once allocated
+    uint size;            // bytes, this header included
+    uint cls;             // size class, or LARGE
   } s;
-  Align x;
+  Align x[2];
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+// block sizes, header included; multiples of sizeof(Header).
+static const uint classes[] = {
+  32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512,
+  640, 768, 1024, 1280, 1536, 2048, 2560, 3072, 4096,
+};
+#define NCLASS (sizeof(classes)/sizeof(classes[0]))
 
-void
-free(void *ap)
+struct mcache {
+  Header *free[NCLASS];
+  int nfree[NCLASS];
+  Header *volatile remote;      // freed by other threads
+  struct mcache *next;          // on the abandoned list
+};
+
+static struct mutex heaplock;
+static Header *freelist[NCLASS];
+static char *bump, *bumpend;    // unused part of the bump region
+static Header *largelist;       // free large blocks, by address
+static struct mcache *abandoned;
+static uchar sizecls[MAXSMALL/sizeof(Header) + 1];
+
+static void
+initclasses(void)
 {
-  Header *bp, *p;
+  int c = 0;
+  uint n;
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  for(n = 0; n <= MAXSMALL/sizeof(Header); n++){
+    while(classes[c] < n * sizeof(Header))
+      c++;
+    sizecls[n] = c;
+  }
+}
+
+// Extend the heap by n bytes, n a multiple of PGSIZE, at a
+// page boundary, whatever else has moved the break.
+static char*
+morecore(uint n)
+{
+  char *p;
+  uint pad;
+
+  p = sbrk(0);
+  pad = PGROUNDUP((uint64)p) - (uint64)p;
+  if(sbrk(n + pad) == (char*)-1)
+    return 0;
+  return p + pad;
+}
+
+// Break the rest of the bump region into free small blocks,
+// largest first, before it is abandoned.
+static void
+retirebump(void)
+{
+  Header *h;
+  int c;
+
+  for(c = NCLASS - 1; c >= 0; c--){
+    while(bumpend - bump >= classes[c]){
+      h = (Header*)bump;
+      bump += classes[c];
+      h->s.size = classes[c];
+      h->s.cls = c;
+      h->s.next = freelist[c];
+      freelist[c] = h;
+    }
+  }
 }
 
+// Take a block of class c from the central heap.
+// Caller must hold heaplock.
 static Header*
-morecore(uint nu)
+centralalloc(int c)
 {
+  Header *h;
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  if((h = freelist[c]) != 0){
+    freelist[c] = h->s.next;
+    return h;
+  }
+  if(bumpend - bump < classes[c]){
+    if((p = morecore(CHUNK)) == 0)
+      return 0;
+    if(p == bumpend){
+      bumpend += CHUNK;  // right after the region; extend it
+    } else {
+      retirebump();
+      bump = p;
+      bumpend = p + CHUNK;
+    }
+  }
+  h = (Header*)bump;
+  bump += classes[c];
+  h->s.size = classes[c];
+  h->s.cls = c;
+  return h;
+}
+
+static void
+largefree(Header *bp)
+{
+  Header *p, **pp;
+
+  // find bp's place in the list, and merge it with the
+  // free blocks either side if they touch.
+  for(pp = &largelist; (p = *pp) != 0 && p < bp; pp = &p->s.next)
+    if((char*)p + p->s.size == (char*)bp)
+      break;
+  if(p != 0 && p < bp){
+    p->s.size += bp->s.size;
+    bp = p;
+  } else {
+    bp->s.next = p;
+    *pp = bp;
+  }
+  if((p = bp->s.next) != 0 && (char*)bp + bp->s.size == (char*)p){
+    bp->s.size += p->s.size;
+    bp->s.next = p->s.next;
+  }
+
+  if((char*)bp + bp->s.size == sbrk(0)){
+    // at the top of the heap: give it back.
+    *pp = bp->s.next;
+    sbrk(-(int)bp->s.size);
+  }
+}
+
+static void*
+largealloc(uint64 nbytes)
+{
+  Header *p, **pp, *h;
+  uint64 n;
+
+  n = PGROUNDUP(nbytes + sizeof(Header));
+  if(n >= 0x80000000L)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  for(pp = &largelist; (p = *pp) != 0; pp = &p->s.next){
+    if(p->s.size == n){
+      *pp = p->s.next;
+      return (void*)(p + 1);
+    }
+    if(p->s.size > n){
+      // take the tail.
+      p->s.size -= n;
+      h = (Header*)((char*)p + p->s.size);
+      h->s.size = n;
+      h->s.cls = LARGE;
+      return (void*)(h + 1);
+    }
+  }
+  if((h = (Header*)morecore(n)) == 0)
+    return 0;
+  h->s.size = n;
+  h->s.cls = LARGE;
+  return (void*)(h + 1);
+}
+
+// Move up to BATCH blocks of class c from the central
+// heap into mc.
+static void
+refill(struct mcache *mc, int c)
+{
+  Header *h;
+  int i;
+
+  mutex_lock(&heaplock);
+  for(i = 0; i < BATCH && (h = centralalloc(c)) != 0; i++){
+    h->s.next = mc->free[c];
+    mc->free[c] = h;
+    mc->nfree[c]++;
+  }
+  mutex_unlock(&heaplock);
+}
+
+// Return all but n of mc's blocks of class c to the
+// central heap.
+static void
+spill(struct mcache *mc, int c, int n)
+{
+  Header *h;
+
+  mutex_lock(&heaplock);
+  while(mc->nfree[c] > n){
+    h = mc->free[c];
+    mc->free[c] = h->s.next;
+    mc->nfree[c]--;
+    h->s.next = freelist[c];
+    freelist[c] = h;
+  }
+  mutex_unlock(&heaplock);
+}
+
+// Take back the blocks other threads have freed to mc.
+static void
+drain(struct mcache *mc)
+{
+  Header *h, *next;
+
+  if(mc->remote == 0)
+    return;
+  for(h = __sync_lock_test_and_set(&mc->remote, 0); h != 0; h = next){
+    next = h->s.next;
+    h->s.next = mc->free[h->s.cls];
+    mc->free[h->s.cls] = h;
+    mc->nfree[h->s.cls]++;
+  }
+}
+
+// The calling thread's cache, set up on first use, or 0
+// if there is no memory for one.
+static struct mcache*
+mycache(void)
+{
+  struct tls *t;
+  struct mcache *mc;
+  Header *h;
+
+  if((t = tls()) == 0)
+    return 0;
+  if((mc = t->mcache) != 0)
+    return mc;
+  mutex_lock(&heaplock);
+  if(sizecls[MAXSMALL/sizeof(Header)] == 0)
+    initclasses();
+  if((mc = abandoned) != 0){
+    abandoned = mc->next;
+    mc->next = 0;
+  } else if((h = centralalloc(sizecls[sizeof(*mc)/sizeof(Header) + 2])) != 0){
+    // caches live in ordinary blocks that are never freed.
+    mc = (struct mcache*)(h + 1);
+    memset(mc, 0, sizeof(*mc));
+  }
+  mutex_unlock(&heaplock);
+  t->mcache = mc;
+  return mc;
+}
+
+// The calling thread will not malloc() again, or is about
+// to exit: hand its cache to the next new thread. Blocks it
+// allocated may still be freed by others meanwhile.
+void
+malloc_thread_done(void)
+{
+  struct tls *t;
+  struct mcache *mc;
+  int c;
+
+  if((t = tls()) == 0 || (mc = t->mcache) == 0)
+    return;
+  drain(mc);
+  for(c = 0; c < NCLASS; c++)
+    spill(mc, c, 0);
+  t->mcache = 0;
+  mutex_lock(&heaplock);
+  mc->next = abandoned;
+  abandoned = mc;
+  mutex_unlock(&heaplock);
+}
+
+void
+free(void *ap)
+{
+  Header *h, *old;
+  struct mcache *owner, *mc;
+  int c;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  if(h->s.cls == LARGE){
+    mutex_lock(&heaplock);
+    largefree(h);
+    mutex_unlock(&heaplock);
+    return;
+  }
+  c = h->s.cls;
+  owner = (struct mcache*)h->s.next;
+  if((mc = mycache()) == owner && mc != 0){
+    h->s.next = mc->free[c];
+    mc->free[c] = h;
+    if(++mc->nfree[c] > MAXCACHE)
+      spill(mc, c, MAXCACHE - BATCH);
+  } else if(owner != 0){
+    do {
+      old = owner->remote;
+      h->s.next = old;
+    } while(!__sync_bool_compare_and_swap(&owner->remote, old, h));
+  } else {
+    mutex_lock(&heaplock);
+    h->s.next = freelist[c];
+    freelist[c] = h;
+    mutex_unlock(&heaplock);
+  }
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
-
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  struct mcache *mc;
+  Header *h;
+  int c;
+
+  if(nbytes > MAXSMALL - sizeof(Header)){
+    mutex_lock(&heaplock);
+    h = largealloc(nbytes);
+    mutex_unlock(&heaplock);
+    return h;
+  }
+  if((mc = mycache()) == 0)
+    return 0;
+  c = sizecls[(nbytes + sizeof(Header) - 1)/sizeof(Header) + 1];
+  if(mc->free[c] == 0){
+    drain(mc);
+    if(mc->free[c] == 0)
+      refill(mc, c);
+    if(mc->free[c] == 0)
+      return 0;
   }
+  h = mc->free[c];
+  mc->free[c] = h->s.next;
+  mc->nfree[c]--;
+  h->s.next = (Header*)mc;
+  return (void*)(h + 1);
 }
@@ -0,0 +1,198 @@
+//
+// uprof: an in-process sampling profiler. uprofstart() has
+// sigalarm() interrupt the program every tick it runs, and
+// counts the pc each alarm interrupted in a histogram of the
+// program's text. uprofdump() prints the counts by function,
+// named from the program's .sym file, which the Makefile puts
+// on the file system as /<program>.sym.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define UPROFSHIFT 2   // four bytes of text per bucket
+
+extern char etext[];   // end of text, from the linker
+
+static uint *hist;
+static uint nbucket;
+static uint nsample;   // including those outside the text
+
+// The alarm handler.
+static void
+uprofsample(uint64 pc)
+{
+  if((pc >> UPROFSHIFT) < nbucket)
+    hist[pc >> UPROFSHIFT]++;
+  nsample++;
+  sigreturn();
+}
+
+// Start sampling, or go on after uprofstop().
+int
+uprofstart(void)
+{
+  if(hist == 0){
+    nbucket = ((uint64)etext >> UPROFSHIFT) + 1;
+    if((hist = malloc(nbucket * sizeof(uint))) == 0)
+      return -1;
+    memset(hist, 0, nbucket * sizeof(uint));
+  }
+  return sigalarm(1, uprofsample);
+}
+
+void
+uprofstop(void)
+{
+  sigalarm(0, 0);
+}
+
+// Samples so far with pcs in [lo, hi).
+uint
+uprofsamples(uint64 lo, uint64 hi)
+{
+  uint64 b;
+  uint n = 0;
+
+  for(b = lo >> UPROFSHIFT; b < nbucket && b << UPROFSHIFT < hi; b++)
+    n += hist[b];
+  return n;
+}
+
+struct usym {
+  uint64 addr;
+  char *name;
+  uint n;       // samples
+};
+
+static uint64
+hex(char *s)
+{
+  uint64 x = 0;
+
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x * 16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x * 16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  return x;
+}
+
+// Read symfile's "address name" lines into a table sorted
+// by address, naming symbols in *bufp. Returns the number
+// of symbols, or -1.
+static int
+readsyms(char *symfile, struct usym **symsp, char **bufp)
+{
+  struct stat st;
+  struct usym *syms, t;
+  char *buf, *p, *line, *name;
+  int fd, n, nsym, len, i, j;
+
+  if((fd = open(symfile, O_RDONLY)) < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+    close(fd);
+    return -1;
+  }
+  for(n = 0; n < st.size; n += i)
+    if((i = read(fd, buf + n, st.size - n)) <= 0)
+      break;
+  buf[n] = 0;
+  close(fd);
+
+  // at most one symbol a line.
+  nsym = 1;
+  for(p = buf; *p; p++)
+    nsym += *p == '\n';
+  if((syms = malloc(nsym * sizeof(*syms))) == 0){
+    free(buf);
+    return -1;
+  }
+  nsym = 0;
+  for(p = buf; *p; ){
+    line = p;
+    while(*p && *p != '\n')
+      p++;
+    if(*p)
+      *p++ = 0;
+    // leave out section and source file names.
+    if((name = strchr(line, ' ')) == 0)
+      continue;
+    *name++ = 0;
+    len = strlen(name);
+    if(name[0] == '.' || name[0] == 0 || (len > 2 && name[len-2] == '.'))
+      continue;
+    syms[nsym].addr = hex(line);
+    syms[nsym].name = name;
+    syms[nsym].n = 0;
+    nsym++;
+  }
+  for(i = 1; i < nsym; i++){
+    t = syms[i];
+    for(j = i; j > 0 && syms[j-1].addr > t.addr; j--)
+      syms[j] = syms[j-1];
+    syms[j] = t;
+  }
+  *symsp = syms;
+  *bufp = buf;
+  return nsym;
+}
+
+// Print the samples so far by function, most first.
+void
+uprofdump(char *symfile)
+{
+  struct usym *syms, *best;
+  char *buf;
+  uint64 b, pc;
+  int nsym, i, lo, hi, mid;
+  uint other;
+
+  printf("uprof: %d samples\n", nsample);
+  if((nsym = readsyms(symfile, &syms, &buf)) < 0){
+    printf("uprof: cannot read %s\n", symfile);
+    return;
+  }
+
+  // each bucket goes to the last symbol at or below it.
+  other = nsample;
+  for(b = 0; b < nbucket; b++){
+    if(hist[b] == 0)
+      continue;
+    pc = b << UPROFSHIFT;
+    lo = 0;
+    hi = nsym;
+    while(lo < hi){
+      mid = (lo + hi) / 2;
+      if(syms[mid].addr <= pc)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if(lo > 0){
+      syms[lo-1].n += hist[b];
+      other -= hist[b];
+    }
+  }
+
+  for(;;){
+    best = 0;
+    for(i = 0; i < nsym; i++)
+      if(syms[i].n > 0 && (best == 0 || syms[i].n > best->n))
+        best = &syms[i];
+    if(best == 0)
+      break;
+    printf("%d\t%d%%\t%s\n", best->n, best->n * 100 / nsample, best->name);
+    best->n = 0;
+  }
+  if(other)
+    printf("%d\t%d%%\t?\n", other, other * 100 / nsample);
+  free(syms);
+  free(buf);
+}
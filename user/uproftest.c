@@ -0,0 +1,55 @@
+// Profile a program that spends most of its time in spin(),
+// and check that uprof's samples land there.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+volatile uint64 sink;
+
+// spin for about n ticks of CPU time.
+__attribute__((noinline)) void
+spin(uint64 n)
+{
+  uint64 t0 = clock_cycles(), i = 0;
+
+  while(clock_cycles() - t0 < n * clock_hz() / 10)
+    sink += i++ * 7;
+}
+
+__attribute__((noinline)) void
+spinend(void)
+{
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 before;
+  uint n, in;
+
+  if(uprofstart() < 0){
+    printf("uproftest: uprofstart failed\n");
+    exit(1);
+  }
+  before = sink;
+  spin(20);
+  uprofstop();
+  if(sink == before){
+    printf("uproftest: spin did nothing\n");
+    exit(1);
+  }
+
+  // most of the time was in spin(), or the clock_cycles()
+  // it calls, if the compiler kept spinend() after spin().
+  n = uprofsamples(0, (uint64)-1);
+  in = uprofsamples((uint64)spin, (uint64)spinend) +
+       uprofsamples((uint64)clock_cycles, (uint64)clock_cycles + 64);
+  if(n < 10 || ((uint64)spinend > (uint64)spin && in < n / 2)){
+    printf("uproftest: %d samples, %d in spin()\n", n, in);
+    exit(1);
+  }
+  uprofdump("/uproftest.sym");
+  printf("uproftest: ok\n");
+  exit(0);
+}
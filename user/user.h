@@ -3,7 +3,33 @@
 //#include <stdarg.h>
 
 struct stat;
+struct spawnact;
 struct rtcdate;
+struct lockstat;
+struct sysstat;
+struct profsample;
+struct traceev;
+struct rusage;
+struct dirstat;
+struct sqe;
+struct pollfd;
+struct iovec;
+struct memstat;
+
+struct mutex {
+  volatile int state;
+};
+
+struct cond {
+  volatile int seq;
+};
+
+// Per-thread data: each kernel thread's tp points at its
+// own struct tls, made on first use by tls().
+struct tls {
+  void *mcache;   // umalloc.c
+  void *mthread;  // mthread.c
+};
 
 // system calls
 int fork(void);
@@ -31,8 +57,59 @@ int ntas();
 int crash(const char*, int);
 int mount(char*, char *);
 int umount(char*);
+void *mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int spawn(char*, char**, struct spawnact*);
+int splice(int, int, int);
+int fsync(int);
+int setprio(int, int);
+int waitpid(int, int*, int);
+int clone(void (*)(void*), void*, void*);
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+int _spawn(char*, char**, struct spawnact*);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
+int lockstat(struct lockstat*, int);
+int sysstat(int, struct sysstat*, int);
+int profile(int, struct profsample*, int);
+int trace(int, struct traceev*, int);
+int getrusage(int, struct rusage*);
+int getdents(int, struct dirstat*, int);
+int sigalarm(int, void (*)());
+int sigreturn(void);
+int submit(struct sqe*, int);
+int poll(struct pollfd*, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int memstat(struct memstat*);
+int setaffinity(int, uint64);
+uint64 getaffinity(int);
+int shm_open(const char*, uint64);
+int shm_unlink(const char*);
+
+// mthread.c
+int mthread_init(int);
+int mthread_create(void (*)(void*), void*);
+void mthread_yield(void);
+void mthread_exit(void) __attribute__((noreturn));
+void mthread_run(void);
+
+// printf.c
+void fflush(int);
+
+// getline.c
+char* gets(char*, int max);
+char* fgets(char*, int, int);
+int getline(char**, uint*, int);
 
 // ulib.c
+extern void (*stdio_flush)(int);
+extern void (*stdio_drop)(int);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
@@ -41,14 +118,32 @@ int strcmp(const char*, const char*);
 int snprintf(char *str, int size, const char *format, ...);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void malloc_thread_done(void);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_init(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+struct tls* tls(void);
+int uptime_fast(void);
+uint64 clock_cycles(void);
+uint64 clock_hz(void);
+
+// uprof.c
+int uprofstart(void);
+void uprofstop(void);
+uint uprofsamples(uint64, uint64);
+void uprofdump(char*);
 
 //// tsh_util.c
 //#define ErrorU(cause)  tsh_error("An error has occurred", (cause), __FILE__, __LINE__)
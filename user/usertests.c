@@ -12,9 +12,14 @@
 // Tests xv6 system calls.  usertests without arguments runs them all
 // and usertests <name> runs <name> test. The test runner creates for
 // each test a process and based on the exit status of the process,
-// the test runner reports "OK" or "FAILED".  Some tests result in
-// kernel printing usertrap messages, which can be ignored if test
-// prints "OK".
+// the test runner reports "OK" or "FAILED", and how long it took.
+// Some tests result in kernel printing usertrap messages, which can
+// be ignored if test prints "OK".
+//
+// usertests -j N [name] runs the tests in N worker processes at once,
+// each in a directory of its own, which claim tests from a counter
+// in a shared memory segment; then the tests marked alone, one at a
+// time.
 //
 
 #define BUFSZ  (MAXOPBLOCKS+2)*BSIZE
@@ -1385,37 +1390,49 @@ bigfile(char *s)
 void
 fourteen(char *s)
 {
-  int fd;
+  // names of DIRSIZ characters fill a dirent; longer
+  // ones are cut to DIRSIZ.
+  char full[DIRSIZ+1], lng[DIRSIZ+2], path[4*(DIRSIZ+2)];
+  int fd, i;
 
-  // DIRSIZ is 14.
+  for(i = 0; i < DIRSIZ+1; i++)
+    lng[i] = '1' + i % 9;
+  lng[DIRSIZ+1] = 0;
+  memmove(full, lng, DIRSIZ);
+  full[DIRSIZ] = 0;
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(mkdir(full) != 0){
+    printf("%s: mkdir %s failed\n", s, full);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  snprintf(path, sizeof(path), "%s/%s", full, lng);
+  if(mkdir(path) != 0){
+    printf("%s: mkdir %s failed\n", s, path);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  snprintf(path, sizeof(path), "%s/%s/%s", lng, lng, lng);
+  fd = open(path, O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create %s failed\n", s, path);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  snprintf(path, sizeof(path), "%s/%s/%s", full, full, full);
+  fd = open(path, 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open %s failed\n", s, path);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  snprintf(path, sizeof(path), "%s/%s", full, full);
+  if(mkdir(path) == 0){
+    printf("%s: mkdir %s succeeded!\n", s, path);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  snprintf(path, sizeof(path), "%s/%s", lng, full);
+  if(mkdir(path) == 0){
+    printf("%s: mkdir %s succeeded!\n", s, path);
     exit(1);
   }
 }
@@ -2087,14 +2104,16 @@ badarg(char *s)
   exit(0);
 }
 
-// run each test in its own process. run returns 1 if child's exit()
-// indicates success.
+// run f in a process of its own. returns 1 if the child's exit()
+// indicates success, and sets *ms to how long it took.
 int
-run(void f(char *), char *s) {
+runtest(void f(char *), char *s, int *ms)
+{
   int pid;
   int xstatus;
-  
-  printf("test %s: ", s);
+  uint64 t0;
+
+  t0 = clock_cycles();
   if((pid = fork()) < 0) {
     printf("runtest: fork error\n");
     exit(1);
@@ -2102,44 +2121,158 @@ run(void f(char *), char *s) {
   if(pid == 0) {
     f(s);
     exit(0);
-  } else {
-    wait(&xstatus);
-    if(xstatus != 0) 
-      printf("FAILED\n", s);
-    else
-      printf("OK\n", s);
-    return xstatus == 0;
   }
+  waitpid(pid, &xstatus, 0);
+  *ms = (clock_cycles() - t0) * 1000 / clock_hz();
+  return xstatus == 0;
+}
+
+// run each test in its own process. run returns 1 if child's exit()
+// indicates success.
+int
+run(void f(char *), char *s) {
+  int ok, ms;
+
+  printf("test %s: ", s);
+  ok = runtest(f, s, &ms);
+  if(!ok)
+    printf("FAILED %dms\n", ms);
+  else
+    printf("OK %dms\n", ms);
+  return ok;
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+  int alone;    // uses up processes or memory, or names files
+                // outside its directory; not for usertests -j
+};
+
+// the state usertests -j workers share, in a shm segment.
+struct jobs {
+  int next;     // tests[next] is the next to claim
+  int ntests;   // entries in tests[] before the 0 one
+  int fail;
+};
+
+// files in / that tests use by their plain names.
+char *rootfiles[] = { "echo", "init", "cat", 0 };
+
+// a usertests -j worker: claim tests one at a time and run each
+// in directory w<id>, printing each result in a single line.
+void
+worker(int id, struct test *tests, struct jobs *jobs, char *n)
+{
+  char dir[8], path[16];
+  struct test *t;
+  int i, ok, ms;
+
+  snprintf(dir, sizeof(dir), "w%d", id);
+  if(mkdir(dir) < 0 || chdir(dir) < 0){
+    printf("usertests: worker %d: cannot make %s\n", id, dir);
+    jobs->fail = 1;
+    exit(1);
+  }
+  for(i = 0; rootfiles[i]; i++){
+    snprintf(path, sizeof(path), "/%s", rootfiles[i]);
+    link(path, rootfiles[i]);
+  }
+  for(;;){
+    // each worker claims one index past the end before it
+    // stops, so next runs past the 0 entry.
+    if((i = __sync_fetch_and_add(&jobs->next, 1)) >= jobs->ntests)
+      break;
+    t = &tests[i];
+    if(t->alone || (n != 0 && strcmp(t->s, n) != 0))
+      continue;
+    ok = runtest(t->f, t->s, &ms);
+    printf("test %s: %s %dms (w%d)\n", t->s, ok ? "OK" : "FAILED", ms, id);
+    if(!ok)
+      jobs->fail = 1;
+  }
+  exit(0);
+}
+
+// run the tests that can share the machine in nworkers processes
+// at once, then the others one at a time. returns 1 if all passed.
+int
+runjobs(struct test *tests, int nworkers, char *n)
+{
+  struct jobs *jobs;
+  struct test *t;
+  int fd, i, fail;
+
+  if((fd = shm_open("usertests", sizeof(*jobs))) < 0){
+    printf("usertests: shm_open failed\n");
+    exit(1);
+  }
+  jobs = mmap(0, sizeof(*jobs), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  shm_unlink("usertests");
+  if(jobs == (struct jobs*)-1){
+    printf("usertests: mmap failed\n");
+    exit(1);
+  }
+  jobs->next = 0;
+  for(jobs->ntests = 0; tests[jobs->ntests].s != 0; jobs->ntests++)
+    ;
+  jobs->fail = 0;
+
+  for(i = 0; i < nworkers; i++){
+    fd = fork();
+    if(fd < 0){
+      printf("usertests: fork failed\n");
+      exit(1);
+    }
+    if(fd == 0)
+      worker(i, tests, jobs, n);
+  }
+  for(i = 0; i < nworkers; i++)
+    wait(0);
+
+  fail = jobs->fail;
+  for(t = tests; t->s != 0; t++) {
+    if(t->alone && ((n == 0) || strcmp(t->s, n) == 0)) {
+      if(!run(t->f, t->s))
+        fail = 1;
+    }
+  }
+  munmap(jobs, sizeof(*jobs));
+  return !fail;
 }
 
 int
 main(int argc, char *argv[])
 {
   char *n = 0;
+  int nworkers = 0;
+  if(argc > 2 && strcmp(argv[1], "-j") == 0) {
+    nworkers = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc > 1) {
     n = argv[1];
   }
   
-  struct test {
-    void (*f)(char *);
-    char *s;
-  } tests[] = {
-    {reparent2, "reparent2"},
+  struct test tests[] = {
+    {reparent2, "reparent2", 1},
     {pgbug, "pgbug" },
     {sbrkbugs, "sbrkbugs" },
     // {badwrite, "badwrite" },
     {badarg, "badarg" },
     {reparent, "reparent" },
     {twochildren, "twochildren"},
-    {forkfork, "forkfork"},
-    {forkforkfork, "forkforkfork"},
+    {forkfork, "forkfork", 1},
+    {forkforkfork, "forkforkfork", 1},
     {argptest, "argptest"},
     {createdelete, "createdelete"},
     {linkunlink, "linkunlink"},
     {linktest, "linktest"},
     {unlinkread, "unlinkread"},
     {concreate, "concreate"},
-    {subdir, "subdir"},
+    {subdir, "subdir", 1},
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
@@ -2147,9 +2280,9 @@ main(int argc, char *argv[])
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
-    {sbrkmuch, "sbrkmuch"},
+    {sbrkmuch, "sbrkmuch", 1},
     {kernmem, "kernmem"},
-    {sbrkfail, "sbrkfail"},
+    {sbrkfail, "sbrkfail", 1},
     {sbrkarg, "sbrkarg"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
@@ -2160,16 +2293,16 @@ main(int argc, char *argv[])
     {openiputtest, "openiput"},
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
-    {mem, "mem"},
+    {mem, "mem", 1},
     {pipe1, "pipe1"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
-    {rmdot, "rmdot"},
+    {rmdot, "rmdot", 1},
     {fourteen, "fourteen"},
     {bigfile, "bigfile"},
     {dirfile, "dirfile"},
     {iref, "iref"},
-    {forktest, "forktest"},
+    {forktest, "forktest", 1},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
@@ -2183,10 +2316,14 @@ main(int argc, char *argv[])
   close(open("usertests.ran", O_CREATE));
 
   int fail = 0;
-  for (struct test *t = tests; t->s != 0; t++) {
-    if((n == 0) || strcmp(t->s, n) == 0) {
-      if(!run(t->f, t->s))
-        fail = 1;
+  if(nworkers > 0) {
+    fail = !runjobs(tests, nworkers, n);
+  } else {
+    for (struct test *t = tests; t->s != 0; t++) {
+      if((n == 0) || strcmp(t->s, n) == 0) {
+        if(!run(t->f, t->s))
+          fail = 1;
+      }
     }
   }
   if(!fail)
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name[, label]): the stub is called label, if given;
+# ulib.c wraps those that must flush output first.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -37,3 +40,32 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("ntas");
+entry("mmap");
+entry("munmap");
+entry("spawn", "_spawn");
+entry("splice");
+entry("fsync");
+entry("setprio");
+entry("waitpid");
+entry("clone");
+entry("futex_wait");
+entry("futex_wake");
+entry("lockstat");
+entry("sysstat");
+entry("profile");
+entry("trace");
+entry("getrusage");
+entry("getdents");
+entry("sigalarm");
+entry("sigreturn");
+entry("submit");
+entry("poll");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("memstat");
+entry("setaffinity");
+entry("getaffinity");
+entry("shm_open");
+entry("shm_unlink");
@@ -10,9 +10,17 @@
 #define STACK_SIZE  8192
 #define MAX_THREAD  4
 
+/* Registers saved by thread_switch(): ra, sp, s0-s11. */
+struct context {
+  uint64     ra;
+  uint64     sp;
+  uint64     s[12];
+};
+
 struct thread {
   char       stack[STACK_SIZE]; /* the thread's stack */
   int        state;             /* FREE, RUNNING, RUNNABLE */
+  struct context context;       /* saved while not running */
 };
 struct thread all_thread[MAX_THREAD];
 struct thread *current_thread;
@@ -57,10 +65,7 @@ thread_schedule(void)
     next_thread->state = RUNNING;
     t = current_thread;
     current_thread = next_thread;
-    /* YOUR CODE HERE
-     * Invoke thread_switch to switch from t to next_thread:
-     * thread_switch(??, ??);
-     */
+    thread_switch((uint64)&t->context, (uint64)&next_thread->context);
   } else
     next_thread = 0;
 }
@@ -74,7 +79,10 @@ thread_create(void (*func)())
     if (t->state == FREE) break;
   }
   t->state = RUNNABLE;
-  // YOUR CODE HERE
+  // the first switch to t "returns" into func on t's own stack.
+  memset(&t->context, 0, sizeof(t->context));
+  t->context.ra = (uint64)func;
+  t->context.sp = (uint64)(t->stack + STACK_SIZE);
 }
 
 void 
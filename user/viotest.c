@@ -0,0 +1,107 @@
+// Test pread()/pwrite(), which leave the file offset alone,
+// and readv()/writev() on files and pipes.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct iovec iov[3];
+  char hdr[4], body[8], buf[16];
+  int fd, p[2];
+
+  unlink("vio.f");
+  if((fd = open("vio.f", O_CREATE|O_RDWR)) < 0){
+    printf("viotest: create\n");
+    exit(1);
+  }
+
+  // gather a header and a payload into one write.
+  iov[0].base = "HDR:";
+  iov[0].len = 4;
+  iov[1].base = "payload!";
+  iov[1].len = 8;
+  if(writev(fd, iov, 2) != 12){
+    printf("viotest: writev\n");
+    exit(1);
+  }
+
+  // positional I/O doesn't move the offset.
+  if(pwrite(fd, "hdr", 3, 0) != 3){
+    printf("viotest: pwrite\n");
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 8) != 4 || memcmp(buf, "oad!", 4) != 0){
+    printf("viotest: pread\n");
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 12) != 0){
+    printf("viotest: pread at end of file\n");
+    exit(1);
+  }
+  if(write(fd, "+", 1) != 1 || pread(fd, buf, 13, 0) != 13 ||
+     memcmp(buf, "hdr:payload!+", 13) != 0){
+    printf("viotest: offset moved\n");
+    exit(1);
+  }
+
+  // scatter it back out.
+  iov[0].base = hdr;
+  iov[0].len = sizeof(hdr);
+  iov[1].base = body;
+  iov[1].len = sizeof(body);
+  iov[2].base = buf;
+  iov[2].len = sizeof(buf);
+  close(fd);
+  if((fd = open("vio.f", O_RDONLY)) < 0){
+    printf("viotest: open\n");
+    exit(1);
+  }
+  if(readv(fd, iov, 3) != 13 || memcmp(hdr, "hdr:", 4) != 0 ||
+     memcmp(body, "payload!", 8) != 0 || buf[0] != '+'){
+    printf("viotest: readv\n");
+    exit(1);
+  }
+  if(readv(fd, iov, 3) != 0){
+    printf("viotest: readv at end of file\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("vio.f");
+
+  // pipes: vectors work, offsets don't, and readv() returns
+  // what there is rather than waiting for more.
+  if(pipe(p) < 0){
+    printf("viotest: pipe\n");
+    exit(1);
+  }
+  iov[0].base = "ab";
+  iov[0].len = 2;
+  iov[1].base = "cdef";
+  iov[1].len = 4;
+  if(writev(p[1], iov, 2) != 6){
+    printf("viotest: pipe writev\n");
+    exit(1);
+  }
+  if(pread(p[0], buf, 1, 0) != -1 || pwrite(p[1], "x", 1, 0) != -1){
+    printf("viotest: pipe offsets\n");
+    exit(1);
+  }
+  iov[0].base = hdr;
+  iov[0].len = 4;
+  iov[1].base = body;
+  iov[1].len = 8;
+  if(readv(p[0], iov, 2) != 6 || memcmp(hdr, "abcd", 4) != 0 ||
+     memcmp(body, "ef", 2) != 0){
+    printf("viotest: pipe readv\n");
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+
+  printf("viotest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,140 @@
+// Test write-back caching of file data, before and after it
+// is flushed, with unaligned rewrites and unlinked files.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SIZE (200*1000)
+
+char buf[SIZE];
+
+// byte i of version v of the file.
+char
+pattern(int v, int i)
+{
+  return v * 13 + i % 251;
+}
+
+// the file is version v, but version v1 in [off0, off1).
+void
+check(char *name, int v, int v1, int off0, int off1, char *what)
+{
+  struct stat st;
+  int fd, i;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("wbtest: open\n");
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != SIZE){
+    printf("wbtest: size\n");
+    exit(1);
+  }
+  memset(buf, 0, SIZE);
+  if(read(fd, buf, SIZE) != SIZE){
+    printf("wbtest: short read\n");
+    exit(1);
+  }
+  for(i = 0; i < SIZE; i++)
+    if(buf[i] != pattern(i >= off0 && i < off1 ? v1 : v, i)){
+      printf("wbtest: %s\n", what);
+      exit(1);
+    }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n;
+
+  // many small writes, read back at once.
+  unlink("wb.file");
+  unlink("wb.tmp");
+  if((fd = open("wb.file", O_CREATE|O_WRONLY)) < 0){
+    printf("wbtest: create\n");
+    exit(1);
+  }
+  for(i = 0; i < SIZE; i++)
+    buf[i] = pattern(0, i);
+  for(i = 0; i < SIZE; i += n){
+    n = SIZE - i < 1000 ? SIZE - i : 1000;
+    if(write(fd, buf + i, n) != n){
+      printf("wbtest: small write\n");
+      exit(1);
+    }
+  }
+  check("wb.file", 0, 0, 0, 0, "read before flush");
+
+  // durable once fsync() returns.
+  if(fsync(fd) < 0){
+    printf("wbtest: fsync\n");
+    exit(1);
+  }
+  close(fd);
+  check("wb.file", 0, 0, 0, 0, "read after fsync");
+
+  // an unaligned rewrite across pages, left to the flusher.
+  if((fd = open("wb.file", O_WRONLY)) < 0){
+    printf("wbtest: open for rewrite\n");
+    exit(1);
+  }
+  for(i = 0; i < 5555; i++)
+    buf[i] = pattern(0, i);
+  if(write(fd, buf, 5555) != 5555){
+    printf("wbtest: write up to rewrite\n");
+    exit(1);
+  }
+  for(i = 0; i < 10001; i++)
+    buf[i] = pattern(1, 5555 + i);
+  if(write(fd, buf, 10001) != 10001){
+    printf("wbtest: rewrite\n");
+    exit(1);
+  }
+  close(fd);
+  check("wb.file", 0, 1, 5555, 15556, "read after rewrite");
+  sleep(3);
+  check("wb.file", 0, 1, 5555, 15556, "read after flusher");
+
+  // one write bigger than a transaction's worth of blocks.
+  unlink("wb.file");
+  if((fd = open("wb.file", O_CREATE|O_WRONLY)) < 0){
+    printf("wbtest: create big\n");
+    exit(1);
+  }
+  for(i = 0; i < SIZE; i++)
+    buf[i] = pattern(2, i);
+  if(write(fd, buf, SIZE) != SIZE){
+    printf("wbtest: big write\n");
+    exit(1);
+  }
+  close(fd);
+  check("wb.file", 2, 2, 0, 0, "read after big write");
+
+  // an unlinked file can be written while open, and
+  // goes away once closed.
+  if((fd = open("wb.tmp", O_CREATE|O_RDWR)) < 0){
+    printf("wbtest: create tmp\n");
+    exit(1);
+  }
+  unlink("wb.tmp");
+  for(i = 0; i < SIZE; i++)
+    buf[i] = pattern(3, i);
+  if(write(fd, buf, SIZE) != SIZE){
+    printf("wbtest: write unlinked\n");
+    exit(1);
+  }
+  sleep(3);
+  close(fd);
+  if(open("wb.tmp", O_RDONLY) >= 0){
+    printf("wbtest: unlinked file still there\n");
+    exit(1);
+  }
+  check("wb.file", 2, 2, 0, 0, "read after unlinked file");
+
+  unlink("wb.file");
+  printf("wbtest: ok\n");
+  exit(0);
+}
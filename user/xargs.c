@@ -0,0 +1,115 @@
+// Run a command with arguments read from standard input.
+//
+//   xargs [-P n] command [arg ...]
+//
+// Words are read from input and passed to command as many
+// at a time as exec() allows. With -P, up to n commands run
+// at once, and a new one starts as soon as one finishes.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char *args[MAXARG];    // exec() takes MAXARG-1 and a null
+int nfixed;            // args[0..nfixed) come from the command line
+int nargs;
+int running, failed;
+
+// Wait for one command, noting whether it failed.
+void
+reap(void)
+{
+  int status;
+
+  if(wait(&status) < 0){
+    running = 0;
+    return;
+  }
+  running--;
+  if(status != 0)
+    failed = 1;
+}
+
+// Start args as a command, keeping no more than maxjobs
+// running.
+void
+run(int maxjobs)
+{
+  struct spawnact actions[2];
+  int i;
+
+  // the commands must not eat our input.
+  actions[0].type = SPAWN_CLOSE;
+  actions[0].fd = 0;
+  actions[1].type = SPAWN_END;
+
+  while(running >= maxjobs)
+    reap();
+  args[nargs] = 0;
+  if(spawn(args[0], args, actions) < 0){
+    fprintf(2, "xargs: cannot run %s\n", args[0]);
+    failed = 1;
+  } else
+    running++;
+  // spawn() copied the words into the child.
+  for(i = nfixed; i < nargs; i++)
+    free(args[i]);
+  nargs = nfixed;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxjobs, i, n, len;
+  char *line, *p, *w;
+  uint linecap;
+
+  maxjobs = 1;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-P") == 0){
+    if((maxjobs = atoi(argv[2])) < 1){
+      fprintf(2, "xargs: bad job count %s\n", argv[2]);
+      exit(1);
+    }
+    i = 3;
+  }
+  if(i >= argc){
+    fprintf(2, "usage: xargs [-P n] command [arg ...]\n");
+    exit(1);
+  }
+  if(argc - i >= MAXARG-1){
+    fprintf(2, "xargs: too many arguments\n");
+    exit(1);
+  }
+  for(; i < argc; i++)
+    args[nfixed++] = argv[i];
+  nargs = nfixed;
+
+  line = 0;
+  linecap = 0;
+  while((n = getline(&line, &linecap, 0)) > 0){
+    for(p = line; p < line + n; ){
+      while(p < line + n && strchr(" \t\r\n", *p))
+        p++;
+      for(w = p; p < line + n && !strchr(" \t\r\n", *p); p++)
+        ;
+      if((len = p - w) == 0)
+        continue;
+      if(nargs == MAXARG-1)
+        run(maxjobs);
+      if((args[nargs] = malloc(len + 1)) == 0){
+        fprintf(2, "xargs: out of memory\n");
+        exit(1);
+      }
+      memmove(args[nargs], w, len);
+      args[nargs++][len] = 0;
+    }
+  }
+  if(nargs > nfixed)
+    run(maxjobs);
+  while(running > 0)
+    reap();
+  exit(failed);
+}